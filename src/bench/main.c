@@ -0,0 +1,491 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * darktable-bench: reproducible performance numbers for builds.
+ *
+ *  - runs process() of every iop on synthetic input at several resolutions and thread counts
+ *  - runs full exports of reference images, once without and once with every given style
+ *
+ * every measurement is printed to stdout as one json object per line, everything else goes
+ * to stderr. without --image a synthetic test image is generated in the tmp directory.
+ */
+
+#include "common/darktable.h"
+#include "common/film.h"
+#include "common/image.h"
+#include "common/image_cache.h"
+#include "common/imageio.h"
+#include "common/imageio_module.h"
+#include "common/mipmap_cache.h"
+#include "common/styles.h"
+#include "control/conf.h"
+#include "develop/develop.h"
+#include "develop/imageop.h"
+#include "develop/pixelpipe.h"
+
+#include <inttypes.h>
+#include <libintl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#define DT_BENCH_MAX_VALUES 16
+
+typedef struct dt_bench_t
+{
+  int runs;
+  int num_sizes, num_threads;
+  float sizes[DT_BENCH_MAX_VALUES]; // in megapixels
+  int threads[DT_BENCH_MAX_VALUES];
+  GList *images;  // file names
+  GList *modules; // only benchmark these iops, all if NULL
+  gboolean iop, export;
+  const char *format;
+} dt_bench_t;
+
+typedef struct dt_bench_result_t
+{
+  double mean, stddev, min;
+  long peak_kb;
+} dt_bench_result_t;
+
+static void usage(const char *progname)
+{
+  fprintf(stderr, "usage: %s [--image <file>]... [--style <dtstyle file>]... [--module <op>]... [--sizes "
+                  "<megapixels,...>] [--threads <n,...>] [--runs <n>] [--format <export format>] [--no-iop] "
+                  "[--no-export] [--core <darktable options>]\n",
+          progname);
+}
+
+static int parse_list(const char *str, float *values)
+{
+  int num = 0;
+  gchar **tokens = g_strsplit(str, ",", DT_BENCH_MAX_VALUES);
+  for(gchar **t = tokens; *t && num < DT_BENCH_MAX_VALUES; t++)
+  {
+    const float v = atof(*t);
+    if(v > 0.0f) values[num++] = v;
+  }
+  g_strfreev(tokens);
+  return num;
+}
+
+// peak resident set size since the last call, in KiB.
+static long peak_memory_reset()
+{
+  long peak = 0;
+#ifdef __linux__
+  // VmHWM can be reset by writing 5 to clear_refs, so we get the peak of each benchmark.
+  FILE *f = fopen("/proc/self/status", "r");
+  if(f)
+  {
+    char line[256];
+    while(fgets(line, sizeof(line), f))
+      if(!strncmp(line, "VmHWM:", 6)) peak = atol(line + 6);
+    fclose(f);
+  }
+  f = fopen("/proc/self/clear_refs", "w");
+  if(f)
+  {
+    fputs("5", f);
+    fclose(f);
+  }
+#endif
+  if(!peak)
+  {
+    // monotonic high water mark of the whole process, better than nothing.
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    peak = ru.ru_maxrss;
+  }
+  return peak;
+}
+
+static void stats(const double *t, const int num, dt_bench_result_t *res)
+{
+  double sum = 0.0, sum2 = 0.0;
+  res->min = t[0];
+  for(int k = 0; k < num; k++)
+  {
+    sum += t[k];
+    sum2 += t[k] * t[k];
+    res->min = fmin(res->min, t[k]);
+  }
+  res->mean = sum / num;
+  res->stddev = num > 1 ? sqrt(fmax(0.0, (sum2 - sum * sum / num) / (num - 1))) : 0.0;
+}
+
+static void print_result(const char *kind, const char *name, const char *style, const int width,
+                         const int height, const int threads, const int runs, const dt_bench_result_t *res)
+{
+  const double mpix = width * (double)height * 1e-6;
+  printf("{\"bench\":\"%s\",\"name\":\"%s\",\"style\":\"%s\",\"width\":%d,\"height\":%d,\"threads\":%d,"
+         "\"runs\":%d,\"mean_s\":%.6f,\"stddev_s\":%.6f,\"min_s\":%.6f,\"mpix_per_s\":%.3f,\"peak_kb\":%ld}\n",
+         kind, name, style ? style : "", width, height, threads, runs, res->mean, res->stddev, res->min,
+         res->mean > 0.0 ? mpix / res->mean : 0.0, res->peak_kb);
+  fflush(stdout);
+}
+
+static void set_threads(const int threads)
+{
+#ifdef _OPENMP
+  omp_set_num_threads(threads);
+#endif
+}
+
+// smooth gradients with some structure and noise, so that no module sees a trivial image.
+static void fill_synthetic(float *buf, const int width, const int height, const dt_iop_colorspace_type_t cst)
+{
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int j = 0; j < height; j++)
+  {
+    unsigned int seed = 1234567u + j;
+    float *out = buf + (size_t)4 * width * j;
+    for(int i = 0; i < width; i++, out += 4)
+    {
+      const float x = i / (float)width, y = j / (float)height;
+      const float edge = ((i / 64 + j / 64) & 1) ? 0.1f : 0.0f;
+      seed = seed * 1103515245u + 12345u;
+      const float noise = 0.02f * ((seed >> 16) / 65535.0f - 0.5f);
+      const float v[3] = { 0.9f * x + edge + noise, 0.5f + 0.4f * sinf(8.0f * y) + noise,
+                           0.9f * (1.0f - x) * y + edge + noise };
+      if(cst == iop_cs_Lab)
+      {
+        out[0] = 100.0f * CLAMPS(v[0], 0.0f, 1.0f);
+        out[1] = 100.0f * (v[1] - 0.5f);
+        out[2] = 100.0f * (v[2] - 0.5f);
+      }
+      else
+        for(int c = 0; c < 3; c++) out[c] = CLAMPS(v[c], 0.0f, 1.0f);
+      out[3] = 1.0f;
+    }
+  }
+}
+
+static gchar *write_synthetic_image(const int width, const int height)
+{
+  gchar *filename = g_strdup_printf("%s/darktable-bench-%d.pfm", darktable.tmpdir, (int)getpid());
+  FILE *f = fopen(filename, "wb");
+  float *buf = (float *)dt_alloc_align(16, sizeof(float) * 4 * width * height);
+  if(!f || !buf)
+  {
+    fprintf(stderr, "[bench] could not write synthetic image `%s'\n", filename);
+    if(f) fclose(f);
+    dt_free_align(buf);
+    g_free(filename);
+    return NULL;
+  }
+  fill_synthetic(buf, width, height, iop_cs_rgb);
+  fprintf(f, "PF\n%d %d\n-1.0\n", width, height);
+  for(size_t k = 0; k < (size_t)width * height; k++) fwrite(buf + 4 * k, sizeof(float), 3, f);
+  fclose(f);
+  dt_free_align(buf);
+  return filename;
+}
+
+static uint32_t import_image(const char *filename)
+{
+  dt_film_t film;
+  gchar *directory = g_path_get_dirname(filename);
+  const int filmid = dt_film_new(&film, directory);
+  g_free(directory);
+  const uint32_t id = dt_image_import(filmid, filename, TRUE);
+  if(!id) fprintf(stderr, "[bench] can't open file `%s'\n", filename);
+  return id;
+}
+
+static void bench_piece(const dt_bench_t *b, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
+{
+  dt_iop_module_t *module = piece->module;
+  const dt_iop_colorspace_type_t cst = dt_iop_module_colorspace(module);
+
+  dt_iop_commit_params(module, module->default_params, module->default_blendop_params, pipe, piece);
+  piece->enabled = 1;
+
+  for(int s = 0; s < b->num_sizes; s++)
+  {
+    const int width = (int)(sqrtf(b->sizes[s] * 1e6f * 1.5f) / 16.0f) * 16;
+    const int height = (int)(width / 1.5f / 16.0f) * 16;
+    dt_iop_roi_t full = (dt_iop_roi_t){ 0, 0, width, height, 1.0f }, roi_in, roi_out;
+    module->modify_roi_out(module, piece, &roi_out, &full);
+    module->modify_roi_in(module, piece, &roi_out, &roi_in);
+    piece->buf_in = full;
+    piece->buf_out = roi_out;
+
+    float *in = (float *)dt_alloc_align(64, sizeof(float) * 4 * roi_in.width * roi_in.height);
+    float *out = (float *)dt_alloc_align(64, sizeof(float) * 4 * roi_out.width * roi_out.height);
+    if(!in || !out)
+    {
+      fprintf(stderr, "[bench] out of memory for `%s' at %dx%d\n", module->op, width, height);
+      dt_free_align(in);
+      dt_free_align(out);
+      continue;
+    }
+    fill_synthetic(in, roi_in.width, roi_in.height, cst);
+
+    for(int t = 0; t < b->num_threads; t++)
+    {
+      set_threads(b->threads[t]);
+      double times[b->runs];
+      // one warm-up run to get the lookup tables and page faults out of the way
+      module->process(module, piece, in, out, &roi_in, &roi_out);
+      peak_memory_reset();
+      for(int r = 0; r < b->runs; r++)
+      {
+        const double start = dt_get_wtime();
+        module->process(module, piece, in, out, &roi_in, &roi_out);
+        times[r] = dt_get_wtime() - start;
+      }
+      dt_bench_result_t res;
+      stats(times, b->runs, &res);
+      res.peak_kb = peak_memory_reset();
+      print_result("iop", module->op, NULL, roi_out.width, roi_out.height, b->threads[t], b->runs, &res);
+    }
+    dt_free_align(in);
+    dt_free_align(out);
+  }
+  set_threads(darktable.num_openmp_threads);
+}
+
+static void bench_iops(const dt_bench_t *b, const uint32_t imgid)
+{
+  dt_develop_t dev;
+  dt_dev_init(&dev, 0);
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING, 'r');
+  dt_dev_load_image(&dev, imgid);
+
+  dt_dev_pixelpipe_t pipe;
+  if(!buf.buf || !dt_dev_pixelpipe_init_export(&pipe, buf.width, buf.height, IMAGEIO_RGB | IMAGEIO_INT8))
+  {
+    fprintf(stderr, "[bench] failed to set up a pixelpipe\n");
+    dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+    dt_dev_cleanup(&dev);
+    return;
+  }
+  dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, 1.0);
+  dt_dev_pixelpipe_create_nodes(&pipe, &dev);
+  dt_dev_pixelpipe_synch_all(&pipe, &dev);
+
+  for(GList *nodes = pipe.nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    dt_iop_module_t *module = piece->module;
+    if(b->modules && !g_list_find_custom(b->modules, module->op, (GCompareFunc)strcmp)) continue;
+    // raw modules want mosaiced input in whatever format the loader produced, they are covered by the
+    // export benchmark of a real raw.
+    if(dt_iop_module_colorspace(module) == iop_cs_RAW || (module->flags() & IOP_FLAGS_DEPRECATED)) continue;
+    fprintf(stderr, "[bench] %s\n", module->op);
+    bench_piece(b, &pipe, piece);
+  }
+
+  dt_dev_pixelpipe_cleanup(&pipe);
+  dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  dt_dev_cleanup(&dev);
+}
+
+static void bench_export(const dt_bench_t *b, const uint32_t imgid, const char *name, const char *style)
+{
+  dt_imageio_module_format_t *format = dt_imageio_get_format_by_name(b->format);
+  if(!format)
+  {
+    fprintf(stderr, "[bench] unknown export format `%s'\n", b->format);
+    return;
+  }
+  dt_imageio_module_data_t *fdata = format->get_params(format);
+  if(!fdata) return;
+  fdata->max_width = fdata->max_height = 0;
+  g_strlcpy(fdata->style, style ? style : "", sizeof(fdata->style));
+  fdata->style_append = 0;
+
+  gchar *filename = g_strdup_printf("%s/darktable-bench-%d.%s", darktable.tmpdir, (int)getpid(),
+                                    format->extension(fdata));
+  int width = 0, height = 0;
+  for(int t = 0; t < b->num_threads; t++)
+  {
+    set_threads(b->threads[t]);
+    double times[b->runs];
+    // warm-up, this also pulls the full image into the mipmap cache
+    dt_imageio_export(imgid, filename, format, fdata, TRUE, FALSE, FALSE, NULL, NULL, 1, 1);
+    peak_memory_reset();
+    for(int r = 0; r < b->runs; r++)
+    {
+      const double start = dt_get_wtime();
+      dt_imageio_export(imgid, filename, format, fdata, TRUE, FALSE, FALSE, NULL, NULL, 1, 1);
+      times[r] = dt_get_wtime() - start;
+    }
+    // the format fills in the final size while writing
+    width = fdata->width;
+    height = fdata->height;
+    dt_bench_result_t res;
+    stats(times, b->runs, &res);
+    res.peak_kb = peak_memory_reset();
+    print_result("export", name, style, width, height, b->threads[t], b->runs, &res);
+  }
+  set_threads(darktable.num_openmp_threads);
+  unlink(filename);
+  g_free(filename);
+  format->free_params(format, fdata);
+}
+
+int main(int argc, char *arg[])
+{
+  bindtextdomain(GETTEXT_PACKAGE, DARKTABLE_LOCALEDIR);
+  bind_textdomain_codeset(GETTEXT_PACKAGE, "UTF-8");
+  textdomain(GETTEXT_PACKAGE);
+
+  gtk_init_check(&argc, &arg);
+
+  dt_bench_t b = { 0 };
+  b.runs = 5;
+  b.iop = b.export = TRUE;
+  b.format = "jpeg";
+  b.num_sizes = parse_list("1,4,12", b.sizes);
+  GList *style_files = NULL;
+  const char *threads = NULL;
+
+  int k;
+  for(k = 1; k < argc; k++)
+  {
+    if(!strcmp(arg[k], "--help"))
+    {
+      usage(arg[0]);
+      exit(1);
+    }
+    else if(!strcmp(arg[k], "--image") && k + 1 < argc)
+      b.images = g_list_append(b.images, arg[++k]);
+    else if(!strcmp(arg[k], "--style") && k + 1 < argc)
+      style_files = g_list_append(style_files, arg[++k]);
+    else if(!strcmp(arg[k], "--module") && k + 1 < argc)
+      b.modules = g_list_append(b.modules, arg[++k]);
+    else if(!strcmp(arg[k], "--sizes") && k + 1 < argc)
+      b.num_sizes = parse_list(arg[++k], b.sizes);
+    else if(!strcmp(arg[k], "--threads") && k + 1 < argc)
+      threads = arg[++k];
+    else if(!strcmp(arg[k], "--runs") && k + 1 < argc)
+      b.runs = MAX(atoi(arg[++k]), 1);
+    else if(!strcmp(arg[k], "--format") && k + 1 < argc)
+      b.format = arg[++k];
+    else if(!strcmp(arg[k], "--no-iop"))
+      b.iop = FALSE;
+    else if(!strcmp(arg[k], "--no-export"))
+      b.export = FALSE;
+    else if(!strcmp(arg[k], "--core"))
+    {
+      // everything from here on should be passed to the core
+      k++;
+      break;
+    }
+    else
+    {
+      usage(arg[0]);
+      exit(1);
+    }
+  }
+
+  int m_argc = 0;
+  char *m_arg[5 + argc - k];
+  m_arg[m_argc++] = "darktable-bench";
+  m_arg[m_argc++] = "--library";
+  m_arg[m_argc++] = ":memory:";
+  m_arg[m_argc++] = "--conf";
+  m_arg[m_argc++] = "write_sidecar_files=FALSE";
+  for(; k < argc; k++) m_arg[m_argc++] = arg[k];
+  m_arg[m_argc] = NULL;
+
+  // init dt without gui:
+  if(dt_init(m_argc, m_arg, 0, NULL)) exit(1);
+
+  // default: single threaded and all cores, to see the scaling
+  if(threads)
+  {
+    float t[DT_BENCH_MAX_VALUES];
+    b.num_threads = parse_list(threads, t);
+    for(int i = 0; i < b.num_threads; i++) b.threads[i] = (int)t[i];
+  }
+  else
+  {
+    b.threads[b.num_threads++] = 1;
+    if(darktable.num_openmp_threads > 1) b.threads[b.num_threads++] = darktable.num_openmp_threads;
+  }
+
+  gchar *synthetic = NULL;
+  if(!b.images)
+  {
+    synthetic = write_synthetic_image(4800, 3200);
+    if(!synthetic)
+    {
+      dt_cleanup();
+      exit(1);
+    }
+    b.images = g_list_append(b.images, synthetic);
+  }
+
+  for(GList *l = style_files; l; l = g_list_next(l)) dt_styles_import_from_file((const char *)l->data);
+  // the library is in memory, so these are exactly the styles from the command line
+  GList *styles = dt_styles_get_list("");
+
+  for(GList *l = b.images; l; l = g_list_next(l))
+  {
+    const char *filename = (const char *)l->data;
+    const uint32_t imgid = import_image(filename);
+    if(!imgid) continue;
+    gchar *name = g_path_get_basename(filename);
+
+    // the per-module numbers don't depend on the image, one set is enough
+    if(b.iop && l == b.images) bench_iops(&b, imgid);
+
+    if(b.export)
+    {
+      bench_export(&b, imgid, name, NULL);
+      for(GList *s = styles; s; s = g_list_next(s))
+        bench_export(&b, imgid, name, ((dt_style_t *)s->data)->name);
+    }
+    g_free(name);
+  }
+
+  for(GList *s = styles; s; s = g_list_next(s))
+  {
+    dt_style_t *style = (dt_style_t *)s->data;
+    g_free(style->name);
+    g_free(style->description);
+    g_free(style);
+  }
+  g_list_free(styles);
+  g_list_free(style_files);
+  g_list_free(b.modules);
+  g_list_free(b.images);
+  if(synthetic)
+  {
+    unlink(synthetic);
+    g_free(synthetic);
+  }
+
+  dt_cleanup();
+  return 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -19,6 +19,8 @@
 #ifndef DT_COMMON_BILATERAL_H
 #define DT_COMMON_BILATERAL_H
 
+#include <xmmintrin.h>
+
 // these clamp away insane memory requirements.
 // they should reasonably faithfully represent the
 // full precision though, so tiling will help reducing memory footprint
@@ -42,7 +44,8 @@ size_t dt_bilateral_memory_use(const int width,     // width of input image
   size_t size_y = CLAMPS((int)_y, 4, DT_COMMON_BILATERAL_MAX_RES_S) + 1;
   size_t size_z = CLAMPS((int)_z, 4, DT_COMMON_BILATERAL_MAX_RES_R) + 1;
 
-  return size_x * size_y * size_z * sizeof(float);
+  // the grid plus the per-thread slabs it is splatted into
+  return size_x * size_y * size_z * sizeof(float) * 2;
 }
 
 
@@ -110,18 +113,20 @@ dt_bilateral_t *dt_bilateral_init(const int width,     // width of input image
   return b;
 }
 
-void dt_bilateral_splat(dt_bilateral_t *b, const float *const in)
+// splatting is done in horizontal bands of the image, one per thread. every band owns
+// a private slab of the grid which covers all grid lines y the band can touch, so
+// no atomics are needed. slabs of neighbouring bands overlap by at most one line,
+// they are summed up into the grid afterwards.
+static void splat_band(const dt_bilateral_t *const b, const float *const in, float *slab, const int j0,
+                       const int j1, const int y0, const int ny)
 {
   const int ox = 1;
   const int oy = b->size_x;
-  const int oz = b->size_y * b->size_x;
-// splat into downsampled grid
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(b)
-#endif
-  for(int j = 0; j < b->height; j++)
+  const int oz = ny * b->size_x;
+  const float norm = 100.0f / (b->sigma_s * b->sigma_s);
+  for(int j = j0; j < j1; j++)
   {
-    size_t index = 4 * j * b->width;
+    size_t index = (size_t)4 * j * b->width;
     for(int i = 0; i < b->width; i++)
     {
       float x, y, z;
@@ -134,7 +139,7 @@ void dt_bilateral_splat(dt_bilateral_t *b, const float *const in)
       const float yf = y - yi;
       const float zf = z - zi;
       // nearest neighbour splatting:
-      const size_t grid_index = xi + b->size_x * (yi + b->size_y * zi);
+      const size_t grid_index = xi + b->size_x * ((yi - y0) + ny * zi);
       // sum up payload here, doesn't have to be same as edge stopping data
       // for cross bilateral applications.
       // also note that this is not clipped (as L->z is), so potentially hdr/out of gamut
@@ -143,17 +148,69 @@ void dt_bilateral_splat(dt_bilateral_t *b, const float *const in)
       {
         const size_t ii = grid_index + ((k & 1) ? ox : 0) + ((k & 2) ? oy : 0) + ((k & 4) ? oz : 0);
         const float contrib = ((k & 1) ? xf : (1.0f - xf)) * ((k & 2) ? yf : (1.0f - yf))
-                              * ((k & 4) ? zf : (1.0f - zf)) * 100.0f / (b->sigma_s * b->sigma_s);
-#ifdef _OPENMP
-#pragma omp atomic
-#endif
-        b->buf[ii] += contrib;
+                              * ((k & 4) ? zf : (1.0f - zf)) * norm;
+        slab[ii] += contrib;
       }
       index += 4;
     }
   }
 }
 
+static inline int grid_line(const dt_bilateral_t *const b, const int j)
+{
+  return MIN((int)CLAMPS(j / b->sigma_s, 0, b->size_y - 1), b->size_y - 2);
+}
+
+void dt_bilateral_splat(dt_bilateral_t *b, const float *const in)
+{
+  const int nbands = MAX(1, MIN(dt_get_num_threads(), MIN(b->height, (int)b->size_y - 1)));
+  int y0[nbands], ny[nbands];
+  size_t offset[nbands + 1];
+  offset[0] = 0;
+  for(int t = 0; t < nbands; t++)
+  {
+    y0[t] = grid_line(b, (int64_t)t * b->height / nbands);
+    ny[t] = grid_line(b, (int64_t)(t + 1) * b->height / nbands - 1) + 2 - y0[t];
+    offset[t + 1] = offset[t] + b->size_x * ny[t] * b->size_z;
+  }
+  float *slabs = dt_alloc_align(16, offset[nbands] * sizeof(float));
+  if(!slabs)
+  {
+    // no memory for the slabs, splat the whole image directly into the grid
+    splat_band(b, in, b->buf, 0, b->height, 0, b->size_y);
+    return;
+  }
+  memset(slabs, 0, offset[nbands] * sizeof(float));
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1) shared(b, slabs, y0, ny, offset)
+#endif
+  for(int t = 0; t < nbands; t++)
+    splat_band(b, in, slabs + offset[t], (int64_t)t * b->height / nbands,
+               (int64_t)(t + 1) * b->height / nbands, y0[t], ny[t]);
+
+  // sum up the slabs, every line of the grid is written by one thread only
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) shared(b, slabs, y0, ny, offset)
+#endif
+  for(int l = 0; l < (int)(b->size_y * b->size_z); l++)
+  {
+    const int y = l % b->size_y;
+    const int z = l / b->size_y;
+    float *dst = b->buf + (size_t)l * b->size_x;
+    for(int t = 0; t < nbands; t++)
+    {
+      if(y < y0[t] || y >= y0[t] + ny[t]) continue;
+      const float *src = slabs + offset[t] + b->size_x * ((y - y0[t]) + (size_t)ny[t] * z);
+      int i = 0;
+      for(; i + 4 <= b->size_x; i += 4)
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(src + i)));
+      for(; i < b->size_x; i++) dst[i] += src[i];
+    }
+  }
+  dt_free_align(slabs);
+}
+
 static void blur_line_z(float *buf, const int offset1, const int offset2, const int offset3, const int size1,
                         const int size2, const int size3)
 {
@@ -242,45 +299,60 @@ void dt_bilateral_blur(dt_bilateral_t *b)
 }
 
 
+static inline void grid_row(const dt_bilateral_t *const b, const int j, size_t *gy, __m128 *wy)
+{
+  const float y = CLAMPS(j / b->sigma_s, 0, b->size_y - 1);
+  const int yi = MIN((int)y, b->size_y - 2);
+  const float yf = y - yi;
+  *gy = (size_t)b->size_x * yi;
+  *wy = _mm_set_ps(yf, yf, 1.0f - yf, 1.0f - yf);
+}
+
+// trilinear lookup, the grid line and its weights (1-yf, 1-yf, yf, yf) are the same for
+// a whole row of the image and come from grid_row().
+static inline float grid_lookup(const dt_bilateral_t *const b, const size_t gy, const __m128 wy, const int i,
+                                const float L)
+{
+  const float x = CLAMPS(i / b->sigma_s, 0, b->size_x - 1);
+  const float z = CLAMPS(L / b->sigma_r, 0, b->size_z - 1);
+  const int xi = MIN((int)x, b->size_x - 2);
+  const int zi = MIN((int)z, b->size_z - 2);
+  const float xf = x - xi;
+  const float zf = z - zi;
+  const size_t oy = b->size_x;
+  const size_t oz = b->size_y * b->size_x;
+  const float *const g = b->buf + xi + gy + oz * zi;
+  // lanes: (xi, yi), (xi+1, yi), (xi, yi+1), (xi+1, yi+1)
+  const __m128 c0 = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)g), (const __m64 *)(g + oy));
+  const __m128 c1
+      = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)(g + oz)), (const __m64 *)(g + oz + oy));
+  const __m128 wxy = _mm_mul_ps(wy, _mm_set_ps(xf, 1.0f - xf, xf, 1.0f - xf));
+  __m128 sum = _mm_mul_ps(wxy, _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(1.0f - zf)), _mm_mul_ps(c1, _mm_set1_ps(zf))));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+  return _mm_cvtss_f32(sum);
+}
+
 void dt_bilateral_slice(const dt_bilateral_t *const b, const float *const in, float *out, const float detail)
 {
   // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
   const float norm = -detail * b->sigma_r * 0.04f;
-  const int ox = 1;
-  const int oy = b->size_x;
-  const int oz = b->size_y * b->size_x;
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out)
+#pragma omp parallel for schedule(static) shared(out)
 #endif
   for(int j = 0; j < b->height; j++)
   {
-    size_t index = 4 * j * b->width;
+    size_t gy;
+    __m128 wy;
+    grid_row(b, j, &gy, &wy);
+    size_t index = (size_t)4 * j * b->width;
     for(int i = 0; i < b->width; i++)
     {
-      float x, y, z;
-      const float L = in[index];
-      image_to_grid(b, i, j, L, &x, &y, &z);
-      // trilinear lookup:
-      const int xi = MIN((int)x, b->size_x - 2);
-      const int yi = MIN((int)y, b->size_y - 2);
-      const int zi = MIN((int)z, b->size_z - 2);
-      const float xf = x - xi;
-      const float yf = y - yi;
-      const float zf = z - zi;
-      const size_t gi = xi + b->size_x * (yi + b->size_y * zi);
-      const float Lout = L
-                         + norm * (b->buf[gi] * (1.0f - xf) * (1.0f - yf) * (1.0f - zf)
-                                   + b->buf[gi + ox] * (xf) * (1.0f - yf) * (1.0f - zf)
-                                   + b->buf[gi + oy] * (1.0f - xf) * (yf) * (1.0f - zf)
-                                   + b->buf[gi + ox + oy] * (xf) * (yf) * (1.0f - zf)
-                                   + b->buf[gi + oz] * (1.0f - xf) * (1.0f - yf) * (zf)+b->buf[gi + ox + oz]
-                                     * (xf) * (1.0f - yf) * (zf)+b->buf[gi + oy + oz] * (1.0f - xf) * (yf)
-                                     * (zf)+b->buf[gi + ox + oy + oz] * (xf) * (yf) * (zf));
-      out[index] = MAX(0.0f, Lout);
+      const __m128 pixel = _mm_load_ps(in + index);
+      const float L = _mm_cvtss_f32(pixel);
+      const float Lout = L + norm * grid_lookup(b, gy, wy, i, L);
       // and copy color and mask
-      out[index + 1] = in[index + 1];
-      out[index + 2] = in[index + 2];
-      out[index + 3] = in[index + 3];
+      _mm_store_ps(out + index, _mm_move_ss(pixel, _mm_set_ss(MAX(0.0f, Lout))));
       index += 4;
     }
   }
@@ -291,35 +363,18 @@ void dt_bilateral_slice_to_output(const dt_bilateral_t *const b, const float *co
 {
   // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
   const float norm = -detail * b->sigma_r * 0.04f;
-  const int ox = 1;
-  const int oy = b->size_x;
-  const int oz = b->size_y * b->size_x;
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out)
+#pragma omp parallel for schedule(static) shared(out)
 #endif
   for(int j = 0; j < b->height; j++)
   {
-    size_t index = 4 * j * b->width;
+    size_t gy;
+    __m128 wy;
+    grid_row(b, j, &gy, &wy);
+    size_t index = (size_t)4 * j * b->width;
     for(int i = 0; i < b->width; i++)
     {
-      float x, y, z;
-      const float L = in[index];
-      image_to_grid(b, i, j, L, &x, &y, &z);
-      // trilinear lookup:
-      const int xi = MIN((int)x, b->size_x - 2);
-      const int yi = MIN((int)y, b->size_y - 2);
-      const int zi = MIN((int)z, b->size_z - 2);
-      const float xf = x - xi;
-      const float yf = y - yi;
-      const float zf = z - zi;
-      const size_t gi = xi + b->size_x * (yi + b->size_y * zi);
-      const float Lout = norm * (b->buf[gi] * (1.0f - xf) * (1.0f - yf) * (1.0f - zf)
-                                 + b->buf[gi + ox] * (xf) * (1.0f - yf) * (1.0f - zf)
-                                 + b->buf[gi + oy] * (1.0f - xf) * (yf) * (1.0f - zf)
-                                 + b->buf[gi + ox + oy] * (xf) * (yf) * (1.0f - zf)
-                                 + b->buf[gi + oz] * (1.0f - xf) * (1.0f - yf) * (zf)+b->buf[gi + ox + oz]
-                                   * (xf) * (1.0f - yf) * (zf)+b->buf[gi + oy + oz] * (1.0f - xf) * (yf)
-                                   * (zf)+b->buf[gi + ox + oy + oz] * (xf) * (yf) * (zf));
+      const float Lout = norm * grid_lookup(b, gy, wy, i, in[index]);
       out[index] = MAX(0.0f, out[index] + Lout);
       index += 4;
     }
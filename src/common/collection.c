@@ -46,17 +46,24 @@ static const char *comparators[] = {
 
 /* Stores the collection query, returns 1 if changed.. */
 static int _dt_collection_store(const dt_collection_t *collection, gchar *query);
-/* Counts the number of images in the current collection */
-static uint32_t _dt_collection_compute_count(const dt_collection_t *collection);
-/* signal handlers to update the cached count when something interesting might have happened.
+/* Fetches the images of the collection into ids and positions, returns their number */
+static uint32_t _dt_collection_materialize(const dt_collection_t *collection);
+/* signal handlers to update the cached images and count when something interesting might have happened.
  * we need 2 different since there are different kinds of signals we need to listen to. */
 static void _dt_collection_recount_callback_1(gpointer instace, gpointer user_data);
 static void _dt_collection_recount_callback_2(gpointer instance, uint8_t id, gpointer user_data);
+/* refetches the images when DT_SIGNAL_COLLECTION_CHANGED comes from elsewhere, e.g. after duplicating */
+static void _dt_collection_changed_callback(gpointer instance, gpointer user_data);
+/* raises DT_SIGNAL_COLLECTION_CHANGED for images which were just fetched */
+static void _dt_collection_signal_changed(const dt_collection_t *collection);
 
 
 const dt_collection_t *dt_collection_new(const dt_collection_t *clone)
 {
   dt_collection_t *collection = g_malloc0(sizeof(dt_collection_t));
+  collection->ids = g_array_new(FALSE, FALSE, sizeof(int32_t));
+  collection->positions = g_hash_table_new(NULL, NULL);
+  dt_pthread_mutex_init(&collection->lock, NULL);
 
   /* initialize collection context*/
   if(clone) /* if clone is provided let's copy it into this context */
@@ -66,15 +73,20 @@ const dt_collection_t *dt_collection_new(const dt_collection_t *clone)
     collection->where_ext = g_strdup(clone->where_ext);
     collection->query = g_strdup(clone->query);
     collection->clone = 1;
+    collection->member_query = g_strdup(clone->member_query);
+    dt_pthread_mutex_lock((dt_pthread_mutex_t *)&clone->lock);
     collection->count = clone->count;
+    g_array_append_vals(collection->ids, clone->ids->data, clone->ids->len);
+    for(guint k = 0; k < collection->ids->len; k++)
+      g_hash_table_insert(collection->positions, GINT_TO_POINTER(g_array_index(collection->ids, int32_t, k)),
+                          GINT_TO_POINTER(k + 1));
+    dt_pthread_mutex_unlock((dt_pthread_mutex_t *)&clone->lock);
   }
   else /* else we just initialize using the reset */
     dt_collection_reset(collection);
 
-  /* connect to all the signals that might indicate that the count of images matching the collection changed
-   */
-  dt_control_signal_connect(darktable.signals, DT_SIGNAL_TAG_CHANGED,
-                            G_CALLBACK(_dt_collection_recount_callback_1), collection);
+  /* connect to all the signals that might indicate that the count of images matching the collection changed.
+   * changed ratings, color labels and tags are patched in by dt_collection_update_images(). */
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_FILMROLLS_CHANGED,
                             G_CALLBACK(_dt_collection_recount_callback_1), collection);
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_FILMROLLS_REMOVED,
@@ -84,6 +96,10 @@ const dt_collection_t *dt_collection_new(const dt_collection_t *clone)
                             G_CALLBACK(_dt_collection_recount_callback_2), collection);
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_FILMROLLS_IMPORTED,
                             G_CALLBACK(_dt_collection_recount_callback_2), collection);
+  /* the copies of the selection are recreated on collection changes, only the original follows them */
+  if(!collection->clone)
+    dt_control_signal_connect(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED,
+                              G_CALLBACK(_dt_collection_changed_callback), collection);
 
   return collection;
 }
@@ -94,9 +110,15 @@ void dt_collection_free(const dt_collection_t *collection)
                                (gpointer)collection);
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_collection_recount_callback_2),
                                (gpointer)collection);
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_dt_collection_changed_callback),
+                               (gpointer)collection);
 
   g_free(collection->query);
   g_free(collection->where_ext);
+  g_free(collection->member_query);
+  g_array_free(collection->ids, TRUE);
+  g_hash_table_destroy(collection->positions);
+  dt_pthread_mutex_destroy((dt_pthread_mutex_t *)&collection->lock);
   g_free((dt_collection_t *)collection);
 }
 
@@ -160,6 +182,13 @@ int dt_collection_update(const dt_collection_t *collection)
     wq = dt_util_dstrcat(wq, " and (group_id = id or group_id = %d)", darktable.gui->expanded_group_id);
   }
 
+  /* a single image matches if it passes the where part, no matter how the result is sorted */
+  g_free(((dt_collection_t *)collection)->member_query);
+  ((dt_collection_t *)collection)->member_query
+      = (collection->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT)
+            ? NULL
+            : g_strdup_printf("select id from images where id = ?1 and (%s)", wq);
+
   /* build select part includes where */
   if(collection->params.sort == DT_COLLECTION_SORT_COLOR
      && (collection->params.query_flags & COLLECTION_QUERY_USE_SORT))
@@ -192,9 +221,9 @@ int dt_collection_update(const dt_collection_t *collection)
   g_free(selq);
   g_free(query);
 
-  /* update the cached count. collection isn't a real const anyway, we are writing to it in
+  /* update the cached images and count. collection isn't a real const anyway, we are writing to it in
    * _dt_collection_store, too. */
-  ((dt_collection_t *)collection)->count = _dt_collection_compute_count(collection);
+  ((dt_collection_t *)collection)->count = _dt_collection_materialize(collection);
   dt_collection_hint_message(collection);
 
   return result;
@@ -397,30 +426,46 @@ static int _dt_collection_store(const dt_collection_t *collection, gchar *query)
   return 1;
 }
 
-static uint32_t _dt_collection_compute_count(const dt_collection_t *collection)
+static uint32_t _dt_collection_materialize(const dt_collection_t *collection)
 {
-  sqlite3_stmt *stmt = NULL;
-  uint32_t count = 1;
-  const gchar *query = dt_collection_get_query(collection);
-  gchar *count_query = NULL;
+  dt_collection_t *c = (dt_collection_t *)collection;
 
-  gchar *fq = g_strstr_len(query, strlen(query), "from");
-  if((collection->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT))
-    count_query = dt_util_dstrcat(NULL, "select count(images.id) from images %s", collection->where_ext);
-  else
-    count_query = dt_util_dstrcat(count_query, "select count(id) %s", fq);
+  // build the new images aside, views keep drawing the old ones until they are swapped in
+  GArray *ids = g_array_new(FALSE, FALSE, sizeof(int32_t));
+  GHashTable *positions = g_hash_table_new(NULL, NULL);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), count_query, -1, &stmt, NULL);
-  if((collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT)
-     && !(collection->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT))
+  const gchar *query = dt_collection_get_query(collection);
+  if(query)
   {
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
+    sqlite3_stmt *stmt = NULL;
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+    if(collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT)
+    {
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
+    }
+
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      const int32_t id = sqlite3_column_int(stmt, 0);
+      // the join for sorting by color labels can return an image more than once, keep the first one
+      if(g_hash_table_lookup(positions, GINT_TO_POINTER(id))) continue;
+      g_array_append_val(ids, id);
+      g_hash_table_insert(positions, GINT_TO_POINTER(id), GINT_TO_POINTER(ids->len));
+    }
+    sqlite3_finalize(stmt);
   }
 
-  if(sqlite3_step(stmt) == SQLITE_ROW) count = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
-  g_free(count_query);
+  const uint32_t count = ids->len;
+  dt_pthread_mutex_lock(&c->lock);
+  GArray *old_ids = c->ids;
+  GHashTable *old_positions = c->positions;
+  c->ids = ids;
+  c->positions = positions;
+  dt_pthread_mutex_unlock(&c->lock);
+
+  g_array_free(old_ids, TRUE);
+  g_hash_table_destroy(old_positions);
   return count;
 }
 
@@ -804,7 +849,7 @@ void dt_collection_update_query(const dt_collection_t *collection)
 
 
   /* raise signal of collection change, only if this is an original */
-  if(!collection->clone) dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
+  if(!collection->clone) _dt_collection_signal_changed(collection);
 }
 
 void dt_collection_hint_message(const dt_collection_t *collection)
@@ -821,45 +866,132 @@ void dt_collection_hint_message(const dt_collection_t *collection)
 
 int dt_collection_image_offset(int imgid)
 {
-  const gchar *qin = dt_collection_get_query(darktable.collection);
-  int offset = 0;
-  sqlite3_stmt *stmt;
+  dt_collection_t *collection = (dt_collection_t *)darktable.collection;
+  dt_pthread_mutex_lock(&collection->lock);
+  const int pos = GPOINTER_TO_INT(g_hash_table_lookup(collection->positions, GINT_TO_POINTER(imgid)));
+  dt_pthread_mutex_unlock(&collection->lock);
+  return pos ? pos - 1 : 0;
+}
 
-  if(qin)
-  {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), qin, -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
+gboolean dt_collection_has_image(const dt_collection_t *collection, int imgid)
+{
+  dt_collection_t *c = (dt_collection_t *)collection;
+  dt_pthread_mutex_lock(&c->lock);
+  const gboolean found = g_hash_table_lookup(c->positions, GINT_TO_POINTER(imgid)) != NULL;
+  dt_pthread_mutex_unlock(&c->lock);
+  return found;
+}
 
-    gboolean found = FALSE;
+int dt_collection_get_ids(const dt_collection_t *collection, int offset, int count, int32_t *ids)
+{
+  dt_collection_t *c = (dt_collection_t *)collection;
+  // like sqlite's limit, a negative offset starts at the first image
+  offset = MAX(offset, 0);
+  dt_pthread_mutex_lock(&c->lock);
+  count = MIN(count, (int)c->ids->len - offset);
+  if(count > 0) memcpy(ids, &g_array_index(c->ids, int32_t, offset), sizeof(int32_t) * count);
+  dt_pthread_mutex_unlock(&c->lock);
+  return MAX(count, 0);
+}
 
-    while(sqlite3_step(stmt) == SQLITE_ROW)
+void dt_collection_update_images(const dt_collection_t *collection, int imgid, dt_collection_change_t change)
+{
+  dt_collection_t *c = (dt_collection_t *)collection;
+
+  // where an image goes depends on all the others when the collection is sorted by what changed
+  const gboolean sorted_by_change
+      = (collection->params.query_flags & COLLECTION_QUERY_USE_SORT)
+        && ((change == DT_COLLECTION_CHANGE_RATING && collection->params.sort == DT_COLLECTION_SORT_RATING)
+            || (change == DT_COLLECTION_CHANGE_COLORLABEL
+                && collection->params.sort == DT_COLLECTION_SORT_COLOR));
+  gboolean rebuild = sorted_by_change || !collection->member_query;
+  GHashTable *removed = g_hash_table_new(NULL, NULL);
+
+  if(!rebuild)
+  {
+    GList *images = NULL;
+    if(imgid > 0)
+      images = g_list_append(images, GINT_TO_POINTER(imgid));
+    else
+    {
+      sqlite3_stmt *stmt;
+      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select imgid from selected_images", -1,
+                                  &stmt, NULL);
+      while(sqlite3_step(stmt) == SQLITE_ROW)
+        images = g_list_prepend(images, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+      sqlite3_finalize(stmt);
+    }
+
+    sqlite3_stmt *stmt;
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), collection->member_query, -1, &stmt, NULL);
+    for(GList *iter = images; iter; iter = g_list_next(iter))
     {
-      int id = sqlite3_column_int(stmt, 0);
-      if(imgid == id)
+      const int id = GPOINTER_TO_INT(iter->data);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
+      const gboolean match = sqlite3_step(stmt) == SQLITE_ROW;
+      sqlite3_reset(stmt);
+      sqlite3_clear_bindings(stmt);
+
+      const gboolean found = dt_collection_has_image(collection, id);
+      if(found && !match)
+        g_hash_table_add(removed, GINT_TO_POINTER(id));
+      else if(!found && match)
       {
-        found = TRUE;
+        // we don't know its place in the sort order, ask the db for everything
+        rebuild = TRUE;
         break;
       }
-      offset++;
     }
+    sqlite3_finalize(stmt);
+    g_list_free(images);
+  }
 
-    if(!found) offset = 0;
+  gboolean changed = rebuild;
+  if(rebuild)
+    c->count = _dt_collection_materialize(collection);
+  else if(g_hash_table_size(removed))
+  {
+    // drop the images which don't match anymore, everything behind them moves up
+    dt_pthread_mutex_lock(&c->lock);
+    guint k = 0;
+    for(guint i = 0; i < c->ids->len; i++)
+    {
+      const int32_t id = g_array_index(c->ids, int32_t, i);
+      if(g_hash_table_contains(removed, GINT_TO_POINTER(id)))
+      {
+        g_hash_table_remove(c->positions, GINT_TO_POINTER(id));
+        continue;
+      }
+      if(k != i)
+      {
+        g_array_index(c->ids, int32_t, k) = id;
+        g_hash_table_insert(c->positions, GINT_TO_POINTER(id), GINT_TO_POINTER(k + 1));
+      }
+      k++;
+    }
+    g_array_set_size(c->ids, k);
+    c->count = k;
+    dt_pthread_mutex_unlock(&c->lock);
+    changed = TRUE;
+  }
+  g_hash_table_destroy(removed);
 
-    sqlite3_finalize(stmt);
+  if(changed && !collection->clone)
+  {
+    dt_collection_hint_message(collection);
+    _dt_collection_signal_changed(collection);
   }
-  return offset;
 }
 
 static void _dt_collection_recount_callback_1(gpointer instace, gpointer user_data)
 {
   dt_collection_t *collection = (dt_collection_t *)user_data;
   int old_count = collection->count;
-  collection->count = _dt_collection_compute_count(collection);
+  collection->count = _dt_collection_materialize(collection);
   if(!collection->clone)
   {
     if(old_count != collection->count) dt_collection_hint_message(collection);
-    dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
+    _dt_collection_signal_changed(collection);
   }
 }
 
@@ -867,14 +999,43 @@ static void _dt_collection_recount_callback_2(gpointer instance, uint8_t id, gpo
 {
   dt_collection_t *collection = (dt_collection_t *)user_data;
   int old_count = collection->count;
-  collection->count = _dt_collection_compute_count(collection);
+  collection->count = _dt_collection_materialize(collection);
   if(!collection->clone)
   {
     if(old_count != collection->count) dt_collection_hint_message(collection);
-    dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
+    _dt_collection_signal_changed(collection);
   }
 }
 
+static void _dt_collection_signal_changed(const dt_collection_t *collection)
+{
+  dt_collection_t *c = (dt_collection_t *)collection;
+  // signals are dropped while not running, don't leave a token behind for them
+  if(!dt_control_running()) return;
+  g_atomic_int_inc(&c->fresh_signals);
+  dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
+}
+
+static void _dt_collection_changed_callback(gpointer instance, gpointer user_data)
+{
+  dt_collection_t *collection = (dt_collection_t *)user_data;
+
+  // one of our own signals, the ids were fetched right before raising it
+  gint fresh;
+  do
+  {
+    fresh = g_atomic_int_get(&collection->fresh_signals);
+    if(fresh <= 0) break;
+  } while(!g_atomic_int_compare_and_exchange(&collection->fresh_signals, fresh, fresh - 1));
+  if(fresh > 0) return;
+
+  // the images changed behind our back. this handler runs before the views', which draw from the new ids
+  // then. the signal is on its way already, so don't raise it again.
+  int old_count = collection->count;
+  collection->count = _dt_collection_materialize(collection);
+  if(old_count != collection->count) dt_collection_hint_message(collection);
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -18,6 +18,7 @@
 #ifndef DT_COLLECTION_H
 #define DT_COLLECTION_H
 
+#include "common/dtpthread.h"
 #include <inttypes.h>
 #include <glib.h>
 
@@ -88,6 +89,14 @@ typedef enum dt_collection_properties_t
   DT_COLLECTION_PROP_GEOTAGGING
 } dt_collection_properties_t;
 
+/** what changed about an image, see dt_collection_update_images() */
+typedef enum dt_collection_change_t
+{
+  DT_COLLECTION_CHANGE_RATING,
+  DT_COLLECTION_CHANGE_COLORLABEL,
+  DT_COLLECTION_CHANGE_TAG
+} dt_collection_change_t;
+
 typedef enum dt_collection_rating_comperator_t
 {
   DT_COLLECTION_RATING_COMP_LT = 0,
@@ -126,6 +135,15 @@ typedef struct dt_collection_t
   gchar *query;
   gchar *where_ext;
   unsigned int count;
+  /* tests if a single image (?1) matches the collection, NULL if that isn't possible */
+  gchar *member_query;
+  /* the images of the collection in query order, and imgid -> position + 1. both are replaced or patched
+   * under the lock, readers have to hold it, too. */
+  GArray *ids;
+  GHashTable *positions;
+  dt_pthread_mutex_t lock;
+  /* DT_SIGNAL_COLLECTION_CHANGED raised by the collection itself with fresh ids, not delivered yet */
+  gint fresh_signals;
   dt_collection_params_t params;
   dt_collection_params_t store;
 } dt_collection_t;
@@ -195,6 +213,16 @@ void dt_collection_hint_message(const dt_collection_t *collection);
 /** returns the image offset in the collection */
 int dt_collection_image_offset(int imgid);
 
+/** returns TRUE if the image is part of the collection */
+gboolean dt_collection_has_image(const dt_collection_t *collection, int imgid);
+
+/** fills ids with at most count image ids of the collection starting at offset, returns how many */
+int dt_collection_get_ids(const dt_collection_t *collection, int offset, int count, int32_t *ids);
+
+/** patches the images of the collection after the rating, color labels or tags of imgid changed. imgid -1
+ * stands for all selected images. */
+void dt_collection_update_images(const dt_collection_t *collection, int imgid, dt_collection_change_t change);
+
 /* serialize and deserialize into a string. */
 void dt_collection_deserialize(char *buf);
 int dt_collection_serialize(char *buf, int bufsize);
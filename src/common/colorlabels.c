@@ -35,6 +35,7 @@ void dt_colorlabels_remove_labels_selection()
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
                         "delete from color_labels where imgid in (select imgid from selected_images)", NULL,
                         NULL, NULL);
+  dt_collection_update_images(darktable.collection, -1, DT_COLLECTION_CHANGE_COLORLABEL);
 }
 
 void dt_colorlabels_remove_labels(const int imgid)
@@ -45,6 +46,7 @@ void dt_colorlabels_remove_labels(const int imgid)
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  dt_collection_update_images(darktable.collection, imgid, DT_COLLECTION_CHANGE_COLORLABEL);
 }
 
 void dt_colorlabels_set_label(const int imgid, const int color)
@@ -56,6 +58,7 @@ void dt_colorlabels_set_label(const int imgid, const int color)
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, color);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  dt_collection_update_images(darktable.collection, imgid, DT_COLLECTION_CHANGE_COLORLABEL);
 }
 
 void dt_colorlabels_remove_label(const int imgid, const int color)
@@ -67,6 +70,7 @@ void dt_colorlabels_remove_label(const int imgid, const int color)
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, color);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  dt_collection_update_images(darktable.collection, imgid, DT_COLLECTION_CHANGE_COLORLABEL);
 }
 
 void dt_colorlabels_toggle_label_selection(const int color)
@@ -104,6 +108,7 @@ void dt_colorlabels_toggle_label_selection(const int color)
   }
   sqlite3_finalize(stmt);
 
+  dt_collection_update_images(darktable.collection, -1, DT_COLLECTION_CHANGE_COLORLABEL);
   dt_collection_hint_message(darktable.collection);
 }
 
@@ -135,6 +140,7 @@ void dt_colorlabels_toggle_label(const int imgid, const int color)
   }
   sqlite3_finalize(stmt);
 
+  dt_collection_update_images(darktable.collection, imgid, DT_COLLECTION_CHANGE_COLORLABEL);
   dt_collection_hint_message(darktable.collection);
 }
 
@@ -203,7 +209,6 @@ gboolean dt_colorlabels_key_accel_callback(GtkAccelGroup *accel_group, GObject *
   // synch to file:
   // TODO: move color labels to image_t cache and sync via write_get!
   dt_image_synch_xmp(selected);
-  dt_control_signal_raise(darktable.signals, DT_SIGNAL_FILMROLLS_CHANGED);
   dt_control_queue_redraw_center();
   return TRUE;
 }
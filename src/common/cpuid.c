@@ -106,6 +106,7 @@ dt_cpu_flags_t dt_detect_cpu_features()
         if(cx & 0x00000200) cpuflags |= CPU_FLAG_SSSE3;
         if(cx & 0x00040000) cpuflags |= CPU_FLAG_SSE4_1;
         if(cx & 0x00080000) cpuflags |= CPU_FLAG_SSE4_2;
+        if(cx & 0x20000000) cpuflags |= CPU_FLAG_F16C;
       }
 
       /* Are there extensions? */
@@ -45,10 +45,12 @@
 #include "common/image.h"
 #include "common/image_cache.h"
 #include "common/imageio_module.h"
+#include "common/memo.h"
 #include "common/mipmap_cache.h"
 #include "common/noiseprofiles.h"
 #include "common/opencl.h"
 #include "common/points.h"
+#include "common/profiling.h"
 #include "develop/imageop.h"
 #include "develop/blend.h"
 #include "libs/lib.h"
@@ -111,7 +113,7 @@ const char dt_supported_extensions[] = "3fr,arw,bay,bmq,cap,cine,cr2,crw,cs1,dc2
 static int usage(const char *argv0)
 {
   printf("usage: %s [-d "
-         "{all,cache,camctl,control,dev,fswatch,input,lighttable,masks,memory,nan,opencl,perf,pwstorage,sql}]"
+         "{all,cache,camctl,control,dev,fswatch,input,lighttable,masks,memory,nan,opencl,perf,pwstorage,sql,trace}]"
          " [IMG_1234.{RAW,..}|image_folder/]",
          argv0);
 #ifdef HAVE_OPENCL
@@ -621,6 +623,8 @@ int dt_init(int argc, char *argv[], const int init_gui, lua_State *L)
           darktable.unmuted |= DT_DEBUG_LUA; // lua errors are reported on console
         else if(!strcmp(argv[k + 1], "print"))
           darktable.unmuted |= DT_DEBUG_PRINT; // print errors are reported on console
+        else if(!strcmp(argv[k + 1], "trace"))
+          darktable.unmuted |= DT_DEBUG_TRACE; // structured timing of pixelpipe runs
         else
           return usage(argv[0]);
         k++;
@@ -698,6 +702,13 @@ int dt_init(int argc, char *argv[], const int init_gui, lua_State *L)
   dt_loc_init_user_config_dir(configdir_from_command);
   dt_loc_init_user_cache_dir(cachedir_from_command);
 
+  if(dt_trace_enabled())
+  {
+    gchar *filename = g_strdup_printf("%s/darktable-trace-%d.json", darktable.tmpdir, (int)getpid());
+    dt_trace_init(filename);
+    g_free(filename);
+  }
+
 #if !GLIB_CHECK_VERSION(2, 35, 0)
   g_type_init();
 #endif
@@ -781,15 +792,6 @@ int dt_init(int argc, char *argv[], const int init_gui, lua_State *L)
   // Initialize the signal system
   darktable.signals = dt_control_signal_init();
 
-  // Make sure that the database and xmp files are in sync before starting the fswatch.
-  // We need conf and db to be up and running for that which is the case here.
-  // FIXME: is this also useful in non-gui mode?
-  GList *changed_xmp_files = NULL;
-  if(init_gui && dt_conf_get_bool("run_crawler_on_start"))
-  {
-    changed_xmp_files = dt_control_crawler_run();
-  }
-
   // Initialize the filesystem watcher
   darktable.fswatch = dt_fswatch_new();
 
@@ -842,6 +844,9 @@ int dt_init(int argc, char *argv[], const int init_gui, lua_State *L)
 
   darktable.noiseprofile_parser = dt_noiseprofile_init(noiseprofiles_from_command);
 
+  darktable.memo = (dt_memo_t *)calloc(1, sizeof(dt_memo_t));
+  dt_memo_init(darktable.memo);
+
   // must come before mipmap_cache, because that one will need to access
   // image dimensions stored in here:
   darktable.image_cache = (dt_image_cache_t *)calloc(1, sizeof(dt_image_cache_t));
@@ -949,11 +954,12 @@ int dt_init(int argc, char *argv[], const int init_gui, lua_State *L)
   dt_lua_init(darktable.lua_state.state, lua_command);
 #endif
 
-  // last but not least construct the popup that asks the user about images whose xmp files are newer than the
-  // db entry
-  if(init_gui && changed_xmp_files)
+  // last but not least check in the background if the xmp files are in sync with the db. once that is done
+  // the user gets asked about images whose xmp files are newer than the db entry.
+  // FIXME: is this also useful in non-gui mode?
+  if(init_gui && dt_conf_get_bool("run_crawler_on_start"))
   {
-    dt_control_crawler_show_image_list(changed_xmp_files);
+    dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, dt_control_crawler_job_create());
   }
 
   return 0;
@@ -993,6 +999,8 @@ void dt_cleanup()
   free(darktable.image_cache);
   dt_mipmap_cache_cleanup(darktable.mipmap_cache);
   free(darktable.mipmap_cache);
+  dt_memo_cleanup(darktable.memo);
+  free(darktable.memo);
   if(init_gui)
   {
     dt_control_cleanup(darktable.control);
@@ -1030,6 +1038,8 @@ void dt_cleanup()
 #ifdef HAVE_GEGL
   gegl_exit();
 #endif
+
+  dt_trace_cleanup();
 }
 
 void dt_print(dt_debug_thread_t thread, const char *msg, ...)
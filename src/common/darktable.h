@@ -146,6 +146,7 @@ struct dt_points_t;
 struct dt_imageio_t;
 struct dt_bauhaus_t;
 struct dt_undo_t;
+struct dt_memo_t;
 
 typedef enum dt_debug_thread_t
 {
@@ -165,7 +166,8 @@ typedef enum dt_debug_thread_t
   DT_DEBUG_MASKS = 1 << 12,
   DT_DEBUG_LUA = 1 << 13,
   DT_DEBUG_INPUT = 1 << 14,
-  DT_DEBUG_PRINT = 1 << 15
+  DT_DEBUG_PRINT = 1 << 15,
+  DT_DEBUG_TRACE = 1 << 16
 } dt_debug_thread_t;
 
 typedef struct darktable_t
@@ -200,6 +202,7 @@ typedef struct darktable_t
   struct dt_blendop_t *blendop;
   struct dt_dbus_t *dbus;
   struct dt_undo_t *undo;
+  struct dt_memo_t *memo;
   dt_pthread_mutex_t db_insert;
   dt_pthread_mutex_t plugin_threadsafe;
   dt_pthread_mutex_t capabilities_threadsafe;
@@ -36,7 +36,7 @@
 
 // whenever _create_schema() gets changed you HAVE to bump this version and add an update path to
 // _upgrade_schema_step()!
-#define CURRENT_DATABASE_VERSION 8
+#define CURRENT_DATABASE_VERSION 9
 
 typedef struct dt_database_t
 {
@@ -669,6 +669,18 @@ static int _upgrade_schema_step(dt_database_t *db, int version)
 
     sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
     new_version = 8;
+  }
+  else if(version == 8)
+  {
+    // 8 -> 9 added crawler_timestamp to remember the mtime of the folder when the crawler last looked at it
+    if(sqlite3_exec(db->handle, "ALTER TABLE film_rolls ADD COLUMN crawler_timestamp INTEGER", NULL, NULL, NULL)
+       != SQLITE_OK)
+    {
+      fprintf(stderr, "[init] can't add `crawler_timestamp' column to database\n");
+      fprintf(stderr, "[init]   %s\n", sqlite3_errmsg(db->handle));
+      return version;
+    }
+    new_version = 9;
   } // maybe in the future, see commented out code elsewhere
     //   else if(version == XXX)
     //   {
@@ -722,7 +734,7 @@ static void _create_schema(dt_database_t *db)
                         //                        "folder VARCHAR(1024), external_drive VARCHAR(1024))", //
                         //                        FIXME: make sure to bump CURRENT_DATABASE_VERSION and add a
                         //                        case to _upgrade_schema_step when adding this!
-                        "folder VARCHAR(1024) NOT NULL)",
+                        "folder VARCHAR(1024) NOT NULL, crawler_timestamp INTEGER)",
                         NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(db->handle, "CREATE INDEX film_rolls_folder_index ON film_rolls (folder)", NULL, NULL,
                         NULL);
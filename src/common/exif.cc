@@ -68,6 +68,34 @@ extern "C" {
 
 static void _exif_import_tags(dt_image_t *img, Exiv2::XmpData::iterator &pos);
 
+// the exif data of the last few images, already stripped of everything which only applies to the original
+// file. saves parsing the original once per exported image, format and size.
+#define DT_EXIF_BLOB_CACHE_SIZE 8
+typedef struct dt_exif_blob_cache_entry_t
+{
+  int imgid;
+  std::string path;
+  time_t mtime;
+  uint64_t last_use;
+  Exiv2::ExifData exifData;
+} dt_exif_blob_cache_entry_t;
+static dt_exif_blob_cache_entry_t _blob_cache[DT_EXIF_BLOB_CACHE_SIZE];
+static uint64_t _blob_cache_clock = 0;
+
+#if defined(GLIB_CHECK_VERSION) && GLIB_CHECK_VERSION(2, 32, 0)
+static GMutex _blob_cache_lock;
+#define _blob_cache_lock_acquire() g_mutex_lock(&_blob_cache_lock)
+#define _blob_cache_lock_release() g_mutex_unlock(&_blob_cache_lock)
+#else
+static GStaticMutex _blob_cache_lock = G_STATIC_MUTEX_INIT;
+#define _blob_cache_lock_acquire() g_static_mutex_lock(&_blob_cache_lock)
+#define _blob_cache_lock_release() g_static_mutex_unlock(&_blob_cache_lock)
+#endif
+
+static void _exif_strip_original(Exiv2::ExifData &exifData);
+static void _blob_cache_insert(const int imgid, const char *path, const time_t mtime,
+                               const Exiv2::ExifData &exifData);
+
 // this array should contain all XmpBag and XmpSeq keys used by dt
 const char *dt_xmp_keys[]
     = { "Xmp.dc.subject", "Xmp.lr.hierarchicalSubject", "Xmp.darktable.colorlabels",
@@ -886,8 +914,9 @@ int dt_exif_read(dt_image_t *img, const char *path)
   // at least set datetime taken to something useful in case there is no exif data in this file (pfm, png,
   // ...)
   struct stat statbuf;
+  const int have_stat = !stat(path, &statbuf);
 
-  if(!stat(path, &statbuf))
+  if(have_stat)
   {
     struct tm result;
     strftime(img->exif_datetime_taken, 20, "%Y:%m:%d %H:%M:%S", localtime_r(&statbuf.st_mtime, &result));
@@ -904,7 +933,16 @@ int dt_exif_read(dt_image_t *img, const char *path)
     // EXIF metadata
     Exiv2::ExifData &exifData = image->exifData();
     if(!exifData.empty())
+    {
+      // keep it around for exporting this image, saves parsing the file again
+      if(img->id > 0 && have_stat)
+      {
+        Exiv2::ExifData stripped = exifData;
+        _exif_strip_original(stripped);
+        _blob_cache_insert(img->id, path, statbuf.st_mtime, stripped);
+      }
       res = dt_exif_read_exif_data(img, exifData);
+    }
     else
       img->exif_inited = 1;
 
@@ -980,47 +1018,106 @@ int dt_exif_write_blob(uint8_t *blob, uint32_t size, const char *path)
   return 1;
 }
 
+/** drops what only applies to the original file and is the same for all exports of it. */
+static void _exif_strip_original(Exiv2::ExifData &exifData)
+{
+  // needs to be reset, even in dng mode, as the buffers are flipped during raw import
+  exifData["Exif.Image.Orientation"] = uint16_t(1);
+
+  // get rid of thumbnails
+  Exiv2::ExifThumb(exifData).erase();
+
+  // ufraw-style exif stripping:
+  Exiv2::ExifData::iterator pos;
+  /* Delete original TIFF data, which is irrelevant*/
+  if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.ImageWidth"))) != exifData.end())
+    exifData.erase(pos);
+  if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.ImageLength"))) != exifData.end())
+    exifData.erase(pos);
+  if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.BitsPerSample"))) != exifData.end())
+    exifData.erase(pos);
+  if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.Compression"))) != exifData.end())
+    exifData.erase(pos);
+  if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.PhotometricInterpretation"))) != exifData.end())
+    exifData.erase(pos);
+  if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.FillOrder"))) != exifData.end())
+    exifData.erase(pos);
+  if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.SamplesPerPixel"))) != exifData.end())
+    exifData.erase(pos);
+  if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.StripOffsets"))) != exifData.end())
+    exifData.erase(pos);
+  if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.RowsPerStrip"))) != exifData.end())
+    exifData.erase(pos);
+  if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.StripByteCounts"))) != exifData.end())
+    exifData.erase(pos);
+  if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.PlanarConfiguration"))) != exifData.end())
+    exifData.erase(pos);
+}
+
+static void _blob_cache_insert(const int imgid, const char *path, const time_t mtime,
+                               const Exiv2::ExifData &exifData)
+{
+  _blob_cache_lock_acquire();
+  dt_exif_blob_cache_entry_t *victim = _blob_cache;
+  for(int k = 0; k < DT_EXIF_BLOB_CACHE_SIZE; k++)
+  {
+    dt_exif_blob_cache_entry_t *e = _blob_cache + k;
+    if(e->imgid == imgid && e->path == path)
+    {
+      victim = e;
+      break;
+    }
+    if(e->last_use < victim->last_use) victim = e;
+  }
+  victim->imgid = imgid;
+  victim->path = path;
+  victim->mtime = mtime;
+  victim->last_use = ++_blob_cache_clock;
+  victim->exifData = exifData;
+  _blob_cache_lock_release();
+}
+
+/** stripped exif data of the original, from the cache if the file didn't change since it was parsed. */
+static void _blob_cache_get(Exiv2::ExifData &exifData, const char *path, const int imgid)
+{
+  struct stat statbuf;
+  const int cacheable = imgid > 0 && !stat(path, &statbuf);
+  if(cacheable)
+  {
+    bool found = false;
+    _blob_cache_lock_acquire();
+    for(int k = 0; k < DT_EXIF_BLOB_CACHE_SIZE; k++)
+    {
+      dt_exif_blob_cache_entry_t *e = _blob_cache + k;
+      if(e->last_use && e->imgid == imgid && e->mtime == statbuf.st_mtime && e->path == path)
+      {
+        e->last_use = ++_blob_cache_clock;
+        exifData = e->exifData;
+        found = true;
+        break;
+      }
+    }
+    _blob_cache_lock_release();
+    if(found) return;
+  }
+
+  Exiv2::Image::AutoPtr image;
+  image = Exiv2::ImageFactory::open(path);
+  assert(image.get() != 0);
+  image->readMetadata();
+  exifData = image->exifData();
+  _exif_strip_original(exifData);
+  if(cacheable) _blob_cache_insert(imgid, path, statbuf.st_mtime, exifData);
+}
+
 int dt_exif_read_blob(uint8_t *buf, const char *path, const int imgid, const int sRGB, const int out_width,
                       const int out_height, const int dng_mode)
 {
   try
   {
-    Exiv2::Image::AutoPtr image;
-    image = Exiv2::ImageFactory::open(path);
-    assert(image.get() != 0);
-    image->readMetadata();
-    Exiv2::ExifData &exifData = image->exifData();
-    // needs to be reset, even in dng mode, as the buffers are flipped during raw import
-    exifData["Exif.Image.Orientation"] = uint16_t(1);
-
-    // get rid of thumbnails
-    Exiv2::ExifThumb(exifData).erase();
-
-    // ufraw-style exif stripping:
+    Exiv2::ExifData exifData;
+    _blob_cache_get(exifData, path, imgid);
     Exiv2::ExifData::iterator pos;
-    /* Delete original TIFF data, which is irrelevant*/
-    if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.ImageWidth"))) != exifData.end())
-      exifData.erase(pos);
-    if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.ImageLength"))) != exifData.end())
-      exifData.erase(pos);
-    if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.BitsPerSample"))) != exifData.end())
-      exifData.erase(pos);
-    if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.Compression"))) != exifData.end())
-      exifData.erase(pos);
-    if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.PhotometricInterpretation"))) != exifData.end())
-      exifData.erase(pos);
-    if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.FillOrder"))) != exifData.end())
-      exifData.erase(pos);
-    if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.SamplesPerPixel"))) != exifData.end())
-      exifData.erase(pos);
-    if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.StripOffsets"))) != exifData.end())
-      exifData.erase(pos);
-    if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.RowsPerStrip"))) != exifData.end())
-      exifData.erase(pos);
-    if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.StripByteCounts"))) != exifData.end())
-      exifData.erase(pos);
-    if((pos = exifData.findKey(Exiv2::ExifKey("Exif.Image.PlanarConfiguration"))) != exifData.end())
-      exifData.erase(pos);
 
     if(!dng_mode)
     {
@@ -2133,6 +2230,11 @@ void dt_exif_init()
 
 void dt_exif_cleanup()
 {
+  for(int k = 0; k < DT_EXIF_BLOB_CACHE_SIZE; k++)
+  {
+    _blob_cache[k].exifData.clear();
+    _blob_cache[k].last_use = 0;
+  }
   Exiv2::XmpParser::terminate();
 }
 
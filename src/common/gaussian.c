@@ -19,6 +19,7 @@
 
 #include <math.h>
 #include <assert.h>
+#include <string.h>
 #include <xmmintrin.h>
 #include "common/opencl.h"
 #include "common/gaussian.h"
@@ -26,6 +27,7 @@
 #define CLAMPF(a, mn, mx) ((a) < (mn) ? (mn) : ((a) > (mx) ? (mx) : (a)))
 #define MMCLAMPPS(a, mn, mx) (_mm_min_ps((mx), _mm_max_ps((a), (mn))))
 #define BLOCKSIZE 32
+#define LANES 16
 
 static void compute_gauss_params(const float sigma, dt_gaussian_order_t order, float *a0, float *a1,
                                  float *a2, float *a3, float *b1, float *b2, float *coefp, float *coefn)
@@ -145,325 +147,236 @@ error:
 }
 
 
-void dt_gaussian_blur(dt_gaussian_t *g, float *in, float *out)
+// the recursive filter runs down columns of floats, row j of a column is found at j * stride. the vertical
+// pass filters the image columns directly, the horizontal pass first transposes a band of rows (or, with four
+// channels, picks one pixel of each row of the band) so that the same code can be used. either way LANES adjacent columns are filtered at once: the loads and stores of one
+// row are contiguous, and the independent recursions hide each other's latency.
+static inline void blur_column(const float *const in, float *const out, const size_t stride, const int height,
+                               const float min, const float max, const float *const c)
 {
+  const float a0 = c[0], a1 = c[1], a2 = c[2], a3 = c[3], b1 = c[4], b2 = c[5], coefp = c[6], coefn = c[7];
 
-  const int width = g->width;
-  const int height = g->height;
-  const int ch = g->channels;
-
-  float a0, a1, a2, a3, b1, b2, coefp, coefn;
-
-  compute_gauss_params(g->sigma, g->order, &a0, &a1, &a2, &a3, &b1, &b2, &coefp, &coefn);
-
-  float *temp = g->buf;
+  // forward filter
+  float xp = CLAMPF(in[0], min, max);
+  float yb = xp * coefp;
+  float yp = yb;
 
-  float *Labmax = g->max;
-  float *Labmin = g->min;
-
-// vertical blur column by column
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(in, out, temp, Labmin, Labmax, a0, a1, a2, a3, b1, b2, coefp,  \
-                                              coefn) schedule(static)
-#endif
-  for(int i = 0; i < width; i++)
+  for(int j = 0; j < height; j++)
   {
-    float xp[ch];
-    float yb[ch];
-    float yp[ch];
-    float xc[ch];
-    float yc[ch];
-    float xn[ch];
-    float xa[ch];
-    float yn[ch];
-    float ya[ch];
-
-    // forward filter
-    for(int k = 0; k < ch; k++)
-    {
-      xp[k] = CLAMPF(in[(size_t)i * ch + k], Labmin[k], Labmax[k]);
-      yb[k] = xp[k] * coefp;
-      yp[k] = yb[k];
-      xc[k] = yc[k] = xn[k] = xa[k] = yn[k] = ya[k] = 0.0f;
-    }
-
-    for(int j = 0; j < height; j++)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
+    const size_t offset = j * stride;
+    const float xc = CLAMPF(in[offset], min, max);
+    const float yc = (a0 * xc) + ((a1 * xp) - ((b1 * yp) + (b2 * yb)));
 
-      for(int k = 0; k < ch; k++)
-      {
-        xc[k] = CLAMPF(in[offset + k], Labmin[k], Labmax[k]);
-        yc[k] = (a0 * xc[k]) + (a1 * xp[k]) - (b1 * yp[k]) - (b2 * yb[k]);
+    out[offset] = yc;
 
-        temp[offset + k] = yc[k];
-
-        xp[k] = xc[k];
-        yb[k] = yp[k];
-        yp[k] = yc[k];
-      }
-    }
+    xp = xc;
+    yb = yp;
+    yp = yc;
+  }
 
-    // backward filter
-    for(int k = 0; k < ch; k++)
-    {
-      xn[k] = CLAMPF(in[((size_t)(height - 1) * width + i) * ch + k], Labmin[k], Labmax[k]);
-      xa[k] = xn[k];
-      yn[k] = xn[k] * coefn;
-      ya[k] = yn[k];
-    }
+  // backward filter
+  float xn = CLAMPF(in[(size_t)(height - 1) * stride], min, max);
+  float xa = xn;
+  float yn = xn * coefn;
+  float ya = yn;
 
-    for(int j = height - 1; j > -1; j--)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
+  for(int j = height - 1; j > -1; j--)
+  {
+    const size_t offset = j * stride;
+    const float xc = CLAMPF(in[offset], min, max);
+    const float yc = (a2 * xn) + ((a3 * xa) - ((b1 * yn) + (b2 * ya)));
 
-      for(int k = 0; k < ch; k++)
-      {
-        xc[k] = CLAMPF(in[offset + k], Labmin[k], Labmax[k]);
+    xa = xn;
+    xn = xc;
+    ya = yn;
+    yn = yc;
 
-        yc[k] = (a2 * xn[k]) + (a3 * xa[k]) - (b1 * yn[k]) - (b2 * ya[k]);
+    out[offset] += yc;
+  }
+}
 
-        xa[k] = xn[k];
-        xn[k] = xc[k];
-        ya[k] = yn[k];
-        yn[k] = yc[k];
+// filters LANES columns at once, as LANES / 4 vectors which are vstride floats apart.
+static inline void blur_columns_sse(const float *const in, float *const out, const size_t stride,
+                                    const size_t vstride, const int height, const int phase, const int ch,
+                                    const float *const min, const float *const max, const float *const c)
+{
+  const __m128 a0 = _mm_set1_ps(c[0]);
+  const __m128 a1 = _mm_set1_ps(c[1]);
+  const __m128 a2 = _mm_set1_ps(c[2]);
+  const __m128 a3 = _mm_set1_ps(c[3]);
+  const __m128 b1 = _mm_set1_ps(c[4]);
+  const __m128 b2 = _mm_set1_ps(c[5]);
+  const __m128 coefp = _mm_set1_ps(c[6]);
+  const __m128 coefn = _mm_set1_ps(c[7]);
+
+  // clamping bounds of every lane, depending on the channel it holds
+  __m128 mn[LANES / 4], mx[LANES / 4];
+  for(int v = 0; v < LANES / 4; v++)
+  {
+    const int k = phase + 4 * v;
+    mn[v] = _mm_set_ps(min[(k + 3) % ch], min[(k + 2) % ch], min[(k + 1) % ch], min[k % ch]);
+    mx[v] = _mm_set_ps(max[(k + 3) % ch], max[(k + 2) % ch], max[(k + 1) % ch], max[k % ch]);
+  }
 
-        temp[offset + k] += yc[k];
-      }
-    }
+  // forward filter
+  __m128 xp[LANES / 4], yb[LANES / 4], yp[LANES / 4];
+  for(int v = 0; v < LANES / 4; v++)
+  {
+    xp[v] = MMCLAMPPS(_mm_loadu_ps(in + v * vstride), mn[v], mx[v]);
+    yb[v] = _mm_mul_ps(coefp, xp[v]);
+    yp[v] = yb[v];
   }
 
-// horizontal blur line by line
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out, temp, Labmin, Labmax, a0, a1, a2, a3, b1, b2, coefp,      \
-                                              coefn) schedule(static)
-#endif
   for(int j = 0; j < height; j++)
   {
-    float xp[ch];
-    float yb[ch];
-    float yp[ch];
-    float xc[ch];
-    float yc[ch];
-    float xn[ch];
-    float xa[ch];
-    float yn[ch];
-    float ya[ch];
-
-    // forward filter
-    for(int k = 0; k < ch; k++)
+    const size_t offset = j * stride;
+    for(int v = 0; v < LANES / 4; v++)
     {
-      xp[k] = CLAMPF(temp[(size_t)j * width * ch + k], Labmin[k], Labmax[k]);
-      yb[k] = xp[k] * coefp;
-      yp[k] = yb[k];
-      xc[k] = yc[k] = xn[k] = xa[k] = yn[k] = ya[k] = 0.0f;
-    }
+      const __m128 xc = MMCLAMPPS(_mm_loadu_ps(in + offset + v * vstride), mn[v], mx[v]);
+      const __m128 yc = _mm_add_ps(
+          _mm_mul_ps(xc, a0),
+          _mm_sub_ps(_mm_mul_ps(xp[v], a1), _mm_add_ps(_mm_mul_ps(yp[v], b1), _mm_mul_ps(yb[v], b2))));
 
-    for(int i = 0; i < width; i++)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
+      _mm_storeu_ps(out + offset + v * vstride, yc);
 
-      for(int k = 0; k < ch; k++)
-      {
-        xc[k] = CLAMPF(temp[offset + k], Labmin[k], Labmax[k]);
-        yc[k] = (a0 * xc[k]) + (a1 * xp[k]) - (b1 * yp[k]) - (b2 * yb[k]);
-
-        out[offset + k] = yc[k];
-
-        xp[k] = xc[k];
-        yb[k] = yp[k];
-        yp[k] = yc[k];
-      }
+      xp[v] = xc;
+      yb[v] = yp[v];
+      yp[v] = yc;
     }
+  }
 
-    // backward filter
-    for(int k = 0; k < ch; k++)
-    {
-      xn[k] = CLAMPF(temp[((size_t)(j + 1) * width - 1) * ch + k], Labmin[k], Labmax[k]);
-      xa[k] = xn[k];
-      yn[k] = xn[k] * coefn;
-      ya[k] = yn[k];
-    }
+  // backward filter
+  __m128 xn[LANES / 4], xa[LANES / 4], yn[LANES / 4], ya[LANES / 4];
+  for(int v = 0; v < LANES / 4; v++)
+  {
+    xn[v] = MMCLAMPPS(_mm_loadu_ps(in + (size_t)(height - 1) * stride + v * vstride), mn[v], mx[v]);
+    xa[v] = xn[v];
+    yn[v] = _mm_mul_ps(coefn, xn[v]);
+    ya[v] = yn[v];
+  }
 
-    for(int i = width - 1; i > -1; i--)
+  for(int j = height - 1; j > -1; j--)
+  {
+    const size_t offset = j * stride;
+    for(int v = 0; v < LANES / 4; v++)
     {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      for(int k = 0; k < ch; k++)
-      {
-        xc[k] = CLAMPF(temp[offset + k], Labmin[k], Labmax[k]);
-
-        yc[k] = (a2 * xn[k]) + (a3 * xa[k]) - (b1 * yn[k]) - (b2 * ya[k]);
+      const __m128 xc = MMCLAMPPS(_mm_loadu_ps(in + offset + v * vstride), mn[v], mx[v]);
+      const __m128 yc = _mm_add_ps(
+          _mm_mul_ps(xn[v], a2),
+          _mm_sub_ps(_mm_mul_ps(xa[v], a3), _mm_add_ps(_mm_mul_ps(yn[v], b1), _mm_mul_ps(ya[v], b2))));
 
-        xa[k] = xn[k];
-        xn[k] = xc[k];
-        ya[k] = yn[k];
-        yn[k] = yc[k];
+      xa[v] = xn[v];
+      xn[v] = xc;
+      ya[v] = yn[v];
+      yn[v] = yc;
 
-        out[offset + k] += yc[k];
-      }
+      _mm_storeu_ps(out + offset + v * vstride, _mm_add_ps(_mm_loadu_ps(out + offset + v * vstride), yc));
     }
   }
 }
 
-
-
-void dt_gaussian_blur_4c(dt_gaussian_t *g, float *in, float *out)
+// filters `lanes` adjacent columns. the channel of column l is (phase + l) % ch.
+static void blur_columns(const float *const in, float *const out, const size_t stride, const int height,
+                         const int lanes, const int phase, const int ch, const float *const min,
+                         const float *const max, const float *const c)
 {
+  int l = 0;
+  for(; l + LANES <= lanes; l += LANES)
+    blur_columns_sse(in + l, out + l, stride, 4, height, (phase + l) % ch, ch, min, max, c);
+  for(; l < lanes; l++)
+    blur_column(in + l, out + l, stride, height, min[(phase + l) % ch], max[(phase + l) % ch], c);
+}
 
+static void blur(const dt_gaussian_t *const g, const float *const in, float *const out)
+{
   const int width = g->width;
   const int height = g->height;
-  const int ch = 4;
-
-  assert(g->channels == 4);
-
-  float a0, a1, a2, a3, b1, b2, coefp, coefn;
-
-  compute_gauss_params(g->sigma, g->order, &a0, &a1, &a2, &a3, &b1, &b2, &coefp, &coefn);
-
-  const __m128 Labmax = _mm_set_ps(g->max[3], g->max[2], g->max[1], g->max[0]);
-  const __m128 Labmin = _mm_set_ps(g->min[3], g->min[2], g->min[1], g->min[0]);
+  const int ch = g->channels;
+  const float *const Labmax = g->max;
+  const float *const Labmin = g->min;
 
-  float *temp = g->buf;
+  float c[8];
+  compute_gauss_params(g->sigma, g->order, c, c + 1, c + 2, c + 3, c + 4, c + 5, c + 6, c + 7);
 
+  float *const temp = g->buf;
+  const size_t row = (size_t)width * ch;
 
-// vertical blur column by column
+// vertical blur, LANES columns of floats at a time
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(in, out, temp, a0, a1, a2, a3, b1, b2, coefp,                  \
-                                              coefn) schedule(static)
+#pragma omp parallel for schedule(static)
 #endif
-  for(int i = 0; i < width; i++)
-  {
-    __m128 xp = _mm_setzero_ps();
-    __m128 yb = _mm_setzero_ps();
-    __m128 yp = _mm_setzero_ps();
-    __m128 xc = _mm_setzero_ps();
-    __m128 yc = _mm_setzero_ps();
-    __m128 xn = _mm_setzero_ps();
-    __m128 xa = _mm_setzero_ps();
-    __m128 yn = _mm_setzero_ps();
-    __m128 ya = _mm_setzero_ps();
-
-    // forward filter
-    xp = MMCLAMPPS(_mm_load_ps(in + i * ch), Labmin, Labmax);
-    yb = _mm_mul_ps(_mm_set_ps1(coefp), xp);
-    yp = yb;
-
+  for(size_t l = 0; l < row; l += LANES)
+    blur_columns(in + l, temp + l, row, height, MIN(LANES, row - l), l % ch, ch, Labmin, Labmax, c);
 
-    for(int j = 0; j < height; j++)
+  if(ch == 4)
+  {
+    // horizontal blur, the pixels are vectors already. so LANES / 4 rows can be filtered at once without
+    // transposing them first.
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for(int j = 0; j < height; j += LANES / 4)
     {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(in + offset), Labmin, Labmax);
-
-
-      yc = _mm_add_ps(
-          _mm_mul_ps(xc, _mm_set_ps1(a0)),
-          _mm_sub_ps(_mm_mul_ps(xp, _mm_set_ps1(a1)),
-                     _mm_add_ps(_mm_mul_ps(yp, _mm_set_ps1(b1)), _mm_mul_ps(yb, _mm_set_ps1(b2)))));
-
-      _mm_store_ps(temp + offset, yc);
-
-      xp = xc;
-      yb = yp;
-      yp = yc;
+      if(j + LANES / 4 <= height)
+        blur_columns_sse(temp + j * row, out + j * row, ch, row, width, 0, ch, Labmin, Labmax, c);
+      else
+        for(int r = j; r < height; r++)
+          blur_columns(temp + r * row, out + r * row, ch, width, ch, 0, ch, Labmin, Labmax, c);
     }
+    return;
+  }
 
-    // backward filter
-    xn = MMCLAMPPS(_mm_load_ps(in + ((size_t)(height - 1) * width + i) * ch), Labmin, Labmax);
-    xa = xn;
-    yn = _mm_mul_ps(_mm_set_ps1(coefn), xn);
-    ya = yn;
-
-    for(int j = height - 1; j > -1; j--)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(in + offset), Labmin, Labmax);
-
-      yc = _mm_add_ps(
-          _mm_mul_ps(xn, _mm_set_ps1(a2)),
-          _mm_sub_ps(_mm_mul_ps(xa, _mm_set_ps1(a3)),
-                     _mm_add_ps(_mm_mul_ps(yn, _mm_set_ps1(b1)), _mm_mul_ps(ya, _mm_set_ps1(b2)))));
-
-
-      xa = xn;
-      xn = xc;
-      ya = yn;
-      yn = yc;
+  // horizontal blur, bands of rows are transposed into a scratch buffer per thread so that every pixel of the
+  // band becomes one row of columns
+  const int rows = MAX(1, LANES / ch);
+  const int lanes = rows * ch;
+  const int nthreads = dt_get_num_threads();
+  float *const scratch = dt_alloc_align(64, sizeof(float) * 2 * lanes * width * nthreads);
 
-      _mm_store_ps(temp + offset, _mm_add_ps(_mm_load_ps(temp + offset), yc));
-    }
+  if(!scratch)
+  {
+    // filter each row as it is, pixel by pixel
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for(int j = 0; j < height; j++)
+      blur_columns(temp + j * row, out + j * row, ch, width, ch, 0, ch, Labmin, Labmax, c);
+    return;
   }
 
-// horizontal blur line by line
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out, temp, a0, a1, a2, a3, b1, b2, coefp,                      \
-                                              coefn) schedule(static)
+#pragma omp parallel for schedule(static)
 #endif
-  for(size_t j = 0; j < height; j++)
+  for(int j = 0; j < height; j += rows)
   {
-    __m128 xp = _mm_setzero_ps();
-    __m128 yb = _mm_setzero_ps();
-    __m128 yp = _mm_setzero_ps();
-    __m128 xc = _mm_setzero_ps();
-    __m128 yc = _mm_setzero_ps();
-    __m128 xn = _mm_setzero_ps();
-    __m128 xa = _mm_setzero_ps();
-    __m128 yn = _mm_setzero_ps();
-    __m128 ya = _mm_setzero_ps();
-
-    // forward filter
-    xp = MMCLAMPPS(_mm_load_ps(temp + j * width * ch), Labmin, Labmax);
-    yb = _mm_mul_ps(_mm_set_ps1(coefp), xp);
-    yp = yb;
-
+    float *const tin = scratch + (size_t)2 * lanes * width * dt_get_thread_num();
+    float *const tout = tin + (size_t)lanes * width;
+    const int band = MIN(rows, height - j);
 
     for(int i = 0; i < width; i++)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(temp + offset), Labmin, Labmax);
-
-      yc = _mm_add_ps(
-          _mm_mul_ps(xc, _mm_set_ps1(a0)),
-          _mm_sub_ps(_mm_mul_ps(xp, _mm_set_ps1(a1)),
-                     _mm_add_ps(_mm_mul_ps(yp, _mm_set_ps1(b1)), _mm_mul_ps(yb, _mm_set_ps1(b2)))));
-
-      _mm_store_ps(out + offset, yc);
-
-      xp = xc;
-      yb = yp;
-      yp = yc;
-    }
-
-    // backward filter
-    xn = MMCLAMPPS(_mm_load_ps(temp + ((size_t)(j + 1) * width - 1) * ch), Labmin, Labmax);
-    xa = xn;
-    yn = _mm_mul_ps(_mm_set_ps1(coefn), xn);
-    ya = yn;
+      for(int r = 0; r < band; r++)
+        memcpy(tin + (size_t)i * lanes + r * ch, temp + (j + r) * row + i * ch, sizeof(float) * ch);
 
+    blur_columns(tin, tout, lanes, width, band * ch, 0, ch, Labmin, Labmax, c);
 
-    for(int i = width - 1; i > -1; i--)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(temp + offset), Labmin, Labmax);
+    for(int i = 0; i < width; i++)
+      for(int r = 0; r < band; r++)
+        memcpy(out + (j + r) * row + i * ch, tout + (size_t)i * lanes + r * ch, sizeof(float) * ch);
+  }
 
-      yc = _mm_add_ps(
-          _mm_mul_ps(xn, _mm_set_ps1(a2)),
-          _mm_sub_ps(_mm_mul_ps(xa, _mm_set_ps1(a3)),
-                     _mm_add_ps(_mm_mul_ps(yn, _mm_set_ps1(b1)), _mm_mul_ps(ya, _mm_set_ps1(b2)))));
+  dt_free_align(scratch);
+}
 
+void dt_gaussian_blur(dt_gaussian_t *g, float *in, float *out)
+{
+  blur(g, in, out);
+}
 
-      xa = xn;
-      xn = xc;
-      ya = yn;
-      yn = yc;
+void dt_gaussian_blur_4c(dt_gaussian_t *g, float *in, float *out)
+{
+  assert(g->channels == 4);
 
-      _mm_store_ps(out + offset, _mm_add_ps(_mm_load_ps(out + offset), yc));
-    }
-  }
+  blur(g, in, out);
 }
 
 
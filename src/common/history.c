@@ -20,6 +20,8 @@
 #include "common/darktable.h"
 #include "develop/develop.h"
 #include "control/control.h"
+#include "control/conf.h"
+#include "control/jobs/control_jobs.h"
 #include "common/debug.h"
 #include "common/exif.h"
 #include "common/history.h"
@@ -204,40 +206,22 @@ int dt_history_load_and_apply_on_selection(gchar *filename)
   return res;
 }
 
-int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboolean merge, GList *ops)
+/** the statements pasting one history stack, prepared once for a whole batch of images */
+typedef struct _history_paste_t
 {
-  sqlite3_stmt *stmt;
-  if(imgid == dest_imgid) return 1;
-
-  if(imgid == -1)
-  {
-    dt_control_log(_("you need to copy history from an image before you paste it onto another"));
-    return 1;
-  }
-
-  // be sure the current history is written before pasting some other history data
-  const dt_view_t *cv = dt_view_manager_get_current_view(darktable.view_manager);
-  if(cv->view((dt_view_t *)cv) == DT_VIEW_DARKROOM) dt_dev_write_history(darktable.develop);
-
-  /* if merge onto history stack, lets find history offest in destination image */
-  int32_t offs = 0;
-  if(merge)
-  {
-    /* apply on top of history stack */
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "SELECT MAX(num)+1 FROM history WHERE imgid = ?1", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
-    if(sqlite3_step(stmt) == SQLITE_ROW) offs = sqlite3_column_int(stmt, 0);
-  }
-  else
-  {
-    /* replace history stack */
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "delete from history where imgid = ?1", -1,
-                                &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
-    sqlite3_step(stmt);
-  }
-  sqlite3_finalize(stmt);
+  sqlite3_stmt *max_num;
+  sqlite3_stmt *delete_history;
+  sqlite3_stmt *insert_history;
+  sqlite3_stmt *delete_mask;
+  sqlite3_stmt *insert_mask;
+} _history_paste_t;
+
+static void _history_paste_prepare(_history_paste_t *p, GList *ops)
+{
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT MAX(num)+1 FROM history WHERE imgid = ?1", -1, &p->max_num, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "delete from history where imgid = ?1", -1,
+                              &p->delete_history, NULL);
 
   //  prepare SQL request
   char req[2048];
@@ -267,14 +251,58 @@ int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboole
     }
     g_strlcat(req, ")", sizeof(req));
   }
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), req, -1, &p->insert_history, NULL);
 
-  /* add the history items to stack offest */
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), req, -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, offs);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, imgid);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "delete from mask where imgid = ?1", -1,
+                              &p->delete_mask, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "insert into mask (imgid, formid, form, name, version, points, points_count, "
+                              "source) select ?1, formid, form, name, version, points, points_count, source "
+                              "from mask where imgid = ?2",
+                              -1, &p->insert_mask, NULL);
+}
+
+static void _history_paste_finalize(_history_paste_t *p)
+{
+  sqlite3_finalize(p->max_num);
+  sqlite3_finalize(p->delete_history);
+  sqlite3_finalize(p->insert_history);
+  sqlite3_finalize(p->delete_mask);
+  sqlite3_finalize(p->insert_mask);
+}
+
+static void _history_paste_step(sqlite3_stmt *stmt)
+{
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+}
+
+/** database part of the paste: history and masks only, no xmp, mipmaps or develop. */
+static void _history_paste(_history_paste_t *p, int32_t imgid, int32_t dest_imgid, gboolean merge, GList *ops)
+{
+  /* if merge onto history stack, lets find history offest in destination image */
+  int32_t offs = 0;
+  if(merge)
+  {
+    /* apply on top of history stack */
+    DT_DEBUG_SQLITE3_BIND_INT(p->max_num, 1, dest_imgid);
+    if(sqlite3_step(p->max_num) == SQLITE_ROW) offs = sqlite3_column_int(p->max_num, 0);
+    sqlite3_reset(p->max_num);
+    sqlite3_clear_bindings(p->max_num);
+  }
+  else
+  {
+    /* replace history stack */
+    DT_DEBUG_SQLITE3_BIND_INT(p->delete_history, 1, dest_imgid);
+    _history_paste_step(p->delete_history);
+  }
+
+  /* add the history items to stack offest */
+  DT_DEBUG_SQLITE3_BIND_INT(p->insert_history, 1, dest_imgid);
+  DT_DEBUG_SQLITE3_BIND_INT(p->insert_history, 2, offs);
+  DT_DEBUG_SQLITE3_BIND_INT(p->insert_history, 3, imgid);
+  _history_paste_step(p->insert_history);
 
   if(merge && ops) _dt_history_cleanup_multi_instance(dest_imgid, offs);
 
@@ -289,29 +317,51 @@ int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboole
   else
   {
     // let's remove all existing shapes
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "delete from mask where imgid = ?1", -1, &stmt,
-                                NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    DT_DEBUG_SQLITE3_BIND_INT(p->delete_mask, 1, dest_imgid);
+    _history_paste_step(p->delete_mask);
   }
 
   // let's copy now
-  g_strlcpy(req, "insert into mask (imgid, formid, form, name, version, points, points_count, source) select "
-                 "?1, formid, form, name, version, points, points_count, source from mask where imgid = ?2",
-            sizeof(req));
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), req, -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  DT_DEBUG_SQLITE3_BIND_INT(p->insert_mask, 1, dest_imgid);
+  DT_DEBUG_SQLITE3_BIND_INT(p->insert_mask, 2, imgid);
+  _history_paste_step(p->insert_mask);
+}
 
+static int _history_paste_check(int32_t imgid)
+{
+  if(imgid == -1)
+  {
+    dt_control_log(_("you need to copy history from an image before you paste it onto another"));
+    return 1;
+  }
+
+  // be sure the current history is written before pasting some other history data
+  const dt_view_t *cv = dt_view_manager_get_current_view(darktable.view_manager);
+  if(cv->view((dt_view_t *)cv) == DT_VIEW_DARKROOM) dt_dev_write_history(darktable.develop);
+  return 0;
+}
+
+static void _history_reload_if_current(int32_t dest_imgid)
+{
   /* if current image in develop reload history */
   if(dt_dev_is_current_image(darktable.develop, dest_imgid))
   {
     dt_dev_reload_history_items(darktable.develop);
     dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
   }
+}
+
+int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboolean merge, GList *ops)
+{
+  if(imgid == dest_imgid) return 1;
+  if(_history_paste_check(imgid)) return 1;
+
+  _history_paste_t p;
+  _history_paste_prepare(&p, ops);
+  _history_paste(&p, imgid, dest_imgid, merge, ops);
+  _history_paste_finalize(&p);
+
+  _history_reload_if_current(dest_imgid);
 
   /* update xmp file */
   dt_image_synch_xmp(dest_imgid);
@@ -405,28 +455,40 @@ int dt_history_copy_and_paste_on_selection(int32_t imgid, gboolean merge, GList
 {
   if(imgid < 0) return 1;
 
-  int res = 0;
+  GList *dest = NULL;
   sqlite3_stmt *stmt;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "select * from selected_images where imgid != ?1", -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    dest = g_list_prepend(dest, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+
+  if(!dest) return 1;
+  dest = g_list_reverse(dest);
+
+  if(!_history_paste_check(imgid))
   {
-    do
+    /* paste history stack onto all selected images, with the statements prepared only once. no transaction
+     * around it, the db connection is shared with the jobs. */
+    _history_paste_t p;
+    _history_paste_prepare(&p, ops);
+    for(GList *d = dest; d; d = g_list_next(d))
+      _history_paste(&p, imgid, GPOINTER_TO_INT(d->data), merge, ops);
+    _history_paste_finalize(&p);
+
+    for(GList *d = dest; d; d = g_list_next(d))
     {
-      /* get imgid of selected image */
-      int32_t dest_imgid = sqlite3_column_int(stmt, 0);
-
-      /* paste history stack onto image id */
-      dt_history_copy_and_paste_on_image(imgid, dest_imgid, merge, ops);
+      _history_reload_if_current(GPOINTER_TO_INT(d->data));
+      dt_mipmap_cache_remove(darktable.mipmap_cache, GPOINTER_TO_INT(d->data));
+    }
 
-    } while(sqlite3_step(stmt) == SQLITE_ROW);
+    /* the xmp files are written in the background */
+    if(dt_conf_get_bool("write_sidecar_files")) dt_control_write_sidecar_files_list(dest);
   }
-  else
-    res = 1;
 
-  sqlite3_finalize(stmt);
-  return res;
+  g_list_free(dest);
+  return 0;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -41,6 +41,7 @@
 #include "common/imageio_rawspeed.h"
 #include "common/image_compression.h"
 #include "common/mipmap_cache.h"
+#include "common/pixel_convert.h"
 #include "common/styles.h"
 #include "control/control.h"
 #include "control/conf.h"
@@ -727,43 +728,24 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
                 NULL);
 
   // downconversion to low-precision formats:
+  const dt_pixel_convert_flags_t dither = dt_conf_get_bool("plugins/lighttable/export/dither_8bit")
+                                              ? DT_PIXEL_CONVERT_DITHER
+                                              : DT_PIXEL_CONVERT_NONE;
   if(bpp == 8)
   {
     if(display_byteorder)
     {
       if(high_quality_processing)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
-          const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
-          const uint8_t b = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
-          outbuf[4 * k + 0] = r;
-          outbuf[4 * k + 1] = g;
-          outbuf[4 * k + 2] = b;
-        }
-      }
+        dt_pixel_convert_float_to_u8((const float *)outbuf, outbuf, processed_width, processed_height,
+                                     DT_PIXEL_CONVERT_SWAP_RB | dither);
       // else processing output was 8-bit already, and no need to swap order
     }
     else // need to flip
     {
       // ldr output: char
       if(high_quality_processing)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff);
-          const uint8_t g = CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff);
-          const uint8_t b = CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff);
-          outbuf[4 * k + 0] = r;
-          outbuf[4 * k + 1] = g;
-          outbuf[4 * k + 2] = b;
-        }
-      }
+        dt_pixel_convert_float_to_u8((const float *)outbuf, outbuf, processed_width, processed_height,
+                                     dither);
       else
       { // !display_byteorder, need to swap:
         uint8_t *const buf8 = pipe.backbuf;
@@ -783,15 +765,8 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
   else if(bpp == 16)
   {
     // uint16_t per color channel
-    float *buff = (float *)outbuf;
-    uint16_t *buf16 = (uint16_t *)outbuf;
-    for(int y = 0; y < processed_height; y++)
-      for(int x = 0; x < processed_width; x++)
-      {
-        // convert in place
-        const size_t k = (size_t)processed_width * y + x;
-        for(int i = 0; i < 3; i++) buf16[4 * k + i] = CLAMP(buff[4 * k + i] * 0x10000, 0, 0xffff);
-      }
+    dt_pixel_convert_float_to_u16((const float *)outbuf, (uint16_t *)outbuf, processed_width,
+                                  processed_height, DT_PIXEL_CONVERT_NONE);
   }
   // else output float, no further harm done to the pixels :)
 
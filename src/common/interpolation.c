@@ -912,26 +912,27 @@ void dt_interpolation_compute_pixel4c(const struct dt_interpolation *itor, const
  * Interpolation factory
  * ------------------------------------------------------------------------*/
 
+/** index of the named interpolator in dt_interpolator[], -1 if there is none */
+static int _interpolator_index(const char *name)
+{
+  for(int i = DT_INTERPOLATION_FIRST; i < DT_INTERPOLATION_LAST; i++)
+    if(!strcmp(name, dt_interpolator[i].name)) return i;
+  return -1;
+}
+
 const struct dt_interpolation *dt_interpolation_new(enum dt_interpolation_type type)
 {
+  static dt_conf_handle_t uipref
+      = DT_CONF_HANDLE_PARSED("plugins/lighttable/export/pixel_interpolator", _interpolator_index);
   const struct dt_interpolation *itor = NULL;
 
   if(type == DT_INTERPOLATION_USERPREF)
   {
     // Find user preferred interpolation method
-    gchar *uipref = dt_conf_get_string("plugins/lighttable/export/pixel_interpolator");
-    for(int i = DT_INTERPOLATION_FIRST; uipref && i < DT_INTERPOLATION_LAST; i++)
-    {
-      if(!strcmp(uipref, dt_interpolator[i].name))
-      {
-        // Found the one
-        itor = &dt_interpolator[i];
-        break;
-      }
-    }
-    g_free(uipref);
+    const int i = dt_conf_handle_get_parsed(&uipref);
+    if(i >= 0) itor = &dt_interpolator[i];
 
-    /* In the case the search failed (!uipref or name not found),
+    /* In the case the search failed (name not found),
      * prepare later search pass with default fallback */
     type = DT_INTERPOLATION_DEFAULT;
   }
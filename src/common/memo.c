@@ -0,0 +1,154 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "common/memo.h"
+#include "common/darktable.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// number of tables kept around, they are all small
+#define DT_MEMO_ENTRIES 64
+
+typedef struct dt_memo_item_t
+{
+  char *ns;
+  void *key;
+  size_t key_size;
+  void *value;
+} dt_memo_item_t;
+
+static void _memo_allocate(void *data, dt_cache_entry_t *entry)
+{
+  // filled in by dt_memo_get() which holds the write lock on fresh entries
+  entry->data = NULL;
+  entry->cost = 1;
+}
+
+static void _memo_deallocate(void *data, dt_cache_entry_t *entry)
+{
+  dt_memo_item_t *item = (dt_memo_item_t *)entry->data;
+  if(!item) return;
+  free(item->value);
+  free(item->key);
+  g_free(item->ns);
+  free(item);
+  entry->data = NULL;
+}
+
+void dt_memo_init(dt_memo_t *memo)
+{
+  dt_cache_init(&memo->cache, 0, DT_MEMO_ENTRIES);
+  dt_cache_set_allocate_callback(&memo->cache, _memo_allocate, memo);
+  dt_cache_set_cleanup_callback(&memo->cache, _memo_deallocate, memo);
+}
+
+void dt_memo_cleanup(dt_memo_t *memo)
+{
+  dt_cache_cleanup(&memo->cache);
+}
+
+static uint32_t _memo_hash(const char *ns, const void *key, const size_t key_size)
+{
+  // fnv-1a over the namespace and the key bytes
+  uint32_t hash = 2166136261u;
+  for(const char *c = ns; *c; c++) hash = (hash ^ (uint8_t)*c) * 16777619u;
+  const uint8_t *k = (const uint8_t *)key;
+  for(size_t i = 0; i < key_size; i++) hash = (hash ^ k[i]) * 16777619u;
+  return hash;
+}
+
+static int _memo_matches(const dt_memo_item_t *item, const char *ns, const void *key, const size_t key_size)
+{
+  return item && item->key_size == key_size && !strcmp(item->ns, ns) && !memcmp(item->key, key, key_size);
+}
+
+static dt_memo_item_t *_memo_item_new(const char *ns, const void *key, const size_t key_size, void *value)
+{
+  dt_memo_item_t *item = (dt_memo_item_t *)malloc(sizeof(dt_memo_item_t));
+  item->ns = g_strdup(ns);
+  item->key = malloc(key_size);
+  memcpy(item->key, key, key_size);
+  item->key_size = key_size;
+  item->value = value;
+  return item;
+}
+
+const void *dt_memo_get(dt_memo_t *memo, const char *ns, const void *key, const size_t key_size,
+                        dt_memo_compute_t compute, void *user_data, dt_cache_entry_t **entry)
+{
+  const uint32_t hash = _memo_hash(ns, key, key_size);
+  while(1)
+  {
+    // existing entries come back read locked, fresh ones write locked with data == NULL
+    dt_cache_entry_t *e = dt_cache_get(&memo->cache, hash, 'r');
+    dt_memo_item_t *item = (dt_memo_item_t *)e->data;
+
+    if(_memo_matches(item, ns, key, key_size))
+    {
+      *entry = e;
+      return item->value;
+    }
+
+    if(item)
+    {
+      // some other key with the same hash. it may well be held, even by our caller, so don't try
+      // to evict it: hand out a private entry which isn't in the cache and dies on release.
+      dt_cache_release(&memo->cache, e);
+      void *value = compute(key, user_data);
+      if(!value)
+      {
+        *entry = NULL;
+        return NULL;
+      }
+      dt_cache_entry_t *loose = (dt_cache_entry_t *)calloc(1, sizeof(dt_cache_entry_t));
+      loose->key = hash;
+      loose->data = _memo_item_new(ns, key, key_size, value);
+      *entry = loose;
+      return value;
+    }
+
+    void *value = compute(key, user_data);
+    if(!value)
+    {
+      dt_cache_release(&memo->cache, e);
+      dt_cache_remove(&memo->cache, hash);
+      *entry = NULL;
+      return NULL;
+    }
+    e->data = _memo_item_new(ns, key, key_size, value);
+    // drop the write lock and come back for a read lock, so others can share the table
+    dt_cache_release(&memo->cache, e);
+  }
+}
+
+void dt_memo_release(dt_memo_t *memo, dt_cache_entry_t *entry)
+{
+  if(!entry) return;
+  if(!entry->link)
+  {
+    // private entry from a hash collision, never made it into the cache
+    _memo_deallocate(memo, entry);
+    free(entry);
+    return;
+  }
+  dt_cache_release(&memo->cache, entry);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
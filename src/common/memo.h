@@ -0,0 +1,53 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_COMMON_MEMO_H
+#define DT_COMMON_MEMO_H
+
+#include "common/cache.h"
+
+/**
+ * process wide memoization of tables which modules precompute from a handful of parameters
+ * (a radius, the iso and camera, ..). entries are looked up by a namespace and the raw bytes
+ * of a key struct, so make sure to zero the padding of it. the values are kept in a small
+ * lru cache, entries in use are never evicted. a key whose hash collides with another cached key is
+ * computed again on every call and not cached.
+ */
+typedef struct dt_memo_t
+{
+  dt_cache_t cache;
+} dt_memo_t;
+
+/** computes the value for key, to be freed with free(). may return NULL on failure. */
+typedef void *(*dt_memo_compute_t)(const void *key, void *user_data);
+
+void dt_memo_init(dt_memo_t *memo);
+void dt_memo_cleanup(dt_memo_t *memo);
+
+/**
+ * returns the value for (ns, key), calling compute on a miss, or NULL if that failed.
+ * the value stays valid until it is handed back with dt_memo_release(memo, *entry).
+ */
+const void *dt_memo_get(dt_memo_t *memo, const char *ns, const void *key, const size_t key_size,
+                        dt_memo_compute_t compute, void *user_data, dt_cache_entry_t **entry);
+
+void dt_memo_release(dt_memo_t *memo, dt_cache_entry_t *entry);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -24,6 +24,7 @@
 #include "common/imageio_module.h"
 #include "common/imageio_jpeg.h"
 #include "common/mipmap_cache.h"
+#include "common/profiling.h"
 #include "control/conf.h"
 #include "control/jobs.h"
 
@@ -55,6 +56,9 @@ struct dt_mipmap_buffer_dsc
   /* NB: sizeof must be a multiple of 4*sizeof(float) */
 } __attribute__((packed, aligned(16)));
 
+// read for every thumbnail the cache allocates or evicts
+static dt_conf_handle_t _cache_disk_backend = DT_CONF_HANDLE("cache_disk_backend");
+
 // last resort mem alloc for dead images. sizeof(dt_mipmap_buffer_dsc) + dead image pixels (8x8)
 // __m128 type for sse alignment.
 static __m128 dt_mipmap_cache_static_dead_image[sizeof(struct dt_mipmap_buffer_dsc) / sizeof(__m128) + 64];
@@ -244,7 +248,7 @@ void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
   int loaded_from_disk = 0;
   if(mip < DT_MIPMAP_F)
   {
-    if(cache->cachedir[0] && dt_conf_get_bool("cache_disk_backend"))
+    if(cache->cachedir[0] && dt_conf_handle_get_bool(&_cache_disk_backend))
     {
       // try and load from disk, if successful set flag
       char filename[PATH_MAX] = {0};
@@ -316,7 +320,7 @@ void dt_mipmap_cache_deallocate_dynamic(void *data, dt_cache_entry_t *entry)
           g_unlink(filename);
         }
       }
-      else if(cache->cachedir[0] && dt_conf_get_bool("cache_disk_backend"))
+      else if(cache->cachedir[0] && dt_conf_handle_get_bool(&_cache_disk_backend))
       {
         // serialize to disk
         char filename[PATH_MAX] = {0};
@@ -568,11 +572,14 @@ void dt_mipmap_cache_get_with_caller(
   else if(flags == DT_MIPMAP_BLOCKING)
   {
     // simple case: blocking get
+    dt_times_t start = { 0 };
+    if(dt_trace_enabled()) dt_get_times(&start);
     dt_cache_entry_t *entry =  dt_cache_get_with_caller(&_get_cache(cache, mip)->cache, key, mode, file, line);
     struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)entry->data;
     buf->cache_entry = entry;
+    const int generate = dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
 
-    if(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE)
+    if(generate)
     {
       __sync_fetch_and_add(&(_get_cache(cache, mip)->stats_fetches), 1);
       // fprintf(stderr, "[mipmap cache get] now initializing buffer for img %u mip %d!\n", imgid, mip);
@@ -661,6 +668,13 @@ void dt_mipmap_cache_get_with_caller(
       else
         buf->buf = NULL; // full images with NULL buffer have to be handled, indicates `missing image', but still return locked slot
     }
+    if(dt_trace_enabled())
+    {
+      if(generate)
+        dt_trace_span("cache", "mipmap cache miss", &start, "\"image\":%u,\"mip\":%d", imgid, (int)mip);
+      else
+        dt_trace_instant("cache", "mipmap cache hit", "\"image\":%u,\"mip\":%d", imgid, (int)mip);
+    }
   }
   else if(flags == DT_MIPMAP_BEST_EFFORT)
   {
@@ -0,0 +1,134 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/pixel_convert.h"
+#include "common/darktable.h"
+
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+typedef enum _convert_type_t
+{
+  CONVERT_U8 = 1,
+  CONVERT_U16 = 2
+} _convert_type_t;
+
+// 8x8 bayer matrix for ordered dithering
+static const uint8_t _bayer[8][8] = { { 0, 32, 8, 40, 2, 34, 10, 42 },
+                                      { 48, 16, 56, 24, 50, 18, 58, 26 },
+                                      { 12, 44, 4, 36, 14, 46, 6, 38 },
+                                      { 60, 28, 52, 20, 62, 30, 54, 22 },
+                                      { 3, 35, 11, 43, 1, 33, 9, 41 },
+                                      { 51, 19, 59, 27, 49, 17, 57, 25 },
+                                      { 15, 47, 7, 39, 13, 45, 5, 37 },
+                                      { 63, 31, 55, 23, 61, 29, 53, 21 } };
+
+// converts one row. every pixel is loaded before its result is stored, and the result is never larger
+// than the input pixel, so this works in place.
+static inline void _convert_row(const float *in, void *const out, const int width, const int y,
+                                const _convert_type_t type, const dt_pixel_convert_flags_t flags)
+{
+  const int swap = flags & DT_PIXEL_CONVERT_SWAP_RB;
+
+  // offsets in [0,1) of a step of the output, added before truncation
+  float dither[8] = { 0.0f };
+  if(flags & DT_PIXEL_CONVERT_DITHER)
+    for(int k = 0; k < 8; k++) dither[k] = (_bayer[y & 7][k] + 0.5f) / 64.0f;
+
+  const __m128 zero = _mm_setzero_ps();
+  if(type == CONVERT_U8)
+  {
+    const __m128 scale = _mm_set1_ps(0xff);
+    uint8_t *o = (uint8_t *)out;
+    for(int x = 0; x < width; x++, in += 4, o += 4)
+    {
+      __m128 p = _mm_load_ps(in);
+      if(swap) p = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 0, 1, 2));
+      p = _mm_add_ps(_mm_mul_ps(p, scale), _mm_set1_ps(dither[x & 7]));
+      const __m128i i = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(p, zero), scale));
+      const __m128i s = _mm_packs_epi32(i, i);
+      *(uint32_t *)o = _mm_cvtsi128_si32(_mm_packus_epi16(s, s));
+    }
+  }
+  else
+  {
+    const __m128 scale = _mm_set1_ps(0x10000);
+    const __m128 max = _mm_set1_ps(0xffff);
+    // sse2 can only pack with signed saturation, so shift the range for packing
+    const __m128i bias32 = _mm_set1_epi32(0x8000);
+    const __m128i bias16 = _mm_set1_epi16((short)0x8000);
+    uint16_t *o = (uint16_t *)out;
+    for(int x = 0; x < width; x++, in += 4, o += 4)
+    {
+      __m128 p = _mm_load_ps(in);
+      if(swap) p = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 0, 1, 2));
+      p = _mm_add_ps(_mm_mul_ps(p, scale), _mm_set1_ps(dither[x & 7]));
+      const __m128i i = _mm_sub_epi32(_mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(p, zero), max)), bias32);
+      const __m128i s = _mm_xor_si128(_mm_packs_epi32(i, i), bias16);
+      _mm_storel_epi64((__m128i *)o, s);
+    }
+  }
+}
+
+static void _convert(const float *const in, void *const out, const int width, const int height,
+                     const _convert_type_t type, const dt_pixel_convert_flags_t flags)
+{
+  // bytes per output pixel
+  const size_t bpp = 4 * type;
+
+  if((const void *)in != out)
+  {
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+    for(int y = 0; y < height; y++)
+      _convert_row(in + (size_t)4 * width * y, (uint8_t *)out + bpp * width * y, width, y, type, flags);
+    return;
+  }
+
+  // in place: output row y lands on input rows up to y / ratio, which have to be converted already.
+  // the first row converts onto itself, after that every wave of rows [y0, ratio * y0) only overwrites
+  // rows of earlier waves and can run in parallel.
+  const int ratio = 16 / bpp;
+  if(height > 0) _convert_row(in, out, width, 0, type, flags);
+  for(int y0 = 1; y0 < height; y0 *= ratio)
+  {
+    const int y1 = MIN(height, y0 * ratio);
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(y0) schedule(static)
+#endif
+    for(int y = y0; y < y1; y++)
+      _convert_row(in + (size_t)4 * width * y, (uint8_t *)out + bpp * width * y, width, y, type, flags);
+  }
+}
+
+void dt_pixel_convert_float_to_u8(const float *const in, uint8_t *const out, const int width,
+                                  const int height, const dt_pixel_convert_flags_t flags)
+{
+  _convert(in, out, width, height, CONVERT_U8, flags);
+}
+
+void dt_pixel_convert_float_to_u16(const float *const in, uint16_t *const out, const int width,
+                                   const int height, const dt_pixel_convert_flags_t flags)
+{
+  _convert(in, out, width, height, CONVERT_U16, flags);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,49 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DT_COMMON_PIXEL_CONVERT_H
+#define DT_COMMON_PIXEL_CONVERT_H
+
+#include <stdint.h>
+
+typedef enum dt_pixel_convert_flags_t
+{
+  DT_PIXEL_CONVERT_NONE = 0,
+  DT_PIXEL_CONVERT_SWAP_RB = 1 << 0, // swap the first and third channel, for display byte order
+  DT_PIXEL_CONVERT_DITHER = 1 << 1   // ordered dithering of integer output, hides banding in gradients
+} dt_pixel_convert_flags_t;
+
+/**
+ * convert a 4 channel float buffer (16 byte aligned, as it comes out of the pixelpipe) to 4 channels of
+ * 8 or 16 bit integers. values are clamped to the range of the output type, 1.0 maps to 0xff for 8 bits
+ * and to 0x10000 (clamped to 0xffff) for 16 bits, fractions are truncated. float output needs no
+ * conversion, it is written as the pipe left it.
+ *
+ * out may either be the very same buffer as in, then the conversion happens in place and the result is
+ * packed at the start of the buffer, or it may not overlap in at all.
+ */
+void dt_pixel_convert_float_to_u8(const float *const in, uint8_t *const out, const int width,
+                                  const int height, const dt_pixel_convert_flags_t flags);
+void dt_pixel_convert_float_to_u16(const float *const in, uint16_t *const out, const int width,
+                                   const int height, const dt_pixel_convert_flags_t flags);
+
+#endif
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -17,6 +17,8 @@
 */
 
 #include <glib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include "lcms2.h"
 #include "common/printprof.h"
@@ -38,21 +40,49 @@ static cmsUInt32Number ComputeFormatDescriptor (int OutColorSpace, int bps)
   return (FLOAT_SH(IsFlt)|COLORSPACE_SH(OutColorSpace)|PLANAR_SH(IsPlanar)|CHANNELS_SH(Channels)|BYTES_SH(bps));
 }
 
-int dt_apply_printer_profile(int imgid, void **in, uint32_t width, uint32_t height, int bpp,
-                             const char *profile, int intent, gboolean black_point_compensation)
+// creating a transform means parsing both profiles and precomputing the pipeline between them,
+// which takes much longer than applying it to a small print. keep the last few around.
+#define DT_PRINTPROF_CACHE_SIZE 4
+
+typedef struct dt_printprof_transform_t
+{
+  char *in_profile;  // name of the image's output profile
+  char *out_profile; // path of the printer profile
+  time_t mtime;      // of the printer profile, a changed file gets a new transform
+  int bpp, intent;
+  gboolean black_point_compensation;
+  cmsHTRANSFORM transform;
+  int users;         // entries in use can't be evicted
+  uint64_t last_use;
+} dt_printprof_transform_t;
+
+static dt_printprof_transform_t _transforms[DT_PRINTPROF_CACHE_SIZE];
+static uint64_t _transforms_clock = 0;
+#if defined(GLIB_CHECK_VERSION) && GLIB_CHECK_VERSION(2, 32, 0)
+static GMutex _transforms_lock;
+#define _transforms_lock_acquire() g_mutex_lock(&_transforms_lock)
+#define _transforms_lock_release() g_mutex_unlock(&_transforms_lock)
+#else
+static GStaticMutex _transforms_lock = G_STATIC_MUTEX_INIT;
+#define _transforms_lock_acquire() g_static_mutex_lock(&_transforms_lock)
+#define _transforms_lock_release() g_static_mutex_unlock(&_transforms_lock)
+#endif
+
+static cmsHTRANSFORM _create_transform(int imgid, int bpp, const char *profile, int intent,
+                                       gboolean black_point_compensation)
 {
   cmsHPROFILE hInProfile, hOutProfile;
   cmsHTRANSFORM hTransform;
   cmsUInt32Number wInput, wOutput;
   int OutputColorSpace;
 
-  if(!g_file_test(profile, G_FILE_TEST_IS_REGULAR))
-    return 1;
-
-  void *out = (void *)malloc(width*height*3);
-
   hInProfile = dt_colorspaces_create_output_profile(imgid);
   hOutProfile = cmsOpenProfileFromFileTHR(NULL, profile, "r");
+  if(!hOutProfile)
+  {
+    cmsCloseProfile(hInProfile);
+    return NULL;
+  }
 
   wInput = ComputeFormatDescriptor (PT_RGB, (bpp==8?1:2));
 
@@ -68,24 +98,125 @@ int dt_apply_printer_profile(int imgid, void **in, uint32_t width, uint32_t heig
   cmsCloseProfile(hInProfile);
   cmsCloseProfile(hOutProfile);
 
-  if (bpp == 8)
+  return hTransform;
+}
+
+// returns a transform from the cache, or a fresh one which isn't cached if *entry stays NULL
+static cmsHTRANSFORM _get_transform(int imgid, int bpp, const char *profile, int intent,
+                                    gboolean black_point_compensation, dt_printprof_transform_t **entry)
+{
+  *entry = NULL;
+
+  struct stat st;
+  if(stat(profile, &st)) return NULL;
+
+  // the x display profile can change under our feet, don't keep transforms from it
+  char *in_profile = dt_colorspaces_get_output_profile_name(imgid);
+  if(!strcmp(in_profile, "X profile"))
+  {
+    g_free(in_profile);
+    return _create_transform(imgid, bpp, profile, intent, black_point_compensation);
+  }
+
+  _transforms_lock_acquire();
+  dt_printprof_transform_t *victim = NULL;
+  for(int k = 0; k < DT_PRINTPROF_CACHE_SIZE; k++)
+  {
+    dt_printprof_transform_t *t = _transforms + k;
+    if(t->transform && t->bpp == bpp && t->intent == intent
+       && t->black_point_compensation == black_point_compensation && t->mtime == st.st_mtime
+       && !strcmp(t->in_profile, in_profile) && !strcmp(t->out_profile, profile))
+    {
+      t->users++;
+      t->last_use = ++_transforms_clock;
+      _transforms_lock_release();
+      g_free(in_profile);
+      *entry = t;
+      return t->transform;
+    }
+    if(!t->users && (!victim || !t->transform || (victim->transform && t->last_use < victim->last_use)))
+      victim = t;
+  }
+  _transforms_lock_release();
+
+  // don't hold the lock while lcms is busy, somebody else might create the same transform meanwhile
+  cmsHTRANSFORM hTransform = _create_transform(imgid, bpp, profile, intent, black_point_compensation);
+  if(!hTransform || !victim)
   {
-    const uint8_t *ptr_in = (uint8_t *)*in;
-    uint8_t *ptr_out = (uint8_t *)out;
+    g_free(in_profile);
+    return hTransform;
+  }
 
-    for (int k=0; k<height; k++)
-      cmsDoTransform(hTransform, (const void *)&ptr_in[k*width*3], (void *)&ptr_out[k*width*3], width);
+  _transforms_lock_acquire();
+  if(victim->users)
+  {
+    // got taken in the meantime, just don't cache this one
+    _transforms_lock_release();
+    g_free(in_profile);
+    return hTransform;
   }
-  else
+  if(victim->transform) cmsDeleteTransform(victim->transform);
+  g_free(victim->in_profile);
+  g_free(victim->out_profile);
+  victim->in_profile = in_profile;
+  victim->out_profile = g_strdup(profile);
+  victim->mtime = st.st_mtime;
+  victim->bpp = bpp;
+  victim->intent = intent;
+  victim->black_point_compensation = black_point_compensation;
+  victim->transform = hTransform;
+  victim->users = 1;
+  victim->last_use = ++_transforms_clock;
+  _transforms_lock_release();
+
+  *entry = victim;
+  return hTransform;
+}
+
+static void _release_transform(cmsHTRANSFORM hTransform, dt_printprof_transform_t *entry)
+{
+  if(!entry)
   {
-    const uint16_t *ptr_in = (uint16_t *)*in;
-    uint8_t *ptr_out = (uint8_t *)out;
+    cmsDeleteTransform(hTransform);
+    return;
+  }
+  _transforms_lock_acquire();
+  entry->users--;
+  _transforms_lock_release();
+}
+
+int dt_apply_printer_profile(int imgid, void **in, uint32_t width, uint32_t height, int bpp,
+                             const char *profile, int intent, gboolean black_point_compensation)
+{
+  if(!g_file_test(profile, G_FILE_TEST_IS_REGULAR))
+    return 1;
+
+  dt_printprof_transform_t *entry;
+  cmsHTRANSFORM hTransform = _get_transform(imgid, bpp, profile, intent, black_point_compensation, &entry);
+  if(!hTransform)
+    return 1;
 
-    for (int k=0; k<height; k++)
-      cmsDoTransform(hTransform, (const void *)&ptr_in[k*width*3], (void *)&ptr_out[k*width*3], width);
+  void *out = (void *)malloc((size_t)width*height*3);
+  if(!out)
+  {
+    _release_transform(hTransform, entry);
+    return 1;
   }
 
-  cmsDeleteTransform(hTransform);
+  // lcms transforms only read their state while applied (as in colorin and colorout),
+  // so all threads share it, every one working on its own band of rows.
+  const size_t bytes_in = (bpp == 8) ? 1 : 2;
+  const void *const ptr_in = *in;
+  uint8_t *const ptr_out = (uint8_t *)out;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) shared(hTransform, width, height)
+#endif
+  for (int k=0; k<height; k++)
+    cmsDoTransform(hTransform, (const uint8_t *)ptr_in + (size_t)k*width*3*bytes_in,
+                   (void *)&ptr_out[(size_t)k*width*3], width);
+
+  _release_transform(hTransform, entry);
 
   free(*in);
   *in = out;
@@ -18,6 +18,11 @@
 
 #include "common/profiling.h"
 
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#ifdef USE_DARKTABLE_PROFILING
 dt_timer_t *dt_timer_start_with_name(const char *file, const char *function, const char *description)
 {
   dt_timer_t *t = g_malloc(sizeof(dt_timer_t));
@@ -38,6 +43,151 @@ void dt_timer_stop_with_name(dt_timer_t *t)
   g_timer_destroy(t->timer);
   g_free(t);
 }
+#endif
+
+typedef struct dt_trace_t
+{
+  dt_pthread_mutex_t lock;
+  FILE *f;
+  GString *events; // pending events, already formatted
+  int num_written;
+  int pid;
+} dt_trace_t;
+
+static dt_trace_t *_trace = NULL;
+
+// small sequential ids read much nicer in the viewer than pthread_t's.
+static __thread int _trace_tid = 0;
+static int _trace_num_threads = 0;
+
+static int _get_tid()
+{
+  if(!_trace_tid) _trace_tid = __sync_add_and_fetch(&_trace_num_threads, 1);
+  return _trace_tid;
+}
+
+void dt_trace_init(const char *filename)
+{
+  FILE *f = fopen(filename, "wb");
+  if(!f)
+  {
+    fprintf(stderr, "[trace] could not open `%s' for writing\n", filename);
+    return;
+  }
+  dt_trace_t *t = (dt_trace_t *)calloc(1, sizeof(dt_trace_t));
+  dt_pthread_mutex_init(&t->lock, NULL);
+  t->f = f;
+  t->events = g_string_sized_new(1 << 16);
+  t->pid = getpid();
+  // the closing bracket is optional in the array format, so an interrupted session can still be loaded.
+  fputs("[\n", f);
+  _trace = t;
+  fprintf(stderr, "[trace] writing trace events to `%s'\n", filename);
+}
+
+static void _trace_write(dt_trace_t *t)
+{
+  if(t->events->len == 0) return;
+  fwrite(t->events->str, 1, t->events->len, t->f);
+  fflush(t->f);
+  g_string_truncate(t->events, 0);
+}
+
+void dt_trace_flush()
+{
+  dt_trace_t *t = _trace;
+  if(!t) return;
+  dt_pthread_mutex_lock(&t->lock);
+  _trace_write(t);
+  dt_pthread_mutex_unlock(&t->lock);
+}
+
+void dt_trace_cleanup()
+{
+  dt_trace_t *t = _trace;
+  if(!t) return;
+  _trace = NULL;
+  dt_pthread_mutex_lock(&t->lock);
+  _trace_write(t);
+  fputs("\n]\n", t->f);
+  fclose(t->f);
+  dt_pthread_mutex_unlock(&t->lock);
+  dt_pthread_mutex_destroy(&t->lock);
+  g_string_free(t->events, TRUE);
+  free(t);
+}
+
+static void _append_escaped(GString *s, const char *str)
+{
+  for(const char *c = str; *c; c++)
+  {
+    if(*c == '"' || *c == '\\')
+      g_string_append_c(s, '\\');
+    else if((unsigned char)*c < 0x20)
+      continue;
+    g_string_append_c(s, *c);
+  }
+}
+
+static void _append_event(const char *category, const char *name, const char phase, const double ts,
+                          const double dur, const char *members, const char *args, va_list ap)
+{
+  dt_trace_t *t = _trace;
+  if(!t) return;
+
+  // format outside of the lock, events of concurrent pipes don't have to wait for each other that way.
+  GString *e = g_string_sized_new(256);
+  g_string_append(e, "{\"name\":\"");
+  _append_escaped(e, name);
+  g_string_append_printf(e, "\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.0f,", category, phase, ts * 1e6);
+  if(phase == 'X') g_string_append_printf(e, "\"dur\":%.0f,", dur * 1e6);
+  if(phase == 'i') g_string_append(e, "\"s\":\"t\",");
+  g_string_append_printf(e, "\"pid\":%d,\"tid\":%d,\"args\":{", t->pid, _get_tid());
+  if(members) g_string_append(e, members);
+  if(args)
+  {
+    if(members) g_string_append_c(e, ',');
+    g_string_append_vprintf(e, args, ap);
+  }
+  g_string_append(e, "}}");
+
+  dt_pthread_mutex_lock(&t->lock);
+  if(t->num_written++) g_string_append(t->events, ",\n");
+  g_string_append_len(t->events, e->str, e->len);
+  // nobody flushes outside of pipe runs, don't let the lighttable pile up events forever
+  if(t->events->len > (1 << 20)) _trace_write(t);
+  dt_pthread_mutex_unlock(&t->lock);
+  g_string_free(e, TRUE);
+}
+
+void dt_trace_span(const char *category, const char *name, const dt_times_t *start, const char *args, ...)
+{
+  if(!_trace) return;
+  dt_times_t end;
+  dt_get_times(&end);
+  const double wall = end.clock - start->clock;
+  const double cpu = end.user - start->user;
+
+  // cpu time is per process, concurrent pipes will inflate each others' numbers.
+  char members[128];
+  snprintf(members, sizeof(members), "\"cpu_ms\":%.3f,\"thread_utilization\":%.3f", 1e3 * cpu,
+           wall > 0.0 ? cpu / (wall * dt_get_num_threads()) : 0.0);
+
+  va_list ap;
+  va_start(ap, args);
+  _append_event(category, name, 'X', start->clock, wall, members, args, ap);
+  va_end(ap);
+}
+
+void dt_trace_instant(const char *category, const char *name, const char *args, ...)
+{
+  if(!_trace) return;
+  va_list ap;
+  va_start(ap, args);
+  _append_event(category, name, 'i', dt_get_wtime(), 0.0, NULL, args, ap);
+  va_end(ap);
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -20,6 +20,7 @@
 #define __PROFILING_H
 
 #include "gui/gtk.h"
+#include "common/darktable.h"
 
 
 #ifdef USE_DARKTABLE_PROFILING
@@ -52,6 +53,35 @@ dt_timer_t *dt_timer_start_with_name(const char *file, const char *function, con
 void dt_timer_stop_with_name(dt_timer_t *);
 #endif
 
+/*
+ * structured tracing of pixelpipe runs, enabled with -d trace.
+ *
+ * events are written in the chrome trace event format to darktable-trace-<pid>.json in
+ * the tmp directory, load it in chrome://tracing or any compatible viewer. every pipe run
+ * is a span, containing one span per processed module (wall and cpu time, bytes in/out,
+ * device and tiling). pixelpipe and mipmap cache hits are recorded as instant events.
+ *
+ * when tracing is disabled every call site costs one test of darktable.unmuted, so always
+ * guard with dt_trace_enabled() before collecting anything expensive.
+ */
+#define dt_trace_enabled() (darktable.unmuted & DT_DEBUG_TRACE)
+
+/** opens the trace file, called once from dt_init() if tracing was requested. */
+void dt_trace_init(const char *filename);
+/** writes out all pending events and closes the trace file. */
+void dt_trace_cleanup();
+/** appends all pending events to the trace file, called after every pipe run. */
+void dt_trace_flush();
+
+/**
+ * records a span of work from start until now, together with the cpu time spent in the
+ * meantime. args are additional json members ("key":value, comma separated) as printf
+ * format, may be NULL.
+ */
+void dt_trace_span(const char *category, const char *name, const dt_times_t *start, const char *args, ...);
+/** records a single point in time, args as above. */
+void dt_trace_instant(const char *category, const char *name, const char *args, ...);
+
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -24,7 +24,7 @@
 #include "gui/gtk.h"
 
 
-void dt_ratings_apply_to_image(int imgid, int rating)
+static void _ratings_apply_to_image(int imgid, int rating)
 {
   dt_image_t *image = dt_image_cache_get(darktable.image_cache, imgid, 'w');
   // one star is a toggle, so you can easily reject images by removing the last star:
@@ -32,7 +32,12 @@ void dt_ratings_apply_to_image(int imgid, int rating)
   image->flags = (image->flags & ~0x7) | (0x7 & rating);
   // synch through:
   dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_SAFE);
+}
 
+void dt_ratings_apply_to_image(int imgid, int rating)
+{
+  _ratings_apply_to_image(imgid, rating);
+  dt_collection_update_images(darktable.collection, imgid, DT_COLLECTION_CHANGE_RATING);
   dt_collection_hint_message(darktable.collection);
 }
 
@@ -61,10 +66,13 @@ void dt_ratings_apply_to_selection(int rating)
                                 NULL);
     while(sqlite3_step(stmt) == SQLITE_ROW)
     {
-      dt_ratings_apply_to_image(sqlite3_column_int(stmt, 0), rating);
+      _ratings_apply_to_image(sqlite3_column_int(stmt, 0), rating);
     }
     sqlite3_finalize(stmt);
 
+    dt_collection_update_images(darktable.collection, -1, DT_COLLECTION_CHANGE_RATING);
+    dt_collection_hint_message(darktable.collection);
+
     /* redraw view */
     /* dt_control_queue_redraw_center() */
     /* needs to be called in the caller function */
@@ -19,6 +19,8 @@
 #include "common/darktable.h"
 #include "develop/develop.h"
 #include "control/control.h"
+#include "control/conf.h"
+#include "control/jobs/control_jobs.h"
 #include "common/history.h"
 #include "common/imageio.h"
 #include "common/image_cache.h"
@@ -441,28 +443,159 @@ gboolean dt_styles_create_from_image(const char *name, const char *description,
   return FALSE;
 }
 
-void dt_styles_apply_to_selection(const char *name, gboolean duplicate)
+/** the statements applying one style, prepared once for a whole batch of images */
+typedef struct _styles_apply_t
 {
-  gboolean selected = FALSE;
+  sqlite3_stmt *max_num;
+  sqlite3_stmt *insert_history;
+  sqlite3_stmt *attach_tag;
+} _styles_apply_t;
+
+static void _styles_apply_prepare(_styles_apply_t *a, const char *name, int id)
+{
+  sqlite3_stmt *stmt;
+
+  /* delete all items from the temp styles_items, this table is used only to get a ROWNUM of the results */
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.style_items", NULL, NULL, NULL);
+
+  /* copy history items from styles onto temp table */
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "INSERT INTO MEMORY.style_items SELECT * FROM "
+                                                             "style_items WHERE styleid=?1 ORDER BY "
+                                                             "multi_priority DESC;",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+
+  /* merge onto history stack, the offset is looked up per destination image */
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT MAX(num)+1 FROM history WHERE imgid = ?1", -1, &a->max_num, NULL);
+
+  /* copy the style items into the history */
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "INSERT INTO history "
+                              "(imgid,num,module,operation,op_params,enabled,blendop_params,blendop_"
+                              "version,multi_priority,multi_name) SELECT "
+                              "?1,?2+rowid,module,operation,op_params,enabled,blendop_params,blendop_"
+                              "version,multi_priority,multi_name FROM MEMORY.style_items",
+                              -1, &a->insert_history, NULL);
+
+  /* add tag */
+  a->attach_tag = NULL;
+  guint tagid = 0;
+  gchar ntag[512] = { 0 };
+  g_snprintf(ntag, sizeof(ntag), "darktable|style|%s", name);
+  if(dt_tag_new(ntag, &tagid))
+  {
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "INSERT OR REPLACE INTO tagged_images (imgid, tagid) VALUES (?1, ?2)", -1,
+                                &a->attach_tag, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(a->attach_tag, 2, tagid);
+  }
+}
+
+static void _styles_apply_finalize(_styles_apply_t *a)
+{
+  sqlite3_finalize(a->max_num);
+  sqlite3_finalize(a->insert_history);
+  if(a->attach_tag) sqlite3_finalize(a->attach_tag);
+}
 
+/** database part of applying a style, returns the image the style ended up on. */
+static int32_t _styles_apply(_styles_apply_t *a, gboolean duplicate, int32_t imgid)
+{
+  int32_t newimgid;
+
+  /* check if we should make a duplicate before applying style */
+  if(duplicate)
+  {
+    newimgid = dt_image_duplicate(imgid);
+    if(newimgid != -1) dt_history_copy_and_paste_on_image(imgid, newimgid, FALSE, NULL);
+  }
+  else
+    newimgid = imgid;
+
+  /* merge onto history stack, let's find history offest in destination image */
+  int32_t offs = 0;
+  DT_DEBUG_SQLITE3_BIND_INT(a->max_num, 1, newimgid);
+  if(sqlite3_step(a->max_num) == SQLITE_ROW) offs = sqlite3_column_int(a->max_num, 0);
+  sqlite3_reset(a->max_num);
+
+  DT_DEBUG_SQLITE3_BIND_INT(a->insert_history, 1, newimgid);
+  DT_DEBUG_SQLITE3_BIND_INT(a->insert_history, 2, offs);
+  sqlite3_step(a->insert_history);
+  sqlite3_reset(a->insert_history);
+
+  if(a->attach_tag && newimgid > 0)
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(a->attach_tag, 1, newimgid);
+    sqlite3_step(a->attach_tag);
+    sqlite3_reset(a->attach_tag);
+  }
+
+  return newimgid;
+}
+
+/** the parts of applying a style outside the database, but for the xmp file. */
+static void _styles_applied(int32_t imgid)
+{
+  /* if current image in develop reload history */
+  if(dt_dev_is_current_image(darktable.develop, imgid))
+  {
+    dt_dev_reload_history_items(darktable.develop);
+    dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
+  }
+
+  /* remove old obsolete thumbnails */
+  dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+}
+
+void dt_styles_apply_to_selection(const char *name, gboolean duplicate)
+{
   /* write current history changes so nothing gets lost, do that only in the darkroom as there is nothing to
      be
      save when in the lighttable (and it would write over current history stack) */
   const dt_view_t *cv = dt_view_manager_get_current_view(darktable.view_manager);
   if(cv->view((dt_view_t *)cv) == DT_VIEW_DARKROOM) dt_dev_write_history(darktable.develop);
 
-  /* for each selected image apply style */
+  GList *imgs = NULL;
   sqlite3_stmt *stmt;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select * from selected_images", -1, &stmt, NULL);
   while(sqlite3_step(stmt) == SQLITE_ROW)
+    imgs = g_list_prepend(imgs, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+
+  if(!imgs)
   {
-    int imgid = sqlite3_column_int(stmt, 0);
-    dt_styles_apply_to_image(name, duplicate, imgid);
-    selected = TRUE;
+    dt_control_log(_("no image selected!"));
+    return;
   }
-  sqlite3_finalize(stmt);
+  imgs = g_list_reverse(imgs);
 
-  if(!selected) dt_control_log(_("no image selected!"));
+  const int id = dt_styles_get_id_by_name(name);
+  if(id != 0)
+  {
+    /* for each selected image apply style, with the statements prepared only once. no transaction around it,
+     * the db connection is shared with the jobs. */
+    _styles_apply_t a;
+    _styles_apply_prepare(&a, name, id);
+    for(GList *i = imgs; i; i = g_list_next(i))
+      i->data = GINT_TO_POINTER(_styles_apply(&a, duplicate, GPOINTER_TO_INT(i->data)));
+    _styles_apply_finalize(&a);
+
+    for(GList *i = imgs; i; i = g_list_next(i)) _styles_applied(GPOINTER_TO_INT(i->data));
+
+    /* the xmp files are written in the background */
+    if(dt_conf_get_bool("write_sidecar_files")) dt_control_write_sidecar_files_list(imgs);
+
+    /* if we have created duplicates, reset collected images */
+    if(duplicate) dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
+
+    /* redraw center view to update visible mipmaps */
+    dt_control_queue_redraw_center();
+  }
+
+  g_list_free(imgs);
 }
 
 void dt_styles_create_from_selection()
@@ -484,73 +617,19 @@ void dt_styles_create_from_selection()
 
 void dt_styles_apply_to_image(const char *name, gboolean duplicate, int32_t imgid)
 {
-  int id = 0;
-  sqlite3_stmt *stmt;
-  int32_t newimgid;
-
-  if((id = dt_styles_get_id_by_name(name)) != 0)
+  const int id = dt_styles_get_id_by_name(name);
+  if(id != 0)
   {
-    /* check if we should make a duplicate before applying style */
-    if(duplicate)
-    {
-      newimgid = dt_image_duplicate(imgid);
-      if(newimgid != -1) dt_history_copy_and_paste_on_image(imgid, newimgid, FALSE, NULL);
-    }
-    else
-      newimgid = imgid;
-
-    /* merge onto history stack, let's find history offest in destination image */
-    int32_t offs = 0;
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "SELECT MAX(num)+1 FROM history WHERE imgid = ?1", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newimgid);
-    if(sqlite3_step(stmt) == SQLITE_ROW) offs = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
+    _styles_apply_t a;
+    _styles_apply_prepare(&a, name, id);
+    const int32_t newimgid = _styles_apply(&a, duplicate, imgid);
+    _styles_apply_finalize(&a);
 
-    /* delete all items from the temp styles_items, this table is used only to get a ROWNUM of the results */
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.style_items", NULL, NULL, NULL);
-
-    /* copy history items from styles onto temp table */
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "INSERT INTO MEMORY.style_items SELECT * FROM "
-                                                               "style_items WHERE styleid=?1 ORDER BY "
-                                                               "multi_priority DESC;",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-
-    /* copy the style items into the history */
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT INTO history "
-                                "(imgid,num,module,operation,op_params,enabled,blendop_params,blendop_"
-                                "version,multi_priority,multi_name) SELECT "
-                                "?1,?2+rowid,module,operation,op_params,enabled,blendop_params,blendop_"
-                                "version,multi_priority,multi_name FROM MEMORY.style_items",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newimgid);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, offs);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-
-    /* add tag */
-    guint tagid = 0;
-    gchar ntag[512] = { 0 };
-    g_snprintf(ntag, sizeof(ntag), "darktable|style|%s", name);
-    if(dt_tag_new(ntag, &tagid)) dt_tag_attach(tagid, newimgid);
-
-    /* if current image in develop reload history */
-    if(dt_dev_is_current_image(darktable.develop, newimgid))
-    {
-      dt_dev_reload_history_items(darktable.develop);
-      dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
-    }
+    _styles_applied(newimgid);
 
     /* update xmp file */
     dt_image_synch_xmp(newimgid);
 
-    /* remove old obsolete thumbnails */
-    dt_mipmap_cache_remove(darktable.mipmap_cache, newimgid);
-
     /* if we have created a duplicate, reset collected images */
     if(duplicate) dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
 
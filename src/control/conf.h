@@ -26,6 +26,7 @@
 #include "common/darktable.h"
 #include "common/file_location.h"
 
+#include <assert.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -40,8 +41,32 @@ typedef struct dt_conf_t
   GHashTable *table;
   GHashTable *defaults;
   GHashTable *override_entries;
+  GHashTable *handles;
 } dt_conf_t;
 
+/**
+ * a typed handle on one key, for code which reads a setting over and over (per tile, per
+ * thumbnail, per expose). it is resolved through the hash tables on first use and then read
+ * with a single atomic load, until one of the dt_conf_set_*() calls for its key invalidates it.
+ * handles have to live in static storage:
+ *
+ *   static dt_conf_handle_t handle = DT_CONF_HANDLE("cache_disk_backend");
+ *   if(dt_conf_handle_get_bool(&handle)) ..
+ */
+typedef struct dt_conf_handle_t
+{
+  const char *name;
+  int (*parse)(const char *value); // for dt_conf_handle_get_parsed(), called with the conf mutex held
+  int64_t state; // the value in the low 32 bits, DT_CONF_HANDLE_VALID once resolved, the type above that
+} dt_conf_handle_t;
+
+#define DT_CONF_HANDLE(name) { (name), NULL, 0 }
+#define DT_CONF_HANDLE_PARSED(name, parse) { (name), (parse), 0 }
+#define DT_CONF_HANDLE_VALID ((int64_t)1 << 32)
+// dt_conf_handle_type_t + 1 the handle was first resolved as, kept over invalidations
+#define DT_CONF_HANDLE_TYPE(type) ((int64_t)((type) + 1) << 33)
+#define DT_CONF_HANDLE_TYPE_MASK ((int64_t)7 << 33)
+
 typedef struct dt_conf_string_entry_t
 {
   char *key;
@@ -85,6 +110,13 @@ static inline int dt_conf_is_still_overridden(const char *name, const char *valu
   return (over && !strcmp(value, over));
 }
 
+/** drop the cached values of all handles on this key. the conf mutex has to be held. */
+static inline void dt_conf_invalidate_handles(const char *name)
+{
+  for(GSList *h = (GSList *)g_hash_table_lookup(darktable.conf->handles, name); h; h = g_slist_next(h))
+    __atomic_and_fetch(&((dt_conf_handle_t *)h->data)->state, DT_CONF_HANDLE_TYPE_MASK, __ATOMIC_RELEASE);
+}
+
 static inline void dt_conf_set_int(const char *name, int val)
 {
   dt_pthread_mutex_lock(&darktable.conf->mutex);
@@ -93,6 +125,7 @@ static inline void dt_conf_set_int(const char *name, int val)
     g_hash_table_insert(darktable.conf->table, g_strdup(name), str);
   else
     g_free(str);
+  dt_conf_invalidate_handles(name);
   dt_pthread_mutex_unlock(&darktable.conf->mutex);
 }
 
@@ -104,6 +137,7 @@ static inline void dt_conf_set_int64(const char *name, int64_t val)
     g_hash_table_insert(darktable.conf->table, g_strdup(name), str);
   else
     g_free(str);
+  dt_conf_invalidate_handles(name);
   dt_pthread_mutex_unlock(&darktable.conf->mutex);
 }
 
@@ -116,6 +150,7 @@ static inline void dt_conf_set_float(const char *name, float val)
     g_hash_table_insert(darktable.conf->table, g_strdup(name), str);
   else
     g_free(str);
+  dt_conf_invalidate_handles(name);
   dt_pthread_mutex_unlock(&darktable.conf->mutex);
 }
 
@@ -127,6 +162,7 @@ static inline void dt_conf_set_bool(const char *name, int val)
     g_hash_table_insert(darktable.conf->table, g_strdup(name), str);
   else
     g_free(str);
+  dt_conf_invalidate_handles(name);
   dt_pthread_mutex_unlock(&darktable.conf->mutex);
 }
 
@@ -135,6 +171,7 @@ static inline void dt_conf_set_string(const char *name, const char *val)
   dt_pthread_mutex_lock(&darktable.conf->mutex);
   if(!dt_conf_is_still_overridden(name, val))
     g_hash_table_insert(darktable.conf->table, g_strdup(name), g_strdup(val));
+  dt_conf_invalidate_handles(name);
   dt_pthread_mutex_unlock(&darktable.conf->mutex);
 }
 
@@ -195,11 +232,99 @@ static inline gchar *dt_conf_get_string(const char *name)
   return g_strdup(str);
 }
 
+typedef enum dt_conf_handle_type_t
+{
+  DT_CONF_HANDLE_INT,
+  DT_CONF_HANDLE_FLOAT,
+  DT_CONF_HANDLE_BOOL,
+  DT_CONF_HANDLE_PARSED
+} dt_conf_handle_type_t;
+
+typedef union dt_conf_handle_bits_t
+{
+  int32_t i;
+  float f;
+} dt_conf_handle_bits_t;
+
+/** slow path of the handles: parse the value and register the handle for invalidation, all under the
+ * conf mutex so no setter can slip in between. */
+static inline int32_t dt_conf_handle_resolve(dt_conf_handle_t *handle, const dt_conf_handle_type_t type)
+{
+  dt_pthread_mutex_lock(&darktable.conf->mutex);
+  // a handle is read as one type only, its cached bits mean nothing as another
+  const int64_t typed = __atomic_load_n(&handle->state, __ATOMIC_ACQUIRE) & DT_CONF_HANDLE_TYPE_MASK;
+  assert(!typed || typed == DT_CONF_HANDLE_TYPE(type));
+  const char *str = dt_conf_get_var(handle->name);
+  dt_conf_handle_bits_t bits;
+  if(type == DT_CONF_HANDLE_BOOL)
+    bits.i = (str[0] == 'T') || (str[0] == 't');
+  else if(type == DT_CONF_HANDLE_PARSED)
+    bits.i = handle->parse(str);
+  else
+  {
+    float val = dt_calculator_solve(1, str);
+    if(isnan(val)) val = 0.0;
+    if(type == DT_CONF_HANDLE_FLOAT)
+      bits.f = val;
+    else
+      bits.i = val > 0 ? val + 0.5 : val - 0.5;
+  }
+  GSList *list = (GSList *)g_hash_table_lookup(darktable.conf->handles, handle->name);
+  if(!list)
+    g_hash_table_insert(darktable.conf->handles, g_strdup(handle->name), g_slist_prepend(NULL, handle));
+  else if(!g_slist_find(list, handle))
+    list = g_slist_append(list, handle); // keeps the head, which the table holds on to
+  __atomic_store_n(&handle->state, DT_CONF_HANDLE_TYPE(type) | DT_CONF_HANDLE_VALID | (uint32_t)bits.i,
+                   __ATOMIC_RELEASE);
+  dt_pthread_mutex_unlock(&darktable.conf->mutex);
+  return bits.i;
+}
+
+static inline int dt_conf_handle_get_int(dt_conf_handle_t *handle)
+{
+  const int64_t state = __atomic_load_n(&handle->state, __ATOMIC_ACQUIRE);
+  assert(!(state & DT_CONF_HANDLE_VALID)
+         || (state & DT_CONF_HANDLE_TYPE_MASK) == DT_CONF_HANDLE_TYPE(DT_CONF_HANDLE_INT));
+  if(state & DT_CONF_HANDLE_VALID) return (int32_t)(uint32_t)state;
+  return dt_conf_handle_resolve(handle, DT_CONF_HANDLE_INT);
+}
+
+static inline float dt_conf_handle_get_float(dt_conf_handle_t *handle)
+{
+  const int64_t state = __atomic_load_n(&handle->state, __ATOMIC_ACQUIRE);
+  assert(!(state & DT_CONF_HANDLE_VALID)
+         || (state & DT_CONF_HANDLE_TYPE_MASK) == DT_CONF_HANDLE_TYPE(DT_CONF_HANDLE_FLOAT));
+  dt_conf_handle_bits_t bits;
+  bits.i = (state & DT_CONF_HANDLE_VALID) ? (int32_t)(uint32_t)state
+                                          : dt_conf_handle_resolve(handle, DT_CONF_HANDLE_FLOAT);
+  return bits.f;
+}
+
+static inline int dt_conf_handle_get_bool(dt_conf_handle_t *handle)
+{
+  const int64_t state = __atomic_load_n(&handle->state, __ATOMIC_ACQUIRE);
+  assert(!(state & DT_CONF_HANDLE_VALID)
+         || (state & DT_CONF_HANDLE_TYPE_MASK) == DT_CONF_HANDLE_TYPE(DT_CONF_HANDLE_BOOL));
+  if(state & DT_CONF_HANDLE_VALID) return (int32_t)(uint32_t)state;
+  return dt_conf_handle_resolve(handle, DT_CONF_HANDLE_BOOL);
+}
+
+/** for string settings: the result of the handle's parse function on the current value. */
+static inline int dt_conf_handle_get_parsed(dt_conf_handle_t *handle)
+{
+  const int64_t state = __atomic_load_n(&handle->state, __ATOMIC_ACQUIRE);
+  assert(!(state & DT_CONF_HANDLE_VALID)
+         || (state & DT_CONF_HANDLE_TYPE_MASK) == DT_CONF_HANDLE_TYPE(DT_CONF_HANDLE_PARSED));
+  if(state & DT_CONF_HANDLE_VALID) return (int32_t)(uint32_t)state;
+  return dt_conf_handle_resolve(handle, DT_CONF_HANDLE_PARSED);
+}
+
 static inline void dt_conf_init(dt_conf_t *cf, const char *filename, GSList *override_entries)
 {
   cf->table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
   cf->defaults = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
   cf->override_entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  cf->handles = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_slist_free);
   dt_pthread_mutex_init(&darktable.conf->mutex, NULL);
   FILE *f = 0;
   char line[1024];
@@ -292,6 +417,7 @@ static inline void dt_conf_cleanup(dt_conf_t *cf)
   g_hash_table_unref(cf->table);
   g_hash_table_unref(cf->defaults);
   g_hash_table_unref(cf->override_entries);
+  g_hash_table_unref(cf->handles);
   dt_pthread_mutex_destroy(&darktable.conf->mutex);
 }
 
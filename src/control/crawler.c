@@ -27,6 +27,7 @@
 #include "common/database.h"
 #include "common/history.h"
 #include "common/image.h"
+#include "common/image_cache.h"
 #include "control/conf.h"
 #include "gui/gtk.h"
 
@@ -51,134 +52,255 @@ typedef struct dt_control_crawler_result_t
 } dt_control_crawler_result_t;
 
 
-GList *dt_control_crawler_run()
+typedef struct dt_control_crawler_image_t
 {
-  sqlite3_stmt *stmt, *inner_stmt;
-  GList *result = NULL;
-  gboolean look_for_xmp = dt_conf_get_bool("write_sidecar_files");
+  int id;
+  time_t timestamp;
+  int version;
+  int flags;
+  char *filename;
+} dt_control_crawler_image_t;
 
-  sqlite3_prepare_v2(dt_database_get(darktable.db),
-                     "SELECT images.id, write_timestamp, version, folder || '/' || filename, flags "
-                     "FROM images, film_rolls WHERE images.film_id = film_rolls.id "
-                     "ORDER BY film_rolls.id, filename",
-                     -1, &stmt, NULL);
-  sqlite3_prepare_v2(dt_database_get(darktable.db), "UPDATE images SET flags = ?1 WHERE id = ?2", -1,
-                     &inner_stmt, NULL);
+typedef struct dt_control_crawler_folder_t
+{
+  int id;
+  char *path;
+  time_t timestamp; // mtime of the folder when it was crawled the last time, 0 if never
+  GArray *images;   // dt_control_crawler_image_t
+
+  // filled in by _crawl_folder()
+  gboolean crawled;
+  time_t mtime;
+  GArray *new_flags; // pairs of image id and the extra file bits that have changed
+  GList *result;     // dt_control_crawler_result_t
+} dt_control_crawler_folder_t;
+
+// looks for all the extra files of the images of one film roll. the folder is only listed once, everything
+// else is a lookup in the set of names found there. only xmp files that exist get a stat() to read their
+// mtime. nothing in here touches the db, so the folders can be crawled in parallel.
+static void _crawl_folder(dt_control_crawler_folder_t *folder, const gboolean look_for_xmp)
+{
+  struct stat statbuf;
+  // skip folders that are gone or offline, they will be looked at again next time
+  if(stat(folder->path, &statbuf) == -1) return;
+  // adding, removing or renaming files (which is also how most tools write xmp files) changes the mtime of
+  // the folder. so if it's the same as last time there is nothing new in here.
+  if(statbuf.st_mtime == folder->timestamp) return;
+
+  GDir *dir = g_dir_open(folder->path, 0, NULL);
+  if(!dir) return;
+
+  GHashTable *names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  const gchar *name;
+  while((name = g_dir_read_name(dir)) != NULL)
+  {
+    gchar *key = g_strdup(name);
+    g_hash_table_insert(names, key, key);
+  }
+  g_dir_close(dir);
 
-  // let's wrap this into a transaction, it might make it a little faster.
-  sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+  folder->crawled = TRUE;
+  folder->mtime = statbuf.st_mtime;
 
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  for(int k = 0; k < folder->images->len; k++)
   {
-    const int id = sqlite3_column_int(stmt, 0);
-    const time_t timestamp = sqlite3_column_int(stmt, 1);
-    const int version = sqlite3_column_int(stmt, 2);
-    gchar *image_path = (gchar *)sqlite3_column_text(stmt, 3);
-    int flags = sqlite3_column_int(stmt, 4);
+    const dt_control_crawler_image_t *image = &g_array_index(folder->images, dt_control_crawler_image_t, k);
+    gchar filename[PATH_MAX] = { 0 };
 
     // no need to look for xmp files if none get written anyway.
     if(look_for_xmp)
     {
       // construct the xmp filename for this image
-      gchar xmp_path[PATH_MAX] = { 0 };
-      g_strlcpy(xmp_path, image_path, sizeof(xmp_path));
-      dt_image_path_append_version_no_db(version, xmp_path, sizeof(xmp_path));
-      size_t len = strlen(xmp_path);
-      if(len + 4 >= PATH_MAX) continue;
-      xmp_path[len++] = '.';
-      xmp_path[len++] = 'x';
-      xmp_path[len++] = 'm';
-      xmp_path[len++] = 'p';
-      xmp_path[len] = '\0';
-
-      struct stat statbuf;
-      if(stat(xmp_path, &statbuf) == -1) continue; // TODO: shall we report these?
-
-      // step 1: check if the xmp is newer than our db entry
-      // FIXME: allow for a few seconds difference?
-      if(timestamp < statbuf.st_mtime)
+      g_strlcpy(filename, image->filename, sizeof(filename));
+      dt_image_path_append_version_no_db(image->version, filename, sizeof(filename));
+      const size_t len = strlen(filename);
+      if(len + 4 < sizeof(filename))
       {
-        dt_control_crawler_result_t *item
-            = (dt_control_crawler_result_t *)malloc(sizeof(dt_control_crawler_result_t));
-        item->id = id;
-        item->timestamp_xmp = statbuf.st_mtime;
-        item->timestamp_db = timestamp;
-        item->image_path = g_strdup(image_path);
-        item->xmp_path = g_strdup(xmp_path);
-
-        result = g_list_append(result, item);
-        dt_print(DT_DEBUG_CONTROL, "[crawler] `%s' (id: %d) is a newer xmp file.\n", xmp_path, id);
+        g_strlcpy(filename + len, ".xmp", sizeof(filename) - len);
+
+        if(g_hash_table_contains(names, filename))
+        {
+          gchar *xmp_path = g_build_filename(folder->path, filename, NULL);
+
+          // step 1: check if the xmp is newer than our db entry
+          // FIXME: allow for a few seconds difference?
+          if(stat(xmp_path, &statbuf) == 0 && image->timestamp < statbuf.st_mtime)
+          {
+            dt_control_crawler_result_t *item
+                = (dt_control_crawler_result_t *)malloc(sizeof(dt_control_crawler_result_t));
+            item->id = image->id;
+            item->timestamp_xmp = statbuf.st_mtime;
+            item->timestamp_db = image->timestamp;
+            item->image_path = g_build_filename(folder->path, image->filename, NULL);
+            item->xmp_path = xmp_path;
+
+            folder->result = g_list_prepend(folder->result, item);
+            dt_print(DT_DEBUG_CONTROL, "[crawler] `%s' (id: %d) is a newer xmp file.\n", xmp_path, image->id);
+          }
+          else
+            g_free(xmp_path);
+          // older timestamps are the case for all images after the db upgrade. better not report these
+        }
       }
-      // older timestamps are the case for all images after the db upgrade. better not report these
-      //       else if(timestamp > statbuf.st_mtime)
-      //         printf("`%s' (%d) has an older xmp file.\n", image_path, id);
     }
 
-    // step 2: check if the image has associated files (.txt, .wav)
-    size_t len = strlen(image_path);
-    char *c = image_path + len;
-    while((c > image_path) && (*c != '.')) *c-- = '\0';
-    len = c - image_path + 1;
-
-    char *extra_path = g_strndup(image_path, len + 3);
-
-    extra_path[len] = 't';
-    extra_path[len + 1] = 'x';
-    extra_path[len + 2] = 't';
-    gboolean has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
-
+    // step 2: check if the image has associated files (.txt, .wav). these are looked for with the same two
+    // spellings as dt_image_get_text_path() and dt_image_get_audio_path() use.
+    g_strlcpy(filename, image->filename, sizeof(filename));
+    char *c = filename + strlen(filename);
+    while((c > filename) && (*c != '.')) c--;
+    const size_t len = c - filename + 1;
+    if(len + 3 >= sizeof(filename)) continue;
+    filename[len + 3] = '\0';
+
+    memcpy(filename + len, "txt", 3);
+    gboolean has_txt = g_hash_table_contains(names, filename);
     if(!has_txt)
     {
-      extra_path[len] = 'T';
-      extra_path[len + 1] = 'X';
-      extra_path[len + 2] = 'T';
-      has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+      memcpy(filename + len, "TXT", 3);
+      has_txt = g_hash_table_contains(names, filename);
     }
 
-    extra_path[len] = 'w';
-    extra_path[len + 1] = 'a';
-    extra_path[len + 2] = 'v';
-    gboolean has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
-
+    memcpy(filename + len, "wav", 3);
+    gboolean has_wav = g_hash_table_contains(names, filename);
     if(!has_wav)
     {
-      extra_path[len] = 'W';
-      extra_path[len + 1] = 'A';
-      extra_path[len + 2] = 'V';
-      has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+      memcpy(filename + len, "WAV", 3);
+      has_wav = g_hash_table_contains(names, filename);
     }
 
     // TODO: decide if we want to remove the flag for images that lost their extra file. currently we do (the
     // else cases)
-    int new_flags = flags;
-    if(has_txt)
-      new_flags |= DT_IMAGE_HAS_TXT;
-    else
-      new_flags &= ~DT_IMAGE_HAS_TXT;
-    if(has_wav)
-      new_flags |= DT_IMAGE_HAS_WAV;
-    else
-      new_flags &= ~DT_IMAGE_HAS_WAV;
-    if(flags != new_flags)
+    const int new_flags = (has_txt ? DT_IMAGE_HAS_TXT : 0) | (has_wav ? DT_IMAGE_HAS_WAV : 0);
+    if((image->flags & (DT_IMAGE_HAS_TXT | DT_IMAGE_HAS_WAV)) != new_flags)
     {
-      sqlite3_bind_int(inner_stmt, 1, new_flags);
-      sqlite3_bind_int(inner_stmt, 2, id);
-      sqlite3_step(inner_stmt);
-      sqlite3_reset(inner_stmt);
-      sqlite3_clear_bindings(inner_stmt);
+      const int update[2] = { image->id, new_flags };
+      g_array_append_vals(folder->new_flags, update, 2);
     }
+  }
+
+  folder->result = g_list_reverse(folder->result);
+  g_hash_table_destroy(names);
+}
+
+GList *dt_control_crawler_run()
+{
+  sqlite3_stmt *stmt;
+  GList *result = NULL;
+  gboolean look_for_xmp = dt_conf_get_bool("write_sidecar_files");
+
+  // collect all film rolls and their images first, the crawling itself doesn't touch the db
+  GArray *folders = g_array_new(FALSE, FALSE, sizeof(dt_control_crawler_folder_t));
+  sqlite3_prepare_v2(dt_database_get(darktable.db),
+                     "SELECT id, folder, crawler_timestamp FROM film_rolls ORDER BY id", -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    dt_control_crawler_folder_t folder = { 0 };
+    folder.id = sqlite3_column_int(stmt, 0);
+    folder.path = g_strdup((const gchar *)sqlite3_column_text(stmt, 1));
+    folder.timestamp = sqlite3_column_int64(stmt, 2);
+    folder.images = g_array_new(FALSE, FALSE, sizeof(dt_control_crawler_image_t));
+    folder.new_flags = g_array_new(FALSE, FALSE, sizeof(int));
+    g_array_append_val(folders, folder);
+  }
+  sqlite3_finalize(stmt);
 
-    g_free(extra_path);
+  sqlite3_prepare_v2(dt_database_get(darktable.db),
+                     "SELECT film_id, id, write_timestamp, version, filename, flags FROM images "
+                     "ORDER BY film_id, filename",
+                     -1, &stmt, NULL);
+  int f = 0;
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const int film_id = sqlite3_column_int(stmt, 0);
+    // both queries are sorted by the film roll id
+    while(f < folders->len && g_array_index(folders, dt_control_crawler_folder_t, f).id < film_id) f++;
+    if(f == folders->len) break;
+    dt_control_crawler_folder_t *folder = &g_array_index(folders, dt_control_crawler_folder_t, f);
+    if(folder->id != film_id) continue;
+
+    dt_control_crawler_image_t image;
+    image.id = sqlite3_column_int(stmt, 1);
+    image.timestamp = sqlite3_column_int(stmt, 2);
+    image.version = sqlite3_column_int(stmt, 3);
+    image.filename = g_strdup((const gchar *)sqlite3_column_text(stmt, 4));
+    image.flags = sqlite3_column_int(stmt, 5);
+    g_array_append_val(folder->images, image);
   }
+  sqlite3_finalize(stmt);
+
+  const int num_folders = folders->len;
+  dt_control_crawler_folder_t *folder_array = (dt_control_crawler_folder_t *)folders->data;
+
+  // most of the time goes into waiting for the file system, especially on network shares. so look at
+  // several folders at once.
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+  for(int k = 0; k < num_folders; k++) _crawl_folder(&folder_array[k], look_for_xmp);
+
+  sqlite3_prepare_v2(dt_database_get(darktable.db),
+                     "UPDATE film_rolls SET crawler_timestamp = ?1 WHERE id = ?2", -1, &stmt, NULL);
+
+  for(int k = 0; k < num_folders; k++)
+  {
+    dt_control_crawler_folder_t *folder = &folder_array[k];
+
+    // the crawl can take a while, so only flip the extra file bits of the current image struct. everything
+    // else in there might have been changed in the meantime.
+    for(int i = 0; i < folder->new_flags->len; i += 2)
+    {
+      dt_image_t *img
+          = dt_image_cache_get(darktable.image_cache, g_array_index(folder->new_flags, int, i), 'w');
+      if(!img) continue;
+      img->flags = (img->flags & ~(DT_IMAGE_HAS_TXT | DT_IMAGE_HAS_WAV))
+                   | g_array_index(folder->new_flags, int, i + 1);
+      dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
+    }
+
+    if(folder->crawled)
+    {
+      sqlite3_bind_int64(stmt, 1, folder->mtime);
+      sqlite3_bind_int(stmt, 2, folder->id);
+      sqlite3_step(stmt);
+      sqlite3_reset(stmt);
+      sqlite3_clear_bindings(stmt);
+    }
 
-  sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+    result = g_list_concat(result, folder->result);
+
+    for(int i = 0; i < folder->images->len; i++)
+      g_free(g_array_index(folder->images, dt_control_crawler_image_t, i).filename);
+    g_array_free(folder->images, TRUE);
+    g_array_free(folder->new_flags, TRUE);
+    g_free(folder->path);
+  }
 
   sqlite3_finalize(stmt);
-  sqlite3_finalize(inner_stmt);
+  g_array_free(folders, TRUE);
 
   return result;
 }
 
+static gboolean _show_image_list_gui_thread(gpointer user_data)
+{
+  dt_control_crawler_show_image_list((GList *)user_data);
+  return FALSE;
+}
+
+static int32_t dt_control_crawler_job_run(dt_job_t *job)
+{
+  GList *images = dt_control_crawler_run();
+  // the popup has to be built in the gui thread
+  if(images) g_main_context_invoke(NULL, _show_image_list_gui_thread, images);
+  return 0;
+}
+
+dt_job_t *dt_control_crawler_job_create()
+{
+  return dt_control_job_create(&dt_control_crawler_job_run, "crawl xmp files");
+}
+
 
 /********************* the gui stuff *********************/
 
@@ -231,6 +231,17 @@ typedef struct dt_control_merge_hdr_t
 
   // 0 - ok; 1 - errors, abort
   gboolean abort;
+
+  // the frames are decoded by several threads at once, but merged one after the other in the order of the
+  // list, straight from the output buffer of the pipe which decoded them.
+  dt_pthread_mutex_t lock;
+  pthread_cond_t cond;
+  GList *todo; // frames no thread has claimed yet
+  int claimed; // number of frames claimed so far
+  int merged;  // number of frames done with, the next one to merge is merged + 1
+  int total;
+  dt_imageio_module_format_t *format;
+  dt_progress_t *progress;
 } dt_control_merge_hdr_t;
 
 typedef struct dt_control_merge_hdr_format_t
@@ -281,6 +292,13 @@ static int dt_control_merge_hdr_process(dt_imageio_module_data_t *datai, const c
   dt_control_merge_hdr_format_t *data = (dt_control_merge_hdr_format_t *)datai;
   dt_control_merge_hdr_t *d = data->d;
 
+  // wait for our turn, the frames before us might still be decoding.
+  dt_pthread_mutex_lock(&d->lock);
+  while(d->merged != num - 1) dt_pthread_cond_wait(&d->cond, &d->lock);
+  const gboolean abort = d->abort;
+  dt_pthread_mutex_unlock(&d->lock);
+  if(abort) return 1;
+
   // just take a copy. also do it after blocking read, so filters will make sense.
   const dt_image_t *img = dt_image_cache_get(darktable.image_cache, imgid, 'r');
   const dt_image_t image = *img;
@@ -326,111 +344,177 @@ static int dt_control_merge_hdr_process(dt_imageio_module_data_t *datai, const c
   // using the values):
   float saturation = 1.0f; // image.raw_white_point - image.raw_black_level;
   d->whitelevel = fmaxf(d->whitelevel, saturation * cal);
+  const float *const in = (const float *)ivoid;
+  float *const pixels = d->pixels;
+  float *const weight = d->weight;
+  const int wd = d->wd, ht = d->ht;
+  const float whitelevel = d->whitelevel;
+  const float epsw = d->epsw;
+  // need some safety margin due to upsampling and 16-bit quantization + dithering?
+  const float offset = 3000.0f / (float)UINT16_MAX;
 #ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) shared(d, saturation)
+#pragma omp parallel for schedule(static) default(none) shared(saturation)
 #endif
-  for(int y = 0; y < d->ht; y++)
-    for(int x = 0; x < d->wd; x++)
+  for(int yy = 0; yy < ht; yy += 2)
+    for(int xx = 0; xx < wd; xx += 2)
     {
-      const float in = ((float *)ivoid)[x + d->wd * y];
       // weights based on siggraph 12 poster
       // zijian zhu, zhengguo li, susanto rahardja, pasi fraenti
       // 2d denoising factor for high dynamic range imaging
       float w = photoncnt;
 
-      // need some safety margin due to upsampling and 16-bit quantization + dithering?
-      float offset = 3000.0f / (float)UINT16_MAX;
-
       // cannot do an envelope based on single pixel values here, need to get
       // maximum value of all color channels. do find that, go through the bayer
-      // pattern block:
-      int xx = x & ~1, yy = y & ~1;
+      // pattern block, once for all four pixels of it:
       float M = 0.0f, m = FLT_MAX;
-      if(xx < d->wd - 1 && yy < d->ht - 1)
+      if(xx < wd - 1 && yy < ht - 1)
       {
         for(int i = 0; i < 2; i++)
           for(int j = 0; j < 2; j++)
           {
-            M = MAX(M, ((float *)ivoid)[xx + i + d->wd * (yy + j)]);
-            m = MIN(m, ((float *)ivoid)[xx + i + d->wd * (yy + j)]);
+            M = MAX(M, in[xx + i + (size_t)wd * (yy + j)]);
+            m = MIN(m, in[xx + i + (size_t)wd * (yy + j)]);
           }
         // move envelope a little to allow non-zero weight even for clipped regions.
         // this is because even if the 2x2 block is clipped somewhere, the other channels
         // might still prove useful. we'll check for individual channel saturation below.
-        w *= d->epsw + envelope((M + offset) / saturation);
+        w *= epsw + envelope((M + offset) / saturation);
       }
 
-      if(M + offset >= saturation)
-      {
-        if(d->weight[x + d->wd * y] <= 0.0f)
-        { // only consider saturated pixels in case we have nothing better:
-          if(d->weight[x + d->wd * y] == 0 || m < -d->weight[x + d->wd * y])
+      for(int y = yy; y < MIN(yy + 2, ht); y++)
+        for(int x = xx; x < MIN(xx + 2, wd); x++)
+        {
+          const size_t k = x + (size_t)wd * y;
+          if(M + offset >= saturation)
           {
-            if(m + offset >= saturation)
-              d->pixels[x + d->wd * y] = 1.0f; // let's admit we were completely clipped, too
-            else
-              d->pixels[x + d->wd * y] = in * cal / d->whitelevel;
-            d->weight[x + d->wd * y]
-                = -m; // could use -cal here, but m is per pixel and safer for varying illumination conditions
+            if(weight[k] <= 0.0f)
+            { // only consider saturated pixels in case we have nothing better:
+              if(weight[k] == 0 || m < -weight[k])
+              {
+                if(m + offset >= saturation)
+                  pixels[k] = 1.0f; // let's admit we were completely clipped, too
+                else
+                  pixels[k] = in[k] * cal / whitelevel;
+                // could use -cal here, but m is per pixel and safer for varying illumination conditions
+                weight[k] = -m;
+              }
+            }
+            // else silently ignore, others have filled in a better color here already
+          }
+          else
+          {
+            if(weight[k] <= 0.0)
+            { // cleanup potentially blown highlights from earlier images
+              pixels[k] = 0.0f;
+              weight[k] = 0.0f;
+            }
+            pixels[k] += w * in[k] * cal;
+            weight[k] += w;
           }
         }
-        // else silently ignore, others have filled in a better color here already
-      }
-      else
-      {
-        if(d->weight[x + d->wd * y] <= 0.0)
-        { // cleanup potentially blown highlights from earlier images
-          d->pixels[x + d->wd * y] = 0.0f;
-          d->weight[x + d->wd * y] = 0.0f;
-        }
-        d->pixels[x + d->wd * y] += w * in * cal;
-        d->weight[x + d->wd * y] += w;
-      }
     }
 
   return 0;
 }
 
+static void *dt_control_merge_hdr_worker(void *arg)
+{
+  dt_control_merge_hdr_t *d = (dt_control_merge_hdr_t *)arg;
+  // width and height are written by the export, so every thread needs its own
+  dt_control_merge_hdr_format_t dat = (dt_control_merge_hdr_format_t){.parent = { 0 }, .d = d };
+
+  while(1)
+  {
+    dt_pthread_mutex_lock(&d->lock);
+    if(d->abort || !d->todo)
+    {
+      dt_pthread_mutex_unlock(&d->lock);
+      break;
+    }
+    const uint32_t imgid = GPOINTER_TO_INT(d->todo->data);
+    d->todo = g_list_delete_link(d->todo, d->todo);
+    const int num = ++d->claimed;
+    dt_pthread_mutex_unlock(&d->lock);
+
+    // merges the frame through dt_control_merge_hdr_process() once it's its turn
+    dt_imageio_export_with_flags(imgid, "unused", d->format, (dt_imageio_module_data_t *)&dat, 1, 0, 0, 1, 0,
+                                 "pre:rawprepare", 0, 0, 0, num, d->total);
+
+    // pass the turn on, also if the frame could not be loaded at all
+    dt_pthread_mutex_lock(&d->lock);
+    while(d->merged != num - 1) dt_pthread_cond_wait(&d->cond, &d->lock);
+    d->merged = num;
+    pthread_cond_broadcast(&d->cond);
+    /* update the progress bar */
+    dt_control_progress_set_progress(darktable.control, d->progress, num / (double)(d->total + 1));
+    dt_pthread_mutex_unlock(&d->lock);
+  }
+  return NULL;
+}
+
 static int32_t dt_control_merge_hdr_job_run(dt_job_t *job)
 {
   dt_control_image_enumerator_t *params = dt_control_job_get_params(job);
   GList *t = params->index;
   const guint total = g_list_length(t);
   char message[512] = { 0 };
-  double fraction = 0;
   snprintf(message, sizeof(message), ngettext("merging %d image", "merging %d images", total), total);
 
   dt_progress_t *progress = dt_control_progress_create(darktable.control, TRUE, message);
   dt_control_progress_attach_job(darktable.control, progress, job);
 
-  dt_control_merge_hdr_t d = (dt_control_merge_hdr_t){.epsw = 1e-8f, .abort = FALSE };
-
   dt_imageio_module_format_t buf = (dt_imageio_module_format_t){.mime = dt_control_merge_hdr_mime,
                                                                 .levels = dt_control_merge_hdr_levels,
                                                                 .bpp = dt_control_merge_hdr_bpp,
                                                                 .write_image = dt_control_merge_hdr_process };
 
-  dt_control_merge_hdr_format_t dat = (dt_control_merge_hdr_format_t){.parent = { 0 }, .d = &d };
-
-  int num = 1;
-  while(t)
+  dt_control_merge_hdr_t d = (dt_control_merge_hdr_t){.epsw = 1e-8f,
+                                                      .abort = FALSE,
+                                                      .todo = t,
+                                                      .total = total,
+                                                      .format = &buf,
+                                                      .progress = progress };
+  dt_pthread_mutex_init(&d.lock, NULL);
+  pthread_cond_init(&d.cond, NULL);
+
+  // decode as many frames at once as the host memory limit allows. each one needs the raw and about two
+  // float buffers of the same size in its pipe.
+  int num_threads = MAX(1, MIN((int)total, dt_get_num_threads()));
+  const size_t limit = (size_t)MAX(0, dt_conf_get_int("host_memory_limit")) << 20;
+  if(limit > 0 && t)
   {
-    if(d.abort) goto end;
-
-    const uint32_t imgid = GPOINTER_TO_INT(t->data);
-
-    dt_imageio_export_with_flags(imgid, "unused", &buf, (dt_imageio_module_data_t *)&dat, 1, 0, 0, 1, 0,
-                                 "pre:rawprepare", 0, 0, 0, num, total);
-
-    t = g_list_delete_link(t, t);
+    const dt_image_t *img = dt_image_cache_get(darktable.image_cache, GPOINTER_TO_INT(t->data), 'r');
+    size_t frame_size = 0;
+    if(img)
+    {
+      frame_size = (size_t)img->width * img->height * (sizeof(uint16_t) + 2 * sizeof(float));
+      dt_image_cache_read_release(darktable.image_cache, img);
+    }
+    // the size isn't known before the first full load, don't bet on it being small
+    num_threads = frame_size > 0 ? MIN(num_threads, MAX(1, limit / frame_size)) : 1;
+  }
 
-    /* update the progress bar */
-    fraction += 1.0 / (total + 1);
-    dt_control_progress_set_progress(darktable.control, progress, fraction);
-    num++;
+  // this thread is a worker as well, so the frames get merged even if no other thread could be started
+  pthread_t *threads = num_threads > 1 ? (pthread_t *)malloc(sizeof(pthread_t) * (num_threads - 1)) : NULL;
+  int started = 0;
+  for(int k = 0; threads && k < num_threads - 1; k++)
+  {
+    if(pthread_create(threads + started, NULL, dt_control_merge_hdr_worker, &d))
+    {
+      fprintf(stderr, "[merge_hdr] could only start %d of %d decoding threads\n", started + 1, num_threads);
+      break;
+    }
+    started++;
   }
+  dt_control_merge_hdr_worker(&d);
+  for(int k = 0; k < started; k++) pthread_join(threads[k], NULL);
+  free(threads);
+
+  g_list_free(d.todo);
+  pthread_cond_destroy(&d.cond);
+  dt_pthread_mutex_destroy(&d.lock);
 
-  if(d.abort) goto end;
+  if(d.abort || !d.pixels) goto end;
 
 // normalize by white level to make clipping at 1.0 work as expected
 
@@ -1449,6 +1533,23 @@ void dt_control_write_sidecar_files()
                                                           "write sidecar files", 0, NULL));
 }
 
+void dt_control_write_sidecar_files_list(const GList *imgs)
+{
+  if(!imgs) return;
+  dt_job_t *job = dt_control_job_create(&dt_control_write_sidecar_files_job_run, "write sidecar files");
+  if(!job) return;
+  dt_control_image_enumerator_t *params
+      = (dt_control_image_enumerator_t *)calloc(1, sizeof(dt_control_image_enumerator_t));
+  if(!params)
+  {
+    dt_control_job_dispose(job);
+    return;
+  }
+  params->index = g_list_copy((GList *)imgs);
+  dt_control_job_set_params(job, params);
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_FG, job);
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,313 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "develop/curvefusion.h"
+#include "develop/blend.h"
+#include "common/darktable.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+static void _fusion_free(dt_dev_curve_fusion_t *fusion)
+{
+  if(!fusion) return;
+  for(int c = 0; c < 3; c++) dt_free_align(fusion->curve[c]);
+  dt_free_align(fusion->scale);
+  free(fusion->pieces);
+  free(fusion);
+}
+
+void dt_dev_curve_fusion_cleanup(dt_dev_pixelpipe_t *pipe)
+{
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    _fusion_free(piece->fusion);
+    piece->fusion = NULL;
+    piece->fused = 0;
+  }
+}
+
+static dt_iop_transfer_t _piece_transfer(dt_dev_pixelpipe_iop_t *piece)
+{
+  dt_iop_module_t *module = piece->module;
+  if(!module->transfer_function) return DT_IOP_TRANSFER_NONE;
+
+  // blending needs the untouched output of every single module
+  const dt_develop_blend_params_t *const bp = (const dt_develop_blend_params_t *)piece->blendop_data;
+  if(bp && (bp->mask_mode & DEVELOP_MASK_ENABLED)) return DT_IOP_TRANSFER_NONE;
+
+  const dt_iop_colorspace_type_t cst = dt_iop_module_colorspace(module);
+  if(cst == iop_cs_RAW) return DT_IOP_TRANSFER_NONE;
+
+  const dt_iop_transfer_t kind = module->transfer_function(module, piece, NULL, NULL, 0);
+  if(kind == DT_IOP_TRANSFER_SCALE_CHROMA && cst != iop_cs_Lab) return DT_IOP_TRANSFER_NONE;
+  return kind;
+}
+
+static dt_dev_curve_fusion_t *_fusion_create(GList *run, const int num, const dt_iop_colorspace_type_t cst)
+{
+  const int n = DT_CURVE_FUSION_LUT_SIZE;
+  dt_dev_curve_fusion_t *fusion = (dt_dev_curve_fusion_t *)calloc(1, sizeof(dt_dev_curve_fusion_t));
+  float *buf = (float *)dt_alloc_align(64, sizeof(float) * 4 * n);
+  float *tmp = (float *)dt_alloc_align(64, sizeof(float) * 4 * n);
+  if(!fusion || !buf || !tmp) goto error;
+
+  fusion->cst = cst;
+  for(int c = 0; c < 3; c++)
+  {
+    fusion->min[c] = (cst == iop_cs_Lab) ? ((c == 0) ? 0.0f : -128.0f) : 0.0f;
+    fusion->max[c] = (cst == iop_cs_Lab) ? ((c == 0) ? 100.0f : 128.0f) : 1.0f;
+  }
+  fusion->num_pieces = num;
+  fusion->pieces = (dt_dev_pixelpipe_iop_t **)malloc(sizeof(dt_dev_pixelpipe_iop_t *) * num);
+  if(!fusion->pieces) goto error;
+
+  // start out with the identity on the sampled input range and push it through all modules
+  for(int k = 0; k < n; k++)
+  {
+    for(int c = 0; c < 3; c++)
+      buf[4 * k + c] = fusion->min[c] + (fusion->max[c] - fusion->min[c]) * k / (float)(n - 1);
+    buf[4 * k + 3] = 0.0f;
+  }
+
+  int i = 0;
+  for(GList *l = run; l; l = g_list_next(l), i++)
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)l->data;
+    dt_iop_module_t *module = piece->module;
+    fusion->pieces[i] = piece;
+    if(module->transfer_function(module, piece, NULL, NULL, 0) == DT_IOP_TRANSFER_PER_CHANNEL)
+    {
+      module->transfer_function(module, piece, buf, buf, n);
+      continue;
+    }
+
+    // chroma scale: feed unit chroma to read back s(L), and accumulate it over the
+    // lightness as it was at the input of the run.
+    if(!fusion->scale)
+    {
+      fusion->scale = (float *)dt_alloc_align(64, sizeof(float) * n);
+      if(!fusion->scale) goto error;
+      for(int k = 0; k < n; k++) fusion->scale[k] = 1.0f;
+    }
+    for(int k = 0; k < n; k++)
+    {
+      tmp[4 * k + 0] = buf[4 * k + 0];
+      tmp[4 * k + 1] = tmp[4 * k + 2] = 1.0f;
+      tmp[4 * k + 3] = 0.0f;
+    }
+    module->transfer_function(module, piece, tmp, tmp, n);
+    for(int k = 0; k < n; k++)
+    {
+      buf[4 * k + 0] = tmp[4 * k + 0];
+      fusion->scale[k] *= tmp[4 * k + 1];
+    }
+  }
+
+  for(int c = 0; c < 3; c++)
+  {
+    fusion->curve[c] = (float *)dt_alloc_align(64, sizeof(float) * n);
+    if(!fusion->curve[c]) goto error;
+    for(int k = 0; k < n; k++) fusion->curve[c][k] = buf[4 * k + c];
+  }
+
+  dt_free_align(buf);
+  dt_free_align(tmp);
+  return fusion;
+
+error:
+  dt_free_align(buf);
+  dt_free_align(tmp);
+  _fusion_free(fusion);
+  return NULL;
+}
+
+static void _fuse_run(GList *run, const int num, const dt_iop_colorspace_type_t cst)
+{
+  // a single module is faster on its own
+  if(num < 2) return;
+
+  dt_dev_curve_fusion_t *fusion = _fusion_create(run, num, cst);
+  if(!fusion) return;
+
+  GList *l = run;
+  for(; l->next; l = g_list_next(l)) ((dt_dev_pixelpipe_iop_t *)l->data)->fused = 1;
+  ((dt_dev_pixelpipe_iop_t *)l->data)->fusion = fusion;
+
+  dt_print(DT_DEBUG_DEV, "[curve_fusion] fused %d modules into `%s'\n", num,
+           ((dt_dev_pixelpipe_iop_t *)l->data)->module->op);
+}
+
+void dt_dev_curve_fusion_update(dt_dev_pixelpipe_t *pipe)
+{
+  dt_dev_curve_fusion_cleanup(pipe);
+
+  // the darkroom wants to pick colors and collect histograms at every single module,
+  // so only pipes without gui get fused.
+  if(!(pipe->type & (DT_DEV_PIXELPIPE_EXPORT | DT_DEV_PIXELPIPE_THUMBNAIL))) return;
+
+  GList *run = NULL;
+  int num = 0, scaled = 0;
+  dt_iop_colorspace_type_t cst = iop_cs_RAW;
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    // disabled pieces are skipped by the pipe anyways, they don't break a run
+    if(!piece->enabled) continue;
+
+    const dt_iop_transfer_t kind = _piece_transfer(piece);
+    const dt_iop_colorspace_type_t piece_cst = dt_iop_module_colorspace(piece->module);
+
+    // a chroma scale can't be moved past a later curve on the chroma channels,
+    // so that one has to start a new run.
+    if(run && (kind == DT_IOP_TRANSFER_NONE || piece_cst != cst
+               || (kind == DT_IOP_TRANSFER_PER_CHANNEL && scaled)))
+    {
+      _fuse_run(run, num, cst);
+      g_list_free(run);
+      run = NULL;
+      num = scaled = 0;
+    }
+    if(kind == DT_IOP_TRANSFER_NONE) continue;
+
+    run = g_list_append(run, piece);
+    num++;
+    cst = piece_cst;
+    scaled |= (kind == DT_IOP_TRANSFER_SCALE_CHROMA);
+  }
+  if(run)
+  {
+    _fuse_run(run, num, cst);
+    g_list_free(run);
+  }
+}
+
+void dt_dev_curve_fusion_process(const dt_dev_curve_fusion_t *fusion, const float *const in,
+                                 float *const out, const int width, const int height)
+{
+  const int n = DT_CURVE_FUSION_LUT_SIZE;
+  const float *const c0 = fusion->curve[0];
+  const float *const c1 = fusion->curve[1];
+  const float *const c2 = fusion->curve[2];
+  const float *const scale = fusion->scale;
+
+  const __m128 min = _mm_set_ps(0.0f, fusion->min[2], fusion->min[1], fusion->min[0]);
+  const __m128 mul = _mm_set_ps(0.0f, (n - 1) / (fusion->max[2] - fusion->min[2]),
+                                (n - 1) / (fusion->max[1] - fusion->min[1]),
+                                (n - 1) / (fusion->max[0] - fusion->min[0]));
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 top = _mm_set1_ps(n - 1);
+
+  // pixels outside the sampled range are sent through the modules one after another.
+  // they are rare, collect them per row.
+  const int nthreads = dt_get_num_threads();
+  float *const scratch = (float *)dt_alloc_align(64, sizeof(float) * 4 * width * nthreads);
+  int *const outliers = (int *)malloc(sizeof(int) * width * nthreads);
+  if(!scratch || !outliers)
+  {
+    // no room for the lookup path, send every row through the modules one after another, as unfused
+    fprintf(stderr, "[curve_fusion] could not allocate row buffers, falling back to the single modules\n");
+    dt_free_align(scratch);
+    free(outliers);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for(int j = 0; j < height; j++)
+    {
+      const float *row_in = in + (size_t)4 * width * j;
+      float *row_out = out + (size_t)4 * width * j;
+      for(int p = 0; p < fusion->num_pieces; p++)
+      {
+        dt_dev_pixelpipe_iop_t *piece = fusion->pieces[p];
+        piece->module->transfer_function(piece->module, piece, p ? row_out : row_in, row_out, width);
+      }
+      for(int k = 0; k < width; k++) row_out[4 * k + 3] = row_in[4 * k + 3];
+    }
+    return;
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int j = 0; j < height; j++)
+  {
+    const float *i = in + (size_t)4 * width * j;
+    float *o = out + (size_t)4 * width * j;
+    int *rest = outliers + (size_t)width * dt_get_thread_num();
+    int num_rest = 0;
+
+    for(int k = 0; k < width; k++, i += 4, o += 4)
+    {
+      const __m128 x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(i), min), mul);
+      // not in [0, n-1], also catches NaN
+      if(_mm_movemask_ps(_mm_or_ps(_mm_cmpnge_ps(x, zero), _mm_cmpnle_ps(x, top))) & 7)
+      {
+        rest[num_rest++] = k;
+        continue;
+      }
+
+      int xi[4] __attribute__((aligned(16)));
+      _mm_store_si128((__m128i *)xi, _mm_cvttps_epi32(x));
+      for(int c = 0; c < 3; c++) xi[c] = MIN(xi[c], n - 2);
+      const __m128 f = _mm_sub_ps(x, _mm_cvtepi32_ps(_mm_load_si128((__m128i *)xi)));
+
+      // no gather in sse, fetch the three taps by hand and interpolate in one go
+      const __m128 lo = _mm_set_ps(0.0f, c2[xi[2]], c1[xi[1]], c0[xi[0]]);
+      const __m128 hi = _mm_set_ps(0.0f, c2[xi[2] + 1], c1[xi[1] + 1], c0[xi[0] + 1]);
+      __m128 res = _mm_add_ps(lo, _mm_mul_ps(f, _mm_sub_ps(hi, lo)));
+
+      if(scale)
+      {
+        float fx[4] __attribute__((aligned(16)));
+        _mm_store_ps(fx, f);
+        const float s = scale[xi[0]] + fx[0] * (scale[xi[0] + 1] - scale[xi[0]]);
+        res = _mm_mul_ps(res, _mm_set_ps(0.0f, s, s, 1.0f));
+      }
+      _mm_store_ps(o, res);
+      o[3] = i[3];
+    }
+
+    if(num_rest)
+    {
+      float *tmp = scratch + (size_t)4 * width * dt_get_thread_num();
+      const float *row_in = in + (size_t)4 * width * j;
+      float *row_out = out + (size_t)4 * width * j;
+      for(int k = 0; k < num_rest; k++) memcpy(tmp + 4 * k, row_in + 4 * rest[k], sizeof(float) * 4);
+      for(int p = 0; p < fusion->num_pieces; p++)
+      {
+        dt_dev_pixelpipe_iop_t *piece = fusion->pieces[p];
+        piece->module->transfer_function(piece->module, piece, tmp, tmp, num_rest);
+      }
+      for(int k = 0; k < num_rest; k++)
+      {
+        for(int c = 0; c < 3; c++) row_out[4 * rest[k] + c] = tmp[4 * k + c];
+        row_out[4 * rest[k] + 3] = row_in[4 * rest[k] + 3];
+      }
+    }
+  }
+
+  dt_free_align(scratch);
+  free(outliers);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,62 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DT_DEVELOP_CURVEFUSION_H
+#define DT_DEVELOP_CURVEFUSION_H
+
+#include "develop/imageop.h"
+#include "develop/pixelpipe.h"
+
+/** number of samples of the composed lookup tables. */
+#define DT_CURVE_FUSION_LUT_SIZE 0x10000
+
+/**
+ * a run of adjacent enabled modules which all report a pointwise transfer function
+ * (see transfer_function() in dt_iop_module_t) is composed into one set of lookup tables
+ *
+ *   out[0] = curve[0](in[0])
+ *   out[c] = curve[c](in[c]) * scale(in[0]),  c = 1, 2
+ *
+ * which is applied once by the last piece of the run. all other pieces of the run are
+ * skipped by the pixelpipe, just like disabled ones.
+ */
+typedef struct dt_dev_curve_fusion_t
+{
+  dt_iop_colorspace_type_t cst;
+  float min[3], max[3]; // input range sampled by the tables, per channel
+  float *curve[3];
+  float *scale;         // NULL if no module of the run scales chroma
+  int num_pieces;
+  struct dt_dev_pixelpipe_iop_t **pieces; // the fused run in pipe order, for input outside the tables
+} dt_dev_curve_fusion_t;
+
+/** (re)computes which pieces of the pipe get fused. call after all params have been committed. */
+void dt_dev_curve_fusion_update(struct dt_dev_pixelpipe_t *pipe);
+
+/** drops all fusion data of the pipe, all pieces are processed on their own again. */
+void dt_dev_curve_fusion_cleanup(struct dt_dev_pixelpipe_t *pipe);
+
+/** applies the composed curves to a 4-channel float buffer. */
+void dt_dev_curve_fusion_process(const dt_dev_curve_fusion_t *fusion, const float *const in,
+                                 float *const out, const int width, const int height);
+
+#endif
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
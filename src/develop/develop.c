@@ -44,6 +44,8 @@
 #define DT_DEV_AVERAGE_DELAY_START 250
 #define DT_DEV_PREVIEW_AVERAGE_DELAY_START 50
 #define DT_DEV_AVERAGE_DELAY_COUNT 5
+// fraction of the view the main pipe renders in addition on each side, to serve small pans from
+#define DT_DEV_VIEWPORT_MARGIN 0.125f
 
 const gchar *dt_dev_histogram_type_names[DT_DEV_HISTOGRAM_N] = { "logarithmic", "linear", "waveform" };
 
@@ -176,6 +178,13 @@ void dt_dev_invalidate(dt_develop_t *dev)
   if(dev->preview_pipe) dev->preview_pipe->input_timestamp = dev->timestamp;
 }
 
+void dt_dev_invalidate_zoom(dt_develop_t *dev)
+{
+  dev->image_status = DT_DEV_PIXELPIPE_DIRTY;
+  // abort a run for the old viewport, the job will restart with the current one.
+  if(dev->pipe) dev->pipe->changed |= DT_DEV_PIPE_ZOOMED;
+}
+
 void dt_dev_invalidate_all(dt_develop_t *dev)
 {
   dev->image_status = dev->preview_status = DT_DEV_PIXELPIPE_DIRTY;
@@ -312,8 +321,8 @@ void dt_dev_process_image_job(dt_develop_t *dev)
   }
 
   dt_dev_zoom_t zoom;
-  float zoom_x, zoom_y, scale;
-  int window_width, window_height, x, y, closeup;
+  float zoom_x, zoom_y;
+  int closeup;
   dt_dev_pixelpipe_change_t pipe_changed;
 
 // adjust pipeline according to changed flag set by {add,pop}_history_item.
@@ -346,21 +355,12 @@ restart:
     dt_control_set_dev_zoom_y(zoom_y);
   }
 
-  scale = dt_dev_get_zoom_scale(dev, zoom, 1.0f, 0) * darktable.gui->ppd;
-  window_width = dev->width * darktable.gui->ppd;
-  window_height = dev->height * darktable.gui->ppd;
-  if(closeup)
-  {
-    window_width /= 2;
-    window_height /= 2;
-  }
-  const int wd = MIN(window_width, dev->pipe->processed_width * scale);
-  const int ht = MIN(window_height, dev->pipe->processed_height * scale);
-  x = MAX(0, scale * dev->pipe->processed_width  * (.5 + zoom_x) - wd / 2);
-  y = MAX(0, scale * dev->pipe->processed_height * (.5 + zoom_y) - ht / 2);
+  // render a margin around the view, so the gui can serve small pans and zooms from it until we're done.
+  dt_dev_viewport_t vp;
+  dt_dev_get_viewport(dev, &vp, DT_DEV_VIEWPORT_MARGIN);
 
   dt_get_times(&start);
-  if(dt_dev_pixelpipe_process(dev->pipe, dev, x, y, wd, ht, scale))
+  if(dt_dev_pixelpipe_process(dev->pipe, dev, vp.x, vp.y, vp.width, vp.height, vp.scale))
   {
     // interrupted because image changed?
     if(dev->image_force_reload)
@@ -1222,6 +1222,24 @@ void dt_dev_get_pointer_zoom_pos(dt_develop_t *dev, const float px, const float
   *zoom_y = zoom2_y;
 }
 
+void dt_dev_get_viewport(dt_develop_t *dev, dt_dev_viewport_t *vp, const float margin)
+{
+  const dt_dev_zoom_t zoom = dt_control_get_dev_zoom();
+  const int closeup = dt_control_get_dev_closeup();
+  const float ppd = darktable.gui->ppd;
+  int window_width = dev->width * ppd;
+  int window_height = dev->height * ppd;
+  // closeup renders at 1:1 and doubles the pixels when drawing
+  if(closeup)
+  {
+    window_width /= 2;
+    window_height /= 2;
+  }
+  dt_dev_viewport_compute(vp, dt_dev_get_zoom_scale(dev, zoom, 1.0f, 0) * ppd, dt_control_get_dev_zoom_x(),
+                          dt_control_get_dev_zoom_y(), window_width, window_height,
+                          dev->pipe->processed_width, dev->pipe->processed_height, margin);
+}
+
 void dt_dev_get_history_item_label(dt_dev_history_item_t *hist, char *label, const int cnt)
 {
   gchar *module_label = dt_history_item_get_name(hist->module);
@@ -1338,9 +1356,10 @@ void dt_dev_masks_selection_change(dt_develop_t *dev, int selectid, int throw_ev
     dev->proxy.masks.selection_change(dev->proxy.masks.module, selectid, throw_event);
 }
 
-void dt_dev_snapshot_request(dt_develop_t *dev, const char *filename)
+void dt_dev_snapshot_request(dt_develop_t *dev, struct dt_dev_snapshot_store_t *store, const uint32_t id)
 {
-  dev->proxy.snapshot.filename = filename;
+  dev->proxy.snapshot.store = store;
+  dev->proxy.snapshot.id = id;
   dev->proxy.snapshot.request = TRUE;
   dt_control_queue_redraw_center();
 }
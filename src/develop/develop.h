@@ -27,6 +27,7 @@
 #include "common/dtpthread.h"
 #include "control/settings.h"
 #include "develop/imageop.h"
+#include "develop/viewport.h"
 #include "common/image.h"
 
 struct dt_iop_module_t;
@@ -68,6 +69,7 @@ typedef enum dt_dev_pixelpipe_status_t
 extern const gchar *dt_dev_histogram_type_names[];
 
 struct dt_dev_pixelpipe_t;
+struct dt_dev_snapshot_store_t;
 typedef struct dt_develop_t
 {
   int32_t gui_attached; // != 0 if the gui should be notified of changes in hist stack and modules should be
@@ -161,9 +163,10 @@ typedef struct dt_develop_t
     struct
     {
       // this flag is set by snapshot plugin to signal that expose of darkroom
-      // should store cairo surface as snapshot to disk using filename.
+      // should put its cairo surface into the store as snapshot id.
       gboolean request;
-      const gchar *filename;
+      struct dt_dev_snapshot_store_t *store;
+      uint32_t id;
     } snapshot;
 
     // masks plugin hooks
@@ -214,6 +217,8 @@ void dt_dev_write_history(dt_develop_t *dev);
 void dt_dev_read_history(dt_develop_t *dev);
 
 void dt_dev_invalidate(dt_develop_t *dev);
+// only zoom or pan changed: the last main pipe output is shown reprojected until the new one is done
+void dt_dev_invalidate_zoom(dt_develop_t *dev);
 // also invalidates preview (which is unaffected by resize/zoom/pan)
 void dt_dev_invalidate_all(dt_develop_t *dev);
 void dt_dev_set_histogram(dt_develop_t *dev);
@@ -229,6 +234,8 @@ float dt_dev_get_zoom_scale(dt_develop_t *dev, dt_dev_zoom_t zoom, int closeup_f
 void dt_dev_get_pointer_zoom_pos(dt_develop_t *dev, const float px, const float py, float *zoom_x,
                                  float *zoom_y);
 
+/** the viewport the center view currently wants the main pipe to render, see develop/viewport.h. */
+void dt_dev_get_viewport(dt_develop_t *dev, dt_dev_viewport_t *vp, const float margin);
 
 void dt_dev_configure(dt_develop_t *dev, int wd, int ht);
 void dt_dev_invalidate_from_gui(dt_develop_t *dev);
@@ -265,7 +272,7 @@ uint32_t dt_dev_modulegroups_get(dt_develop_t *dev);
 gboolean dt_dev_modulegroups_test(dt_develop_t *dev, uint32_t group, uint32_t iop_group);
 
 /** request snapshot */
-void dt_dev_snapshot_request(dt_develop_t *dev, const char *filename);
+void dt_dev_snapshot_request(dt_develop_t *dev, struct dt_dev_snapshot_store_t *store, const uint32_t id);
 
 /** update gliding average for pixelpipe delay */
 void dt_dev_average_delay_update(const dt_times_t *start, uint32_t *average_delay);
@@ -281,6 +281,12 @@ int dt_iop_load_module_so(dt_iop_module_so_t *module, const char *libname, const
     module->distort_transform = default_distort_transform;
   if(!g_module_symbol(module->module, "distort_backtransform", (gpointer) & (module->distort_backtransform)))
     module->distort_backtransform = default_distort_backtransform;
+  if(!g_module_symbol(module->module, "transfer_function", (gpointer) & (module->transfer_function)))
+    module->transfer_function = NULL;
+  if(!g_module_symbol(module->module, "mosaic_radius", (gpointer) & (module->mosaic_radius)))
+    module->mosaic_radius = NULL;
+  if(!g_module_symbol(module->module, "process_mosaic", (gpointer) & (module->process_mosaic)))
+    module->process_mosaic = NULL;
 
   if(!g_module_symbol(module->module, "modify_roi_in", (gpointer) & (module->modify_roi_in)))
     module->modify_roi_in = dt_iop_modify_roi_in;
@@ -390,6 +396,9 @@ static int dt_iop_load_module_by_so(dt_iop_module_t *module, dt_iop_module_so_t
   module->process_tiling_cl = so->process_tiling_cl;
   module->distort_transform = so->distort_transform;
   module->distort_backtransform = so->distort_backtransform;
+  module->transfer_function = so->transfer_function;
+  module->mosaic_radius = so->mosaic_radius;
+  module->process_mosaic = so->process_mosaic;
   module->modify_roi_in = so->modify_roi_in;
   module->modify_roi_out = so->modify_roi_out;
   module->legacy_params = so->legacy_params;
@@ -84,9 +84,18 @@ typedef enum dt_iop_flags_t
   IOP_FLAGS_PREVIEW_NON_OPENCL
   = 1 << 8, // Preview pixelpipe of this module must not run on GPU but always on CPU
   IOP_FLAGS_NO_HISTORY_STACK = 1 << 9, // This iop will never show up in the history stack
-  IOP_FLAGS_NO_MASKS = 1 << 10         // The module doesn't support masks (used with SUPPORT_BLENDING)
+  IOP_FLAGS_NO_MASKS = 1 << 10,        // The module doesn't support masks (used with SUPPORT_BLENDING)
+  IOP_FLAGS_PACKED_CACHE = 1 << 11     // The 4xfloat output may be parked as half floats in the pixelpipe cache
 } dt_iop_flags_t;
 
+/** kinds of pointwise transfer functions a module can report, see transfer_function() */
+typedef enum dt_iop_transfer_t
+{
+  DT_IOP_TRANSFER_NONE = 0,        // not expressible as such with the current params
+  DT_IOP_TRANSFER_PER_CHANNEL = 1, // out[c] = f_c(in[c]) for the three color channels
+  DT_IOP_TRANSFER_SCALE_CHROMA = 2 // Lab only: out[0] = f(in[0]), out[1,2] = in[1,2] * s(in[0])
+} dt_iop_transfer_t;
+
 /** status of a module*/
 typedef enum dt_iop_module_state_t
 {
@@ -233,6 +242,13 @@ typedef struct dt_iop_module_so_t
   int (*distort_backtransform)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                                float *points, size_t points_count);
 
+  dt_iop_transfer_t (*transfer_function)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                                         const float *const in, float *const out, const int num);
+  int (*mosaic_radius)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece);
+  void (*process_mosaic)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                         const void *const in, float *const out, const struct dt_iop_roi_t *const roi,
+                         const int row, const int num);
+
   // introspection related callbacks
   gboolean have_introspection;
   dt_introspection_t *(*get_introspection)();
@@ -428,6 +444,22 @@ typedef struct dt_iop_module_t
   int (*distort_backtransform)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                                float *points, size_t points_count);
 
+  /** optional: if the module currently is a pointwise curve, map num pixels (4 floats each, in and out
+   * may be the same) exactly like process() would and return which kind of curve it is. called with
+   * num == 0 only the kind is returned. used by the pixelpipe to fuse runs of such modules. */
+  dt_iop_transfer_t (*transfer_function)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                                         const float *const in, float *const out, const int num);
+  /** optional: if the module currently works on the raw mosaic row by row, return how many rows above and
+   * below a row it reads, -1 otherwise. used by the pixelpipe to fuse runs of such modules into one cache
+   * blocked pass, see develop/mosaicfusion.h. */
+  int (*mosaic_radius)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece);
+  /** process rows [row, row + num) of roi exactly like process() would, single threaded. in and out point
+   * to the first of these rows, in has the promised rows around them as far as they are inside roi. called
+   * once with num == 0 before the rows of every pass, in pipe order, to update piece->pipe. */
+  void (*process_mosaic)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                         const void *const in, float *const out, const struct dt_iop_roi_t *const roi,
+                         const int row, const int num);
+
   /** Key accelerator registration callbacks */
   void (*connect_key_accels)(struct dt_iop_module_t *self);
   void (*original_connect_key_accels)(struct dt_iop_module_t *self);
@@ -0,0 +1,191 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "develop/mosaicfusion.h"
+#include "develop/blend.h"
+#include "common/darktable.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void _fusion_free(dt_dev_mosaic_fusion_t *fusion)
+{
+  if(!fusion) return;
+  free(fusion->pieces);
+  free(fusion->radius);
+  free(fusion);
+}
+
+void dt_dev_mosaic_fusion_cleanup(dt_dev_pixelpipe_t *pipe)
+{
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    dt_dev_mosaic_fusion_t *fusion = piece->mosaic_fusion;
+    if(!fusion) continue;
+    // curve fusion shares the flag, only touch our own pieces
+    for(int p = 0; p < fusion->num_pieces; p++) fusion->pieces[p]->fused = 0;
+    _fusion_free(fusion);
+    piece->mosaic_fusion = NULL;
+  }
+}
+
+static int _piece_radius(dt_dev_pixelpipe_iop_t *piece)
+{
+  dt_iop_module_t *module = piece->module;
+  if(!module->mosaic_radius || !module->process_mosaic) return -1;
+
+  // blending needs the untouched output of every single module
+  const dt_develop_blend_params_t *const bp = (const dt_develop_blend_params_t *)piece->blendop_data;
+  if(bp && (bp->mask_mode & DEVELOP_MASK_ENABLED)) return -1;
+
+  // only a full single channel mosaic is handled
+  if(piece->colors != 1) return -1;
+
+  return module->mosaic_radius(module, piece);
+}
+
+static void _fuse_run(GList *run, const int num)
+{
+  // a single module is faster on its own
+  if(num < 2) return;
+
+  dt_dev_mosaic_fusion_t *fusion = (dt_dev_mosaic_fusion_t *)calloc(1, sizeof(dt_dev_mosaic_fusion_t));
+  if(!fusion) return;
+  fusion->num_pieces = num;
+  fusion->pieces = (dt_dev_pixelpipe_iop_t **)malloc(sizeof(dt_dev_pixelpipe_iop_t *) * num);
+  fusion->radius = (int *)malloc(sizeof(int) * num);
+  if(!fusion->pieces || !fusion->radius)
+  {
+    _fusion_free(fusion);
+    return;
+  }
+
+  int i = 0;
+  for(GList *l = run; l; l = g_list_next(l), i++)
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)l->data;
+    fusion->pieces[i] = piece;
+    fusion->radius[i] = _piece_radius(piece);
+    if(l->next) piece->fused = 1;
+  }
+  fusion->pieces[num - 1]->mosaic_fusion = fusion;
+
+  dt_print(DT_DEBUG_DEV, "[mosaic_fusion] fused %d modules into `%s'\n", num,
+           fusion->pieces[num - 1]->module->op);
+}
+
+void dt_dev_mosaic_fusion_update(dt_dev_pixelpipe_t *pipe)
+{
+  dt_dev_mosaic_fusion_cleanup(pipe);
+
+  // the darkroom keeps the output of every single module in its cache and shows
+  // what hotpixels did, so only pipes without gui get fused.
+  if(!(pipe->type & (DT_DEV_PIXELPIPE_EXPORT | DT_DEV_PIXELPIPE_THUMBNAIL))) return;
+
+  GList *run = NULL;
+  int num = 0;
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    // disabled pieces are skipped by the pipe anyways, they don't break a run
+    if(!piece->enabled) continue;
+
+    if(_piece_radius(piece) < 0)
+    {
+      _fuse_run(run, num);
+      g_list_free(run);
+      run = NULL;
+      num = 0;
+      continue;
+    }
+    run = g_list_append(run, piece);
+    num++;
+  }
+  _fuse_run(run, num);
+  g_list_free(run);
+}
+
+int dt_dev_mosaic_fusion_process(const dt_dev_mosaic_fusion_t *fusion, const void *const in, const int in_bpp,
+                                 float *const out, const dt_iop_roi_t *const roi)
+{
+  const int num = fusion->num_pieces;
+  const int width = roi->width;
+  const int height = roi->height;
+
+  // halo[p]: rows piece p needs beyond the band at its input, for itself and all pieces after it
+  int halo[num + 1];
+  halo[num] = 0;
+  for(int p = num - 1; p >= 0; p--) halo[p] = halo[p + 1] + fusion->radius[p];
+
+  // two ping-pong buffers per thread, large enough for the widest intermediate band. rows are
+  // placed such that they have the same alignment as in a full buffer, so modules can keep their
+  // aligned sse paths. the slack also allows reading a sample past the last row.
+  const size_t rows = DT_MOSAIC_FUSION_ROWS + 2 * halo[1];
+  const size_t bufsize = ((size_t)width * rows + 16 + 15) & ~(size_t)15;
+  const int nthreads = dt_get_num_threads();
+  float *const scratch = (float *)dt_alloc_align(64, sizeof(float) * 2 * bufsize * nthreads);
+  if(!scratch)
+  {
+    fprintf(stderr, "[mosaic_fusion] could not allocate band buffers\n");
+    return 1;
+  }
+
+  // let every module update the pipe in order, as if it had processed the whole image on its own
+  for(int p = 0; p < num; p++)
+  {
+    dt_dev_pixelpipe_iop_t *piece = fusion->pieces[p];
+    piece->module->process_mosaic(piece->module, piece, NULL, NULL, roi, 0, 0);
+  }
+
+  const int num_bands = (height + DT_MOSAIC_FUSION_ROWS - 1) / DT_MOSAIC_FUSION_ROWS;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for(int b = 0; b < num_bands; b++)
+  {
+    float *const buf = scratch + 2 * bufsize * dt_get_thread_num();
+    const int y0 = b * DT_MOSAIC_FUSION_ROWS;
+    const int y1 = MIN(height, y0 + DT_MOSAIC_FUSION_ROWS);
+
+    // input of the current piece, starting at row src_row
+    const char *src = (const char *)in;
+    size_t src_bpp = in_bpp;
+    int src_row = 0;
+    for(int p = 0; p < num; p++)
+    {
+      dt_dev_pixelpipe_iop_t *piece = fusion->pieces[p];
+      const int r0 = MAX(0, y0 - halo[p + 1]);
+      const int r1 = MIN(height, y1 + halo[p + 1]);
+      float *dst = (p == num - 1) ? out + (size_t)width * r0
+                                  : buf + (p & 1) * bufsize + (((size_t)width * r0) & 7);
+      piece->module->process_mosaic(piece->module, piece, src + src_bpp * width * (r0 - src_row), dst, roi,
+                                    r0, r1 - r0);
+      src = (const char *)dst;
+      src_bpp = sizeof(float);
+      src_row = r0;
+    }
+  }
+
+  dt_free_align(scratch);
+  return 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
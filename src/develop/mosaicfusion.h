@@ -0,0 +1,58 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DT_DEVELOP_MOSAICFUSION_H
+#define DT_DEVELOP_MOSAICFUSION_H
+
+#include "develop/imageop.h"
+#include "develop/pixelpipe.h"
+
+/** number of output rows every thread pushes through the whole run at a time. */
+#define DT_MOSAIC_FUSION_ROWS 16
+
+/**
+ * a run of adjacent enabled modules which all work on the raw mosaic row by row (see mosaic_radius() and
+ * process_mosaic() in dt_iop_module_t), like rawprepare, temperature, highlights clipping and hotpixels,
+ * is processed in one pass by the last piece of the run. the image is cut into bands of
+ * DT_MOSAIC_FUSION_ROWS rows, and every band goes through all modules while it is still in cache. the
+ * rows a module reads around the band are recomputed by the modules before it.
+ *
+ * all other pieces of the run are skipped by the pixelpipe, just like disabled ones.
+ */
+typedef struct dt_dev_mosaic_fusion_t
+{
+  int num_pieces;
+  struct dt_dev_pixelpipe_iop_t **pieces; // the fused run in pipe order
+  int *radius;                            // rows read above and below a row, per piece
+} dt_dev_mosaic_fusion_t;
+
+/** (re)computes which pieces of the pipe get fused. call after all params have been committed. */
+void dt_dev_mosaic_fusion_update(struct dt_dev_pixelpipe_t *pipe);
+
+/** drops all fusion data of the pipe, all pieces are processed on their own again. */
+void dt_dev_mosaic_fusion_cleanup(struct dt_dev_pixelpipe_t *pipe);
+
+/** runs the fused modules on a full mosaic, in has in_bpp bytes per sample. returns non-zero on error. */
+int dt_dev_mosaic_fusion_process(const dt_dev_mosaic_fusion_t *fusion, const void *const in, const int in_bpp,
+                                 float *const out, const struct dt_iop_roi_t *const roi);
+
+#endif
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -19,7 +19,12 @@
 #include "develop/pixelpipe_cache.h"
 #include "develop/pixelpipe_hb.h"
 #include "libs/lib.h"
+#include "common/cpuid.h"
 #include <stdlib.h>
+#include <string.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 
 // TODO: make cache global (needs to be thread safe then)
@@ -31,6 +36,115 @@
 //   ping, pong, and priority buffer (focused plugin)
 // - drop read by the time another is requested (with priority, drop that, or alternating ping and pong?)
 
+
+static int _have_f16c = -1;
+
+// round to nearest even, overflow goes to inf. this is what vcvtps2ph does as well.
+static inline uint16_t _float_to_half(const float f)
+{
+  union
+  {
+    float f;
+    uint32_t i;
+  } u = { .f = f };
+  const uint32_t sign = (u.i >> 16) & 0x8000;
+  const uint32_t absf = u.i & 0x7fffffff;
+  if(absf >= 0x7f800000) return sign | 0x7c00 | (absf > 0x7f800000 ? 0x200 : 0); // inf/nan
+  if(absf >= 0x477ff000) return sign | 0x7c00;                                    // overflow
+  if(absf < 0x38800000)
+  {
+    // denormal half
+    const uint32_t shift = 126 - (absf >> 23);
+    if(shift > 24) return sign;
+    const uint32_t mant = (absf & 0x7fffff) | 0x800000;
+    const uint32_t h = mant >> shift;
+    const uint32_t rem = mant & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+    return sign | (h + (rem > halfway || (rem == halfway && (h & 1))));
+  }
+  const uint32_t h = ((absf - 0x38000000) >> 13);
+  const uint32_t rem = absf & 0x1fff;
+  return sign | (h + (rem > 0x1000 || (rem == 0x1000 && (h & 1))));
+}
+
+static inline float _half_to_float(const uint16_t h)
+{
+  union
+  {
+    float f;
+    uint32_t i;
+  } u;
+  const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  const uint32_t exp = (h >> 10) & 0x1f;
+  const uint32_t mant = h & 0x3ff;
+  if(exp == 0x1f)
+    u.i = sign | 0x7f800000 | (mant << 13);
+  else if(exp)
+    u.i = sign | ((exp + 112) << 23) | (mant << 13);
+  else
+  {
+    // denormal half, exact in float
+    u.f = mant * (1.0f / (1 << 24));
+    u.i |= sign;
+  }
+  return u.f;
+}
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+__attribute__((target("f16c"))) static void _pack_f16c(const float *const in, uint16_t *const out,
+                                                        const size_t n)
+{
+  for(size_t k = 0; k < n; k += 4)
+    _mm_storel_epi64((__m128i *)(out + k), _mm_cvtps_ph(_mm_load_ps(in + k), 0));
+}
+
+__attribute__((target("f16c"))) static void _unpack_f16c(const uint16_t *const in, float *const out,
+                                                          const size_t n)
+{
+  for(size_t k = 0; k < n; k += 4) _mm_store_ps(out + k, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)(in + k))));
+}
+#endif
+
+// n floats, a multiple of 4. buffers are split into blocks so all threads help.
+#define PACK_BLOCK 0x10000
+static void _pack(const float *const in, uint16_t *const out, const size_t n)
+{
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(size_t b = 0; b < n; b += PACK_BLOCK)
+  {
+    const size_t len = MIN(PACK_BLOCK, n - b);
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+    if(_have_f16c)
+    {
+      _pack_f16c(in + b, out + b, len);
+      continue;
+    }
+#endif
+    for(size_t k = b; k < b + len; k++) out[k] = _float_to_half(in[k]);
+  }
+}
+
+static void _unpack(const uint16_t *const in, float *const out, const size_t n)
+{
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(size_t b = 0; b < n; b += PACK_BLOCK)
+  {
+    const size_t len = MIN(PACK_BLOCK, n - b);
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+    if(_have_f16c)
+    {
+      _unpack_f16c(in + b, out + b, len);
+      continue;
+    }
+#endif
+    for(size_t k = b; k < b + len; k++) out[k] = _half_to_float(in[k]);
+  }
+}
+#undef PACK_BLOCK
+
 int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size)
 {
   cache->entries = entries;
@@ -38,6 +152,12 @@ int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, si
   cache->size = (size_t *)calloc(entries, sizeof(size_t));
   cache->hash = (uint64_t *)calloc(entries, sizeof(uint64_t));
   cache->used = (int32_t *)calloc(entries, sizeof(int32_t));
+  cache->packable = (int32_t *)calloc(entries, sizeof(int32_t));
+  cache->packed_entries = 0;
+  cache->packed_data = NULL;
+  cache->packed_size = NULL;
+  cache->packed_hash = NULL;
+  cache->packed_used = NULL;
   for(int k = 0; k < entries; k++)
   {
     if(size)
@@ -53,7 +173,7 @@ int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, si
     cache->hash[k] = -1;
     cache->used[k] = 0;
   }
-  cache->queries = cache->misses = 0;
+  cache->queries = cache->misses = cache->unpacked = 0;
   return 1;
 
 alloc_memory_fail:
@@ -66,10 +186,27 @@ alloc_memory_fail:
   free(cache->size);
   free(cache->hash);
   free(cache->used);
+  free(cache->packable);
 
   return 0;
 }
 
+void dt_dev_pixelpipe_cache_init_packed(dt_dev_pixelpipe_cache_t *cache, int entries)
+{
+  if(entries <= 0) return;
+#if defined(__i386__) || defined(__x86_64__)
+  if(_have_f16c < 0) _have_f16c = (dt_detect_cpu_features() & CPU_FLAG_F16C) != 0;
+#else
+  _have_f16c = 0;
+#endif
+  cache->packed_entries = entries;
+  cache->packed_data = (uint16_t **)calloc(entries, sizeof(uint16_t *));
+  cache->packed_size = (size_t *)calloc(entries, sizeof(size_t));
+  cache->packed_hash = (uint64_t *)calloc(entries, sizeof(uint64_t));
+  cache->packed_used = (int32_t *)calloc(entries, sizeof(int32_t));
+  for(int k = 0; k < entries; k++) cache->packed_hash[k] = -1;
+}
+
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache)
 {
   for(int k = 0; k < cache->entries; k++) dt_free_align(cache->data[k]);
@@ -77,6 +214,12 @@ void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache)
   free(cache->hash);
   free(cache->used);
   free(cache->size);
+  free(cache->packable);
+  for(int k = 0; k < cache->packed_entries; k++) dt_free_align(cache->packed_data[k]);
+  free(cache->packed_data);
+  free(cache->packed_size);
+  free(cache->packed_hash);
+  free(cache->packed_used);
 }
 
 uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const dt_iop_roi_t *roi, dt_dev_pixelpipe_t *pipe, int module)
@@ -119,6 +262,8 @@ int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint
   // search for hash in cache
   for(int32_t k = 0; k < cache->entries; k++)
     if(cache->hash[k] == hash) return 1;
+  for(int32_t k = 0; k < cache->packed_entries; k++)
+    if(cache->packed_hash[k] == hash) return 1;
   return 0;
 }
 
@@ -134,6 +279,57 @@ int dt_dev_pixelpipe_cache_get(dt_dev_pixelpipe_cache_t *cache, const uint64_t h
   return dt_dev_pixelpipe_cache_get_weighted(cache, hash, size, data, 0);
 }
 
+// moves the contents of the given line to the least recently used packed line,
+// except for the one holding keep (which is about to be unparked)
+static void _park(dt_dev_pixelpipe_cache_t *cache, const int line, const uint64_t keep)
+{
+  if(!cache->packed_entries) return;
+  int max_used = -1, max = -1;
+  for(int k = 0; k < cache->packed_entries; k++)
+  {
+    if(cache->packed_hash[k] == cache->hash[line]) return; // already there
+    if(cache->packed_hash[k] != keep && cache->packed_used[k] > max_used)
+    {
+      max_used = cache->packed_used[k];
+      max = k;
+    }
+  }
+  if(max < 0) return;
+  for(int k = 0; k < cache->packed_entries; k++) cache->packed_used[k]++;
+  const size_t n = cache->size[line] / sizeof(float);
+  if(cache->packed_size[max] != cache->size[line])
+  {
+    dt_free_align(cache->packed_data[max]);
+    cache->packed_data[max] = (uint16_t *)dt_alloc_align(16, n * sizeof(uint16_t));
+    cache->packed_size[max] = cache->packed_data[max] ? cache->size[line] : 0;
+  }
+  if(!cache->packed_data[max])
+  {
+    cache->packed_hash[max] = -1;
+    return;
+  }
+  _pack((const float *)cache->data[line], cache->packed_data[max], n);
+  cache->packed_hash[max] = cache->hash[line];
+  cache->packed_used[max] = 0;
+}
+
+// restores a parked buffer into data, returns 1 if one was found
+static int _unpark(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size, void *data)
+{
+  for(int k = 0; k < cache->packed_entries; k++)
+  {
+    if(cache->packed_hash[k] == hash && cache->packed_size[k] >= size)
+    {
+      _unpack(cache->packed_data[k], (float *)data, size / sizeof(float));
+      // it lives in a full line now and will be parked again on eviction
+      cache->packed_hash[k] = -1;
+      cache->packed_used[k] = cache->packed_entries;
+      return 1;
+    }
+  }
+  return 0;
+}
+
 int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash,
                                         const size_t size, void **data, int weight)
 {
@@ -163,6 +359,7 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
     // kill LRU entry
     // printf("[pixelpipe_cache_get] hash not found, returning slot %d/%d age %d\n", max, cache->entries,
     // weight);
+    if(cache->packable[max] && cache->hash[max] != (uint64_t)-1) _park(cache, max, hash);
     if(cache->size[max] < size)
     {
       dt_free_align(cache->data[max]);
@@ -172,6 +369,13 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
     *data = cache->data[max];
     cache->hash[max] = hash;
     cache->used[max] = weight;
+    cache->packable[max] = 0;
+    if(*data && _unpark(cache, hash, size, *data))
+    {
+      cache->packable[max] = 1;
+      cache->unpacked++;
+      return 0;
+    }
     cache->misses++;
     return 1;
   }
@@ -185,6 +389,12 @@ void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache)
   {
     cache->hash[k] = -1;
     cache->used[k] = 0;
+    cache->packable[k] = 0;
+  }
+  for(int k = 0; k < cache->packed_entries; k++)
+  {
+    cache->packed_hash[k] = -1;
+    cache->packed_used[k] = 0;
   }
 }
 
@@ -206,6 +416,19 @@ void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *da
     if(cache->data[k] == data)
     {
       cache->hash[k] = -1;
+      cache->packable[k] = 0;
+    }
+  }
+}
+
+void dt_dev_pixelpipe_cache_set_packable(dt_dev_pixelpipe_cache_t *cache, void *data)
+{
+  if(!cache->packed_entries) return;
+  for(int k = 0; k < cache->entries; k++)
+  {
+    if(cache->data[k] == data)
+    {
+      cache->packable[k] = 1;
     }
   }
 }
@@ -218,6 +441,12 @@ void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache)
     printf("used %d by %" PRIu64 "", cache->used[k], cache->hash[k]);
     printf("\n");
   }
+  for(int k = 0; k < cache->packed_entries; k++)
+  {
+    printf("pixelpipe packed cacheline %d ", k);
+    printf("used %d by %" PRIu64 "", cache->packed_used[k], cache->packed_hash[k]);
+    printf("\n");
+  }
   printf("cache hit rate so far: %.3f\n", (cache->queries - cache->misses) / (float)cache->queries);
 }
 
@@ -35,9 +35,17 @@ typedef struct dt_dev_pixelpipe_cache_t
 #ifdef HAVE_OPENCL
   void **gpu_mem;
 #endif
+  int32_t *packable;
+  // lines evicted from above are parked here as half floats, if they are packable.
+  int32_t packed_entries;
+  uint16_t **packed_data;
+  size_t *packed_size; // size of the unpacked float buffer
+  uint64_t *packed_hash;
+  int32_t *packed_used;
   // profiling:
   uint64_t queries;
   uint64_t misses;
+  uint64_t unpacked;
 } dt_dev_pixelpipe_cache_t;
 
 /** constructs a new cache with given cache line count (entries) and float buffer entry size in bytes.
@@ -46,6 +54,10 @@ typedef struct dt_dev_pixelpipe_cache_t
 int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size);
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache);
 
+/** adds a second level of the given number of lines, which keeps evicted 4xfloat buffers as half floats.
+ * this is lossy, so only buffers marked with dt_dev_pixelpipe_cache_set_packable() go there. */
+void dt_dev_pixelpipe_cache_init_packed(dt_dev_pixelpipe_cache_t *cache, int entries);
+
 struct dt_iop_roi_t;
 /** creates a hopefully unique hash from the complete module stack up to the module-th. */
 uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const struct dt_iop_roi_t *roi,
@@ -73,6 +85,9 @@ void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data
 /** mark the given cache line pointer as invalid. */
 void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *data);
 
+/** marks the fully written 4xfloat buffer as allowed to be kept as half floats once it gets evicted. */
+void dt_dev_pixelpipe_cache_set_packable(dt_dev_pixelpipe_cache_t *cache, void *data);
+
 /** print out cache lines/hashes (debug). */
 void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache);
 
@@ -19,9 +19,12 @@
 #include "develop/pixelpipe.h"
 #include "develop/blend.h"
 #include "develop/tiling.h"
+#include "develop/curvefusion.h"
+#include "develop/mosaicfusion.h"
 #include "gui/gtk.h"
 #include "control/control.h"
 #include "control/signal.h"
+#include "control/conf.h"
 #include "common/opencl.h"
 #include "common/imageio.h"
 #include "libs/lib.h"
@@ -29,6 +32,7 @@
 #include "iop/colorout.h"
 #include "common/colorspaces.h"
 #include "common/histogram.h"
+#include "common/profiling.h"
 
 #include <assert.h>
 #include <string.h>
@@ -106,6 +110,7 @@ int dt_dev_pixelpipe_init_preview(dt_dev_pixelpipe_t *pipe)
   int res = dt_dev_pixelpipe_init_cached(
       pipe, 0, 5);
   pipe->type = DT_DEV_PIXELPIPE_PREVIEW;
+  if(res) dt_dev_pixelpipe_cache_init_packed(&(pipe->cache), dt_conf_get_int("pixelpipe_packed_cache_lines"));
   return res;
 }
 
@@ -115,6 +120,7 @@ int dt_dev_pixelpipe_init(dt_dev_pixelpipe_t *pipe)
   int res = dt_dev_pixelpipe_init_cached(
       pipe, 0, 5);
   pipe->type = DT_DEV_PIXELPIPE_FULL;
+  if(res) dt_dev_pixelpipe_cache_init_packed(&(pipe->cache), dt_conf_get_int("pixelpipe_packed_cache_lines"));
   return res;
 }
 
@@ -124,6 +130,8 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->changed = DT_DEV_PIPE_UNCHANGED;
   pipe->processed_width = pipe->backbuf_width = pipe->iwidth = 0;
   pipe->processed_height = pipe->backbuf_height = pipe->iheight = 0;
+  pipe->backbuf_x = pipe->backbuf_y = pipe->backbuf_timestamp = 0;
+  pipe->backbuf_scale = 0.0f;
   pipe->nodes = NULL;
   pipe->backbuf_size = size;
   if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size)) return 0;
@@ -170,6 +178,8 @@ void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe)
   //        (this is a circular dependency on busy_mutex and the gdk mutex)
   dt_pthread_mutex_lock(&pipe->busy_mutex);
   pipe->shutdown = 1;
+  dt_dev_curve_fusion_cleanup(pipe);
+  dt_dev_mosaic_fusion_cleanup(pipe);
   // destroy all nodes
   GList *nodes = pipe->nodes;
   while(nodes)
@@ -213,6 +223,9 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
       piece->data = NULL;
       piece->hash = 0;
       piece->process_cl_ready = 0;
+      piece->fusion = NULL;
+      piece->mosaic_fusion = NULL;
+      piece->fused = 0;
       dt_iop_init_pipe(piece->module, pipe, piece);
       pipe->nodes = g_list_append(pipe->nodes, piece);
     }
@@ -261,6 +274,8 @@ void dt_dev_pixelpipe_synch_all(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
     dt_dev_pixelpipe_synch(pipe, dev, history);
     history = g_list_next(history);
   }
+  dt_dev_curve_fusion_update(pipe);
+  dt_dev_mosaic_fusion_update(pipe);
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
@@ -269,6 +284,8 @@ void dt_dev_pixelpipe_synch_top(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
   dt_pthread_mutex_lock(&pipe->busy_mutex);
   GList *history = g_list_nth(dev->history, dev->history_end - 1);
   if(history) dt_dev_pixelpipe_synch(pipe, dev, history);
+  dt_dev_curve_fusion_update(pipe);
+  dt_dev_mosaic_fusion_update(pipe);
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
@@ -713,7 +730,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     module = (dt_iop_module_t *)modules->data;
     piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
     // skip this module?
-    if(!piece->enabled
+    if(!piece->enabled || piece->fused
        || (dev->gui_module && dev->gui_module->operation_tags_filter() & module->operation_tags()))
       return dt_dev_pixelpipe_process_rec(pipe, dev, output, cl_mem_output, out_bpp, &roi_in,
                                           g_list_previous(modules), g_list_previous(pieces), pos - 1);
@@ -742,6 +759,9 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       for(int k = 0; k < 3; k++) pipe->processed_maximum[k] = 1.0f;
     (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output);
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    if(dt_trace_enabled())
+      dt_trace_instant("cache", "pixelpipe cache hit", "\"module\":\"%s\",\"pipe\":\"%s\",\"bytes\":%zu",
+                       module ? module->op : "input", _pipe_type_to_str(pipe->type), bufsize);
     if(!modules) return 0;
     // go to post-collect directly:
     goto post_process_collect_info;
@@ -829,6 +849,9 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       }
     }
     dt_show_times(&start, "[dev_pixelpipe]", "initing base buffer [%s]", _pipe_type_to_str(pipe->type));
+    if(dt_trace_enabled())
+      dt_trace_span("module", "input", &start, "\"pipe\":\"%s\",\"bytes_out\":%zu,\"width\":%d,\"height\":%d",
+                    _pipe_type_to_str(pipe->type), bufsize, roi_out->width, roi_out->height);
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
   }
   else
@@ -965,7 +988,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
          are treated in the same manner. */
 
       /* try to enter opencl path after checking some module specific pre-requisites */
-      if(module->process_cl && piece->process_cl_ready
+      if(module->process_cl && piece->process_cl_ready && !piece->fusion && !piece->mosaic_fusion
          && !((pipe->type == DT_DEV_PIXELPIPE_PREVIEW) && (module->flags() & IOP_FLAGS_PREVIEW_NON_OPENCL)))
       {
 
@@ -1387,8 +1410,26 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
             return 1;
           }
 
-          /* process module on cpu. use tiling if needed and possible. */
-          if((module->flags() & IOP_FLAGS_ALLOW_TILING)
+          /* process module on cpu. use tiling if needed and possible. a fused run of curves
+             or mosaic modules is applied in one go, pointwise or in bands, and never needs tiling. */
+          if(piece->fusion)
+          {
+            dt_dev_curve_fusion_process(piece->fusion, (const float *)input, (float *)*output, roi_out->width,
+                                        roi_out->height);
+            pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU);
+            pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
+          }
+          else if(piece->mosaic_fusion)
+          {
+            if(dt_dev_mosaic_fusion_process(piece->mosaic_fusion, input, in_bpp, (float *)*output, roi_out))
+            {
+              dt_pthread_mutex_unlock(&pipe->busy_mutex);
+              return 1;
+            }
+            pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU);
+            pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
+          }
+          else if((module->flags() & IOP_FLAGS_ALLOW_TILING)
              && !dt_tiling_piece_fits_host_memory(MAX(roi_in.width, roi_out->width),
                                                   MAX(roi_in.height, roi_out->height), MAX(in_bpp, bpp),
                                                   tiling.factor, tiling.overhead))
@@ -1509,8 +1550,26 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
           return 1;
         }
 
-        /* process module on cpu. use tiling if needed and possible. */
-        if((module->flags() & IOP_FLAGS_ALLOW_TILING)
+        /* process module on cpu. use tiling if needed and possible. a fused run of curves
+           or mosaic modules is applied in one go, pointwise or in bands, and never needs tiling. */
+        if(piece->fusion)
+        {
+          dt_dev_curve_fusion_process(piece->fusion, (const float *)input, (float *)*output, roi_out->width,
+                                      roi_out->height);
+          pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU);
+          pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
+        }
+        else if(piece->mosaic_fusion)
+        {
+          if(dt_dev_mosaic_fusion_process(piece->mosaic_fusion, input, in_bpp, (float *)*output, roi_out))
+          {
+            dt_pthread_mutex_unlock(&pipe->busy_mutex);
+            return 1;
+          }
+          pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU);
+          pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
+        }
+        else if((module->flags() & IOP_FLAGS_ALLOW_TILING)
            && !dt_tiling_piece_fits_host_memory(MAX(roi_in.width, roi_out->width),
                                                 MAX(roi_in.height, roi_out->height), MAX(in_bpp, bpp),
                                                 tiling.factor, tiling.overhead))
@@ -1596,8 +1655,26 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
         return 1;
       }
 
-      /* process module on cpu. use tiling if needed and possible. */
-      if((module->flags() & IOP_FLAGS_ALLOW_TILING)
+      /* process module on cpu. use tiling if needed and possible. a fused run of curves
+         or mosaic modules is applied in one go, pointwise or in bands, and never needs tiling. */
+      if(piece->fusion)
+      {
+        dt_dev_curve_fusion_process(piece->fusion, (const float *)input, (float *)*output, roi_out->width,
+                                    roi_out->height);
+        pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU);
+        pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
+      }
+      else if(piece->mosaic_fusion)
+      {
+        if(dt_dev_mosaic_fusion_process(piece->mosaic_fusion, input, in_bpp, (float *)*output, roi_out))
+        {
+          dt_pthread_mutex_unlock(&pipe->busy_mutex);
+          return 1;
+        }
+        pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU);
+        pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
+      }
+      else if((module->flags() & IOP_FLAGS_ALLOW_TILING)
          && !dt_tiling_piece_fits_host_memory(MAX(roi_in.width, roi_out->width),
                                               MAX(roi_in.height, roi_out->height), MAX(in_bpp, bpp),
                                               tiling.factor, tiling.overhead))
@@ -1670,8 +1747,26 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       return 1;
     }
 
-    /* process module on cpu. use tiling if needed and possible. */
-    if((module->flags() & IOP_FLAGS_ALLOW_TILING)
+    /* process module on cpu. use tiling if needed and possible. a fused run of curves
+       or mosaic modules is applied in one go, pointwise or in bands, and never needs tiling. */
+    if(piece->fusion)
+    {
+      dt_dev_curve_fusion_process(piece->fusion, (const float *)input, (float *)*output, roi_out->width,
+                                  roi_out->height);
+      pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU);
+      pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
+    }
+    else if(piece->mosaic_fusion)
+    {
+      if(dt_dev_mosaic_fusion_process(piece->mosaic_fusion, input, in_bpp, (float *)*output, roi_out))
+      {
+        dt_pthread_mutex_unlock(&pipe->busy_mutex);
+        return 1;
+      }
+      pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU);
+      pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
+    }
+    else if((module->flags() & IOP_FLAGS_ALLOW_TILING)
        && !dt_tiling_piece_fits_host_memory(MAX(roi_in.width, roi_out->width),
                                             MAX(roi_in.height, roi_out->height), MAX(in_bpp, bpp),
                                             tiling.factor, tiling.overhead))
@@ -1746,6 +1841,15 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
             ? "GPU"
             : pixelpipe_flow & PIXELPIPE_FLOW_BLENDED_ON_CPU ? "CPU" : "",
         _pipe_type_to_str(pipe->type));
+    if(dt_trace_enabled())
+      dt_trace_span("module", module_label,
+                    &start, "\"module\":\"%s\",\"pipe\":\"%s\",\"device\":\"%s\",\"tiling\":%d,"
+                            "\"fused_curves\":%d,\"bytes_in\":%zu,\"bytes_out\":%zu,\"width\":%d,\"height\":%d",
+                    module->op, _pipe_type_to_str(pipe->type),
+                    pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_ON_GPU ? "GPU" : "CPU",
+                    !!(pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_WITH_TILING),
+                    piece->fusion ? piece->fusion->num_pieces : 0,
+                    (size_t)in_bpp * roi_in.width * roi_in.height, bufsize, roi_out->width, roi_out->height);
     g_free(module_label);
     // in case we get this buffer from the cache, also get the processed max:
     for(int k = 0; k < 3; k++) piece->processed_maximum[k] = pipe->processed_maximum[k];
@@ -1756,6 +1860,13 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       // the user is likely to change that one soon, so keep it in cache.
       dt_dev_pixelpipe_cache_reweight(&(pipe->cache), input);
     }
+    // the module is fine with its output being kept as half floats once it gets evicted
+    if(bpp == 4 * sizeof(float) && *cl_mem_output == NULL && (module->flags() & IOP_FLAGS_PACKED_CACHE))
+    {
+      dt_pthread_mutex_lock(&pipe->busy_mutex);
+      dt_dev_pixelpipe_cache_set_packable(&(pipe->cache), *output);
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    }
 #ifndef _DEBUG
     if(darktable.unmuted & DT_DEBUG_NAN)
 #endif
@@ -2199,6 +2310,8 @@ void dt_dev_pixelpipe_disable_after(dt_dev_pixelpipe_t *pipe, const char *op)
     if(!nodes) break;
     piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
   }
+  dt_dev_curve_fusion_update(pipe);
+  dt_dev_mosaic_fusion_update(pipe);
 }
 
 void dt_dev_pixelpipe_disable_before(dt_dev_pixelpipe_t *pipe, const char *op)
@@ -2213,6 +2326,8 @@ void dt_dev_pixelpipe_disable_before(dt_dev_pixelpipe_t *pipe, const char *op)
     if(!nodes) break;
     piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
   }
+  dt_dev_curve_fusion_update(pipe);
+  dt_dev_mosaic_fusion_update(pipe);
 }
 
 static int dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
@@ -2266,6 +2381,8 @@ static int dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, d
 int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width, int height,
                              float scale)
 {
+  dt_times_t start = { 0 };
+  if(dt_trace_enabled()) dt_get_times(&start);
   pipe->processing = 1;
   pipe->opencl_enabled = dt_opencl_update_enabled(); // update enabled flag from preferences
   pipe->devid = (pipe->opencl_enabled) ? dt_opencl_lock_device(pipe->type)
@@ -2345,6 +2462,8 @@ restart:
     dt_dev_pixelpipe_change(pipe, dev);
     dt_print(DT_DEBUG_OPENCL, "[pixelpipe_process] [%s] falling back to cpu path\n",
              _pipe_type_to_str(pipe->type));
+    if(dt_trace_enabled())
+      dt_trace_instant("pixelpipe", "opencl fallback", "\"pipe\":\"%s\"", _pipe_type_to_str(pipe->type));
     goto restart; // try again (this time without opencl)
   }
 
@@ -2354,6 +2473,15 @@ restart:
     dt_opencl_unlock_device(pipe->devid);
     pipe->devid = -1;
   }
+
+  if(dt_trace_enabled())
+  {
+    dt_trace_span("pixelpipe", _pipe_type_to_str(pipe->type), &start,
+                  "\"image\":%d,\"x\":%d,\"y\":%d,\"width\":%d,\"height\":%d,\"scale\":%f,\"aborted\":%d",
+                  pipe->image.id, x, y, width, height, scale, err);
+    dt_trace_flush();
+  }
+
   // ... and in case of other errors ...
   if(err)
   {
@@ -2367,6 +2495,10 @@ restart:
   pipe->backbuf = buf;
   pipe->backbuf_width = width;
   pipe->backbuf_height = height;
+  pipe->backbuf_x = x;
+  pipe->backbuf_y = y;
+  pipe->backbuf_scale = scale;
+  pipe->backbuf_timestamp = pipe->input_timestamp;
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
 
   // printf("pixelpipe homebrew process end\n");
@@ -56,6 +56,9 @@ typedef struct dt_dev_pixelpipe_iop_t
       buf_out;                // theoretical full buffer regions of interest, as passed through modify_roi_out
   int process_cl_ready;       // set this to 0 in commit_params to temporarily disable the use of process_cl
   float processed_maximum[3]; // sensor saturation after this iop, used internally for caching
+  struct dt_dev_curve_fusion_t *fusion; // composed curves of a fused run of modules ending with this piece
+  struct dt_dev_mosaic_fusion_t *mosaic_fusion; // banded run of raw mosaic modules ending with this piece
+  int fused; // processing has been folded into a later piece, skip it
 } dt_dev_pixelpipe_iop_t;
 
 typedef enum dt_dev_pixelpipe_change_t
@@ -98,6 +101,11 @@ typedef struct dt_dev_pixelpipe_t
   uint8_t *backbuf;
   size_t backbuf_size;
   int backbuf_width, backbuf_height;
+  // region of the processed image the backbuffer shows: origin and scale as passed to process(), and the
+  // input timestamp it was rendered for
+  int backbuf_x, backbuf_y;
+  float backbuf_scale;
+  int backbuf_timestamp;
   uint64_t backbuf_hash;
   dt_pthread_mutex_t backbuf_mutex, busy_mutex;
   // working?
@@ -0,0 +1,202 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "develop/snapshots.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+typedef struct dt_dev_snapshot_t
+{
+  uint32_t id;
+  int width, height, stride;
+  cairo_surface_t *surface; // ready to blit, NULL while only the compressed copy is kept
+  uint8_t *packed;          // zlib compressed pixels
+  size_t packed_size;
+} dt_dev_snapshot_t;
+
+static size_t _snapshot_size(const dt_dev_snapshot_t *s)
+{
+  return (s->surface ? (size_t)s->stride * s->height : 0) + s->packed_size;
+}
+
+static void _snapshot_free(dt_dev_snapshot_t *s)
+{
+  if(s->surface) cairo_surface_destroy(s->surface);
+  free(s->packed);
+  free(s);
+}
+
+static GList *_snapshot_find(dt_dev_snapshot_store_t *store, const uint32_t id)
+{
+  for(GList *l = store->lru; l; l = g_list_next(l))
+    if(((dt_dev_snapshot_t *)l->data)->id == id) return l;
+  return NULL;
+}
+
+static void _snapshot_unlink(dt_dev_snapshot_store_t *store, GList *l)
+{
+  dt_dev_snapshot_t *s = (dt_dev_snapshot_t *)l->data;
+  store->used -= _snapshot_size(s);
+  store->lru = g_list_delete_link(store->lru, l);
+  _snapshot_free(s);
+}
+
+static void _snapshot_pack(dt_dev_snapshot_store_t *store, dt_dev_snapshot_t *s)
+{
+  const size_t size = (size_t)s->stride * s->height;
+  uLongf packed_size = compressBound(size);
+  uint8_t *packed = (uint8_t *)malloc(packed_size);
+  if(!packed) return;
+  cairo_surface_flush(s->surface);
+  if(compress2(packed, &packed_size, cairo_image_surface_get_data(s->surface), size, Z_BEST_SPEED) != Z_OK
+     || packed_size >= size)
+  {
+    free(packed);
+    return;
+  }
+  store->used -= _snapshot_size(s);
+  s->packed = realloc(packed, packed_size);
+  s->packed_size = packed_size;
+  cairo_surface_destroy(s->surface);
+  s->surface = NULL;
+  store->used += _snapshot_size(s);
+}
+
+static int _snapshot_unpack(dt_dev_snapshot_store_t *store, dt_dev_snapshot_t *s)
+{
+  cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, s->width, s->height);
+  uLongf size = (size_t)s->stride * s->height;
+  if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS
+     || uncompress(cairo_image_surface_get_data(surface), &size, s->packed, s->packed_size) != Z_OK)
+  {
+    cairo_surface_destroy(surface);
+    return 1;
+  }
+  cairo_surface_mark_dirty(surface);
+  store->used -= _snapshot_size(s);
+  free(s->packed);
+  s->packed = NULL;
+  s->packed_size = 0;
+  s->surface = surface;
+  store->used += _snapshot_size(s);
+  return 0;
+}
+
+// bring the store back under budget, sparing the most recently used snapshot
+static void _snapshot_gc(dt_dev_snapshot_store_t *store)
+{
+  GList *keep = g_list_last(store->lru);
+  if(store->compress)
+    for(GList *l = store->lru; l != keep && store->used > store->budget; l = g_list_next(l))
+    {
+      dt_dev_snapshot_t *s = (dt_dev_snapshot_t *)l->data;
+      if(s->surface) _snapshot_pack(store, s);
+    }
+  while(store->lru != keep && store->used > store->budget) _snapshot_unlink(store, store->lru);
+}
+
+void dt_dev_snapshot_store_init(dt_dev_snapshot_store_t *store, const size_t budget, const gboolean compress)
+{
+  dt_pthread_mutex_init(&store->lock, NULL);
+  store->budget = budget;
+  store->used = 0;
+  store->compress = compress;
+  store->lru = NULL;
+}
+
+void dt_dev_snapshot_store_cleanup(dt_dev_snapshot_store_t *store)
+{
+  while(store->lru) _snapshot_unlink(store, store->lru);
+  dt_pthread_mutex_destroy(&store->lock);
+}
+
+void dt_dev_snapshot_store_put(dt_dev_snapshot_store_t *store, const uint32_t id, cairo_surface_t *surface)
+{
+  const int width = cairo_image_surface_get_width(surface);
+  const int height = cairo_image_surface_get_height(surface);
+
+  // a private copy, the darkroom keeps drawing into its own surface
+  cairo_surface_t *copy = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+  if(cairo_surface_status(copy) != CAIRO_STATUS_SUCCESS)
+  {
+    cairo_surface_destroy(copy);
+    return;
+  }
+  cairo_t *cr = cairo_create(copy);
+  cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+  cairo_set_source_surface(cr, surface, 0, 0);
+  cairo_paint(cr);
+  cairo_destroy(cr);
+
+  dt_dev_snapshot_t *s = (dt_dev_snapshot_t *)calloc(1, sizeof(dt_dev_snapshot_t));
+  s->id = id;
+  s->width = width;
+  s->height = height;
+  s->stride = cairo_image_surface_get_stride(copy);
+  s->surface = copy;
+
+  dt_pthread_mutex_lock(&store->lock);
+  GList *old = _snapshot_find(store, id);
+  if(old) _snapshot_unlink(store, old);
+  store->lru = g_list_append(store->lru, s);
+  store->used += _snapshot_size(s);
+  _snapshot_gc(store);
+  dt_pthread_mutex_unlock(&store->lock);
+}
+
+cairo_surface_t *dt_dev_snapshot_store_get(dt_dev_snapshot_store_t *store, const uint32_t id)
+{
+  cairo_surface_t *surface = NULL;
+  dt_pthread_mutex_lock(&store->lock);
+  GList *l = _snapshot_find(store, id);
+  if(l)
+  {
+    dt_dev_snapshot_t *s = (dt_dev_snapshot_t *)l->data;
+    store->lru = g_list_remove_link(store->lru, l);
+    store->lru = g_list_concat(store->lru, l);
+    if(s->surface || !_snapshot_unpack(store, s))
+    {
+      surface = cairo_surface_reference(s->surface);
+      _snapshot_gc(store);
+    }
+  }
+  dt_pthread_mutex_unlock(&store->lock);
+  return surface;
+}
+
+void dt_dev_snapshot_store_remove(dt_dev_snapshot_store_t *store, const uint32_t id)
+{
+  dt_pthread_mutex_lock(&store->lock);
+  GList *l = _snapshot_find(store, id);
+  if(l) _snapshot_unlink(store, l);
+  dt_pthread_mutex_unlock(&store->lock);
+}
+
+int dt_dev_snapshot_store_write_png(dt_dev_snapshot_store_t *store, const uint32_t id, const char *filename)
+{
+  cairo_surface_t *surface = dt_dev_snapshot_store_get(store, id);
+  if(!surface) return 1;
+  const int res = cairo_surface_write_to_png(surface, filename) != CAIRO_STATUS_SUCCESS;
+  cairo_surface_destroy(surface);
+  return res;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
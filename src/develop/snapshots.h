@@ -0,0 +1,59 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_DEVELOP_SNAPSHOTS_H
+#define DT_DEVELOP_SNAPSHOTS_H
+
+#include "common/dtpthread.h"
+
+#include <cairo.h>
+#include <glib.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+/**
+ * in-memory store for darkroom snapshots. snapshots are kept as ready to blit 8-bit surfaces
+ * under a byte budget. when the budget is exceeded the least recently used ones are first
+ * compressed, then dropped. the most recently stored or fetched snapshot is never touched.
+ */
+typedef struct dt_dev_snapshot_store_t
+{
+  dt_pthread_mutex_t lock;
+  size_t budget;     // bytes
+  size_t used;       // bytes held by surfaces and compressed copies
+  gboolean compress; // compress old snapshots before dropping them
+  GList *lru;        // dt_dev_snapshot_t, least recently used first
+} dt_dev_snapshot_store_t;
+
+void dt_dev_snapshot_store_init(dt_dev_snapshot_store_t *store, const size_t budget, const gboolean compress);
+void dt_dev_snapshot_store_cleanup(dt_dev_snapshot_store_t *store);
+
+/** copies the pixels of surface into the store as snapshot id, replacing an older one. */
+void dt_dev_snapshot_store_put(dt_dev_snapshot_store_t *store, const uint32_t id, cairo_surface_t *surface);
+
+/** a new reference on the surface of snapshot id, NULL if it's not (or no longer) stored. */
+cairo_surface_t *dt_dev_snapshot_store_get(dt_dev_snapshot_store_t *store, const uint32_t id);
+
+void dt_dev_snapshot_store_remove(dt_dev_snapshot_store_t *store, const uint32_t id);
+
+/** writes snapshot id to a png file, returns 0 on success. */
+int dt_dev_snapshot_store_write_png(dt_dev_snapshot_store_t *store, const uint32_t id, const char *filename);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
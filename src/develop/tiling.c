@@ -22,6 +22,7 @@
 #include "develop/blend.h"
 #include "common/opencl.h"
 #include "control/control.h"
+#include "control/conf.h"
 
 #include <string.h>
 #include <strings.h>
@@ -43,6 +44,10 @@
    Needs to be increased if tiling fails due to insufficient buffer sizes. */
 #define RESERVE 5
 
+/* memory limits, consulted for every tiled module */
+static dt_conf_handle_t _host_memory_limit = DT_CONF_HANDLE("host_memory_limit");
+static dt_conf_handle_t _singlebuffer_limit = DT_CONF_HANDLE("singlebuffer_limit");
+
 
 /* greatest common divisor */
 static unsigned _gcd(unsigned a, unsigned b)
@@ -607,7 +612,7 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
   }
 
   /* calculate optimal size of tiles */
-  float available = dt_conf_get_float("host_memory_limit") * 1024.0f * 1024.0f;
+  float available = dt_conf_handle_get_float(&_host_memory_limit) * 1024.0f * 1024.0f;
   assert(available >= 500.0f * 1024.0f * 1024.0f);
   /* correct for size of ivoid and ovoid which are needed on top of tiling */
   available = fmax(available - ((float)roi_out->width * roi_out->height * out_bpp)
@@ -617,7 +622,7 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
   /* we ignore the above value if singlebuffer_limit (is defined and) is higher than available/tiling.factor.
      this will mainly allow tiling for modules with high and "unpredictable" memory demand which is
      reflected in high values of tiling.factor (take bilateral noise reduction as an example). */
-  float singlebuffer = dt_conf_get_float("singlebuffer_limit") * 1024.0f * 1024.0f;
+  float singlebuffer = dt_conf_handle_get_float(&_singlebuffer_limit) * 1024.0f * 1024.0f;
   singlebuffer = fmax(singlebuffer, 2.0f * 1024.0f * 1024.0f);
   float factor = fmax(tiling.factor, 1.0f);
   float maxbuf = fmax(tiling.maxbuf, 1.0f);
@@ -863,7 +868,7 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
   }
 
   /* calculate optimal size of tiles */
-  float available = dt_conf_get_float("host_memory_limit") * 1024.0f * 1024.0f;
+  float available = dt_conf_handle_get_float(&_host_memory_limit) * 1024.0f * 1024.0f;
   assert(available >= 500.0f * 1024.0f * 1024.0f);
   /* correct for size of ivoid and ovoid which are needed on top of tiling */
   available = fmax(available - ((float)roi_out->width * roi_out->height * out_bpp)
@@ -873,7 +878,7 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
   /* we ignore the above value if singlebuffer_limit (is defined and) is higher than available/tiling.factor.
      this will mainly allow tiling for modules with high and "unpredictable" memory demand which is
      reflected in high values of tiling.factor (take bilateral noise reduction as an example). */
-  float singlebuffer = dt_conf_get_float("singlebuffer_limit") * 1024.0f * 1024.0f;
+  float singlebuffer = dt_conf_handle_get_float(&_singlebuffer_limit) * 1024.0f * 1024.0f;
   singlebuffer = fmax(singlebuffer, 2.0f * 1024.0f * 1024.0f);
   float factor = fmax(tiling.factor, 1.0f);
   float maxbuf = fmax(tiling.maxbuf, 1.0f);
@@ -0,0 +1,55 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "develop/viewport.h"
+
+#include <glib.h>
+
+void dt_dev_viewport_compute(dt_dev_viewport_t *vp, const float scale, const float zoom_x, const float zoom_y,
+                             const int window_width, const int window_height, const int procw,
+                             const int proch, const float margin)
+{
+  const int wd = MIN(window_width, procw * scale);
+  const int ht = MIN(window_height, proch * scale);
+  const int x = MAX(0, scale * procw * (.5 + zoom_x) - wd / 2);
+  const int y = MAX(0, scale * proch * (.5 + zoom_y) - ht / 2);
+  // grow by the margin, as far as the scaled image reaches
+  const int mx = margin * window_width, my = margin * window_height;
+  vp->x = MAX(0, x - mx);
+  vp->y = MAX(0, y - my);
+  vp->width = MAX(x + wd, MIN(x + wd + mx, (int)(procw * scale))) - vp->x;
+  vp->height = MAX(y + ht, MIN(y + ht + my, (int)(proch * scale))) - vp->y;
+  vp->scale = scale;
+}
+
+int dt_dev_viewport_reproject(const dt_dev_viewport_t *have, const dt_dev_viewport_t *want, float *k,
+                              float *dx, float *dy)
+{
+  if(have->width <= 0 || have->height <= 0 || have->scale <= 0.0f) return 1;
+  *k = want->scale / have->scale;
+  *dx = have->x * *k - want->x;
+  *dy = have->y * *k - want->y;
+  if(*k > DT_DEV_REPROJECT_MAX_ZOOM) return 1;
+  // allow for the viewport origins being rounded to whole pixels
+  if(*dx > 1.0f || *dy > 1.0f) return 1;
+  if(*dx + have->width * *k < want->width - 1.0f || *dy + have->height * *k < want->height - 1.0f) return 1;
+  return 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
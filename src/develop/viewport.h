@@ -0,0 +1,46 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_DEVELOP_VIEWPORT_H
+#define DT_DEVELOP_VIEWPORT_H
+
+// largest magnification at which an old main pipe output is still shown instead of the preview
+#define DT_DEV_REPROJECT_MAX_ZOOM 2.0f
+
+/** a part of the processed image at a given scale: device pixels [x, x+width) x [y, y+height) of the image
+ * scaled by scale. */
+typedef struct dt_dev_viewport_t
+{
+  int x, y, width, height;
+  float scale;
+} dt_dev_viewport_t;
+
+/** computes the viewport of a window_width x window_height view centered on zoom_x, zoom_y of a
+ * procw x proch image, grown by margin * window size on each side as far as the image reaches. */
+void dt_dev_viewport_compute(dt_dev_viewport_t *vp, const float scale, const float zoom_x, const float zoom_y,
+                             const int window_width, const int window_height, const int procw,
+                             const int proch, const float margin);
+/** finds the transform which draws a buffer rendered for viewport have such that it shows viewport want:
+ * buffer pixel (u, v) lands on (u * k + dx, v * k + dy) of want. returns 0 if the buffer covers want
+ * completely and is not magnified too much to stand in for it, 1 otherwise. */
+int dt_dev_viewport_reproject(const dt_dev_viewport_t *have, const dt_dev_viewport_t *want, float *k,
+                              float *dx, float *dy);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
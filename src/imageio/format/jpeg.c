@@ -312,39 +312,22 @@ read_icc_profile (j_decompress_ptr cinfo,
 #undef MAX_SEQ_NO
 
 
-int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const void *in_tmp, void *exif,
-                int exif_len, int imgid, int num, int total)
+static void setup_compress(const dt_imageio_jpeg_t *jpg, struct jpeg_compress_struct *cinfo, const int height)
 {
-  dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
-  const uint8_t *in = (const uint8_t *)in_tmp;
-  struct dt_imageio_jpeg_error_mgr jerr;
-
-  jpg->cinfo.err = jpeg_std_error(&jerr.pub);
-  jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
-  if(setjmp(jerr.setjmp_buffer))
-  {
-    jpeg_destroy_compress(&(jpg->cinfo));
-    return 1;
-  }
-  jpeg_create_compress(&(jpg->cinfo));
-  FILE *f = fopen(filename, "wb");
-  if(!f) return 1;
-  jpeg_stdio_dest(&(jpg->cinfo), f);
-
-  jpg->cinfo.image_width = jpg->width;
-  jpg->cinfo.image_height = jpg->height;
-  jpg->cinfo.input_components = 3;
-  jpg->cinfo.in_color_space = JCS_RGB;
-  jpeg_set_defaults(&(jpg->cinfo));
-  jpeg_set_quality(&(jpg->cinfo), jpg->quality, TRUE);
-  if(jpg->quality > 90) jpg->cinfo.comp_info[0].v_samp_factor = 1;
-  if(jpg->quality > 92) jpg->cinfo.comp_info[0].h_samp_factor = 1;
-  if(jpg->quality > 95) jpg->cinfo.dct_method = JDCT_FLOAT;
-  if(jpg->quality < 50) jpg->cinfo.dct_method = JDCT_IFAST;
-  if(jpg->quality < 80) jpg->cinfo.smoothing_factor = 20;
-  if(jpg->quality < 60) jpg->cinfo.smoothing_factor = 40;
-  if(jpg->quality < 40) jpg->cinfo.smoothing_factor = 60;
-  jpg->cinfo.optimize_coding = 1;
+  cinfo->image_width = jpg->width;
+  cinfo->image_height = height;
+  cinfo->input_components = 3;
+  cinfo->in_color_space = JCS_RGB;
+  jpeg_set_defaults(cinfo);
+  jpeg_set_quality(cinfo, jpg->quality, TRUE);
+  if(jpg->quality > 90) cinfo->comp_info[0].v_samp_factor = 1;
+  if(jpg->quality > 92) cinfo->comp_info[0].h_samp_factor = 1;
+  if(jpg->quality > 95) cinfo->dct_method = JDCT_FLOAT;
+  if(jpg->quality < 50) cinfo->dct_method = JDCT_IFAST;
+  if(jpg->quality < 80) cinfo->smoothing_factor = 20;
+  if(jpg->quality < 60) cinfo->smoothing_factor = 40;
+  if(jpg->quality < 40) cinfo->smoothing_factor = 60;
+  cinfo->optimize_coding = 1;
 
   // according to specs density_unit = 0, X_density = 1, Y_density = 1 should be fine and valid since it
   // describes an image with unknown unit and square pixels.
@@ -353,19 +336,21 @@ int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const v
   const int resolution = dt_conf_get_int("metadata/resolution");
   if(resolution > 0)
   {
-    jpg->cinfo.density_unit = 1;
-    jpg->cinfo.X_density = resolution;
-    jpg->cinfo.Y_density = resolution;
+    cinfo->density_unit = 1;
+    cinfo->X_density = resolution;
+    cinfo->Y_density = resolution;
   }
   else
   {
-    jpg->cinfo.density_unit = 0;
-    jpg->cinfo.X_density = 1;
-    jpg->cinfo.Y_density = 1;
+    cinfo->density_unit = 0;
+    cinfo->X_density = 1;
+    cinfo->Y_density = 1;
   }
+}
 
-  jpeg_start_compress(&(jpg->cinfo), TRUE);
-
+// icc profile and exif blob, have to come right after jpeg_start_compress()
+static void write_markers(j_compress_ptr cinfo, const int imgid, void *exif, const int exif_len)
+{
   if(imgid > 0)
   {
     cmsHPROFILE out_profile = dt_colorspaces_create_output_profile(imgid);
@@ -375,25 +360,231 @@ int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const v
     {
       unsigned char buf[len];
       cmsSaveProfileToMem(out_profile, buf, &len);
-      write_icc_profile(&(jpg->cinfo), buf, len);
+      write_icc_profile(cinfo, buf, len);
     }
     dt_colorspaces_cleanup_profile(out_profile);
   }
 
-  if(exif && exif_len > 0 && exif_len < 65534)
-    jpeg_write_marker(&(jpg->cinfo), JPEG_APP0 + 1, exif, exif_len);
+  if(exif && exif_len > 0 && exif_len < 65534) jpeg_write_marker(cinfo, JPEG_APP0 + 1, exif, exif_len);
+}
 
-  uint8_t row[3 * jpg->width];
+static void write_scanlines(j_compress_ptr cinfo, const uint8_t *in, const int width)
+{
+  uint8_t row[3 * width];
   const uint8_t *buf;
-  while(jpg->cinfo.next_scanline < jpg->cinfo.image_height)
+  while(cinfo->next_scanline < cinfo->image_height)
   {
     JSAMPROW tmp[1];
-    buf = in + (size_t)jpg->cinfo.next_scanline * jpg->cinfo.image_width * 4;
-    for(int i = 0; i < jpg->width; i++)
+    buf = in + (size_t)cinfo->next_scanline * cinfo->image_width * 4;
+    for(int i = 0; i < width; i++)
       for(int k = 0; k < 3; k++) row[3 * i + k] = buf[4 * i + k];
     tmp[0] = row;
-    jpeg_write_scanlines(&(jpg->cinfo), tmp, 1);
+    jpeg_write_scanlines(cinfo, tmp, 1);
+  }
+}
+
+/*
+ * large images are cut into horizontal bands which are compressed in parallel. every band is
+ * encoded as a jpeg of its own, with exactly one restart interval. as the entropy coder resets
+ * at restart markers, the scans of all bands can be joined with RSTn markers in between, below
+ * the headers of the first band. all bands have to share the huffman tables for that, so the
+ * standard tables are used instead of optimized ones, which costs a few percent in file size.
+ */
+
+// below that the serial encoder is fast enough and gets the slightly smaller files
+#define PARALLEL_MIN_PIXELS (16 * 1000 * 1000)
+
+typedef struct dt_imageio_jpeg_band_t
+{
+  struct jpeg_destination_mgr pub;
+  JOCTET *buf;
+  size_t size, len;
+} dt_imageio_jpeg_band_t;
+
+static void band_init_destination(j_compress_ptr cinfo)
+{
+  dt_imageio_jpeg_band_t *band = (dt_imageio_jpeg_band_t *)cinfo->dest;
+  band->pub.next_output_byte = band->buf;
+  band->pub.free_in_buffer = band->size;
+}
+
+static boolean band_empty_output_buffer(j_compress_ptr cinfo)
+{
+  dt_imageio_jpeg_band_t *band = (dt_imageio_jpeg_band_t *)cinfo->dest;
+  JOCTET *buf = (JOCTET *)realloc(band->buf, 2 * band->size);
+  if(!buf) (*cinfo->err->error_exit)((j_common_ptr)cinfo);
+  band->buf = buf;
+  band->pub.next_output_byte = buf + band->size;
+  band->pub.free_in_buffer = band->size;
+  band->size *= 2;
+  return TRUE;
+}
+
+static void band_term_destination(j_compress_ptr cinfo)
+{
+  dt_imageio_jpeg_band_t *band = (dt_imageio_jpeg_band_t *)cinfo->dest;
+  band->len = band->size - band->pub.free_in_buffer;
+}
+
+static int encode_band(const dt_imageio_jpeg_t *jpg, const uint8_t *in, const int rows, const int mcu_rows,
+                       const int imgid, void *exif, const int exif_len, dt_imageio_jpeg_band_t *band)
+{
+  struct jpeg_compress_struct cinfo;
+  struct dt_imageio_jpeg_error_mgr jerr;
+
+  band->size = MAX((size_t)3 * jpg->width * rows / 8, 65536);
+  band->buf = (JOCTET *)malloc(band->size);
+  if(!band->buf) return 1;
+  band->pub.init_destination = band_init_destination;
+  band->pub.empty_output_buffer = band_empty_output_buffer;
+  band->pub.term_destination = band_term_destination;
+
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
+  if(setjmp(jerr.setjmp_buffer))
+  {
+    jpeg_destroy_compress(&cinfo);
+    return 1;
   }
+  jpeg_create_compress(&cinfo);
+  cinfo.dest = &band->pub;
+  setup_compress(jpg, &cinfo, rows);
+  cinfo.optimize_coding = 0;
+  cinfo.restart_in_rows = mcu_rows;
+  jpeg_start_compress(&cinfo, TRUE);
+  write_markers(&cinfo, imgid, exif, exif_len);
+  write_scanlines(&cinfo, in, jpg->width);
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  return 0;
+}
+
+// returns the offset of the entropy coded data, i.e. the end of the SOS segment. optionally
+// patches the image height in the SOF segment on the way.
+static size_t find_scan(JOCTET *buf, const size_t len, const int height)
+{
+  size_t pos = 2; // SOI
+  while(pos + 4 <= len && buf[pos] == 0xFF)
+  {
+    const int marker = buf[pos + 1];
+    if(height > 0 && marker >= 0xC0 && marker <= 0xC2 && pos + 7 <= len)
+    {
+      buf[pos + 5] = (height >> 8) & 0xFF;
+      buf[pos + 6] = height & 0xFF;
+    }
+    pos += 2 + ((buf[pos + 2] << 8) | buf[pos + 3]);
+    if(marker == 0xDA) return pos;
+  }
+  return 0;
+}
+
+static int write_image_parallel(const dt_imageio_jpeg_t *jpg, FILE *f, const uint8_t *in, void *exif,
+                                const int exif_len, const int imgid)
+{
+  // find the mcu size for the chosen chroma subsampling
+  struct jpeg_compress_struct cinfo;
+  struct dt_imageio_jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
+  if(setjmp(jerr.setjmp_buffer))
+  {
+    jpeg_destroy_compress(&cinfo);
+    return 1;
+  }
+  jpeg_create_compress(&cinfo);
+  setup_compress(jpg, &cinfo, jpg->height);
+  int max_h = 1, max_v = 1;
+  for(int c = 0; c < cinfo.num_components; c++)
+  {
+    max_h = MAX(max_h, cinfo.comp_info[c].h_samp_factor);
+    max_v = MAX(max_v, cinfo.comp_info[c].v_samp_factor);
+  }
+  jpeg_destroy_compress(&cinfo);
+
+  // a few bands per thread for load balancing. the restart interval is stored in 16 bits.
+  const int mcus_per_row = (jpg->width + 8 * max_h - 1) / (8 * max_h);
+  const int target_rows = jpg->height / (4 * dt_get_num_threads());
+  const int mcu_rows = CLAMP(target_rows / (8 * max_v), 1, 65535 / mcus_per_row);
+  const int band_rows = 8 * max_v * mcu_rows;
+  const int num_bands = (jpg->height + band_rows - 1) / band_rows;
+
+  dt_imageio_jpeg_band_t *bands = (dt_imageio_jpeg_band_t *)calloc(num_bands, sizeof(dt_imageio_jpeg_band_t));
+  if(!bands) return 1;
+
+  int err = 0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(| : err)
+#endif
+  for(int b = 0; b < num_bands; b++)
+  {
+    const int y = b * band_rows;
+    err |= encode_band(jpg, in + (size_t)4 * jpg->width * y, MIN(band_rows, jpg->height - y), mcu_rows,
+                       b ? 0 : imgid, b ? NULL : exif, exif_len, bands + b);
+  }
+
+  for(int b = 0; b < num_bands && !err; b++)
+  {
+    dt_imageio_jpeg_band_t *band = bands + b;
+    const size_t scan = find_scan(band->buf, band->len, b ? 0 : jpg->height);
+    // every band has to end in EOI
+    if(!scan || band->len < scan + 2 || band->buf[band->len - 2] != 0xFF || band->buf[band->len - 1] != 0xD9)
+    {
+      err = 1;
+      break;
+    }
+    if(b == 0)
+      err |= fwrite(band->buf, 1, scan, f) != scan;
+    else
+    {
+      const JOCTET rst[2] = { 0xFF, 0xD0 + ((b - 1) & 7) };
+      err |= fwrite(rst, 1, 2, f) != 2;
+    }
+    err |= fwrite(band->buf + scan, 1, band->len - 2 - scan, f) != band->len - 2 - scan;
+  }
+  if(!err)
+  {
+    const JOCTET eoi[2] = { 0xFF, 0xD9 };
+    err |= fwrite(eoi, 1, 2, f) != 2;
+  }
+
+  for(int b = 0; b < num_bands; b++) free(bands[b].buf);
+  free(bands);
+  return err;
+}
+
+int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const void *in_tmp, void *exif,
+                int exif_len, int imgid, int num, int total)
+{
+  dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
+  const uint8_t *in = (const uint8_t *)in_tmp;
+  struct dt_imageio_jpeg_error_mgr jerr;
+
+  // smoothing looks across the band borders, only do it on one thread
+  if(dt_get_num_threads() > 1 && (size_t)jpg->width * jpg->height >= PARALLEL_MIN_PIXELS && jpg->quality >= 80)
+  {
+    FILE *f = fopen(filename, "wb");
+    if(!f) return 1;
+    const int err = write_image_parallel(jpg, f, in, exif, exif_len, imgid);
+    fclose(f);
+    return err;
+  }
+
+  jpg->cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
+  if(setjmp(jerr.setjmp_buffer))
+  {
+    jpeg_destroy_compress(&(jpg->cinfo));
+    return 1;
+  }
+  jpeg_create_compress(&(jpg->cinfo));
+  FILE *f = fopen(filename, "wb");
+  if(!f) return 1;
+  jpeg_stdio_dest(&(jpg->cinfo), f);
+
+  setup_compress(jpg, &(jpg->cinfo), jpg->height);
+  jpeg_start_compress(&(jpg->cinfo), TRUE);
+  write_markers(&(jpg->cinfo), imgid, exif, exif_len);
+  write_scanlines(&(jpg->cinfo), in, jpg->width);
   jpeg_finish_compress(&(jpg->cinfo));
   jpeg_destroy_compress(&(jpg->cinfo));
   fclose(f);
@@ -24,6 +24,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <png.h>
 #include <inttypes.h>
 #include <zlib.h>
@@ -120,6 +121,207 @@ static void PNGwriteRawProfile(png_struct *ping, png_info *ping_info, char *prof
   png_free(ping, text);
 }
 
+/*
+ * big images are compressed in parallel: the filtered rows are cut into strips which are deflated
+ * independently, each one primed with the 32k of data in front of it. all but the last strip end in
+ * a sync flush, so the raw deflate streams can simply be concatenated, and the adler32 checksums of
+ * the strips are combined for the zlib trailer.
+ */
+#define STRIP_BYTES (1 << 20)
+#define WINDOW_BYTES 32768
+
+typedef struct dt_imageio_png_strip_t
+{
+  uint8_t *buf;
+  size_t len, in_len;
+  uLong adler;
+} dt_imageio_png_strip_t;
+
+// rgba in host order to rgb in png byte order
+static void pack_row(const void *in, uint8_t *out, const int width, const int bpp)
+{
+  if(bpp > 8)
+  {
+    const uint16_t *i = (const uint16_t *)in;
+    for(int x = 0; x < width; x++)
+      for(int c = 0; c < 3; c++)
+      {
+        out[6 * x + 2 * c] = i[4 * x + c] >> 8;
+        out[6 * x + 2 * c + 1] = i[4 * x + c] & 0xff;
+      }
+  }
+  else
+  {
+    const uint8_t *i = (const uint8_t *)in;
+    for(int x = 0; x < width; x++)
+      for(int c = 0; c < 3; c++) out[3 * x + c] = i[4 * x + c];
+  }
+}
+
+static inline int paeth(const int a, const int b, const int c)
+{
+  const int p = a + b - c;
+  const int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  if(pa <= pb && pa <= pc) return a;
+  if(pb <= pc) return b;
+  return c;
+}
+
+// picks the filter with the smallest sum of absolute values per row, same heuristic as libpng.
+// prior is NULL for the first row of the image.
+static void filter_row(const uint8_t *prior, const uint8_t *row, const size_t rowbytes, const int pixel_bytes,
+                       uint8_t *out, uint8_t *tmp)
+{
+  uint64_t best = UINT64_MAX;
+  for(int f = PNG_FILTER_VALUE_NONE; f <= PNG_FILTER_VALUE_PAETH; f++)
+  {
+    uint64_t sum = 0;
+    tmp[0] = f;
+    for(size_t i = 0; i < rowbytes; i++)
+    {
+      const int a = i >= pixel_bytes ? row[i - pixel_bytes] : 0;
+      const int b = prior ? prior[i] : 0;
+      const int c = (prior && i >= pixel_bytes) ? prior[i - pixel_bytes] : 0;
+      int pred = 0;
+      switch(f)
+      {
+        case PNG_FILTER_VALUE_SUB:
+          pred = a;
+          break;
+        case PNG_FILTER_VALUE_UP:
+          pred = b;
+          break;
+        case PNG_FILTER_VALUE_AVG:
+          pred = (a + b) >> 1;
+          break;
+        case PNG_FILTER_VALUE_PAETH:
+          pred = paeth(a, b, c);
+          break;
+      }
+      const uint8_t v = row[i] - pred;
+      tmp[i + 1] = v;
+      sum += v < 128 ? v : 256 - v;
+    }
+    if(sum < best)
+    {
+      best = sum;
+      memcpy(out, tmp, rowbytes + 1);
+    }
+  }
+}
+
+static int compress_strip(const void *ivoid, const int width, const int bpp, const int y0, const int rows,
+                          const int last, dt_imageio_png_strip_t *strip)
+{
+  const int pixel_bytes = bpp > 8 ? 6 : 3;
+  const size_t rowbytes = (size_t)pixel_bytes * width;
+  const size_t in_stride = (size_t)4 * width * (bpp > 8 ? 2 : 1);
+  // also filter enough rows in front of the strip to fill the deflate window
+  const int dict_rows = MIN(y0, (WINDOW_BYTES + rowbytes) / (rowbytes + 1));
+  const int y_start = y0 - dict_rows;
+
+  int err = 1;
+  uint8_t *filtered = (uint8_t *)malloc((size_t)(dict_rows + rows) * (rowbytes + 1));
+  uint8_t *prior = (uint8_t *)malloc(rowbytes);
+  uint8_t *row = (uint8_t *)malloc(rowbytes);
+  uint8_t *tmp = (uint8_t *)malloc(rowbytes + 1);
+  if(!filtered || !prior || !row || !tmp) goto exit;
+
+  if(y_start > 0) pack_row((const uint8_t *)ivoid + in_stride * (y_start - 1), prior, width, bpp);
+  for(int y = y_start; y < y0 + rows; y++)
+  {
+    pack_row((const uint8_t *)ivoid + in_stride * y, row, width, bpp);
+    filter_row(y ? prior : NULL, row, rowbytes, pixel_bytes, filtered + (size_t)(y - y_start) * (rowbytes + 1),
+               tmp);
+    uint8_t *t = prior;
+    prior = row;
+    row = t;
+  }
+
+  z_stream zs = { 0 };
+  if(deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) goto exit;
+  const uint8_t *data = filtered + (size_t)dict_rows * (rowbytes + 1);
+  strip->in_len = (size_t)rows * (rowbytes + 1);
+  if(dict_rows)
+  {
+    const size_t dict_len = MIN(WINDOW_BYTES, (size_t)dict_rows * (rowbytes + 1));
+    deflateSetDictionary(&zs, data - dict_len, dict_len);
+  }
+  strip->adler = adler32(adler32(0L, Z_NULL, 0), data, strip->in_len);
+
+  // room for the sync flush marker
+  const size_t bound = deflateBound(&zs, strip->in_len) + 16;
+  strip->buf = (uint8_t *)malloc(bound);
+  if(strip->buf)
+  {
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = strip->in_len;
+    zs.next_out = strip->buf;
+    zs.avail_out = bound;
+    const int ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+    strip->len = bound - zs.avail_out;
+    err = (last ? ret != Z_STREAM_END : ret != Z_OK) || zs.avail_in;
+  }
+  deflateEnd(&zs);
+
+exit:
+  free(filtered);
+  free(prior);
+  free(row);
+  free(tmp);
+  return err;
+}
+
+static int write_idat_parallel(png_structp png_ptr, const void *ivoid, const int width, const int height,
+                               const int bpp)
+{
+  const size_t rowbytes = (size_t)width * (bpp > 8 ? 6 : 3);
+  const int strip_rows = MAX(1, STRIP_BYTES / rowbytes);
+  const int num_strips = (height + strip_rows - 1) / strip_rows;
+  // limit the memory held by compressed strips which wait for their turn
+  const int batch = 4 * dt_get_num_threads();
+  dt_imageio_png_strip_t *strips = (dt_imageio_png_strip_t *)calloc(batch, sizeof(dt_imageio_png_strip_t));
+  if(!strips) return 1;
+
+  int err = 0;
+  uLong adler = adler32(0L, Z_NULL, 0);
+  for(int s0 = 0; s0 < num_strips && !err; s0 += batch)
+  {
+    const int num = MIN(batch, num_strips - s0);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(| : err)
+#endif
+    for(int k = 0; k < num; k++)
+    {
+      const int y = (s0 + k) * strip_rows;
+      err |= compress_strip(ivoid, width, bpp, y, MIN(strip_rows, height - y), s0 + k == num_strips - 1,
+                            strips + k);
+    }
+
+    for(int k = 0; k < num && !err; k++)
+    {
+      dt_imageio_png_strip_t *strip = strips + k;
+      const int first = s0 + k == 0, last = s0 + k == num_strips - 1;
+      adler = adler32_combine(adler, strip->adler, strip->in_len);
+      // zlib header (deflate, 32k window, best compression) and adler32 trailer
+      const png_byte header[2] = { 0x78, 0xda };
+      const png_byte trailer[4] = { adler >> 24, (adler >> 16) & 0xff, (adler >> 8) & 0xff, adler & 0xff };
+      png_write_chunk_start(png_ptr, (png_bytep) "IDAT", strip->len + (first ? 2 : 0) + (last ? 4 : 0));
+      if(first) png_write_chunk_data(png_ptr, (png_bytep)header, 2);
+      png_write_chunk_data(png_ptr, strip->buf, strip->len);
+      if(last) png_write_chunk_data(png_ptr, (png_bytep)trailer, 4);
+      png_write_chunk_end(png_ptr);
+    }
+    for(int k = 0; k < num; k++)
+    {
+      free(strips[k].buf);
+      strips[k].buf = NULL;
+    }
+  }
+  free(strips);
+  return err;
+}
+
 int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const void *ivoid, void *exif,
                 int exif_len, int imgid, int num, int total)
 {
@@ -195,6 +397,16 @@ int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const voi
 
   png_write_info(png_ptr, info_ptr);
 
+  if(dt_get_num_threads() > 1 && (size_t)width * height * (p->bpp > 8 ? 6 : 3) > 2 * STRIP_BYTES)
+  {
+    // we write the image data ourselves, png_write_end() would insist on rows written through libpng.
+    const int err = write_idat_parallel(png_ptr, ivoid, width, height, p->bpp);
+    if(!err) png_write_chunk(png_ptr, (png_bytep) "IEND", NULL, 0);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    fclose(f);
+    return err;
+  }
+
   /*
    * Get rid of filler (OR ALPHA) bytes, pack XRGB/RGBX/ARGB/RGBA into
    * RGB (4 channels -> 3 channels). The second parameter is not used.
@@ -22,6 +22,7 @@
 #include <stddef.h>
 #include <inttypes.h>
 #include <tiffio.h>
+#include <zlib.h>
 #include "common/darktable.h"
 #include "common/imageio_module.h"
 #include "common/imageio.h"
@@ -51,6 +52,130 @@ typedef struct dt_imageio_tiff_gui_t
 } dt_imageio_tiff_gui_t;
 
 
+/*
+ * strips are packed, run through the predictor and deflated in parallel, and then handed to
+ * libtiff in order as raw strip data. this is what libtiff's own codecs would do per strip,
+ * see horDiff*() and fpDiff() in tif_predict.c.
+ */
+#define STRIP_BYTES (1 << 18)
+
+static void float_predictor(uint8_t *row, uint8_t *tmp, const size_t rowsize)
+{
+  // split the floats into byte planes, most significant first, and difference each byte to the one of
+  // the previous pixel.
+  const size_t wc = rowsize / 4;
+  memcpy(tmp, row, rowsize);
+  for(size_t count = 0; count < wc; count++)
+    for(int byte = 0; byte < 4; byte++)
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+      row[byte * wc + count] = tmp[4 * count + byte];
+#else
+      row[(3 - byte) * wc + count] = tmp[4 * count + byte];
+#endif
+  for(size_t i = rowsize - 1; i >= 3; i--) row[i] -= row[i - 3];
+}
+
+static int encode_strip(const dt_imageio_tiff_t *d, const void *in, const int y0, const int rows,
+                        const int predictor, const int byteswap, uint8_t **out, size_t *out_len)
+{
+  const int bytes = d->bpp / 8;
+  const size_t rowsize = (size_t)3 * d->width * bytes;
+  const size_t wc = (size_t)3 * d->width;
+  const size_t len = rowsize * rows;
+  uint8_t *strip = (uint8_t *)malloc(len);
+  uint8_t *tmp = predictor == 3 ? (uint8_t *)malloc(rowsize) : NULL;
+  if(!strip || (predictor == 3 && !tmp))
+  {
+    free(strip);
+    free(tmp);
+    return 1;
+  }
+
+  for(int y = 0; y < rows; y++)
+  {
+    const uint8_t *i = (const uint8_t *)in + (size_t)4 * bytes * d->width * (y0 + y);
+    uint8_t *o = strip + rowsize * y;
+    for(int x = 0; x < d->width; x++, i += 4 * bytes, o += 3 * bytes) memcpy(o, i, 3 * bytes);
+
+    o = strip + rowsize * y;
+    if(predictor == 2)
+    {
+      if(bytes == 1)
+        for(size_t k = wc - 1; k >= 3; k--) o[k] -= o[k - 3];
+      else if(bytes == 2)
+      {
+        uint16_t *w = (uint16_t *)o;
+        for(size_t k = wc - 1; k >= 3; k--) w[k] -= w[k - 3];
+      }
+      else
+      {
+        uint32_t *w = (uint32_t *)o;
+        for(size_t k = wc - 1; k >= 3; k--) w[k] -= w[k - 3];
+      }
+    }
+    else if(predictor == 3)
+      float_predictor(o, tmp, rowsize);
+
+    // the float predictor writes a byte stream, everything else is in host order so far
+    if(byteswap && predictor != 3)
+    {
+      if(bytes == 2) TIFFSwabArrayOfShort((uint16_t *)o, wc);
+      if(bytes == 4) TIFFSwabArrayOfLong((uint32_t *)o, wc);
+    }
+  }
+  free(tmp);
+
+  if(!d->compress)
+  {
+    *out = strip;
+    *out_len = len;
+    return 0;
+  }
+
+  uLongf zlen = compressBound(len);
+  *out = (uint8_t *)malloc(zlen);
+  const int err = !*out || compress2(*out, &zlen, strip, len, Z_BEST_COMPRESSION) != Z_OK;
+  *out_len = zlen;
+  free(strip);
+  return err;
+}
+
+static int write_strips(TIFF *tif, const dt_imageio_tiff_t *d, const void *in, const int rows_per_strip,
+                        const int predictor)
+{
+  const int num_strips = (d->height + rows_per_strip - 1) / rows_per_strip;
+  const int byteswap = TIFFIsByteSwapped(tif);
+  // limit the memory held by encoded strips which wait for their turn
+  const int batch = 4 * dt_get_num_threads();
+  uint8_t **bufs = (uint8_t **)calloc(batch, sizeof(uint8_t *));
+  size_t *lens = (size_t *)calloc(batch, sizeof(size_t));
+  int err = !bufs || !lens;
+
+  for(int s0 = 0; s0 < num_strips && !err; s0 += batch)
+  {
+    const int num = MIN(batch, num_strips - s0);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(| : err)
+#endif
+    for(int k = 0; k < num; k++)
+    {
+      const int y = (s0 + k) * rows_per_strip;
+      err |= encode_strip(d, in, y, MIN(rows_per_strip, d->height - y), predictor, byteswap, bufs + k,
+                          lens + k);
+    }
+    for(int k = 0; k < num && !err; k++)
+      err |= TIFFWriteRawStrip(tif, s0 + k, bufs[k], lens[k]) == -1;
+    for(int k = 0; k < num; k++)
+    {
+      free(bufs[k]);
+      bufs[k] = NULL;
+    }
+  }
+  free(bufs);
+  free(lens);
+  return err;
+}
+
 int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const void *in_void, void *exif,
                 int exif_len, int imgid, int num, int total)
 {
@@ -61,8 +186,6 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
 
   TIFF *tif = NULL;
 
-  void *rowdata = NULL;
-
   int rc = 1; // default to error
 
   if(imgid > 0)
@@ -97,28 +220,14 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   // "write the official compression code (0x0008)."
   // http://www.awaresystems.be/imaging/tiff/tifftags/compression.html
   // http://www.awaresystems.be/imaging/tiff/tifftags/predictor.html
-  if(d->compress == 1)
-  {
-    TIFFSetField(tif, TIFFTAG_COMPRESSION, (uint16_t)COMPRESSION_ADOBE_DEFLATE);
-    TIFFSetField(tif, TIFFTAG_PREDICTOR, (uint16_t)1);
-    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)9);
-  }
-  else if(d->compress == 2)
+  const int predictor = d->compress == 3 ? (d->bpp == 32 ? 3 : 2) : d->compress == 2 ? 2 : 1;
+  if(d->compress)
   {
     TIFFSetField(tif, TIFFTAG_COMPRESSION, (uint16_t)COMPRESSION_ADOBE_DEFLATE);
-    TIFFSetField(tif, TIFFTAG_PREDICTOR, (uint16_t)2);
+    TIFFSetField(tif, TIFFTAG_PREDICTOR, (uint16_t)predictor);
     TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)9);
   }
-  else if(d->compress == 3)
-  {
-    TIFFSetField(tif, TIFFTAG_COMPRESSION, (uint16_t)COMPRESSION_ADOBE_DEFLATE);
-    if(d->bpp == 32)
-      TIFFSetField(tif, TIFFTAG_PREDICTOR, (uint16_t)3);
-    else
-      TIFFSetField(tif, TIFFTAG_PREDICTOR, (uint16_t)2);
-    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)9);
-  }
-  else // (d->compress == 0)
+  else
   {
     TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
   }
@@ -135,7 +244,9 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (uint32_t)d->height);
   TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, (uint16_t)PHOTOMETRIC_RGB);
   TIFFSetField(tif, TIFFTAG_PLANARCONFIG, (uint16_t)PLANARCONFIG_CONTIG);
-  TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, (uint32_t)1);
+  const size_t rowsize = (size_t)3 * d->width * d->bpp / 8;
+  const int rows_per_strip = MAX(1, STRIP_BYTES / rowsize);
+  TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, (uint32_t)rows_per_strip);
   TIFFSetField(tif, TIFFTAG_ORIENTATION, (uint16_t)ORIENTATION_TOPLEFT);
 
   int resolution = dt_conf_get_int("metadata/resolution");
@@ -146,71 +257,12 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
     TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, (uint16_t)RESUNIT_INCH);
   }
 
-  const size_t rowsize = (d->width * 3) * d->bpp / 8;
-  if((rowdata = malloc(rowsize)) == NULL)
+  if(write_strips(tif, d, in_void, rows_per_strip, predictor))
   {
     rc = 1;
     goto exit;
   }
 
-  if(d->bpp == 32)
-  {
-    for(int y = 0; y < d->height; y++)
-    {
-      float *in = (float *)in_void + (size_t)4 * y * d->width;
-      float *out = (float *)rowdata;
-
-      for(int x = 0; x < d->width; x++, in += 4, out += 3)
-      {
-        memcpy(out, in, 3 * sizeof(float));
-      }
-
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
-    }
-  }
-  else if(d->bpp == 16)
-  {
-    for(int y = 0; y < d->height; y++)
-    {
-      uint16_t *in = (uint16_t *)in_void + (size_t)4 * y * d->width;
-      uint16_t *out = (uint16_t *)rowdata;
-
-      for(int x = 0; x < d->width; x++, in += 4, out += 3)
-      {
-        memcpy(out, in, 3 * sizeof(uint16_t));
-      }
-
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
-    }
-  }
-  else
-  {
-    for(int y = 0; y < d->height; y++)
-    {
-      uint8_t *in = (uint8_t *)in_void + (size_t)4 * y * d->width;
-      uint8_t *out = (uint8_t *)rowdata;
-
-      for(int x = 0; x < d->width; x++, in += 4, out += 3)
-      {
-        memcpy(out, in, 3 * sizeof(uint8_t));
-      }
-
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
-    }
-  }
-
   // success
   rc = 0;
 
@@ -229,8 +281,6 @@ exit:
   }
   free(profile);
   profile = NULL;
-  free(rowdata);
-  rowdata = NULL;
 
   return rc;
 }
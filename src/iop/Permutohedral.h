@@ -217,6 +217,198 @@ private:
   unsigned long capacity_bits;
 };
 
+/*******************************************************************
+ * Concurrent hash table for permutohedral lattice                 *
+ *                                                                 *
+ * Open addressing table that can be filled from many threads at   *
+ * once without locks. The probe table only stores 32-bit vertex   *
+ * ids, the keys and value vectors live in dense per-vertex arrays *
+ * indexed by that id, so blurring and slicing can walk them       *
+ * linearly. Slots are claimed with a compare-and-swap, values are *
+ * accumulated with atomic adds. The capacity is fixed while       *
+ * threads are splatting: once it is exhausted, lookupOffset()     *
+ * reports failure and the caller has to fall back to something    *
+ * else (see PermutohedralLattice::splat()). grow() may only be    *
+ * called while no other thread accesses the table.                *
+ *******************************************************************/
+template <int KD, int VD> class ConcurrentHashTablePermutohedral
+{
+public:
+  /* Constructor
+   *  maxVertices: number of vertices the table can hold before it has to be grown.
+   */
+  ConcurrentHashTablePermutohedral(size_t maxVertices)
+  {
+    capacity = 1 << 15;
+    while(capacity / 2 < maxVertices) capacity <<= 1;
+    capacity_bits = capacity - 1;
+    filled = 0;
+    entries = new int[capacity];
+    for(size_t i = 0; i < capacity; i++) entries[i] = EMPTY;
+    keys = new short[KD * capacity / 2];
+    values = new float[VD * capacity / 2];
+    memset(values, 0, sizeof(float) * VD * capacity / 2);
+  }
+
+  ~ConcurrentHashTablePermutohedral()
+  {
+    delete[] entries;
+    delete[] keys;
+    delete[] values;
+  }
+
+  // Returns the number of vectors stored. Insertions which failed because the table
+  // was full have bumped the counter as well, don't count those.
+  int size()
+  {
+    return filled < (int)(capacity / 2) ? filled : (int)(capacity / 2);
+  }
+
+  // Returns a pointer to the keys array.
+  const short *getKeys()
+  {
+    return keys;
+  }
+
+  // Returns a pointer to the values array.
+  float *getValues()
+  {
+    return values;
+  }
+
+  /* Returns the offset into the values array for a given key, or -1 if the key
+   * is not in the table and either create is false or the table is full.
+   * Safe to call from several threads at once.
+   */
+  int lookupOffset(const short *key, size_t h, bool create = true)
+  {
+    volatile int *slots = entries;
+    while(1)
+    {
+      const int e = slots[h];
+      if(e == EMPTY)
+      {
+        if(!create) return -1; // Return not found.
+        // try to claim the slot. if somebody else was faster, look at it again.
+        if(!__sync_bool_compare_and_swap(entries + h, EMPTY, BUSY)) continue;
+        const int idx = __sync_fetch_and_add(&filled, 1);
+        if(idx >= (int)(capacity / 2))
+        {
+          // out of space, give the slot back.
+          __sync_synchronize();
+          slots[h] = EMPTY;
+          return -1;
+        }
+        for(int i = 0; i < KD; i++) keys[idx * KD + i] = key[i];
+        // make sure the key is visible before the slot is published
+        __sync_synchronize();
+        slots[h] = idx;
+        return idx * VD;
+      }
+      // another thread is just writing the key of this slot, wait for it.
+      if(e == BUSY) continue;
+
+      // check if the cell has a matching key
+      bool match = true;
+      for(int i = 0; i < KD && match; i++) match = keys[e * KD + i] == key[i];
+      if(match) return e * VD;
+
+      // increment the bucket with wraparound
+      h = (h + 1) & capacity_bits;
+    }
+  }
+
+  /* Looks up the value vector associated with a given key vector.
+   *        k : pointer to the key vector to be looked up.
+   *   create : true if a non-existing key should be created.
+   */
+  float *lookup(const short *k, bool create = true)
+  {
+    size_t h = hash(k) & capacity_bits;
+    int offset = lookupOffset(k, h, create);
+    if(offset < 0)
+      return NULL;
+    else
+      return values + offset;
+  };
+
+  /* Hash function used in this implementation. A simple base conversion. */
+  size_t hash(const short *key)
+  {
+    size_t k = 0;
+    for(int i = 0; i < KD; i++)
+    {
+      k += key[i];
+      k *= 2531011;
+    }
+    return k;
+  }
+
+  /* Adds v to *val, safe against concurrent updates of the same vertex. */
+  static inline void atomicAdd(float *val, const float v)
+  {
+    union
+    {
+      float f;
+      int i;
+    } oldval, newval;
+    volatile int *p = (volatile int *)val;
+    do
+    {
+      oldval.i = *p;
+      newval.f = oldval.f + v;
+    } while(!__sync_bool_compare_and_swap((int *)val, oldval.i, newval.i));
+  }
+
+  /* Grows the table such that at least n vertices fit. Not thread safe. */
+  void grow(size_t n)
+  {
+    const int oldFilled = size();
+    filled = oldFilled;
+    if(n <= capacity / 2) return;
+    while(capacity / 2 < n) capacity <<= 1;
+    capacity_bits = capacity - 1;
+
+    // Migrate the value vectors.
+    float *newValues = new float[VD * capacity / 2];
+    memset(newValues, 0, sizeof(float) * VD * capacity / 2);
+    memcpy(newValues, values, sizeof(float) * VD * oldFilled);
+    delete[] values;
+    values = newValues;
+
+    // Migrate the key vectors.
+    short *newKeys = new short[KD * capacity / 2];
+    memcpy(newKeys, keys, sizeof(short) * KD * oldFilled);
+    delete[] keys;
+    keys = newKeys;
+
+    // Rebuild the probe table, vertex ids stay the same.
+    delete[] entries;
+    entries = new int[capacity];
+    for(size_t i = 0; i < capacity; i++) entries[i] = EMPTY;
+    for(int i = 0; i < oldFilled; i++)
+    {
+      size_t h = hash(keys + i * KD) & capacity_bits;
+      while(entries[h] != EMPTY) h = (h + 1) & capacity_bits;
+      entries[h] = i;
+    }
+  }
+
+private:
+  enum
+  {
+    EMPTY = -1,
+    BUSY = -2
+  };
+
+  short *keys;
+  float *values;
+  int *entries;
+  size_t capacity;
+  int filled;
+  unsigned long capacity_bits;
+};
+
 /******************************************************************
  * The algorithm class that performs the filter                   *
  *                                                                *
@@ -272,7 +464,14 @@ public:
     }
     scaleFactor = scaleFactorTmp;
 
-    hashTables = new HashTablePermutohedral<D, VD>[nThreads];
+    // all threads splat into one shared table. every point touches D+1 vertices, but usually
+    // most of them are shared with its neighbours, so start with a bounded guess. should it
+    // turn out to be too small the threads spill into private tables which are folded in by
+    // merge_splat_threads().
+    const size_t maxVertices = nData * (D + 1);
+    hashTable = new ConcurrentHashTablePermutohedral<D, VD>(maxVertices < (1 << 21) ? maxVertices : (1 << 21));
+    overflowTables = new HashTablePermutohedral<D, VD> *[nThreads];
+    for(int i = 0; i < nThreads; i++) overflowTables[i] = NULL;
   }
 
 
@@ -281,7 +480,9 @@ public:
     delete[] scaleFactor;
     delete[] replay;
     delete[] canonical;
-    delete[] hashTables;
+    delete hashTable;
+    for(int i = 0; i < nThreads; i++) delete overflowTables[i];
+    delete[] overflowTables;
   }
 
 
@@ -379,45 +580,76 @@ public:
       for(int i = 0; i < D; i++) key[i] = greedy[i] + canonical[remainder * (D + 1) + rank[i]];
 
       // Retrieve pointer to the value at this vertex.
-      float *val = hashTables[thread_index].lookup(key, true);
+      float *val = hashTable->lookup(key, true);
 
-      // Accumulate values with barycentric weight.
-      for(int i = 0; i < VD; i++) val[i] += barycentric[remainder] * value[i];
+      if(val)
+      {
+        // Accumulate values with barycentric weight.
+        for(int i = 0; i < VD; i++)
+          ConcurrentHashTablePermutohedral<D, VD>::atomicAdd(val + i, barycentric[remainder] * value[i]);
 
-      // Record this interaction to use later when slicing
-      replay[replay_index * (D + 1) + remainder].table = thread_index;
-      replay[replay_index * (D + 1) + remainder].offset = val - hashTables[thread_index].getValues();
+        // Record this interaction to use later when slicing
+        replay[replay_index * (D + 1) + remainder].table = 0;
+        replay[replay_index * (D + 1) + remainder].offset = val - hashTable->getValues();
+      }
+      else
+      {
+        // the shared table is full, keep this vertex in a private one for now.
+        if(!overflowTables[thread_index]) overflowTables[thread_index] = new HashTablePermutohedral<D, VD>();
+        val = overflowTables[thread_index]->lookup(key, true);
+        for(int i = 0; i < VD; i++) val[i] += barycentric[remainder] * value[i];
+        replay[replay_index * (D + 1) + remainder].table = thread_index + 1;
+        replay[replay_index * (D + 1) + remainder].offset = val - overflowTables[thread_index]->getValues();
+      }
       replay[replay_index * (D + 1) + remainder].weight = barycentric[remainder];
     }
   }
 
-  /* Merge the multiple threads' hash tables into the totals. */
+  /* Fold the vertices which did not fit into the shared table back into it. Nothing to do in
+   * the common case where the shared table was large enough. */
   void merge_splat_threads(void)
   {
-    if(nThreads <= 1) return;
+    size_t spilled = 0;
+    for(int i = 0; i < nThreads; i++)
+      if(overflowTables[i]) spilled += overflowTables[i]->size();
+    if(!spilled) return;
+
+    hashTable->grow(hashTable->size() + spilled);
 
-    /* Merge the multiple hash tables into one, creating an offset remap table. */
-    int *offset_remap[nThreads];
-    for(int i = 1; i < nThreads; i++)
+    /* Merge the private hash tables into the shared one, creating an offset remap table. */
+    int *offset_remap[nThreads + 1];
+    offset_remap[0] = NULL;
+    for(int i = 0; i < nThreads; i++)
     {
-      const short *oldKeys = hashTables[i].getKeys();
-      const float *oldVals = hashTables[i].getValues();
-      const int filled = hashTables[i].size();
-      offset_remap[i] = new int[filled];
+      offset_remap[i + 1] = NULL;
+      if(!overflowTables[i]) continue;
+      const short *oldKeys = overflowTables[i]->getKeys();
+      const float *oldVals = overflowTables[i]->getValues();
+      const int filled = overflowTables[i]->size();
+      offset_remap[i + 1] = new int[filled];
       for(int j = 0; j < filled; j++)
       {
-        float *val = hashTables[0].lookup(oldKeys + j * D, true);
+        float *val = hashTable->lookup(oldKeys + j * D, true);
         const float *oldVal = oldVals + j * VD;
         for(int k = 0; k < VD; k++) val[k] += oldVal[k];
-        offset_remap[i][j] = val - hashTables[0].getValues();
+        offset_remap[i + 1][j] = val - hashTable->getValues();
       }
+      delete overflowTables[i];
+      overflowTables[i] = NULL;
     }
 
-    /* Rewrite the offsets in the replay structure from the above generated table. */
-    for(int i = 0; i < nData * (D + 1); i++)
-      if(replay[i].table > 0) replay[i].offset = offset_remap[replay[i].table][replay[i].offset / VD];
+/* Rewrite the offsets in the replay structure from the above generated table. */
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) shared(offset_remap)
+#endif
+    for(size_t i = 0; i < nData * (D + 1); i++)
+      if(replay[i].table > 0)
+      {
+        replay[i].offset = offset_remap[replay[i].table][replay[i].offset / VD];
+        replay[i].table = 0;
+      }
 
-    for(int i = 1; i < nThreads; i++) delete[] offset_remap[i];
+    for(int i = 0; i <= nThreads; i++) delete[] offset_remap[i];
   }
 
   /* Performs slicing out of position vectors. Note that the barycentric weights and the simplex
@@ -426,7 +658,7 @@ public:
    */
   void slice(float *col, size_t replay_index)
   {
-    float *base = hashTables[0].getValues();
+    const float *base = hashTable->getValues();
     for(int j = 0; j < VD; j++) col[j] = 0;
     for(int i = 0; i <= D; i++)
     {
@@ -441,10 +673,13 @@ public:
   /* Performs a Gaussian blur along each projected axis in the hyperplane. */
   void blur()
   {
+    const int size = hashTable->size();
+
     // Prepare arrays
-    float *newValue = new float[VD * hashTables[0].size()];
-    float *oldValue = hashTables[0].getValues();
+    float *newValue = new float[VD * size];
+    float *oldValue = hashTable->getValues();
     float *hashTableBase = oldValue;
+    const short *keys = hashTable->getKeys();
 
     float zero[VD];
     for(int k = 0; k < VD; k++) zero[k] = 0;
@@ -452,13 +687,14 @@ public:
     // For each of d+1 axes,
     for(int j = 0; j <= D; j++)
     {
+// the table is read-only from here on, so all vertices can be blurred concurrently
 #ifdef _OPENMP
-#pragma omp parallel for shared(j, oldValue, newValue, hashTableBase, zero)
+#pragma omp parallel for schedule(static) shared(j, oldValue, newValue, hashTableBase, zero, keys)
 #endif
       // For each vertex in the lattice,
-      for(int i = 0; i < hashTables[0].size(); i++) // blur point i in dimension j
+      for(int i = 0; i < size; i++) // blur point i in dimension j
       {
-        const short *key = hashTables[0].getKeys() + i * (D); // keys to current vertex
+        const short *key = keys + i * (D); // keys to current vertex
         short neighbor1[D + 1];
         short neighbor2[D + 1];
         for(int k = 0; k < D; k++)
@@ -469,18 +705,18 @@ public:
         neighbor1[j] = key[j] - D;
         neighbor2[j] = key[j] + D; // keys to the neighbors along the given axis.
 
-        float *oldVal = oldValue + i * VD;
+        const float *oldVal = oldValue + i * VD;
         float *newVal = newValue + i * VD;
 
-        float *vm1, *vp1;
+        const float *vm1, *vp1;
 
-        vm1 = hashTables[0].lookup(neighbor1, false); // look up first neighbor
+        vm1 = hashTable->lookup(neighbor1, false); // look up first neighbor
         if(vm1)
           vm1 = vm1 - hashTableBase + oldValue;
         else
           vm1 = zero;
 
-        vp1 = hashTables[0].lookup(neighbor2, false); // look up second neighbor
+        vp1 = hashTable->lookup(neighbor2, false); // look up second neighbor
         if(vp1)
           vp1 = vp1 - hashTableBase + oldValue;
         else
@@ -498,7 +734,7 @@ public:
     // depending where we ended up, we may have to copy data
     if(oldValue != hashTableBase)
     {
-      memcpy(hashTableBase, oldValue, hashTables[0].size() * VD * sizeof(float));
+      memcpy(hashTableBase, oldValue, (size_t)size * VD * sizeof(float));
       delete[] oldValue;
     }
     else
@@ -508,12 +744,14 @@ public:
   }
 
 private:
-  int nData;
+  size_t nData;
   int nThreads;
   const float *scaleFactor;
   const int *canonical;
 
-  // slicing is done by replaying splatting (ie storing the sparse matrix)
+  // slicing is done by replaying splatting (ie storing the sparse matrix).
+  // table is 0 for the shared table, or thread_index + 1 for a vertex which spilled into a
+  // private table. merge_splat_threads() resets all of them to 0.
   struct ReplayEntry
   {
     int table;
@@ -521,7 +759,8 @@ private:
     float weight;
   } *replay;
 
-  HashTablePermutohedral<D, VD> *hashTables;
+  ConcurrentHashTablePermutohedral<D, VD> *hashTable;
+  HashTablePermutohedral<D, VD> **overflowTables;
 };
 
 #endif
@@ -208,7 +208,6 @@ static inline __m128 weight_sse(const __m128 *c1, const __m128 *c2, const float
 #define ROW_PROLOGUE                                                                                         \
   const __m128 *px = ((__m128 *)in) + (size_t)j * width;                                                     \
   const __m128 *px2;                                                                                         \
-  float *pdetail = detail + (size_t)4 * j * width;                                                           \
   float *pcoarse = out + (size_t)4 * j * width;
 
 #define SUM_PIXEL_PROLOGUE                                                                                   \
@@ -218,14 +217,13 @@ static inline __m128 weight_sse(const __m128 *c1, const __m128 *c2, const float
 #define SUM_PIXEL_EPILOGUE                                                                                   \
   sum = _mm_mul_ps(sum, _mm_rcp_ps(wgt));                                                                    \
                                                                                                              \
-  _mm_stream_ps(pdetail, _mm_sub_ps(*px, sum));                                                              \
   _mm_stream_ps(pcoarse, sum);                                                                               \
   px++;                                                                                                      \
-  pdetail += 4;                                                                                              \
   pcoarse += 4;
 
-static void eaw_decompose(float *const out, const float *const in, float *const detail, const int scale,
-                          const float sharpen, const int32_t width, const int32_t height)
+// the detail coefficients of this scale are not stored, they are exactly in - out.
+static void eaw_decompose(float *const out, const float *const in, const int scale, const float sharpen,
+                          const int32_t width, const int32_t height)
 {
   const int mult = 1 << scale;
   static const float filter[5] = { 1.0f / 16.0f, 4.0f / 16.0f, 6.0f / 16.0f, 4.0f / 16.0f, 1.0f / 16.0f };
@@ -340,8 +338,11 @@ static void eaw_decompose(float *const out, const float *const in, float *const
 #undef SUM_PIXEL_PROLOGUE
 #undef SUM_PIXEL_EPILOGUE
 
-static void eaw_synthesize(float *const out, const float *const in, const float *const detail,
-                           const float *thrsf, const float *boostf, const int32_t width, const int32_t height)
+// adds the thresholded and boosted detail coefficients of one scale, the difference of the coarse buffers
+// before and after its decomposition, to the running sum in accum. the first scale starts the sum.
+static void eaw_accumulate(float *const accum, const float *const coarse_in, const float *const coarse_out,
+                           const float *thrsf, const float *boostf, const int first, const int32_t width,
+                           const int32_t height)
 {
   const __m128 threshold = _mm_set_ps(thrsf[3], thrsf[2], thrsf[1], thrsf[0]);
   const __m128 boost = _mm_set_ps(boostf[3], boostf[2], boostf[1], boostf[0]);
@@ -351,24 +352,35 @@ static void eaw_synthesize(float *const out, const float *const in, const float
 #endif
   for(int j = 0; j < height; j++)
   {
-    // TODO: prefetch? _mm_prefetch()
-    const __m128 *pin = (__m128 *)in + (size_t)j * width;
-    __m128 *pdetail = (__m128 *)detail + (size_t)j * width;
-    float *pout = out + (size_t)4 * j * width;
+    const __m128 *pin = (__m128 *)coarse_in + (size_t)j * width;
+    const __m128 *pcoarse = (__m128 *)coarse_out + (size_t)j * width;
+    __m128 *pacc = (__m128 *)accum + (size_t)j * width;
     for(int i = 0; i < width; i++)
     {
       const __m128i maski = _mm_set1_epi32(0x80000000u);
       const __m128 *mask = (__m128 *)&maski;
+      const __m128 detail = _mm_sub_ps(*pin, *pcoarse);
       const __m128 absamt
-          = _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_andnot_ps(*mask, *pdetail), threshold));
-      const __m128 amount = _mm_or_ps(_mm_and_ps(*pdetail, *mask), absamt);
-      _mm_stream_ps(pout, _mm_add_ps(*pin, _mm_mul_ps(boost, amount)));
-      pdetail++;
+          = _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_andnot_ps(*mask, detail), threshold));
+      const __m128 amount = _mm_or_ps(_mm_and_ps(detail, *mask), absamt);
+      const __m128 contrib = _mm_mul_ps(boost, amount);
+      *pacc = first ? contrib : _mm_add_ps(*pacc, contrib);
       pin++;
-      pout += 4;
+      pcoarse++;
+      pacc++;
     }
   }
-  _mm_sfence();
+}
+
+// adds the accumulated details back onto the coarsest scale. out may be the same buffer as coarse.
+static void eaw_synthesize(float *const out, const float *const coarse, const float *const accum,
+                           const int32_t width, const int32_t height)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(size_t k = 0; k < (size_t)width * height; k++)
+    _mm_store_ps(out + 4 * k, _mm_add_ps(_mm_load_ps(coarse + 4 * k), _mm_load_ps(accum + 4 * k)));
 }
 
 static int get_samples(float *t, const dt_iop_atrous_data_t *const d, const dt_iop_roi_t *roi_in,
@@ -454,8 +466,8 @@ void process(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
     // dt_control_queue_draw(GTK_WIDGET(g->area));
   }
 
-  float *detail[MAX_NUM_SCALES] = { NULL };
   float *tmp = NULL;
+  float *accum = NULL;
   float *buf2 = NULL;
   float *buf1 = NULL;
 
@@ -469,38 +481,35 @@ void process(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
     goto error;
   }
 
-  for(int k = 0; k < max_scale; k++)
+  accum = (float *)dt_alloc_align(64, (size_t)sizeof(float) * 4 * width * height);
+  if(accum == NULL)
   {
-    detail[k] = (float *)dt_alloc_align(64, (size_t)sizeof(float) * 4 * width * height);
-    if(detail[k] == NULL)
-    {
-      fprintf(stderr, "[atrous] failed to allocate one of the detail buffers!\n");
-      goto error;
-    }
+    fprintf(stderr, "[atrous] failed to allocate detail buffer!\n");
+    goto error;
   }
 
   buf1 = (float *)i;
   buf2 = tmp;
 
+  /* every scale is added to a running sum of details as soon as it is decomposed, so only two coarse
+     buffers and the sum are needed, whatever the number of scales. */
   for(int scale = 0; scale < max_scale; scale++)
   {
-    eaw_decompose(buf2, buf1, detail[scale], scale, sharp[scale], width, height);
+    eaw_decompose(buf2, buf1, scale, sharp[scale], width, height);
+    eaw_accumulate(accum, buf1, buf2, thrs[scale], boost[scale], scale == 0, width, height);
     if(scale == 0) buf1 = (float *)o; // now switch to (float *)o for buffer ping-pong between buf1 and buf2
     float *buf3 = buf2;
     buf2 = buf1;
     buf1 = buf3;
   }
 
-  for(int scale = max_scale - 1; scale >= 0; scale--)
-  {
-    eaw_synthesize(buf2, buf1, detail[scale], thrs[scale], boost[scale], width, height);
-    float *buf3 = buf2;
-    buf2 = buf1;
-    buf1 = buf3;
-  }
-  /* due to symmetric processing, output will be left in (float *)o */
+  /* add the details back onto the coarsest scale, output will be left in (float *)o */
+  if(max_scale > 0)
+    eaw_synthesize((float *)o, buf1, accum, width, height);
+  else
+    memcpy(o, i, (size_t)sizeof(float) * 4 * width * height);
 
-  for(int k = 0; k < max_scale; k++) dt_free_align(detail[k]);
+  dt_free_align(accum);
   dt_free_align(tmp);
 
   if(piece->pipe->mask_display) dt_iop_alpha_copy(i, o, width, height);
@@ -508,8 +517,7 @@ void process(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
   return;
 
 error:
-  for(int k = 0; k < max_scale; k++)
-    if(detail[k] != NULL) dt_free_align(detail[k]);
+  if(accum != NULL) dt_free_align(accum);
   if(tmp != NULL) dt_free_align(tmp);
   return;
 }
@@ -666,7 +674,11 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
   const int max_scale = get_scales(thrs, boost, sharp, d, roi_in, piece);
   const int max_filter_radius = (1 << max_scale); // 2 * 2^max_scale
 
-  tiling->factor = 3.0f + max_scale; // in + out + tmp + scale buffers
+  // the cpu code streams the scales through a running sum, opencl keeps one detail buffer per scale
+  if(piece->process_cl_ready && piece->pipe->opencl_enabled && piece->pipe->devid >= 0)
+    tiling->factor = 3.0f + max_scale; // in + out + tmp + scale buffers
+  else
+    tiling->factor = 4.0f; // in + out + tmp + accumulator
   tiling->maxbuf = 1.0f;
   tiling->overhead = 0;
   tiling->overlap = max_filter_radius;
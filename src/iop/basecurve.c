@@ -207,7 +207,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE;
+  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_PACKED_CACHE;
 }
 
 
@@ -279,6 +279,15 @@ error:
 }
 #endif
 
+static inline float apply_curve(const dt_iop_basecurve_data_t *const d, const float x)
+{
+  // use base curve for values < 1, else use extrapolation.
+  if(x < 1.0f)
+    return d->table[CLAMP((int)(x * 0x10000ul), 0, 0xffff)];
+  else
+    return dt_iop_eval_exp(d->unbounded_coeffs, x);
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, void *o,
              const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
@@ -293,19 +302,21 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
   {
     float *inp = in + ch * k;
     float *outp = out + ch * k;
-    for(int i = 0; i < 3; i++)
-    {
-      // use base curve for values < 1, else use extrapolation.
-      if(inp[i] < 1.0f)
-        outp[i] = d->table[CLAMP((int)(inp[i] * 0x10000ul), 0, 0xffff)];
-      else
-        outp[i] = dt_iop_eval_exp(d->unbounded_coeffs, inp[i]);
-    }
+    for(int i = 0; i < 3; i++) outp[i] = apply_curve(d, inp[i]);
 
     outp[3] = inp[3];
   }
 }
 
+dt_iop_transfer_t transfer_function(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
+                                    const float *const in, float *const out, const int num)
+{
+  const dt_iop_basecurve_data_t *const d = (dt_iop_basecurve_data_t *)(piece->data);
+  for(int k = 0; k < 4 * num; k += 4)
+    for(int c = 0; c < 3; c++) out[k + c] = apply_curve(d, in[k + c]);
+  return DT_IOP_TRANSFER_PER_CHANNEL;
+}
+
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe,
                    dt_dev_pixelpipe_iop_t *piece)
 {
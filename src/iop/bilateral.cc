@@ -194,9 +194,10 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
     for(int k = 0; k < 5; k++) sigma[k] = 1.0f / sigma[k];
     PermutohedralLattice<5, 4> lattice((size_t)roi_in->width * roi_in->height, omp_get_max_threads());
 
-// splat into the lattice
+// splat into the lattice. static scheduling keeps every thread on a contiguous band of rows,
+// so threads mostly hit disjoint vertices of the shared table.
 #ifdef _OPENMP
-#pragma omp parallel for
+#pragma omp parallel for schedule(static)
 #endif
     for(int j = 0; j < roi_in->height; j++)
     {
@@ -206,7 +206,8 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
   const int width = roi_in->width;
   const int height = roi_in->height;
   memcpy(out, in2, width * height * sizeof(float));
-  const float *const in = out;
+  // tiles overlap and are processed in parallel, so always read the uncorrected input
+  const float *const in = in2;
   const uint32_t filters = dt_image_filter(&piece->pipe->image);
   // const float clip_pt = fminf(piece->pipe->processed_maximum[0], fminf(piece->pipe->processed_maximum[1],
   // piece->pipe->processed_maximum[2]));
@@ -282,46 +283,6 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
   // static const float gaussg[5] = {0.171582, 0.15839, 0.124594, 0.083518, 0.0477063};//sig=2.5
   // static const float gaussrb[3] = {0.332406, 0.241376, 0.0924212};//sig=1.25
 
-  // block CA shift values and weight assigned to block
-
-  char *buffer; // TS*TS*16
-  // rgb data in a tile
-  float(*rgb)[3]; // TS*TS*12
-  // color differences
-  float(*grbdiff); // TS*TS*4
-  // green interpolated to optical sample points for R/B
-  float(*gshift); // TS*TS*4
-  // high pass filter for R/B in vertical direction
-  float(*rbhpfh); // TS*TS*4
-  // high pass filter for R/B in horizontal direction
-  float(*rbhpfv); // TS*TS*4
-  // low pass filter for R/B in horizontal direction
-  float(*rblpfh); // TS*TS*4
-  // low pass filter for R/B in vertical direction
-  float(*rblpfv); // TS*TS*4
-  // low pass filter for color differences in horizontal direction
-  float(*grblpfh); // TS*TS*4
-  // low pass filter for color differences in vertical direction
-  float(*grblpfv); // TS*TS*4
-
-
-  /* assign working space; this would not be necessary
-   if the algorithm is part of the larger pre-interpolation processing */
-  buffer = (char *)calloc(11 * TS * TS, sizeof(float));
-  // merror(buffer,"CA_correct()");
-
-  // rgb array
-  rgb = (float(*)[3])buffer;
-  grbdiff = (float(*))(buffer + 3 * sizeof(float) * TS * TS);
-  gshift = (float(*))(buffer + 4 * sizeof(float) * TS * TS);
-  rbhpfh = (float(*))(buffer + 5 * sizeof(float) * TS * TS);
-  rbhpfv = (float(*))(buffer + 6 * sizeof(float) * TS * TS);
-  rblpfh = (float(*))(buffer + 7 * sizeof(float) * TS * TS);
-  rblpfv = (float(*))(buffer + 8 * sizeof(float) * TS * TS);
-  grblpfh = (float(*))(buffer + 9 * sizeof(float) * TS * TS);
-  grblpfv = (float(*))(buffer + 10 * sizeof(float) * TS * TS);
-
-
   if((height + border2) % (TS - border2) == 0)
     vz1 = 1;
   else
@@ -347,19 +308,45 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
   blockwt = (float(*))(buffer1);
   blockshifts = (float(*)[3][2])(buffer1 + (vblsz * hblsz * sizeof(float)));
 
-  int vctr = 0, hctr = 0;
+  // number of tiles in vertical and horizontal direction
+  const int vtiles = (height + border + TS - border2 - 1) / (TS - border2);
+  const int htiles = (width + border + TS - border2 - 1) / (TS - border2);
 
   // if (cared==0 && cablue==0)
   {
     // Main algorithm: Tile loop
-    //#pragma omp parallel for shared(image,height,width) private(top,left,indx,indx1) schedule(dynamic)
-    for(top = -border, vblock = 1; top < height; top += TS - border2, vblock++)
+    // the tiles are independent, every thread works on its own scratch space
+#ifdef _OPENMP
+#pragma omp parallel default(none) shared(Gtmp, blockwt, blockshifts, hblsz, eps, eps2) \
+    private(top, left, vblock, hblock, rrmin, rrmax, ccmin, ccmax, row, col, rr, cc, c, indx, indx1, j, k, \
+            wtu, wtd, wtl, wtr, coeff, CAshift, areawt, gdiff, deltgrb, glpfh, glpfv, gradwt)
+#endif
     {
-      hctr = 0;
-      vctr++;
-      for(left = -border, hblock = 1; left < width; left += TS - border2, hblock++)
+      // rgb data in a tile, followed by the filter buffers, TS*TS*4 bytes each
+      char *buffer = (char *)calloc(11 * TS * TS, sizeof(float));
+      float(*rgb)[3] = (float(*)[3])buffer;
+      // high pass filter for R/B in vertical direction
+      float(*rbhpfh) = (float(*))(buffer + 5 * sizeof(float) * TS * TS);
+      // high pass filter for R/B in horizontal direction
+      float(*rbhpfv) = (float(*))(buffer + 6 * sizeof(float) * TS * TS);
+      // low pass filter for R/B in horizontal direction
+      float(*rblpfh) = (float(*))(buffer + 7 * sizeof(float) * TS * TS);
+      // low pass filter for R/B in vertical direction
+      float(*rblpfv) = (float(*))(buffer + 8 * sizeof(float) * TS * TS);
+      // low pass filter for color differences in horizontal direction
+      float(*grblpfh) = (float(*))(buffer + 9 * sizeof(float) * TS * TS);
+      // low pass filter for color differences in vertical direction
+      float(*grblpfv) = (float(*))(buffer + 10 * sizeof(float) * TS * TS);
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+      for(int tile = 0; tile < vtiles * htiles; tile++)
       {
-        hctr++;
+        vblock = tile / htiles + 1;
+        hblock = tile % htiles + 1;
+        top = -border + (vblock - 1) * (TS - border2);
+        left = -border + (hblock - 1) * (TS - border2);
         int bottom = MIN(top + TS, height + border);
         int right = MIN(left + TS, width + border);
         int rr1 = bottom - top;
@@ -547,7 +534,10 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
               rgb[indx][1] = (wtu * rgb[indx - v1][1] + wtd * rgb[indx + v1][1] + wtl * rgb[indx - 1][1]
                               + wtr * rgb[indx + 1][1]) / (wtu + wtd + wtl + wtr);
             }
-            if(row > -1 && row < height && col > -1 && col < width) Gtmp[row * width + col] = rgb[indx][1];
+            // only the inner part of the tile, the borders belong to the neighbouring tiles
+            if(rr >= border && rr < rr1 - border && cc >= border && cc < cc1 - border && row > -1
+               && row < height && col > -1 && col < width)
+              Gtmp[row * width + col] = rgb[indx][1];
           }
 
         for(rr = 4; rr < rr1 - 4; rr++)
@@ -732,13 +722,6 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
 
             // offset[j][c]=floor(CAshift[j][c]);
             // offset gives NW corner of square containing the min; j=0=vert, 1=hor
-
-            if(fabs(CAshift[j][c]) < 2.0)
-            {
-              blockave[j][c] += CAshift[j][c];
-              blocksqave[j][c] += SQR(CAshift[j][c]);
-              blockdenom[j][c] += 1;
-            }
           } // vert/hor
         } // color
 
@@ -758,9 +741,25 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
           // \n",vblock,hblock,blockshifts[(vblock)*hblsz+hblock][c][0]);
         }
       }
+      free(buffer);
     }
     // end of diagnostic pass
 
+    // statistics of the tile shifts, summed up in tile order to stay reproducible
+    for(vblock = 1; vblock <= vtiles; vblock++)
+      for(hblock = 1; hblock <= htiles; hblock++)
+        for(c = 0; c < 3; c += 2)
+          for(j = 0; j < 2; j++)
+          {
+            const float shift = blockshifts[vblock * hblsz + hblock][c][j];
+            if(fabs(shift) < 2.0)
+            {
+              blockave[j][c] += shift;
+              blocksqave[j][c] += SQR(shift);
+              blockdenom[j][c] += 1;
+            }
+          }
+
     for(j = 0; j < 2; j++)
       for(c = 0; c < 3; c += 2)
       {
@@ -771,7 +770,6 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
         else
         {
           printf("blockdenom vanishes \n");
-          free(buffer);
           free(Gtmp);
           free(buffer1);
           return;
@@ -904,7 +902,6 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
       if(numblox[1] < 10)
       {
         printf("numblox = %d \n", numblox[1]);
-        free(buffer);
         free(Gtmp);
         free(buffer1);
         return;
@@ -920,7 +917,6 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
         {
           printf("CA correction pass failed -- can't solve linear equations for color %d direction %d...\n",
                  c, dir);
-          free(buffer);
           free(Gtmp);
           free(buffer1);
           return;
@@ -932,10 +928,28 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
   // only executed if cared and cablue are zero
 
   // Main algorithm: Tile loop
-  //#pragma omp parallel for shared(image,height,width) private(top,left,indx,indx1) schedule(dynamic)
-  for(top = -border, vblock = 1; top < height; top += TS - border2, vblock++)
-    for(left = -border, hblock = 1; left < width; left += TS - border2, hblock++)
+  // tiles only write their own inner part of out, every thread works on its own scratch space
+#ifdef _OPENMP
+#pragma omp parallel default(none) shared(out, Gtmp, blockshifts, hblsz, polyord, fitparams, eps) \
+    private(top, left, vblock, hblock, rrmin, rrmax, ccmin, ccmax, row, col, rr, cc, c, indx, indx1, i, j, \
+            shifthfloor, shiftvfloor, shifthceil, shiftvceil, shifthfrac, shiftvfrac, GRBdir, Ginthfloor, \
+            Ginthceil, Gint, RBint, grbdiffinthfloor, grbdiffinthceil, grbdiffint, grbdiffold, p)
+#endif
+  {
+    char *buffer = (char *)calloc(11 * TS * TS, sizeof(float));
+    float(*rgb)[3] = (float(*)[3])buffer;
+    float(*grbdiff) = (float(*))(buffer + 3 * sizeof(float) * TS * TS);
+    float(*gshift) = (float(*))(buffer + 4 * sizeof(float) * TS * TS);
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+    for(int tile = 0; tile < vtiles * htiles; tile++)
     {
+      vblock = tile / htiles + 1;
+      hblock = tile % htiles + 1;
+      top = -border + (vblock - 1) * (TS - border2);
+      left = -border + (hblock - 1) * (TS - border2);
       int bottom = MIN(top + TS, height + border);
       int right = MIN(left + TS, width + border);
       int rr1 = bottom - top;
@@ -1288,9 +1302,10 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
           // image[indx][c] = CLIP((int)(65535.0*rgb[(rr)*TS+cc][c] + 0.5));//for dcraw implementation
         }
     }
+    free(buffer);
+  }
 
   // clean up
-  free(buffer);
   free(Gtmp);
   free(buffer1);
 
@@ -104,7 +104,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE;
+  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_PACKED_CACHE;
 }
 
 int legacy_params(dt_iop_module_t *self, const void *const old_params, const int old_version,
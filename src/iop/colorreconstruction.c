@@ -35,6 +35,7 @@
 #include "gui/presets.h"
 #include <gtk/gtk.h>
 #include <inttypes.h>
+#include <xmmintrin.h>
 
 #define DT_COLORRECONSTRUCT_BILATERAL_MAX_RES_S 1000
 #define DT_COLORRECONSTRUCT_BILATERAL_MAX_RES_R 200
@@ -261,21 +262,24 @@ static dt_iop_colorreconstruct_bilateral_t *dt_iop_colorreconstruct_bilateral_th
 }
 
 
-static void dt_iop_colorreconstruct_bilateral_splat(dt_iop_colorreconstruct_bilateral_t *b, const float *const in, const float threshold)
+static inline int dt_iop_colorreconstruct_bilateral_line(const dt_iop_colorreconstruct_bilateral_t *const b, const int j)
 {
-  // splat into downsampled grid
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(b)
-#endif
-  for(int j = 0; j < b->height; j++)
+  return CLAMPS((int)round(CLAMPS(j / b->sigma_s, 0, b->size_y - 1)), 0, b->size_y - 1);
+}
+
+// splat rows j0..j1-1 into a slab of the grid which holds the ny grid lines starting at y0
+static void dt_iop_colorreconstruct_bilateral_splat_band(const dt_iop_colorreconstruct_bilateral_t *const b,
+                                                         const float *const in, const float threshold,
+                                                         dt_iop_colorreconstruct_Lab_t *slab, const int j0,
+                                                         const int j1, const int y0, const int ny)
+{
+  for(int j = j0; j < j1; j++)
   {
-    size_t index = 4 * j * b->width;
+    size_t index = (size_t)4 * j * b->width;
     for(int i = 0; i < b->width; i++, index += 4)
     {
       float x, y, z;
       const float Lin = in[index];
-      const float ain = in[index + 1];
-      const float bin = in[index + 2];
       // we deliberately ignore pixels above threshold
       if (Lin > threshold) continue;
       image_to_grid(b, i, j, Lin, &x, &y, &z);
@@ -284,29 +288,63 @@ static void dt_iop_colorreconstruct_bilateral_splat(dt_iop_colorreconstruct_bila
       const int xi = CLAMPS((int)round(x), 0, b->size_x - 1);
       const int yi = CLAMPS((int)round(y), 0, b->size_y - 1);
       const int zi = CLAMPS((int)round(z), 0, b->size_z - 1);
-      const size_t grid_index = xi + b->size_x * (yi + b->size_y * zi);
+      const size_t grid_index = xi + b->size_x * ((yi - y0) + ny * zi);
 
-#ifdef _OPENMP
-#pragma omp atomic
-#endif
-      b->buf[grid_index].L += Lin;
+      const __m128 pixel = _mm_set_ps(1.0f, in[index + 2], in[index + 1], Lin);
+      _mm_store_ps((float *)(slab + grid_index), _mm_add_ps(_mm_load_ps((float *)(slab + grid_index)), pixel));
+    }
+  }
+}
 
-#ifdef _OPENMP
-#pragma omp atomic
-#endif
-      b->buf[grid_index].a += ain;
+static void dt_iop_colorreconstruct_bilateral_splat(dt_iop_colorreconstruct_bilateral_t *b, const float *const in, const float threshold)
+{
+  // splat into downsampled grid. every thread gets a horizontal band of the image and splats
+  // into its own slab of the grid, covering only the grid lines the band can reach. this
+  // avoids atomics, the slabs are summed up into the grid afterwards.
+  const int nbands = MAX(1, MIN(dt_get_num_threads(), MIN(b->height, (int)b->size_y)));
+  int y0[nbands], ny[nbands];
+  size_t offset[nbands + 1];
+  offset[0] = 0;
+  for(int t = 0; t < nbands; t++)
+  {
+    y0[t] = dt_iop_colorreconstruct_bilateral_line(b, (int64_t)t * b->height / nbands);
+    ny[t] = dt_iop_colorreconstruct_bilateral_line(b, (int64_t)(t + 1) * b->height / nbands - 1) + 1 - y0[t];
+    offset[t + 1] = offset[t] + b->size_x * ny[t] * b->size_z;
+  }
+  dt_iop_colorreconstruct_Lab_t *slabs = dt_alloc_align(16, offset[nbands] * sizeof(dt_iop_colorreconstruct_Lab_t));
+  if(!slabs)
+  {
+    dt_iop_colorreconstruct_bilateral_splat_band(b, in, threshold, b->buf, 0, b->height, 0, b->size_y);
+    return;
+  }
+  memset(slabs, 0, offset[nbands] * sizeof(dt_iop_colorreconstruct_Lab_t));
 
 #ifdef _OPENMP
-#pragma omp atomic
+#pragma omp parallel for schedule(static, 1) shared(b, slabs, y0, ny, offset)
 #endif
-      b->buf[grid_index].b += bin;
+  for(int t = 0; t < nbands; t++)
+    dt_iop_colorreconstruct_bilateral_splat_band(b, in, threshold, slabs + offset[t],
+                                                 (int64_t)t * b->height / nbands,
+                                                 (int64_t)(t + 1) * b->height / nbands, y0[t], ny[t]);
 
+  // every line of the grid is summed up by one thread only
 #ifdef _OPENMP
-#pragma omp atomic
+#pragma omp parallel for schedule(static) shared(b, slabs, y0, ny, offset)
 #endif
-      b->buf[grid_index].weight += 1.0f;
+  for(int l = 0; l < (int)(b->size_y * b->size_z); l++)
+  {
+    const int y = l % b->size_y;
+    const int z = l / b->size_y;
+    float *dst = (float *)(b->buf + (size_t)l * b->size_x);
+    for(int t = 0; t < nbands; t++)
+    {
+      if(y < y0[t] || y >= y0[t] + ny[t]) continue;
+      const float *src = (float *)(slabs + offset[t] + b->size_x * ((y - y0[t]) + (size_t)ny[t] * z));
+      for(int i = 0; i < 4 * b->size_x; i += 4)
+        _mm_store_ps(dst + i, _mm_add_ps(_mm_load_ps(dst + i), _mm_load_ps(src + i)));
     }
   }
+  dt_free_align(slabs);
 }
 
 
@@ -979,7 +1017,7 @@ static size_t dt_iop_colorreconstruct_bilateral_memory_use(const int width,
   size_t size_y = CLAMPS((int)_y, 4, DT_COLORRECONSTRUCT_BILATERAL_MAX_RES_S) + 1;
   size_t size_z = CLAMPS((int)_z, 4, DT_COLORRECONSTRUCT_BILATERAL_MAX_RES_R) + 1;
 
-  return size_x * size_y * size_z * 4 * sizeof(float) * 2;   // in fact only the OpenCL path needs a second tmp buffer
+  return size_x * size_y * size_z * 4 * sizeof(float) * 2;   // a second tmp buffer in OpenCL, the splatting slabs on the cpu
 }
 
 
@@ -26,6 +26,7 @@
 #include <gtk/gtk.h>
 #include <stdlib.h>
 #include "common/gaussian.h"
+#include "common/memo.h"
 
 DT_MODULE_INTROSPECTION(1, dt_iop_defringe_params_t)
 
@@ -122,6 +123,30 @@ static inline void fib_latt(int *const x, int *const y, float radius, int step,
   *y = round(dy - radius / 2.0);
 }
 
+// lattices only depend on these two, so they are shared between all tiles and images
+typedef struct dt_iop_defringe_lattice_key_t
+{
+  int idx;
+  int radius;
+} dt_iop_defringe_lattice_key_t;
+
+static void *fib_latt_compute(const void *key, void *user_data)
+{
+  const dt_iop_defringe_lattice_key_t *k = (const dt_iop_defringe_lattice_key_t *)key;
+  const int samples = fib[k->idx];
+  int *xy = malloc((size_t)2 * sizeof(int) * samples);
+  if(!xy) return NULL;
+  for(int u = 0; u < samples; u++) fib_latt(xy + 2 * u, xy + 2 * u + 1, k->radius, u, k->idx);
+  return xy;
+}
+
+static const int *fib_latt_get(const int radius, const int idx, dt_cache_entry_t **entry)
+{
+  const dt_iop_defringe_lattice_key_t key = {.idx = idx, .radius = radius };
+  return (const int *)dt_memo_get(darktable.memo, "defringe/lattice", &key, sizeof(key), fib_latt_compute,
+                                  NULL, entry);
+}
+
 #define MAGIC_THRESHOLD_COEFF 33.0
 
 // the basis of how the following algorithm works comes from rawtherapee (http://rawtherapee.com/)
@@ -151,9 +176,10 @@ void process(struct dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, void
   const int radius = ceil(2.0 * ceilf(sigma));
 
   // save the fibonacci lattices in them later
-  int *xy_avg = NULL;
-  int *xy_artifact = NULL;
-  int *xy_small = NULL;
+  const int *xy_avg = NULL;
+  const int *xy_artifact = NULL;
+  const int *xy_small = NULL;
+  dt_cache_entry_t *avg_entry = NULL, *small_entry = NULL;
 
   if(roi_out->width < 2 * radius + 1 || roi_out->height < 2 * radius + 1) goto ERROR_EXIT;
 
@@ -175,8 +201,6 @@ void process(struct dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, void
   dt_gaussian_free(gauss);
 
   // Pre-Compute Fibonacci Lattices
-  int *tmp;
-
   int samples_wish = radius * radius;
   int sampleidx_avg;
   // select samples by fibonacci number
@@ -212,36 +236,9 @@ void process(struct dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, void
   const int samples_small = fib[sampleidx_small];
   const int samples_avg = fib[sampleidx_avg];
 
-  // precompute all required fibonacci lattices:
-  if((xy_avg = malloc((size_t)2 * sizeof(int) * samples_avg)))
-  {
-    tmp = xy_avg;
-    for(int u = 0; u < samples_avg; u++)
-    {
-      int dx, dy;
-      fib_latt(&dx, &dy, avg_radius, u, sampleidx_avg);
-      *tmp++ = dx;
-      *tmp++ = dy;
-    }
-  }
-  else
-  {
-    fprintf(stderr, "Error allocating memory for fibonacci lattice in: defringe module\n");
-    goto ERROR_EXIT;
-  }
-
-  if((xy_small = malloc((size_t)2 * sizeof(int) * samples_small)))
-  {
-    tmp = xy_small;
-    for(int u = 0; u < samples_small; u++)
-    {
-      int dx, dy;
-      fib_latt(&dx, &dy, small_radius, u, sampleidx_small);
-      *tmp++ = dx;
-      *tmp++ = dy;
-    }
-  }
-  else
+  // fetch all required fibonacci lattices, computed once per radius:
+  if(!(xy_avg = fib_latt_get(avg_radius, sampleidx_avg, &avg_entry))
+     || !(xy_small = fib_latt_get(small_radius, sampleidx_small, &small_entry)))
   {
     fprintf(stderr, "Error allocating memory for fibonacci lattice in: defringe module\n");
     goto ERROR_EXIT;
@@ -376,9 +373,8 @@ ERROR_EXIT:
   memcpy(o, i, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
 
 FINISH_PROCESS:
-  free(xy_artifact);
-  free(xy_small);
-  free(xy_avg);
+  dt_memo_release(darktable.memo, small_entry);
+  dt_memo_release(darktable.memo, avg_entry);
 }
 
 void reload_defaults(dt_iop_module_t *module)
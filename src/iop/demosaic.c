@@ -119,7 +119,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE;
+  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_PACKED_CACHE;
 }
 
 void init_key_accels(dt_iop_module_so_t *self)
@@ -1396,6 +1396,60 @@ void modify_roi_in(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *
     roi_in->height = piece->pipe->image.height;
 }
 
+/** demosaic by binning the mosaic into cells of factor x factor pixels (2 for bayer, 3 for x-trans).
+ * every cell is filtered with a separable tent spanning the neighbouring cells, which
+ * is the anti-aliasing filter for the factor:1 step and puts all three colours at the
+ * cell centre. roi_out is the binned buffer, roi_in the full-size mosaic. */
+static void demosaic_binned(float *const out, const float *const in, const dt_iop_roi_t *const roi_out,
+                            const dt_iop_roi_t *const roi_in, const int factor, const unsigned int filters,
+                            const uint8_t (*const xtrans)[6])
+{
+  static const float tent2[4] = { 1.0f, 3.0f, 3.0f, 1.0f };
+  static const float tent3[5] = { 1.0f, 2.0f, 3.0f, 2.0f, 1.0f };
+  const float *const tent = factor == 2 ? tent2 : tent3;
+  const int taps = factor + 2;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for(int j = 0; j < roi_out->height; j++)
+  {
+    float *outp = out + (size_t)4 * roi_out->width * j;
+    for(int i = 0; i < roi_out->width; i++, outp += 4)
+    {
+      float sum[3] = { 0.0f }, wgt[3] = { 0.0f };
+      for(int jj = 0; jj < taps; jj++)
+      {
+        const int y = factor * j - 1 + jj;
+        if(y < 0 || y >= roi_in->height) continue;
+        const float *inp = in + (size_t)roi_in->width * y;
+        for(int ii = 0; ii < taps; ii++)
+        {
+          const int x = factor * i - 1 + ii;
+          if(x < 0 || x >= roi_in->width) continue;
+          int c = fcol(y + roi_in->y, x + roi_in->x, filters, xtrans);
+          if(c == 3) c = 1;
+          const float w = tent[jj] * tent[ii];
+          sum[c] += w * inp[x];
+          wgt[c] += w;
+        }
+      }
+      for(int c = 0; c < 3; c++) outp[c] = wgt[c] > 0.0f ? sum[c] / wgt[c] : 0.0f;
+      outp[3] = 0.0f;
+    }
+  }
+}
+
+/** exports at or below half (third for x-trans) size are demosaiced on binned cells instead
+ * of at 1:1, if the user did not ask for full resolution processing. */
+static int binned_export(const dt_dev_pixelpipe_iop_t *const piece, const dt_iop_roi_t *const roi_out,
+                         const unsigned int filters)
+{
+  return piece->pipe->type == DT_DEV_PIXELPIPE_EXPORT
+         && roi_out->scale <= (filters == 9u ? 1.0f / 3.0f : 0.5f)
+         && dt_conf_get_bool("plugins/darkroom/demosaic/binned_export");
+}
+
 static int get_quality()
 {
   int qual = 1;
@@ -1458,9 +1512,34 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
 
   const float *const pixels = (float *)i;
 
-  if((piece->pipe->type == DT_DEV_PIXELPIPE_FULL && qual > 0) ||
+  // demosaic on binned cells and resample these, never touching a full-size buffer
+  const int binned = binned_export(piece, roi_out, data->filters);
+  const int factor = data->filters == 9u ? 3 : 2;
+  dt_iop_roi_t rob = *roi_in;
+  rob.x = rob.y = 0;
+  rob.width = roi_in->width / factor;
+  rob.height = roi_in->height / factor;
+  rob.scale = 1.0f;
+  float *binned_buf = NULL;
+  if(binned)
+  {
+    binned_buf = (float *)dt_alloc_align(16, (size_t)rob.width * rob.height * 4 * sizeof(float));
+    // the full size path needs even more memory, sample the mosaic directly instead
+    if(!binned_buf) fprintf(stderr, "[demosaic] could not allocate the binned buffer, sampling the mosaic\n");
+  }
+
+  if(binned_buf)
+  {
+    demosaic_binned(binned_buf, pixels, &rob, roi_in, factor, data->filters, img->xtrans);
+    roi = *roi_out;
+    roi.x = roi.y = 0;
+    roi.scale = roi_out->scale * factor;
+    dt_iop_clip_and_zoom((float *)o, binned_buf, &roi, &rob, roi.width, rob.width);
+    dt_free_align(binned_buf);
+  }
+  else if(!binned && ((piece->pipe->type == DT_DEV_PIXELPIPE_FULL && qual > 0) ||
       piece->pipe->type == DT_DEV_PIXELPIPE_EXPORT || (uhq_thumb) ||
-      roi_out->scale > (img->filters == 9u ? 0.333f : .5f))
+      roi_out->scale > (img->filters == 9u ? 0.333f : .5f)))
   {
     // Full demosaic and then scaling if needed
     int scaled = (roi_out->scale <= 0.99999f || roi_out->scale >= 1.00001f);
@@ -1806,6 +1885,8 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
 
   if(roi_out->scale > 0.99999f && roi_out->scale < 1.00001f)
     tiling->factor += fmax(0.25f, smooth);
+  else if(binned_export(piece, roi_out, data->filters))
+    tiling->factor += fmax(0.25f + (data->filters == 9u ? 1.0f / 9.0f : 0.25f), smooth);
   else if(roi_out->scale > (data->filters == 9u ? 0.333f : 0.5f)
           || (piece->pipe->type == DT_DEV_PIXELPIPE_FULL && qual > 0)
           || (piece->pipe->type == DT_DEV_PIXELPIPE_EXPORT))
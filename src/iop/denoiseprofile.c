@@ -22,6 +22,7 @@
 #include "develop/tiling.h"
 #include "bauhaus/bauhaus.h"
 #include "control/control.h"
+#include "common/memo.h"
 #include "common/noiseprofiles.h"
 #include "common/opencl.h"
 #include "gui/accelerators.h"
@@ -199,7 +200,11 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
 
     const int max_filter_radius = (1 << max_scale); // 2 * 2^max_scale
 
-    tiling->factor = 3.5f + max_scale; // in + out + tmp + reducebuffer + scale buffers
+    // the cpu code streams the scales through a running sum, opencl keeps one detail buffer per scale
+    if(piece->process_cl_ready && piece->pipe->opencl_enabled && piece->pipe->devid >= 0)
+      tiling->factor = 3.5f + max_scale; // in + out + tmp + reducebuffer + scale buffers
+    else
+      tiling->factor = 4.0f; // in + out + tmp + accumulator
     tiling->maxbuf = 1.0f;
     tiling->overhead = 0;
     tiling->overlap = max_filter_radius;
@@ -321,7 +326,6 @@ static inline __m128 weight_sse(const __m128 *c1, const __m128 *c2, const float
 #define ROW_PROLOGUE                                                                                         \
   const __m128 *px = ((__m128 *)in) + (size_t)j * width;                                                     \
   const __m128 *px2;                                                                                         \
-  float *pdetail = detail + (size_t)4 * j * width;                                                           \
   float *pcoarse = out + (size_t)4 * j * width;
 
 #define SUM_PIXEL_PROLOGUE                                                                                   \
@@ -331,14 +335,13 @@ static inline __m128 weight_sse(const __m128 *c1, const __m128 *c2, const float
 #define SUM_PIXEL_EPILOGUE                                                                                   \
   sum = _mm_div_ps(sum, wgt);                                                                                \
                                                                                                              \
-  _mm_stream_ps(pdetail, _mm_sub_ps(*px, sum));                                                              \
   _mm_stream_ps(pcoarse, sum);                                                                               \
   px++;                                                                                                      \
-  pdetail += 4;                                                                                              \
   pcoarse += 4;
 
-static void eaw_decompose(float *const out, const float *const in, float *const detail, const int scale,
-                          const float inv_sigma2, const int32_t width, const int32_t height)
+// the detail coefficients of this scale are not stored, they are exactly in - out.
+static void eaw_decompose(float *const out, const float *const in, const int scale, const float inv_sigma2,
+                          const int32_t width, const int32_t height)
 {
   const int mult = 1 << scale;
   static const float filter[5] = { 1.0f / 16.0f, 4.0f / 16.0f, 6.0f / 16.0f, 4.0f / 16.0f, 1.0f / 16.0f };
@@ -453,8 +456,11 @@ static void eaw_decompose(float *const out, const float *const in, float *const
 #undef SUM_PIXEL_PROLOGUE
 #undef SUM_PIXEL_EPILOGUE
 
-static void eaw_synthesize(float *const out, const float *const in, const float *const detail,
-                           const float *thrsf, const float *boostf, const int32_t width, const int32_t height)
+// adds the thresholded detail coefficients of one scale, the difference of the coarse buffers before and
+// after its decomposition, to the running sum in accum. the first scale starts the sum.
+static void eaw_accumulate(float *const accum, const float *const coarse_in, const float *const coarse_out,
+                           const float *thrsf, const float *boostf, const int first, const int32_t width,
+                           const int32_t height)
 {
   const __m128 threshold = _mm_set_ps(thrsf[3], thrsf[2], thrsf[1], thrsf[0]);
   const __m128 boost = _mm_set_ps(boostf[3], boostf[2], boostf[1], boostf[0]);
@@ -464,27 +470,35 @@ static void eaw_synthesize(float *const out, const float *const in, const float
 #endif
   for(int j = 0; j < height; j++)
   {
-    // TODO: prefetch? _mm_prefetch()
-    const __m128 *pin = (__m128 *)in + (size_t)j * width;
-    __m128 *pdetail = (__m128 *)detail + (size_t)j * width;
-    float *pout = out + (size_t)4 * j * width;
+    const __m128 *pin = (__m128 *)coarse_in + (size_t)j * width;
+    const __m128 *pcoarse = (__m128 *)coarse_out + (size_t)j * width;
+    __m128 *pacc = (__m128 *)accum + (size_t)j * width;
     for(int i = 0; i < width; i++)
     {
-#if 1
       const __m128i maski = _mm_set1_epi32(0x80000000u);
       const __m128 *mask = (__m128 *)&maski;
+      const __m128 detail = _mm_sub_ps(*pin, *pcoarse);
       const __m128 absamt
-          = _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_andnot_ps(*mask, *pdetail), threshold));
-      const __m128 amount = _mm_or_ps(_mm_and_ps(*pdetail, *mask), absamt);
-      _mm_stream_ps(pout, _mm_add_ps(*pin, _mm_mul_ps(boost, amount)));
-#endif
-      // _mm_stream_ps(pout, _mm_add_ps(*pin, *pdetail));
-      pdetail++;
+          = _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_andnot_ps(*mask, detail), threshold));
+      const __m128 amount = _mm_or_ps(_mm_and_ps(detail, *mask), absamt);
+      const __m128 contrib = _mm_mul_ps(boost, amount);
+      *pacc = first ? contrib : _mm_add_ps(*pacc, contrib);
       pin++;
-      pout += 4;
+      pcoarse++;
+      pacc++;
     }
   }
-  _mm_sfence();
+}
+
+// adds the accumulated details back onto the coarsest scale. out may be the same buffer as coarse.
+static void eaw_synthesize(float *const out, const float *const coarse, const float *const accum,
+                           const int32_t width, const int32_t height)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(size_t k = 0; k < (size_t)width * height; k++)
+    _mm_store_ps(out + 4 * k, _mm_add_ps(_mm_load_ps(coarse + 4 * k), _mm_load_ps(accum + 4 * k)));
 }
 // =====================================================================================
 
@@ -515,12 +529,10 @@ void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piec
     if(t < 0.0f) break;
   }
 
-  float *buf[max_max_scale];
-  float *tmp = NULL;
+  float *tmp = NULL, *accum = NULL;
   float *buf1 = NULL, *buf2 = NULL;
-  for(int k = 0; k < max_scale; k++)
-    buf[k] = dt_alloc_align(64, (size_t)4 * sizeof(float) * roi_in->width * roi_in->height);
   tmp = dt_alloc_align(64, (size_t)4 * sizeof(float) * roi_in->width * roi_in->height);
+  accum = dt_alloc_align(64, (size_t)4 * sizeof(float) * roi_in->width * roi_in->height);
 
   const float wb[3] = { // twice as many samples in green channel:
                         2.0f * piece->pipe->processed_maximum[0] * d->strength * (scale * scale),
@@ -547,14 +559,16 @@ void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piec
   buf1 = (float *)ovoid;
   buf2 = tmp;
 
+  // every scale is thresholded and added to a running sum as soon as it is decomposed, so only the two
+  // coarse buffers and the sum are alive at any time, whatever the number of scales.
   for(int scale = 0; scale < max_scale; scale++)
   {
+    // variance stabilizing transform maps sigma to unity.
     const float sigma = 1.0f;
+    // it is then transformed by wavelet scales via the 5 tap a-trous filter:
     const float varf = sqrtf(2.0f + 2.0f * 4.0f * 4.0f + 6.0f * 6.0f) / 16.0f; // about 0.5
     const float sigma_band = powf(varf, scale) * sigma;
-    eaw_decompose(buf2, buf1, buf[scale], scale, 1.0f / (sigma_band * sigma_band), width, height);
-// DEBUG: clean out temporary memory:
-// memset(buf1, 0, sizeof(float)*4*width*height);
+    eaw_decompose(buf2, buf1, scale, 1.0f / (sigma_band * sigma_band), width, height);
 #if 0 // DEBUG: print wavelet scales:
     if(piece->pipe->type != DT_DEV_PIXELPIPE_PREVIEW)
     {
@@ -570,30 +584,25 @@ void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piec
       f = fopen(filename, "wb");
       fprintf(f, "PF\n%d %d\n-1.0\n", width, height);
       for(int k=0; k<n; k++)
-        fwrite(buf[scale]+4*k, sizeof(float), 3, f);
+        for(int c=0; c<3; c++)
+        {
+          const float detail = buf1[4*k+c] - buf2[4*k+c];
+          fwrite(&detail, sizeof(float), 1, f);
+        }
       fclose(f);
     }
 #endif
-    float *buf3 = buf2;
-    buf2 = buf1;
-    buf1 = buf3;
-  }
-
-  // now do everything backwards, so the result will end up in *ovoid
-  for(int scale = max_scale - 1; scale >= 0; scale--)
-  {
 #if 1
-    // variance stabilizing transform maps sigma to unity.
-    const float sigma = 1.0f;
-    // it is then transformed by wavelet scales via the 5 tap a-trous filter:
-    const float varf = sqrtf(2.0f + 2.0f * 4.0f * 4.0f + 6.0f * 6.0f) / 16.0f; // about 0.5
-    const float sigma_band = powf(varf, scale) * sigma;
     // determine thrs as bayesshrink
     // TODO: parallelize!
     float sum_y2[3] = { 0.0f };
     const size_t n = (size_t)width * height;
     for(size_t k = 0; k < n; k++)
-      for(int c = 0; c < 3; c++) sum_y2[c] += buf[scale][4 * k + c] * buf[scale][4 * k + c];
+      for(int c = 0; c < 3; c++)
+      {
+        const float detail = buf1[4 * k + c] - buf2[4 * k + c];
+        sum_y2[c] += detail * detail;
+      }
 
     const float sb2 = sigma_band * sigma_band;
     const float var_y[3] = { sum_y2[0] / (n - 1.0f), sum_y2[1] / (n - 1.0f), sum_y2[2] / (n - 1.0f) };
@@ -609,18 +618,19 @@ void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piec
 #endif
     const float boost[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
     // const float thrs[4] = { 0.0, 0.0, 0.0, 0.0 };
-    eaw_synthesize(buf2, buf1, buf[scale], thrs, boost, width, height);
-    // DEBUG: clean out temporary memory:
-    // memset(buf1, 0, sizeof(float)*4*width*height);
+    eaw_accumulate(accum, buf1, buf2, thrs, boost, scale == 0, width, height);
 
     float *buf3 = buf2;
     buf2 = buf1;
     buf1 = buf3;
   }
 
+  // add the details back onto the coarsest scale, so the result will end up in *ovoid
+  if(max_scale > 0) eaw_synthesize((float *)ovoid, buf1, accum, width, height);
+
   backtransform((float *)ovoid, width, height, aa, bb);
 
-  for(int k = 0; k < max_scale; k++) dt_free_align(buf[k]);
+  dt_free_align(accum);
   dt_free_align(tmp);
 
   if(piece->pipe->mask_display) dt_iop_alpha_copy(ivoid, ovoid, width, height);
@@ -1483,29 +1493,64 @@ void cleanup_global(dt_iop_module_so_t *module)
   module->data = NULL;
 }
 
-static dt_noiseprofile_t dt_iop_denoiseprofile_get_auto_profile(dt_iop_module_t *self)
+// the matching profiles only depend on the camera and the iso, which are the same for a whole shoot
+typedef struct dt_iop_denoiseprofile_auto_key_t
+{
+  char maker[64];
+  char model[64];
+  int iso;
+} dt_iop_denoiseprofile_auto_key_t;
+
+static void *dt_iop_denoiseprofile_compute_auto_profile(const void *key, void *user_data)
 {
-  GList *profiles = dt_noiseprofile_get_matching(&self->dev->image_storage);
-  dt_noiseprofile_t interpolated = dt_noiseprofile_generic; // default to generic poissonian
+  const dt_iop_denoiseprofile_auto_key_t *k = (const dt_iop_denoiseprofile_auto_key_t *)key;
+  dt_noiseprofile_t *interpolated = (dt_noiseprofile_t *)malloc(sizeof(dt_noiseprofile_t));
+  if(!interpolated) return NULL;
+  GList *profiles = dt_noiseprofile_get_matching((const dt_image_t *)user_data);
+  *interpolated = dt_noiseprofile_generic; // default to generic poissonian
 
-  const int iso = self->dev->image_storage.exif_iso;
+  const int iso = k->iso;
   dt_noiseprofile_t *last = NULL;
   for(GList *iter = profiles; iter; iter = g_list_next(iter))
   {
     dt_noiseprofile_t *current = (dt_noiseprofile_t *)iter->data;
     if(current->iso == iso)
     {
-      interpolated = *current;
+      *interpolated = *current;
       break;
     }
     if(last && last->iso < iso && current->iso > iso)
     {
-      dt_noiseprofile_interpolate(last, current, &interpolated);
+      dt_noiseprofile_interpolate(last, current, interpolated);
       break;
     }
     last = current;
   }
   g_list_free_full(profiles, dt_noiseprofile_free);
+  // the strings went with the list
+  interpolated->name = interpolated->maker = interpolated->model = NULL;
+  return interpolated;
+}
+
+static dt_noiseprofile_t dt_iop_denoiseprofile_get_auto_profile(dt_iop_module_t *self)
+{
+  const dt_image_t *img = &self->dev->image_storage;
+  dt_iop_denoiseprofile_auto_key_t key;
+  memset(&key, 0, sizeof(key));
+  g_strlcpy(key.maker, img->exif_maker, sizeof(key.maker));
+  g_strlcpy(key.model, img->exif_model, sizeof(key.model));
+  key.iso = img->exif_iso;
+
+  dt_cache_entry_t *entry;
+  dt_noiseprofile_t interpolated = dt_noiseprofile_generic;
+  const dt_noiseprofile_t *cached
+      = (const dt_noiseprofile_t *)dt_memo_get(darktable.memo, "denoiseprofile/auto", &key, sizeof(key),
+                                               dt_iop_denoiseprofile_compute_auto_profile, (void *)img, &entry);
+  if(cached)
+  {
+    interpolated = *cached;
+    dt_memo_release(darktable.memo, entry);
+  }
   return interpolated;
 }
 
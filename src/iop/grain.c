@@ -22,6 +22,7 @@
 #include <math.h>
 #include <assert.h>
 #include <string.h>
+#include <xmmintrin.h>
 #ifdef HAVE_GEGL
 #include <gegl.h>
 #endif
@@ -74,6 +75,13 @@ typedef struct dt_iop_grain_data_t
   _dt_iop_grain_channel_t channel;
   float scale;
   float strength;
+
+  // grain of the last roi processed by the full or preview pipe, together with everything it depends on
+  float *noise;
+  dt_iop_roi_t noise_roi;
+  float noise_scale;
+  unsigned int noise_hash;
+  double noise_wd, noise_iscale;
 } dt_iop_grain_data_t;
 
 
@@ -110,151 +118,90 @@ static void _simplex_noise_init()
 {
   for(int i = 0; i < 512; i++) perm[i] = p[i & 255];
 }
-static double dot(int g[], double x, double y, double z)
-{
-  return g[0] * x + g[1] * y + g[2] * z;
-}
 
 #define FASTFLOOR(x) (x > 0 ? (int)(x) : (int)(x)-1)
 
-static double _simplex_noise(double xin, double yin, double zin)
+// 3d simplex noise of four points. finding the simplex cell and the corners needs double precision: the
+// corner contributions don't quite fall off to zero at the cell borders, so the choice of simplex has to be
+// made exactly as before. everything relative to the cell origin is done for all four points at once.
+static __m128 _simplex_noise(const double *const xin, const double *const yin, const double zin)
 {
-  double n0, n1, n2, n3; // Noise contributions from the four corners
-                         // Skew the input space to determine which simplex cell we're in
-  double F3 = 1.0 / 3.0;
-  double s = (xin + yin + zin) * F3; // Very nice and simple skew factor for 3D
-  int i = FASTFLOOR(xin + s);
-  int j = FASTFLOOR(yin + s);
-  int k = FASTFLOOR(zin + s);
-  double G3 = 1.0 / 6.0; // Very nice and simple unskew factor, too
-  double t = (i + j + k) * G3;
-  double X0 = i - t; // Unskew the cell origin back to (x,y,z) space
-  double Y0 = j - t;
-  double Z0 = k - t;
-  double x0 = xin - X0; // The x,y,z distances from the cell origin
-  double y0 = yin - Y0;
-  double z0 = zin - Z0;
-  // For the 3D case, the simplex shape is a slightly irregular tetrahedron.
-  // Determine which simplex we are in.
-  int i1, j1, k1; // Offsets for second corner of simplex in (i,j,k) coords
-  int i2, j2, k2; // Offsets for third corner of simplex in (i,j,k) coords
-  if(x0 >= y0)
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 G3 = _mm_set1_ps(1.0f / 6.0f);
+  float cx[4] __attribute__((aligned(16))), cy[4] __attribute__((aligned(16))),
+      cz[4] __attribute__((aligned(16)));
+  float o[6][4] __attribute__((aligned(16)));    // offsets of the second and third corner, lane
+  float g[4][3][4] __attribute__((aligned(16))); // corner, gradient component, lane
+  for(int l = 0; l < 4; l++)
   {
-    if(y0 >= z0)
-    {
-      i1 = 1; // X Y Z order
-      j1 = 0;
-      k1 = 0;
-      i2 = 1;
-      j2 = 1;
-      k2 = 0;
-    }
-    else if(x0 >= z0)
-    {
-      i1 = 1; // X Z Y order
-      j1 = 0;
-      k1 = 0;
-      i2 = 1;
-      j2 = 0;
-      k2 = 1;
-    }
-    else
-    {
-      i1 = 0; // Z X Y order
-      j1 = 0;
-      k1 = 1;
-      i2 = 1;
-      j2 = 0;
-      k2 = 1;
-    }
-  }
-  else // x0<y0
-  {
-    if(y0 < z0)
-    {
-      i1 = 0; // Z Y X order
-      j1 = 0;
-      k1 = 1;
-      i2 = 0;
-      j2 = 1;
-      k2 = 1;
-    }
-    else if(x0 < z0)
-    {
-      i1 = 0; // Y Z X order
-      j1 = 1;
-      k1 = 0;
-      i2 = 0;
-      j2 = 1;
-      k2 = 1;
-    }
-    else
-    {
-      i1 = 0; // Y X Z order
-      j1 = 1;
-      k1 = 0;
-      i2 = 1;
-      j2 = 1;
-      k2 = 0;
-    }
+    // Skew the input space to determine which simplex cell we're in
+    const double s = (xin[l] + yin[l] + zin) * (1.0 / 3.0); // Very nice and simple skew factor for 3D
+    const int i = FASTFLOOR(xin[l] + s);
+    const int j = FASTFLOOR(yin[l] + s);
+    const int k = FASTFLOOR(zin + s);
+    const double t = (i + j + k) * (1.0 / 6.0); // Very nice and simple unskew factor, too
+    // The x,y,z distances from the unskewed cell origin
+    const double x0 = xin[l] - (i - t);
+    const double y0 = yin[l] - (j - t);
+    const double z0 = zin - (k - t);
+    // For the 3D case, the simplex shape is a slightly irregular tetrahedron. Determine which simplex we are
+    // in: the second corner is one step along the largest coordinate, the third one is one step back along
+    // the smallest from the opposite corner.
+    const int xy = x0 >= y0, yz = y0 >= z0, xz = x0 >= z0;
+    const int i1 = xy && xz, j1 = !xy && yz, k1 = !yz && !xz;
+    const int i2 = xy || xz, j2 = !xy || yz, k2 = !yz || !xz;
+    // Work out the hashed gradient indices of the four simplex corners
+    const int ii = i & 255;
+    const int jj = j & 255;
+    const int kk = k & 255;
+    const int gi[4] = { perm[ii + perm[jj + perm[kk]]] % 12, perm[ii + i1 + perm[jj + j1 + perm[kk + k1]]] % 12,
+                        perm[ii + i2 + perm[jj + j2 + perm[kk + k2]]] % 12,
+                        perm[ii + 1 + perm[jj + 1 + perm[kk + 1]]] % 12 };
+    for(int c = 0; c < 4; c++)
+      for(int d = 0; d < 3; d++) g[c][d][l] = grad3[gi[c]][d];
+
+    cx[l] = x0;
+    cy[l] = y0;
+    cz[l] = z0;
+    o[0][l] = i1;
+    o[1][l] = j1;
+    o[2][l] = k1;
+    o[3][l] = i2;
+    o[4][l] = j2;
+    o[5][l] = k2;
   }
-  //  A step of (1,0,0) in (i,j,k) means a step of (1-c,-c,-c) in (x,y,z),
-  //  a step of (0,1,0) in (i,j,k) means a step of (-c,1-c,-c) in (x,y,z), and
-  //  a step of (0,0,1) in (i,j,k) means a step of (-c,-c,1-c) in (x,y,z), where
-  //  c = 1/6.
-  double x1 = x0 - i1 + G3; // Offsets for second corner in (x,y,z) coords
-  double y1 = y0 - j1 + G3;
-  double z1 = z0 - k1 + G3;
-  double x2 = x0 - i2 + 2.0 * G3; // Offsets for third corner in (x,y,z) coords
-  double y2 = y0 - j2 + 2.0 * G3;
-  double z2 = z0 - k2 + 2.0 * G3;
-  double x3 = x0 - 1.0 + 3.0 * G3; // Offsets for last corner in (x,y,z) coords
-  double y3 = y0 - 1.0 + 3.0 * G3;
-  double z3 = z0 - 1.0 + 3.0 * G3;
-  // Work out the hashed gradient indices of the four simplex corners
-  int ii = i & 255;
-  int jj = j & 255;
-  int kk = k & 255;
-  int gi0 = perm[ii + perm[jj + perm[kk]]] % 12;
-  int gi1 = perm[ii + i1 + perm[jj + j1 + perm[kk + k1]]] % 12;
-  int gi2 = perm[ii + i2 + perm[jj + j2 + perm[kk + k2]]] % 12;
-  int gi3 = perm[ii + 1 + perm[jj + 1 + perm[kk + 1]]] % 12;
+
+  const __m128 x0 = _mm_load_ps(cx);
+  const __m128 y0 = _mm_load_ps(cy);
+  const __m128 z0 = _mm_load_ps(cz);
+  // Offsets of the other corners in (x,y,z) coords
+  const __m128 x1 = _mm_add_ps(_mm_sub_ps(x0, _mm_load_ps(o[0])), G3);
+  const __m128 y1 = _mm_add_ps(_mm_sub_ps(y0, _mm_load_ps(o[1])), G3);
+  const __m128 z1 = _mm_add_ps(_mm_sub_ps(z0, _mm_load_ps(o[2])), G3);
+  const __m128 x2 = _mm_add_ps(_mm_sub_ps(x0, _mm_load_ps(o[3])), _mm_add_ps(G3, G3));
+  const __m128 y2 = _mm_add_ps(_mm_sub_ps(y0, _mm_load_ps(o[4])), _mm_add_ps(G3, G3));
+  const __m128 z2 = _mm_add_ps(_mm_sub_ps(z0, _mm_load_ps(o[5])), _mm_add_ps(G3, G3));
+  const __m128 x3 = _mm_sub_ps(x0, _mm_set1_ps(0.5f));
+  const __m128 y3 = _mm_sub_ps(y0, _mm_set1_ps(0.5f));
+  const __m128 z3 = _mm_sub_ps(z0, _mm_set1_ps(0.5f));
+
   // Calculate the contribution from the four corners
-  double t0 = 0.6 - x0 * x0 - y0 * y0 - z0 * z0;
-  if(t0 < 0)
-    n0 = 0.0;
-  else
-  {
-    t0 *= t0;
-    n0 = t0 * t0 * dot(grad3[gi0], x0, y0, z0);
-  }
-  double t1 = 0.6 - x1 * x1 - y1 * y1 - z1 * z1;
-  if(t1 < 0)
-    n1 = 0.0;
-  else
-  {
-    t1 *= t1;
-    n1 = t1 * t1 * dot(grad3[gi1], x1, y1, z1);
-  }
-  double t2 = 0.6 - x2 * x2 - y2 * y2 - z2 * z2;
-  if(t2 < 0)
-    n2 = 0.0;
-  else
+  const __m128 xc[4] = { x0, x1, x2, x3 }, yc[4] = { y0, y1, y2, y3 }, zc[4] = { z0, z1, z2, z3 };
+  __m128 n = zero;
+  for(int c = 0; c < 4; c++)
   {
-    t2 *= t2;
-    n2 = t2 * t2 * dot(grad3[gi2], x2, y2, z2);
+    __m128 tc = _mm_sub_ps(_mm_set1_ps(0.6f), _mm_add_ps(_mm_add_ps(_mm_mul_ps(xc[c], xc[c]),
+                                                                   _mm_mul_ps(yc[c], yc[c])),
+                                                        _mm_mul_ps(zc[c], zc[c])));
+    tc = _mm_max_ps(tc, zero);
+    tc = _mm_mul_ps(tc, tc);
+    const __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(g[c][0]), xc[c]),
+                                             _mm_mul_ps(_mm_load_ps(g[c][1]), yc[c])),
+                                  _mm_mul_ps(_mm_load_ps(g[c][2]), zc[c]));
+    n = _mm_add_ps(n, _mm_mul_ps(_mm_mul_ps(tc, tc), dot));
   }
-  double t3 = 0.6 - x3 * x3 - y3 * y3 - z3 * z3;
-  if(t3 < 0)
-    n3 = 0.0;
-  else
-  {
-    t3 *= t3;
-    n3 = t3 * t3 * dot(grad3[gi3], x3, y3, z3);
-  }
-  // Add contributions from each corner to get the final noise value.
   // The result is scaled to stay just inside [-1,1]
-  return 32.0 * (n0 + n1 + n2 + n3);
+  return _mm_mul_ps(_mm_set1_ps(32.0f), n);
 }
 
 
@@ -315,17 +262,19 @@ static double _perlin_2d_noise(double x,double y,uint32_t octaves,double persist
   return total;
 }*/
 
-static double _simplex_2d_noise(double x, double y, uint32_t octaves, double persistance, double z)
+// the grain at four points of noise space. with three octaves and a persistance of 1 the octave loop
+// this module always used boils down to the first and the third octave.
+static inline __m128 _simplex_2d_noise(const double x[4], const double y[4], const double zoom)
 {
-  double f = 1, a = 1, total = 0;
-
-  for(uint32_t o = 0; o < octaves; o++)
+  double x0[4], y0[4], x2[4], y2[4];
+  for(int l = 0; l < 4; l++)
   {
-    total += (_simplex_noise(x * f / z, y * f / z, o) * a);
-    f = 2 * o;
-    a = persistance * o;
+    x0[l] = x[l] / zoom;
+    y0[l] = y[l] / zoom;
+    x2[l] = 2.0 * x[l] / zoom;
+    y2[l] = 2.0 * y[l] / zoom;
   }
-  return total;
+  return _mm_add_ps(_simplex_noise(x0, y0, 0.0), _simplex_noise(x2, y2, 2.0));
 }
 
 
@@ -370,6 +319,46 @@ static unsigned int _hash_string(char *s)
   return h;
 }
 
+// grain of the pixels i .. i + 3 of row j of the roi
+static inline __m128 _grain_noise(const dt_iop_roi_t *const roi_out, const int i, const int j, const double wd,
+                                  const double zoom, const unsigned int hash, const int filter,
+                                  const double filtermul)
+{
+  // calculate x, y in a resolution independent way:
+  // wx,wy: worldspace in full image pixel coords:
+  // x, y: normalized to shorter side of image, so with pixel aspect = 1.
+  double x[4], y[4];
+  for(int l = 0; l < 4; l++)
+  {
+    x[l] = (roi_out->x + i + l) / roi_out->scale / wd;
+    y[l] = (roi_out->y + j) / roi_out->scale / wd;
+  }
+
+  if(!filter)
+  {
+    for(int l = 0; l < 4; l++) x[l] += hash;
+    return _simplex_2d_noise(x, y, zoom);
+  }
+
+  // if zoomed out a lot, use rank-1 lattice downsampling
+  const float fib1 = 34.0, fib2 = 21.0;
+  __m128 noise = _mm_setzero_ps();
+  for(int l = 0; l < fib2; l++)
+  {
+    float px = l / fib2, py = l * (fib1 / fib2);
+    py -= (int)py;
+    const float dx = px * filtermul, dy = py * filtermul;
+    double sx[4], sy[4];
+    for(int k = 0; k < 4; k++)
+    {
+      sx[k] = x[k] + dx + hash;
+      sy[k] = y[k] + dy;
+    }
+    noise = _mm_add_ps(noise, _mm_mul_ps(_mm_set1_ps(1.0f / fib2), _simplex_2d_noise(sx, sy, zoom)));
+  }
+  return noise;
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid,
              const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
@@ -380,7 +369,6 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
   const int ch = piece->colors;
   // Apply grain to image
   const double strength = (data->strength / 100.0);
-  const double octaves = 3;
   // double zoom=1.0+(8*(data->scale/100.0));
   const double wd = fminf(piece->buf_in.width, piece->buf_in.height);
   const double zoom = (1.0 + 8 * data->scale / 100) / 800.0;
@@ -388,49 +376,66 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
   // filter width depends on world space (i.e. reverse wd norm and roi->scale, as well as buffer input to
   // pixelpipe iscale)
   const double filtermul = piece->iscale / (roi_out->scale * wd);
+
+  // the grain doesn't depend on the image content. the darkroom pipes keep it around, so editing anything
+  // before this module doesn't compute it again. export and thumbnail pipes never see the same roi and
+  // filename hash twice, so they don't keep anything.
+  const int keep = piece->pipe->type == DT_DEV_PIXELPIPE_FULL || piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW;
+  if(keep
+     && !(data->noise && data->noise_roi.x == roi_out->x && data->noise_roi.y == roi_out->y
+          && data->noise_roi.width == roi_out->width && data->noise_roi.height == roi_out->height
+          && data->noise_roi.scale == roi_out->scale && data->noise_scale == data->scale
+          && data->noise_hash == hash && data->noise_wd == wd && data->noise_iscale == piece->iscale))
+  {
+    free(data->noise);
+    data->noise = (float *)malloc(sizeof(float) * roi_out->width * roi_out->height);
+    if(data->noise)
+    {
+      float *const noise = data->noise;
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(roi_out, roi_in, ovoid, ivoid, data, hash)
+#pragma omp parallel for schedule(static) shared(roi_out, hash)
+#endif
+      for(int j = 0; j < roi_out->height; j++)
+        for(int i = 0; i < roi_out->width; i += 4)
+        {
+          float n[4];
+          _mm_storeu_ps(n, _grain_noise(roi_out, i, j, wd, zoom, hash, filter, filtermul));
+          memcpy(noise + (size_t)j * roi_out->width + i, n, sizeof(float) * MIN(4, roi_out->width - i));
+        }
+      data->noise_roi = *roi_out;
+      data->noise_scale = data->scale;
+      data->noise_hash = hash;
+      data->noise_wd = wd;
+      data->noise_iscale = piece->iscale;
+    }
+  }
+  const float *const noise = keep ? data->noise : NULL;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) shared(roi_out, ovoid, ivoid, hash)
 #endif
   for(int j = 0; j < roi_out->height; j++)
   {
-    float *in = ((float *)ivoid) + (size_t)roi_out->width * j * ch;
+    const float *in = ((float *)ivoid) + (size_t)roi_out->width * j * ch;
     float *out = ((float *)ovoid) + (size_t)roi_out->width * j * ch;
-    for(int i = 0; i < roi_out->width; i++)
+    for(int i = 0; i < roi_out->width; i += 4)
     {
-      // calculate x, y in a resolution independent way:
-      // wx,wy: worldspace in full image pixel coords:
-      double wx = (roi_out->x + i) / roi_out->scale;
-      double wy = (roi_out->y + j) / roi_out->scale;
-      // x, y: normalized to shorter side of image, so with pixel aspect = 1.
-      // printf("scale %f\n", wd);
-      double x = wx / wd;
-      double y = wy / wd;
-      //  double noise=_perlin_2d_noise(x, y, octaves,0.25, zoom)*1.5;
-      double noise = 0.0;
-      if(filter)
-      {
-        // if zoomed out a lot, use rank-1 lattice downsampling
-        const float fib1 = 34.0, fib2 = 21.0;
-        for(int l = 0; l < fib2; l++)
-        {
-          float px = l / fib2, py = l * (fib1 / fib2);
-          py -= (int)py;
-          float dx = px * filtermul, dy = py * filtermul;
-          noise += (1.0 / fib2) * _simplex_2d_noise(x + dx + hash, y + dy, octaves, 1.0, zoom);
-        }
-      }
+      float n[4];
+      if(noise)
+        memcpy(n, noise + (size_t)j * roi_out->width + i, sizeof(float) * MIN(4, roi_out->width - i));
       else
-      {
-        noise = _simplex_2d_noise(x + hash, y, octaves, 1.0, zoom);
-      }
+        _mm_storeu_ps(n, _grain_noise(roi_out, i, j, wd, zoom, hash, filter, filtermul));
 
-      out[0] = in[0] + ((100.0 * (noise * (strength))) * GRAIN_LIGHTNESS_STRENGTH_SCALE);
-      out[1] = in[1];
-      out[2] = in[2];
-      out[3] = in[3];
+      for(int l = 0; l < MIN(4, roi_out->width - i); l++)
+      {
+        out[0] = in[0] + ((100.0 * (n[l] * (strength))) * GRAIN_LIGHTNESS_STRENGTH_SCALE);
+        out[1] = in[1];
+        out[2] = in[2];
+        out[3] = in[3];
 
-      out += ch;
-      in += ch;
+        out += ch;
+        in += ch;
+      }
     }
   }
 }
@@ -487,6 +492,8 @@ void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev
   (void)gegl_node_remove_child(pipe->gegl, piece->input);
 // no free necessary, no data is alloc'ed
 #else
+  dt_iop_grain_data_t *d = (dt_iop_grain_data_t *)piece->data;
+  free(d->noise);
   free(piece->data);
   piece->data = NULL;
 #endif
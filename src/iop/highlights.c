@@ -56,7 +56,13 @@ typedef struct dt_iop_highlights_gui_data_t
   GtkWidget *mode;
 } dt_iop_highlights_gui_data_t;
 
-typedef dt_iop_highlights_params_t dt_iop_highlights_data_t;
+typedef struct dt_iop_highlights_data_t
+{
+  dt_iop_highlights_mode_t mode;
+  float blendL, blendC, blendh; // unused
+  float clip;
+  float mosaic_clip; // clip level of the current fused pass, see process_mosaic()
+} dt_iop_highlights_data_t;
 
 typedef struct dt_iop_highlights_global_data_t
 {
@@ -611,6 +617,41 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
   if(piece->pipe->mask_display) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
 
+int mosaic_radius(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece)
+{
+  // only clipping is done sample by sample, the reconstructing modes look far around
+  const dt_iop_highlights_data_t *const d = (dt_iop_highlights_data_t *)piece->data;
+  if(dt_dev_pixelpipe_uses_downsampled_input(piece->pipe) || !dt_image_filter(&piece->pipe->image)
+     || d->mode != DT_IOP_HIGHLIGHTS_CLIP || piece->pipe->mask_display)
+    return -1;
+  return 0;
+}
+
+void process_mosaic(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const in,
+                    float *const out, const dt_iop_roi_t *const roi, const int row, const int num)
+{
+  dt_iop_highlights_data_t *d = (dt_iop_highlights_data_t *)piece->data;
+
+  // the clip level depends on the white balance coefficients applied before
+  if(num == 0)
+  {
+    d->mosaic_clip = d->clip
+                     * fminf(piece->pipe->processed_maximum[0],
+                             fminf(piece->pipe->processed_maximum[1], piece->pipe->processed_maximum[2]));
+    return;
+  }
+
+  const float clip = d->mosaic_clip;
+  const __m128 clipm = _mm_set1_ps(clip);
+  const float *const i = (const float *)in;
+  const size_t n = (size_t)num * roi->width;
+  // rows are aligned like in a full buffer
+  size_t j = 0;
+  for(; j < n && (((size_t)row * roi->width + j) & 3); j++) out[j] = MIN(clip, i[j]);
+  for(; j + 4 <= n; j += 4) _mm_store_ps(out + j, _mm_min_ps(clipm, _mm_load_ps(i + j)));
+  for(; j < n; j++) out[j] = MIN(clip, i[j]);
+}
+
 static void clip_callback(GtkWidget *slider, dt_iop_module_t *self)
 {
   if(self->dt->gui->reset) return;
@@ -102,13 +102,11 @@ static uint8_t FCxtrans(const int row, const int col, const dt_iop_roi_t *const
   return xtrans[(row + roi->y + 6) % 6][(col + roi->x + 6) % 6];
 }
 
-static int process_xtrans(const void *const i, void *o, const dt_iop_roi_t *const roi_in, const int width,
-                          const int height, const uint8_t (*const xtrans)[6], const float threshold,
-                          const float multiplier, const gboolean markfixed, const int min_neighbours)
+/* for each cell of sensor array, a list of the x/y offsets of the
+ * four radially nearest pixels of the same color */
+static void xtrans_offsets(const dt_iop_roi_t *const roi_in, const uint8_t (*const xtrans)[6],
+                           int offsets[6][6][4][2])
 {
-  // for each cell of sensor array, a list of the x/y offsets of the
-  // four radially nearest pixels of the same color
-  int offsets[6][6][4][2];
   const int search[20][2] = { { -1, 0 },
                               { 1, 0 },
                               { 0, -1 },
@@ -143,6 +141,59 @@ static int process_xtrans(const void *const i, void *o, const dt_iop_roi_t *cons
         }
       }
     }
+}
+
+/* fixes one x-trans row, row_in and row_out point to its first sample. out holds a copy of in already. */
+static int process_xtrans_row(const float *const row_in, float *const row_out, const int row, const int width,
+                              const int height, int offsets[6][6][4][2], const float threshold,
+                              const float multiplier, const gboolean markfixed, const int min_neighbours)
+{
+  int fixed = 0;
+  const float *in = row_in + 2;
+  float *out = row_out + 2;
+  for(int col = 1; col < width - 1; col++, in++, out++)
+  {
+    float mid = *in * multiplier;
+    if(*in > threshold)
+    {
+      int count = 0;
+      float maxin = 0.0;
+      for(int n = 0; n < 4; ++n)
+      {
+        int xx = offsets[col % 6][row % 6][n][0];
+        int yy = offsets[col % 6][row % 6][n][1];
+        if((xx < -col) || (xx >= (width - col)) || (yy < -row) || (yy >= (height - row))) break;
+        float other = *(in + xx + yy * width);
+        if(mid > other)
+        {
+          count++;
+          if(other > maxin) maxin = other;
+        }
+      }
+      // NOTE: it seems that detecting by 2 neighbors would help for extreme cases
+      if(count >= min_neighbours)
+      {
+        *out = maxin;
+        fixed++;
+        if(markfixed)
+        {
+          // cheat and mark all colors of pixels
+          // FIXME: use offsets
+          for(int i = -2; i >= -10 && i >= -col; --i) out[i] = *in;
+          for(int i = 2; i <= 10 && i < width - col; ++i) out[i] = *in;
+        }
+      }
+    }
+  }
+  return fixed;
+}
+
+static int process_xtrans(const void *const i, void *o, const dt_iop_roi_t *const roi_in, const int width,
+                          const int height, const uint8_t (*const xtrans)[6], const float threshold,
+                          const float multiplier, const gboolean markfixed, const int min_neighbours)
+{
+  int offsets[6][6][4][2];
+  xtrans_offsets(roi_in, xtrans, offsets);
 
   int fixed = 0;
 #ifdef _OPENMP
@@ -150,44 +201,54 @@ static int process_xtrans(const void *const i, void *o, const dt_iop_roi_t *cons
 #endif
   for(int row = 1; row < height - 1; row++)
   {
-    const float *in = (float *)i + (size_t)width * row + 2;
-    float *out = (float *)o + (size_t)width * row + 2;
-    for(int col = 1; col < width - 1; col++, in++, out++)
+    fixed += process_xtrans_row((float *)i + (size_t)width * row, (float *)o + (size_t)width * row, row,
+                                width, height, offsets, threshold, multiplier, markfixed, min_neighbours);
+  }
+
+  return fixed;
+}
+
+/* fixes one bayer row, same as process_xtrans_row(). */
+static int process_bayer_row(const float *const row_in, float *const row_out, const int width,
+                             const float threshold, const float multiplier, const gboolean markfixed,
+                             const int min_neighbours)
+{
+  const int widthx2 = width * 2;
+  int fixed = 0;
+  const float *in = row_in + 2;
+  float *out = row_out + 2;
+  for(int col = 2; col < width - 1; col++, in++, out++)
+  {
+    float mid = *in * multiplier;
+    if(*in > threshold)
     {
-      float mid = *in * multiplier;
-      if(*in > threshold)
+      int count = 0;
+      float maxin = 0.0;
+      float other;
+#define TESTONE(OFFSET)                                                                                      \
+  other = in[OFFSET];                                                                                        \
+  if(mid > other)                                                                                            \
+  {                                                                                                          \
+    count++;                                                                                                 \
+    if(other > maxin) maxin = other;                                                                         \
+  }
+      TESTONE(-2);
+      TESTONE(-widthx2);
+      TESTONE(+2);
+      TESTONE(+widthx2);
+#undef TESTONE
+      if(count >= min_neighbours)
       {
-        int count = 0;
-        float maxin = 0.0;
-        for(int n = 0; n < 4; ++n)
-        {
-          int xx = offsets[col % 6][row % 6][n][0];
-          int yy = offsets[col % 6][row % 6][n][1];
-          if((xx < -col) || (xx >= (width - col)) || (yy < -row) || (yy >= (height - row))) break;
-          float other = *(in + xx + yy * width);
-          if(mid > other)
-          {
-            count++;
-            if(other > maxin) maxin = other;
-          }
-        }
-        // NOTE: it seems that detecting by 2 neighbors would help for extreme cases
-        if(count >= min_neighbours)
+        *out = maxin;
+        fixed++;
+        if(markfixed)
         {
-          *out = maxin;
-          fixed++;
-          if(markfixed)
-          {
-            // cheat and mark all colors of pixels
-            // FIXME: use offsets
-            for(int i = -2; i >= -10 && i >= -col; --i) out[i] = *in;
-            for(int i = 2; i <= 10 && i < width - col; ++i) out[i] = *in;
-          }
+          for(int i = -2; i >= -10 && i >= -col; i -= 2) out[i] = *in;
+          for(int i = 2; i <= 10 && i < width - col; i += 2) out[i] = *in;
         }
       }
     }
   }
-
   return fixed;
 }
 
@@ -207,8 +268,6 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
   const float threshold = data->threshold;
   const float multiplier = data->multiplier;
   const int width = roi_out->width;
-  const int height = roi_out->height;
-  const int widthx2 = width * 2;
   const gboolean markfixed = data->markfixed;
   const int min_neighbours = data->permissive ? 3 : 4;
 
@@ -219,8 +278,8 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
 
   if(img->filters == 9u)
   {
-    fixed = process_xtrans(i, o, roi_in, width, height, img->xtrans, threshold, multiplier, markfixed,
-                           min_neighbours);
+    fixed = process_xtrans(i, o, roi_in, width, roi_out->height, img->xtrans, threshold, multiplier,
+                           markfixed, min_neighbours);
     goto processed;
   }
 
@@ -230,40 +289,8 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
 #endif
   for(int row = 2; row < roi_out->height - 2; row++)
   {
-    const float *in = (float *)i + (size_t)width * row + 2;
-    float *out = (float *)o + (size_t)width * row + 2;
-    for(int col = 2; col < width - 1; col++, in++, out++)
-    {
-      float mid = *in * multiplier;
-      if(*in > threshold)
-      {
-        int count = 0;
-        float maxin = 0.0;
-        float other;
-#define TESTONE(OFFSET)                                                                                      \
-  other = in[OFFSET];                                                                                        \
-  if(mid > other)                                                                                            \
-  {                                                                                                          \
-    count++;                                                                                                 \
-    if(other > maxin) maxin = other;                                                                         \
-  }
-        TESTONE(-2);
-        TESTONE(-widthx2);
-        TESTONE(+2);
-        TESTONE(+widthx2);
-#undef TESTONE
-        if(count >= min_neighbours)
-        {
-          *out = maxin;
-          fixed++;
-          if(markfixed)
-          {
-            for(int i = -2; i >= -10 && i >= -col; i -= 2) out[i] = *in;
-            for(int i = 2; i <= 10 && i < width - col; i += 2) out[i] = *in;
-          }
-        }
-      }
-    }
+    fixed += process_bayer_row((float *)i + (size_t)width * row, (float *)o + (size_t)width * row, width,
+                               threshold, multiplier, markfixed, min_neighbours);
   }
 
 processed:
@@ -273,6 +300,47 @@ processed:
   }
 }
 
+int mosaic_radius(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece)
+{
+  const dt_iop_hotpixels_data_t *const data = (dt_iop_hotpixels_data_t *)piece->data;
+  // marked pixels are only wanted in the darkroom, which isn't fused anyways
+  if(data->markfixed || !data->filters) return -1;
+  // x-trans looks two rows up and down, but its row pointers are one sample ahead of col,
+  // so the last column peeks into the row after that.
+  return (data->filters == 9u) ? 3 : 2;
+}
+
+void process_mosaic(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const in,
+                    float *const out, const dt_iop_roi_t *const roi, const int row, const int num)
+{
+  if(num == 0) return;
+
+  const dt_image_t *img = &self->dev->image_storage;
+  const dt_iop_hotpixels_data_t *data = (dt_iop_hotpixels_data_t *)piece->data;
+  const int width = roi->width;
+  const int height = roi->height;
+  const int min_neighbours = data->permissive ? 3 : 4;
+
+  memcpy(out, in, sizeof(float) * width * num);
+
+  int offsets[6][6][4][2];
+  if(img->filters == 9u) xtrans_offsets(roi, img->xtrans, offsets);
+
+  for(int r = row; r < row + num; r++)
+  {
+    const float *i = (const float *)in + (size_t)width * (r - row);
+    float *o = out + (size_t)width * (r - row);
+    if(img->filters == 9u)
+    {
+      if(r >= 1 && r < height - 1)
+        process_xtrans_row(i, o, r, width, height, offsets, data->threshold, data->multiplier,
+                           data->markfixed, min_neighbours);
+    }
+    else if(r >= 2 && r < height - 2)
+      process_bayer_row(i, o, width, data->threshold, data->multiplier, data->markfixed, min_neighbours);
+  }
+}
+
 void init(dt_iop_module_t *module)
 {
   module->data = NULL;
@@ -243,6 +243,36 @@ static void commit_params_late(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pi
   }
 }
 
+static inline void apply_levels(const dt_iop_levels_data_t *const d, const float *const in, float *const out)
+{
+  const float L_in = in[0] / 100.0f;
+  float L_out;
+
+  if(L_in <= d->levels[0])
+  {
+    // Anything below the lower threshold just clips to zero
+    L_out = 0.0f;
+  }
+  else if(L_in >= d->levels[2])
+  {
+    float percentage = (L_in - d->levels[0]) / (d->levels[2] - d->levels[0]);
+    L_out = 100.0f * pow(percentage, d->in_inv_gamma);
+  }
+  else
+  {
+    // Within the expected input range we can use the lookup table
+    float percentage = (L_in - d->levels[0]) / (d->levels[2] - d->levels[0]);
+    // L_out = 100.0 * pow(percentage, d->in_inv_gamma);
+    L_out = d->lut[CLAMP((int)(percentage * 0xfffful), 0, 0xffff)];
+  }
+
+  // Preserving contrast
+  const float scale = (in[0] > 0.01f) ? L_out / in[0] : L_out / 0.01f;
+  out[0] = L_out;
+  out[1] = in[1] * scale;
+  out[2] = in[2] * scale;
+}
+
 void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid, void *ovoid,
              const dt_iop_roi_t *roi_in, const dt_iop_roi_t *const roi_out)
 {
@@ -261,45 +291,24 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
   {
     float *in = (float *)ivoid + (size_t)k * ch * roi_out->width;
     float *out = (float *)ovoid + (size_t)k * ch * roi_out->width;
-    for(int j = 0; j < roi_out->width; j++, in += ch, out += ch)
-    {
-      float L_in = in[0] / 100.0f;
-
-      if(L_in <= d->levels[0])
-      {
-        // Anything below the lower threshold just clips to zero
-        out[0] = 0.0f;
-      }
-      else if(L_in >= d->levels[2])
-      {
-        float percentage = (L_in - d->levels[0]) / (d->levels[2] - d->levels[0]);
-        out[0] = 100.0f * pow(percentage, d->in_inv_gamma);
-      }
-      else
-      {
-        // Within the expected input range we can use the lookup table
-        float percentage = (L_in - d->levels[0]) / (d->levels[2] - d->levels[0]);
-        // out[0] = 100.0 * pow(percentage, d->in_inv_gamma);
-        out[0] = d->lut[CLAMP((int)(percentage * 0xfffful), 0, 0xffff)];
-      }
-
-      // Preserving contrast
-      if(in[0] > 0.01f)
-      {
-        out[1] = in[1] * out[0] / in[0];
-        out[2] = in[2] * out[0] / in[0];
-      }
-      else
-      {
-        out[1] = in[1] * out[0] / 0.01f;
-        out[2] = in[2] * out[0] / 0.01f;
-      }
-    }
+    for(int j = 0; j < roi_out->width; j++, in += ch, out += ch) apply_levels(d, in, out);
   }
 
   if(piece->pipe->mask_display) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
 
+dt_iop_transfer_t transfer_function(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
+                                    const float *const in, float *const out, const int num)
+{
+  const dt_iop_levels_data_t *const d = (dt_iop_levels_data_t *)piece->data;
+
+  // automatic levels are only known after looking at the input
+  if(d->mode == LEVELS_MODE_AUTOMATIC) return DT_IOP_TRANSFER_NONE;
+
+  for(int k = 0; k < 4 * num; k += 4) apply_levels(d, in + k, out + k);
+  return DT_IOP_TRANSFER_SCALE_CHROMA;
+}
+
 #ifdef HAVE_OPENCL
 int process_cl(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
                const dt_iop_roi_t *roi_in, const dt_iop_roi_t *const roi_out)
@@ -133,6 +133,15 @@ error:
 }
 #endif
 
+static inline float apply_curve(const dt_iop_profilegamma_data_t *const data, const float x)
+{
+  // use base curve for values < 1, else use extrapolation.
+  if(x < 1.0f)
+    return data->table[CLAMP((int)(x * 0x10000ul), 0, 0xffff)];
+  else
+    return dt_iop_eval_exp(data->unbounded_coeffs, x);
+}
+
 void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid,
              const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
@@ -150,20 +159,22 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid,
 
     for(int j = 0; j < roi_out->width; j++, in += ch, out += ch)
     {
-      for(int i = 0; i < 3; i++)
-      {
-        // use base curve for values < 1, else use extrapolation.
-        if(in[i] < 1.0f)
-          out[i] = data->table[CLAMP((int)(in[i] * 0x10000ul), 0, 0xffff)];
-        else
-          out[i] = dt_iop_eval_exp(data->unbounded_coeffs, in[i]);
-      }
+      for(int i = 0; i < 3; i++) out[i] = apply_curve(data, in[i]);
     }
   }
 
   if(piece->pipe->mask_display) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
 
+dt_iop_transfer_t transfer_function(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
+                                    const float *const in, float *const out, const int num)
+{
+  const dt_iop_profilegamma_data_t *const data = (dt_iop_profilegamma_data_t *)piece->data;
+  for(int k = 0; k < 4 * num; k += 4)
+    for(int c = 0; c < 3; c++) out[k + c] = apply_curve(data, in[k + c]);
+  return DT_IOP_TRANSFER_PER_CHANNEL;
+}
+
 static void linear_callback(GtkWidget *slider, gpointer user_data)
 {
   dt_iop_module_t *self = (dt_iop_module_t *)user_data;
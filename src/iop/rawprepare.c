@@ -129,6 +129,62 @@ static int BL(const dt_iop_roi_t *const roi_out, const dt_iop_rawprepare_data_t
   return ((((row + roi_out->y) & 1) << 1) + ((col + roi_out->x) & 1));
 }
 
+static inline void process_mosaic_row(const dt_iop_rawprepare_data_t *const d,
+                                      const dt_iop_roi_t *const roi_out, const int j, const uint16_t *in,
+                                      float *out, const int stream)
+{
+  int i = 0;
+  int alignment = ((8 - (j * roi_out->width & (8 - 1))) & (8 - 1));
+
+  // process unaligned pixels
+  for(; i < alignment; i++, out++, in++)
+  {
+    const int id = BL(roi_out, d, j, i);
+    *out = MAX(0.0f, ((float)(*in)) - d->sub[id]) / d->div[id];
+  }
+
+  const __m128 sub = _mm_set_ps(d->sub[BL(roi_out, d, j, i + 3)], d->sub[BL(roi_out, d, j, i + 2)],
+                                d->sub[BL(roi_out, d, j, i + 1)], d->sub[BL(roi_out, d, j, i)]);
+
+  const __m128 div = _mm_set_ps(d->div[BL(roi_out, d, j, i + 3)], d->div[BL(roi_out, d, j, i + 2)],
+                                d->div[BL(roi_out, d, j, i + 1)], d->div[BL(roi_out, d, j, i)]);
+
+  // process aligned pixels with SSE
+  for(; i < roi_out->width - (8 - 1); i += 8, in += 8)
+  {
+    const __m128i input = _mm_load_si128((__m128i *)in);
+
+    __m128i ilo = _mm_unpacklo_epi16(input, _mm_set1_epi16(0));
+    __m128i ihi = _mm_unpackhi_epi16(input, _mm_set1_epi16(0));
+
+    __m128 flo = _mm_cvtepi32_ps(ilo);
+    __m128 fhi = _mm_cvtepi32_ps(ihi);
+
+    flo = _mm_div_ps(_mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(flo, sub)), div);
+    fhi = _mm_div_ps(_mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(fhi, sub)), div);
+
+    // the fused pass reads the row again right away, keep it in cache there
+    if(stream)
+    {
+      _mm_stream_ps(out, flo);
+      _mm_stream_ps(out + 4, fhi);
+    }
+    else
+    {
+      _mm_store_ps(out, flo);
+      _mm_store_ps(out + 4, fhi);
+    }
+    out += 8;
+  }
+
+  // process the rest
+  for(; i < roi_out->width; i++, in++, out++)
+  {
+    const int id = BL(roi_out, d, j, i);
+    *out = MAX(0.0f, ((float)(*in)) - d->sub[id]) / d->div[id];
+  }
+}
+
 void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid, void *ovoid,
              const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
@@ -143,49 +199,7 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
     {
       const uint16_t *in = ((uint16_t *)ivoid) + (size_t)roi_in->width * j;
       float *out = ((float *)ovoid) + (size_t)roi_out->width * j;
-
-      int i = 0;
-      int alignment = ((8 - (j * roi_out->width & (8 - 1))) & (8 - 1));
-
-      // process unaligned pixels
-      for(; i < alignment; i++, out++, in++)
-      {
-        const int id = BL(roi_out, d, j, i);
-        *out = MAX(0.0f, ((float)(*in)) - d->sub[id]) / d->div[id];
-      }
-
-      const __m128 sub = _mm_set_ps(d->sub[BL(roi_out, d, j, i + 3)], d->sub[BL(roi_out, d, j, i + 2)],
-                                    d->sub[BL(roi_out, d, j, i + 1)], d->sub[BL(roi_out, d, j, i)]);
-
-      const __m128 div = _mm_set_ps(d->div[BL(roi_out, d, j, i + 3)], d->div[BL(roi_out, d, j, i + 2)],
-                                    d->div[BL(roi_out, d, j, i + 1)], d->div[BL(roi_out, d, j, i)]);
-
-      // process aligned pixels with SSE
-      for(; i < roi_out->width - (8 - 1); i += 8, in += 8)
-      {
-        const __m128i input = _mm_load_si128((__m128i *)in);
-
-        __m128i ilo = _mm_unpacklo_epi16(input, _mm_set1_epi16(0));
-        __m128i ihi = _mm_unpackhi_epi16(input, _mm_set1_epi16(0));
-
-        __m128 flo = _mm_cvtepi32_ps(ilo);
-        __m128 fhi = _mm_cvtepi32_ps(ihi);
-
-        flo = _mm_div_ps(_mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(flo, sub)), div);
-        fhi = _mm_div_ps(_mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(fhi, sub)), div);
-
-        _mm_stream_ps(out, flo);
-        out += 4;
-        _mm_stream_ps(out, fhi);
-        out += 4;
-      }
-
-      // process the rest
-      for(; i < roi_out->width; i++, in++, out++)
-      {
-        const int id = BL(roi_out, d, j, i);
-        *out = MAX(0.0f, ((float)(*in)) - d->sub[id]) / d->div[id];
-      }
+      process_mosaic_row(d, roi_out, j, in, out, 1);
     }
   }
   else
@@ -215,6 +229,22 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
   _mm_sfence();
 }
 
+int mosaic_radius(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece)
+{
+  // the pre-downsampled buffer is not a mosaic
+  if(dt_dev_pixelpipe_uses_downsampled_input(piece->pipe) || !dt_image_filter(&piece->pipe->image)) return -1;
+  return 0;
+}
+
+void process_mosaic(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const in,
+                    float *const out, const dt_iop_roi_t *const roi, const int row, const int num)
+{
+  const dt_iop_rawprepare_data_t *const d = (dt_iop_rawprepare_data_t *)piece->data;
+  for(int j = 0; j < num; j++)
+    process_mosaic_row(d, roi, row + j, ((const uint16_t *)in) + (size_t)roi->width * j,
+                       out + (size_t)roi->width * j, 0);
+}
+
 #ifdef HAVE_OPENCL
 int process_cl(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
                const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
@@ -335,6 +335,49 @@ static uint8_t FCxtrans(const int row, const int col, const dt_iop_roi_t *const
   return xtrans[(row + roi->y) % 6][(col + roi->x) % 6];
 }
 
+static inline void process_xtrans_row(const dt_iop_temperature_data_t *const d,
+                                      const dt_iop_roi_t *const roi_out, const uint8_t (*const xtrans)[6],
+                                      const int j, const float *in, float *out)
+{
+  for(int i = 0; i < roi_out->width; i++, out++, in++)
+    *out = *in * d->coeffs[FCxtrans(j, i, roi_out, xtrans)];
+}
+
+static inline void process_bayer_row(const dt_iop_temperature_data_t *const d,
+                                     const dt_iop_roi_t *const roi_out, const int filters, const int j,
+                                     const float *in, float *out, const int stream)
+{
+  int i = 0;
+  int alignment = ((4 - (j * roi_out->width & (4 - 1))) & (4 - 1));
+
+  // process unaligned pixels
+  for(; i < alignment; i++, out++, in++)
+    *out = *in * d->coeffs[FC(j + roi_out->y, i + roi_out->x, filters)];
+
+  const __m128 coeffs = _mm_set_ps(d->coeffs[FC(j + roi_out->y, roi_out->x + i + 3, filters)],
+                                   d->coeffs[FC(j + roi_out->y, roi_out->x + i + 2, filters)],
+                                   d->coeffs[FC(j + roi_out->y, roi_out->x + i + 1, filters)],
+                                   d->coeffs[FC(j + roi_out->y, roi_out->x + i, filters)]);
+
+  // process aligned pixels with SSE
+  for(; i < roi_out->width - (4 - 1); i += 4, in += 4, out += 4)
+  {
+    const __m128 input = _mm_load_ps(in);
+
+    const __m128 multiplied = _mm_mul_ps(input, coeffs);
+
+    // the fused pass reads the row again right away, keep it in cache there
+    if(stream)
+      _mm_stream_ps(out, multiplied);
+    else
+      _mm_store_ps(out, multiplied);
+  }
+
+  // process the rest
+  for(; i < roi_out->width; i++, out++, in++)
+    *out = *in * d->coeffs[FC(j + roi_out->y, i + roi_out->x, filters)];
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid,
              const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
@@ -350,8 +393,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
     {
       const float *in = ((float *)ivoid) + (size_t)j * roi_out->width;
       float *out = ((float *)ovoid) + (size_t)j * roi_out->width;
-      for(int i = 0; i < roi_out->width; i++, out++, in++)
-        *out = *in * d->coeffs[FCxtrans(j, i, roi_out, xtrans)];
+      process_xtrans_row(d, roi_out, xtrans, j, in, out);
     }
   }
   else if(!dt_dev_pixelpipe_uses_downsampled_input(piece->pipe) && filters)
@@ -363,32 +405,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
     {
       const float *in = ((float *)ivoid) + (size_t)j * roi_out->width;
       float *out = ((float *)ovoid) + (size_t)j * roi_out->width;
-
-      int i = 0;
-      int alignment = ((4 - (j * roi_out->width & (4 - 1))) & (4 - 1));
-
-      // process unaligned pixels
-      for(; i < alignment; i++, out++, in++)
-        *out = *in * d->coeffs[FC(j + roi_out->y, i + roi_out->x, filters)];
-
-      const __m128 coeffs = _mm_set_ps(d->coeffs[FC(j + roi_out->y, roi_out->x + i + 3, filters)],
-                                       d->coeffs[FC(j + roi_out->y, roi_out->x + i + 2, filters)],
-                                       d->coeffs[FC(j + roi_out->y, roi_out->x + i + 1, filters)],
-                                       d->coeffs[FC(j + roi_out->y, roi_out->x + i, filters)]);
-
-      // process aligned pixels with SSE
-      for(; i < roi_out->width - (4 - 1); i += 4, in += 4, out += 4)
-      {
-        const __m128 input = _mm_load_ps(in);
-
-        const __m128 multiplied = _mm_mul_ps(input, coeffs);
-
-        _mm_stream_ps(out, multiplied);
-      }
-
-      // process the rest
-      for(; i < roi_out->width; i++, out++, in++)
-        *out = *in * d->coeffs[FC(j + roi_out->y, i + roi_out->x, filters)];
+      process_bayer_row(d, roi_out, filters, j, in, out, 1);
     }
     _mm_sfence();
   }
@@ -420,6 +437,36 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
     piece->pipe->processed_maximum[k] = d->coeffs[k] * piece->pipe->processed_maximum[k];
 }
 
+int mosaic_radius(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece)
+{
+  if(dt_dev_pixelpipe_uses_downsampled_input(piece->pipe) || !dt_image_filter(&piece->pipe->image)) return -1;
+  return 0;
+}
+
+void process_mosaic(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const in,
+                    float *const out, const dt_iop_roi_t *const roi, const int row, const int num)
+{
+  const int filters = dt_image_filter(&piece->pipe->image);
+  const dt_iop_temperature_data_t *const d = (dt_iop_temperature_data_t *)piece->data;
+
+  if(num == 0)
+  {
+    for(int k = 0; k < 3; k++)
+      piece->pipe->processed_maximum[k] = d->coeffs[k] * piece->pipe->processed_maximum[k];
+    return;
+  }
+
+  for(int j = 0; j < num; j++)
+  {
+    const float *i = ((const float *)in) + (size_t)j * roi->width;
+    float *o = out + (size_t)j * roi->width;
+    if(filters == 9u)
+      process_xtrans_row(d, roi, self->dev->image_storage.xtrans, row + j, i, o);
+    else
+      process_bayer_row(d, roi, filters, row + j, i, o, 0);
+  }
+}
+
 #ifdef HAVE_OPENCL
 int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
                const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
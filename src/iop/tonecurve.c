@@ -148,7 +148,7 @@ int groups()
 
 int flags()
 {
-  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING;
+  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_PACKED_CACHE;
 }
 
 int legacy_params(dt_iop_module_t *self, const void *const old_params, const int old_version,
@@ -269,26 +269,74 @@ error:
 }
 #endif
 
+// x coordinates where the extrapolation takes over from the lookup tables
+static inline void extrapolation_limits(const dt_iop_tonecurve_data_t *const d, float *const xm)
+{
+  xm[0] = 1.0f / d->unbounded_coeffs_L[0];
+  xm[1] = 1.0f / d->unbounded_coeffs_ab[0];
+  xm[2] = 1.0f - 1.0f / d->unbounded_coeffs_ab[3];
+  xm[3] = 1.0f / d->unbounded_coeffs_ab[6];
+  xm[4] = 1.0f - 1.0f / d->unbounded_coeffs_ab[9];
+}
+
+static inline void apply_tonecurve(const dt_iop_tonecurve_data_t *const d, const float *const xm,
+                                   const float low_approximation, const float *const in, float *const out)
+{
+  const float xm_L = xm[0], xm_ar = xm[1], xm_al = xm[2], xm_br = xm[3], xm_bl = xm[4];
+  const float L_in = in[0] / 100.0f;
+  const float L_out = (L_in < xm_L) ? d->table[ch_L][CLAMP((int)(L_in * 0xfffful), 0, 0xffff)]
+                                    : dt_iop_eval_exp(d->unbounded_coeffs_L, L_in);
+
+  if(d->autoscale_ab == 0)
+  {
+    const float a_in = (in[1] + 128.0f) / 256.0f;
+    const float b_in = (in[2] + 128.0f) / 256.0f;
+
+    if(d->unbound_ab == 0)
+    {
+      // old style handling of a/b curves: only lut lookup with clamping
+      out[1] = d->table[ch_a][CLAMP((int)(a_in * 0xfffful), 0, 0xffff)];
+      out[2] = d->table[ch_b][CLAMP((int)(b_in * 0xfffful), 0, 0xffff)];
+    }
+    else
+    {
+      // new style handling of a/b curves: lut lookup with two-sided extrapolation;
+      // mind the x-axis reversal for the left-handed side
+      out[1] = (a_in > xm_ar)
+                   ? dt_iop_eval_exp(d->unbounded_coeffs_ab, a_in)
+                   : ((a_in < xm_al) ? dt_iop_eval_exp(d->unbounded_coeffs_ab + 3, 1.0f - a_in)
+                                     : d->table[ch_a][CLAMP((int)(a_in * 0xfffful), 0, 0xffff)]);
+      out[2] = (b_in > xm_br)
+                   ? dt_iop_eval_exp(d->unbounded_coeffs_ab + 6, b_in)
+                   : ((b_in < xm_bl) ? dt_iop_eval_exp(d->unbounded_coeffs_ab + 9, 1.0f - b_in)
+                                     : d->table[ch_b][CLAMP((int)(b_in * 0xfffful), 0, 0xffff)]);
+    }
+  }
+  else
+  {
+    // in Lab: correct compressed Luminance for saturation:
+    const float scale = (L_in > 0.01f) ? L_out / in[0] : low_approximation;
+    out[1] = in[1] * scale;
+    out[2] = in[2] * scale;
+  }
+  out[0] = L_out;
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, void *o,
              const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
   const int ch = piece->colors;
   dt_iop_tonecurve_data_t *d = (dt_iop_tonecurve_data_t *)(piece->data);
 
-  const float xm_L = 1.0f / d->unbounded_coeffs_L[0];
-  const float xm_ar = 1.0f / d->unbounded_coeffs_ab[0];
-  const float xm_al = 1.0f - 1.0f / d->unbounded_coeffs_ab[3];
-  const float xm_br = 1.0f / d->unbounded_coeffs_ab[6];
-  const float xm_bl = 1.0f - 1.0f / d->unbounded_coeffs_ab[9];
+  float xm[5];
+  extrapolation_limits(d, xm);
   const float low_approximation = d->table[0][(int)(0.01f * 0xfffful)];
 
   const int width = roi_out->width;
   const int height = roi_out->height;
-  const int autoscale_ab = d->autoscale_ab;
-  const int unbound_ab = d->unbound_ab;
 
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(i, o, d) schedule(static)
+#pragma omp parallel for default(none) shared(i, o, d, xm) schedule(static)
 #endif
   for(int k = 0; k < height; k++)
   {
@@ -297,56 +345,25 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
 
     for(int j = 0; j < width; j++, in += ch, out += ch)
     {
-      const float L_in = in[0] / 100.0f;
-
-      out[0] = (L_in < xm_L) ? d->table[ch_L][CLAMP((int)(L_in * 0xfffful), 0, 0xffff)]
-                             : dt_iop_eval_exp(d->unbounded_coeffs_L, L_in);
-
-      if(autoscale_ab == 0)
-      {
-        const float a_in = (in[1] + 128.0f) / 256.0f;
-        const float b_in = (in[2] + 128.0f) / 256.0f;
-
-        if(unbound_ab == 0)
-        {
-          // old style handling of a/b curves: only lut lookup with clamping
-          out[1] = d->table[ch_a][CLAMP((int)(a_in * 0xfffful), 0, 0xffff)];
-          out[2] = d->table[ch_b][CLAMP((int)(b_in * 0xfffful), 0, 0xffff)];
-        }
-        else
-        {
-          // new style handling of a/b curves: lut lookup with two-sided extrapolation;
-          // mind the x-axis reversal for the left-handed side
-          out[1] = (a_in > xm_ar)
-                       ? dt_iop_eval_exp(d->unbounded_coeffs_ab, a_in)
-                       : ((a_in < xm_al) ? dt_iop_eval_exp(d->unbounded_coeffs_ab + 3, 1.0f - a_in)
-                                         : d->table[ch_a][CLAMP((int)(a_in * 0xfffful), 0, 0xffff)]);
-          out[2] = (b_in > xm_br)
-                       ? dt_iop_eval_exp(d->unbounded_coeffs_ab + 6, b_in)
-                       : ((b_in < xm_bl) ? dt_iop_eval_exp(d->unbounded_coeffs_ab + 9, 1.0f - b_in)
-                                         : d->table[ch_b][CLAMP((int)(b_in * 0xfffful), 0, 0xffff)]);
-        }
-      }
-      else
-      {
-        // in Lab: correct compressed Luminance for saturation:
-        if(L_in > 0.01f)
-        {
-          out[1] = in[1] * out[0] / in[0];
-          out[2] = in[2] * out[0] / in[0];
-        }
-        else
-        {
-          out[1] = in[1] * low_approximation;
-          out[2] = in[2] * low_approximation;
-        }
-      }
-
+      apply_tonecurve(d, xm, low_approximation, in, out);
       out[3] = in[3];
     }
   }
 }
 
+dt_iop_transfer_t transfer_function(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
+                                    const float *const in, float *const out, const int num)
+{
+  const dt_iop_tonecurve_data_t *const d = (dt_iop_tonecurve_data_t *)(piece->data);
+
+  float xm[5];
+  extrapolation_limits(d, xm);
+  const float low_approximation = d->table[0][(int)(0.01f * 0xfffful)];
+
+  for(int k = 0; k < 4 * num; k += 4) apply_tonecurve(d, xm, low_approximation, in + k, out + k);
+  return d->autoscale_ab ? DT_IOP_TRANSFER_SCALE_CHROMA : DT_IOP_TRANSFER_PER_CHANNEL;
+}
+
 static const struct
 {
   const char *name;
@@ -124,7 +124,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
 // Build I=log(L)
 // and splat into the lattice
 #ifdef _OPENMP
-#pragma omp parallel for shared(lattice)
+#pragma omp parallel for schedule(static) shared(lattice)
 #endif
   for(int j = 0; j < height; j++)
   {
@@ -31,6 +31,7 @@
 #include "gui/gtk.h"
 #include <gtk/gtk.h>
 #include <inttypes.h>
+#include <sys/stat.h>
 
 #include <librsvg/rsvg.h>
 // ugh, ugly hack. why do people break stuff all the time?
@@ -84,6 +85,53 @@ typedef struct dt_iop_watermark_data_t
   char filename[64];
 } dt_iop_watermark_data_t;
 
+// templates, parsed documents and rendered watermarks are kept around between process() calls, so a batch
+// export with the same watermark reads, parses and rasterizes it only once per output size.
+#define DT_WATERMARK_CACHE_TEMPLATES 4
+#define DT_WATERMARK_CACHE_DOCUMENTS 8
+#define DT_WATERMARK_CACHE_BYTES ((size_t)64 << 20)
+
+typedef struct dt_iop_watermark_template_t
+{
+  gchar *filename;
+  time_t mtime;
+  off_t size;
+  gchar *svgdata; // file contents, variables not substituted
+} dt_iop_watermark_template_t;
+
+typedef struct dt_iop_watermark_raster_key_t
+{
+  double x, y;     // position of the rotation center inside the raster
+  double cx, cy;   // rotation center relative to the unrotated watermark
+  double scale;    // svg units to pixels
+  double angle;
+  int width, height;
+} dt_iop_watermark_raster_key_t;
+
+typedef struct dt_iop_watermark_raster_t
+{
+  dt_iop_watermark_raster_key_t key;
+  int users;       // process() calls blending it right now, never evicted while > 0
+  int stride;
+  guint8 *pixels;  // premultiplied cairo ARGB32
+} dt_iop_watermark_raster_t;
+
+typedef struct dt_iop_watermark_document_t
+{
+  gchar *svgdoc;   // variables substituted, this is what we look the document up by
+  RsvgHandle *svg;
+  RsvgDimensionData dimension;
+  GList *rasters;  // most recently used first
+} dt_iop_watermark_document_t;
+
+typedef struct dt_iop_watermark_global_data_t
+{
+  dt_pthread_mutex_t lock;
+  GList *templates; // most recently used first
+  GList *documents; // most recently used first
+  size_t raster_bytes;
+} dt_iop_watermark_global_data_t;
+
 typedef struct dt_iop_watermark_gui_data_t
 {
   GtkComboBoxText *combobox1;                   // watermark
@@ -253,11 +301,225 @@ static gchar *_string_substitute(gchar *string, const gchar *search, const gchar
   return result;
 }
 
+static void _watermark_template_free(dt_iop_watermark_template_t *t)
+{
+  g_free(t->filename);
+  g_free(t->svgdata);
+  free(t);
+}
+
+// returns a copy of the template, it is only read from disk again if the file has changed
+static gchar *_watermark_get_template(dt_iop_watermark_global_data_t *gd, const gchar *filename)
+{
+  struct stat st;
+  if(stat(filename, &st)) return NULL;
+
+  gchar *svgdata = NULL;
+  dt_pthread_mutex_lock(&gd->lock);
+  for(GList *l = gd->templates; l; l = g_list_next(l))
+  {
+    dt_iop_watermark_template_t *t = (dt_iop_watermark_template_t *)l->data;
+    if(!strcmp(t->filename, filename) && t->mtime == st.st_mtime && t->size == st.st_size)
+    {
+      svgdata = g_strdup(t->svgdata);
+      gd->templates = g_list_remove_link(gd->templates, l);
+      gd->templates = g_list_concat(l, gd->templates);
+      break;
+    }
+  }
+  dt_pthread_mutex_unlock(&gd->lock);
+  if(svgdata) return svgdata;
+
+  if(!g_file_get_contents(filename, &svgdata, NULL, NULL)) return NULL;
+
+  dt_iop_watermark_template_t *t = (dt_iop_watermark_template_t *)malloc(sizeof(dt_iop_watermark_template_t));
+  t->filename = g_strdup(filename);
+  t->mtime = st.st_mtime;
+  t->size = st.st_size;
+  t->svgdata = g_strdup(svgdata);
+
+  dt_pthread_mutex_lock(&gd->lock);
+  // drop older versions of the same file, and the least recently used ones if there are too many
+  GList *l = gd->templates;
+  while(l)
+  {
+    GList *next = g_list_next(l);
+    dt_iop_watermark_template_t *old = (dt_iop_watermark_template_t *)l->data;
+    if(!strcmp(old->filename, filename))
+    {
+      _watermark_template_free(old);
+      gd->templates = g_list_delete_link(gd->templates, l);
+    }
+    l = next;
+  }
+  gd->templates = g_list_prepend(gd->templates, t);
+  while(g_list_length(gd->templates) > DT_WATERMARK_CACHE_TEMPLATES)
+  {
+    GList *last = g_list_last(gd->templates);
+    _watermark_template_free((dt_iop_watermark_template_t *)last->data);
+    gd->templates = g_list_delete_link(gd->templates, last);
+  }
+  dt_pthread_mutex_unlock(&gd->lock);
+
+  return svgdata;
+}
+
+static void _watermark_raster_free(dt_iop_watermark_global_data_t *gd, dt_iop_watermark_raster_t *r)
+{
+  gd->raster_bytes -= (size_t)r->key.height * r->stride;
+  g_free(r->pixels);
+  free(r);
+}
+
+static void _watermark_document_free(dt_iop_watermark_global_data_t *gd, dt_iop_watermark_document_t *doc)
+{
+  for(GList *l = doc->rasters; l; l = g_list_next(l))
+    _watermark_raster_free(gd, (dt_iop_watermark_raster_t *)l->data);
+  g_list_free(doc->rasters);
+  g_object_unref(doc->svg);
+  g_free(doc->svgdoc);
+  free(doc);
+}
+
+// evicts unused rasters and documents, least recently used first, until the cache fits its budget.
+// gd->lock has to be held.
+static void _watermark_cache_trim(dt_iop_watermark_global_data_t *gd)
+{
+  for(GList *d = g_list_last(gd->documents); d && gd->raster_bytes > DT_WATERMARK_CACHE_BYTES;
+      d = g_list_previous(d))
+  {
+    dt_iop_watermark_document_t *doc = (dt_iop_watermark_document_t *)d->data;
+    GList *l = g_list_last(doc->rasters);
+    while(l && gd->raster_bytes > DT_WATERMARK_CACHE_BYTES)
+    {
+      GList *prev = g_list_previous(l);
+      dt_iop_watermark_raster_t *r = (dt_iop_watermark_raster_t *)l->data;
+      if(r->users == 0)
+      {
+        _watermark_raster_free(gd, r);
+        doc->rasters = g_list_delete_link(doc->rasters, l);
+      }
+      l = prev;
+    }
+  }
+
+  guint count = g_list_length(gd->documents);
+  GList *d = g_list_last(gd->documents);
+  while(d && count > DT_WATERMARK_CACHE_DOCUMENTS)
+  {
+    GList *prev = g_list_previous(d);
+    dt_iop_watermark_document_t *doc = (dt_iop_watermark_document_t *)d->data;
+    gboolean in_use = FALSE;
+    for(GList *l = doc->rasters; l; l = g_list_next(l))
+      if(((dt_iop_watermark_raster_t *)l->data)->users) in_use = TRUE;
+    if(!in_use)
+    {
+      _watermark_document_free(gd, doc);
+      gd->documents = g_list_delete_link(gd->documents, d);
+      count--;
+    }
+    d = prev;
+  }
+}
+
+// looks up the parsed document, parsing it on a miss. takes ownership of svgdoc, gd->lock has to be held.
+static dt_iop_watermark_document_t *_watermark_get_document(dt_iop_watermark_global_data_t *gd, gchar *svgdoc)
+{
+  for(GList *l = gd->documents; l; l = g_list_next(l))
+  {
+    dt_iop_watermark_document_t *doc = (dt_iop_watermark_document_t *)l->data;
+    if(!strcmp(doc->svgdoc, svgdoc))
+    {
+      g_free(svgdoc);
+      gd->documents = g_list_remove_link(gd->documents, l);
+      gd->documents = g_list_concat(l, gd->documents);
+      return doc;
+    }
+  }
+
+  /* create the rsvghandle from parsed svg data */
+  GError *error = NULL;
+  RsvgHandle *svg = rsvg_handle_new_from_data((const guint8 *)svgdoc, strlen(svgdoc), &error);
+  if(!svg || error)
+  {
+    if(svg) g_object_unref(svg);
+    if(error) g_error_free(error);
+    g_free(svgdoc);
+    return NULL;
+  }
+
+  dt_iop_watermark_document_t *doc = (dt_iop_watermark_document_t *)malloc(sizeof(dt_iop_watermark_document_t));
+  doc->svgdoc = svgdoc;
+  doc->svg = svg;
+  doc->rasters = NULL;
+  rsvg_handle_get_dimensions(svg, &doc->dimension);
+  gd->documents = g_list_prepend(gd->documents, doc);
+  return doc;
+}
+
+// looks up the watermark rendered with the given transformation, rendering it on a miss.
+// gd->lock has to be held.
+static dt_iop_watermark_raster_t *_watermark_get_raster(dt_iop_watermark_global_data_t *gd,
+                                                        dt_iop_watermark_document_t *doc,
+                                                        const dt_iop_watermark_raster_key_t *key)
+{
+  for(GList *l = doc->rasters; l; l = g_list_next(l))
+  {
+    dt_iop_watermark_raster_t *r = (dt_iop_watermark_raster_t *)l->data;
+    if(!memcmp(&r->key, key, sizeof(dt_iop_watermark_raster_key_t)))
+    {
+      doc->rasters = g_list_remove_link(doc->rasters, l);
+      doc->rasters = g_list_concat(l, doc->rasters);
+      return r;
+    }
+  }
+
+  /* setup stride for performance */
+  const int stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, key->width);
+
+  /* create cairo memory surface */
+  guint8 *pixels = (guint8 *)g_malloc0_n(key->height, stride);
+  cairo_surface_t *surface
+      = cairo_image_surface_create_for_data(pixels, CAIRO_FORMAT_ARGB32, key->width, key->height, stride);
+  if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
+  {
+    //   fprintf(stderr,"Cairo surface error: %s\n",cairo_status_to_string(cairo_surface_status(surface)));
+    cairo_surface_destroy(surface);
+    g_free(pixels);
+    return NULL;
+  }
+
+  /* move the rotation center to its place in the raster, rotate, and scale svg units to pixels */
+  cairo_t *cr = cairo_create(surface);
+  cairo_translate(cr, key->x, key->y);
+  cairo_rotate(cr, key->angle);
+  cairo_translate(cr, -key->cx, -key->cy);
+  cairo_scale(cr, key->scale, key->scale);
+
+  /* render svg into surface*/
+  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+  rsvg_handle_render_cairo(doc->svg, cr);
+  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+
+  /* ensure that all operations on surface finishing up */
+  cairo_surface_flush(surface);
+  cairo_destroy(cr);
+  cairo_surface_destroy(surface);
+
+  dt_iop_watermark_raster_t *r = (dt_iop_watermark_raster_t *)malloc(sizeof(dt_iop_watermark_raster_t));
+  r->key = *key;
+  r->users = 0;
+  r->stride = stride;
+  r->pixels = pixels;
+  doc->rasters = g_list_prepend(doc->rasters, r);
+  gd->raster_bytes += (size_t)key->height * stride;
+  return r;
+}
+
 static gchar *_watermark_get_svgdoc(dt_iop_module_t *self, dt_iop_watermark_data_t *data,
                                     const dt_image_t *image)
 {
-  gsize length;
-
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)self->data;
   gchar *svgdoc = NULL;
   gchar configdir[PATH_MAX] = { 0 };
   gchar datadir[PATH_MAX] = { 0 };
@@ -293,7 +555,7 @@ static gchar *_watermark_get_svgdoc(dt_iop_module_t *self, dt_iop_watermark_data
   time_t t = time(NULL);
   (void)localtime_r(&t, &tt_cur);
 
-  if(g_file_get_contents(filename, &svgdata, &length, NULL))
+  if((svgdata = _watermark_get_template(gd, filename)) != NULL)
   {
     // File is loaded lets substitute strings if found...
 
@@ -604,6 +866,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
              const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
   dt_iop_watermark_data_t *data = (dt_iop_watermark_data_t *)piece->data;
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)self->data;
   float *in = (float *)ivoid;
   float *out = (float *)ovoid;
   const int ch = piece->colors;
@@ -617,37 +880,18 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
     return;
   }
 
-  /* create the rsvghandle from parsed svg data */
-  GError *error = NULL;
-  RsvgHandle *svg = rsvg_handle_new_from_data((const guint8 *)svgdoc, strlen(svgdoc), &error);
-  g_free(svgdoc);
-  if(!svg || error)
+  /* look up the parsed document, only the first image exported with it parses it */
+  dt_pthread_mutex_lock(&gd->lock);
+  dt_iop_watermark_document_t *doc = _watermark_get_document(gd, svgdoc);
+  if(!doc)
   {
+    dt_pthread_mutex_unlock(&gd->lock);
     memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
     return;
   }
 
-  /* setup stride for performance */
-  int stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, roi_out->width);
-
-  /* create cairo memory surface */
-  guint8 *image = (guint8 *)g_malloc0_n(roi_out->height, stride);
-  cairo_surface_t *surface = cairo_image_surface_create_for_data(image, CAIRO_FORMAT_ARGB32, roi_out->width,
-                                                                 roi_out->height, stride);
-  if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
-  {
-    //   fprintf(stderr,"Cairo surface error: %s\n",cairo_status_to_string(cairo_surface_status(surface)));
-    g_free(image);
-    memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
-    return;
-  }
-
-  /* create cairo context and setup transformation/scale */
-  cairo_t *cr = cairo_create(surface);
-
   /* get the dimension of svg */
-  RsvgDimensionData dimension;
-  rsvg_handle_get_dimensions(svg, &dimension);
+  const RsvgDimensionData dimension = doc->dimension;
 
   //  width/height of current (possibly cropped) image
   const float iw = piece->buf_in.width;
@@ -751,62 +995,102 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
   else if(data->alignment == 2 || data->alignment == 5 || data->alignment == 8)
     tx = iw - svg_width - bX;
 
-  // translate to position
-  cairo_translate(cr, -roi_in->x, -roi_in->y);
-
   // add translation for the given value in GUI (xoffset,yoffset)
   tx += data->xoffset * wbase;
   ty += data->yoffset * hbase;
 
-  cairo_translate(cr, tx * roi_out->scale, ty * roi_out->scale);
-
-  // compute the center of the svg to rotate from the center
-  float cX = svg_width / 2.0 * roi_out->scale;
-  float cY = svg_height / 2.0 * roi_out->scale;
-
-  cairo_translate(cr, cX, cY);
-  cairo_rotate(cr, angle);
-  cairo_translate(cr, -cX, -cY);
+  // the center of the svg, which it is rotated around, relative to the watermark and in the full image
+  const double cX = svg_width / 2.0 * roi_out->scale;
+  const double cY = svg_height / 2.0 * roi_out->scale;
+  const double centerX = tx * roi_out->scale + cX;
+  const double centerY = ty * roi_out->scale + cY;
 
-  // now set proper scale for the watermark itself
-  cairo_scale(cr, scale, scale);
+  // bounding box of the scaled and rotated watermark, relative to its center
+  double minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+  for(int k = 0; k < 4; k++)
+  {
+    const double px = ((k & 1) ? dimension.width : 0) * scale - cX;
+    const double py = ((k & 2) ? dimension.height : 0) * scale - cY;
+    const double rx = px * cos(angle) - py * sin(angle);
+    const double ry = px * sin(angle) + py * cos(angle);
+    minX = fmin(minX, rx);
+    maxX = fmax(maxX, rx);
+    minY = fmin(minY, ry);
+    maxY = fmax(maxY, ry);
+  }
 
-  /* render svg into surface*/
-  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
-  rsvg_handle_render_cairo(svg, cr);
-  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+  // the watermark is rendered into its own raster covering the visible part of this box, with a pixel of
+  // margin for antialiasing. all tiles of an image and all images of the same size share it.
+  const int x0 = MAX(0, (int)floor(centerX + minX) - 1);
+  const int y0 = MAX(0, (int)floor(centerY + minY) - 1);
+  const int x1 = MIN((int)ceil(iw * roi_out->scale), (int)ceil(centerX + maxX) + 1);
+  const int y1 = MIN((int)ceil(ih * roi_out->scale), (int)ceil(centerY + maxY) + 1);
+  if(x1 <= x0 || y1 <= y0)
+  {
+    dt_pthread_mutex_unlock(&gd->lock);
+    memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
+    return;
+  }
 
-  /* ensure that all operations on surface finishing up */
-  cairo_surface_flush(surface);
+  dt_iop_watermark_raster_key_t key;
+  memset(&key, 0, sizeof(key));
+  key.x = centerX - x0;
+  key.y = centerY - y0;
+  key.cx = cX;
+  key.cy = cY;
+  key.scale = scale;
+  key.angle = angle;
+  key.width = x1 - x0;
+  key.height = y1 - y0;
+
+  dt_iop_watermark_raster_t *raster = _watermark_get_raster(gd, doc, &key);
+  if(raster) raster->users++;
+  dt_pthread_mutex_unlock(&gd->lock);
+
+  if(!raster)
+  {
+    memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
+    return;
+  }
 
-  /* render surface on output */
-  guint8 *sd = image;
+  /* render raster on output */
+  const guint8 *sd = raster->pixels;
+  int stride = raster->stride;
+  int rw = key.width, rh = key.height;
+  int ox = roi_in->x - x0, oy = roi_in->y - y0;
   float opacity = data->opacity / 100.0;
-  /*
-  #ifdef _OPENMP
-    #pragma omp parallel for default(none) shared(roi_out, in, out,sd,opacity) schedule(static)
-  #endif
-  */
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(roi_out, in, out, sd, opacity, stride, rw, rh, ox, oy)      \
+    schedule(static)
+#endif
   for(int j = 0; j < roi_out->height; j++)
-    for(int i = 0; i < roi_out->width; i++)
+  {
+    const float *inp = in + (size_t)ch * roi_out->width * j;
+    float *outp = out + (size_t)ch * roi_out->width * j;
+    const int y = j + oy;
+    for(int i = 0; i < roi_out->width; i++, inp += ch, outp += ch)
     {
-      float alpha = (sd[3] / 255.0) * opacity;
+      const int x = i + ox;
+      if(y < 0 || y >= rh || x < 0 || x >= rw)
+      {
+        for(int c = 0; c < 4; c++) outp[c] = inp[c];
+        continue;
+      }
+      const guint8 *s = sd + (size_t)stride * y + 4 * x;
+      float alpha = (s[3] / 255.0) * opacity;
       /* svg uses a premultiplied alpha, so only use opacity for the blending */
-      out[0] = ((1.0 - alpha) * in[0]) + (opacity * (sd[2] / 255.0));
-      out[1] = ((1.0 - alpha) * in[1]) + (opacity * (sd[1] / 255.0));
-      out[2] = ((1.0 - alpha) * in[2]) + (opacity * (sd[0] / 255.0));
-      out[3] = in[3];
-
-      out += ch;
-      in += ch;
-      sd += 4;
+      outp[0] = ((1.0 - alpha) * inp[0]) + (opacity * (s[2] / 255.0));
+      outp[1] = ((1.0 - alpha) * inp[1]) + (opacity * (s[1] / 255.0));
+      outp[2] = ((1.0 - alpha) * inp[2]) + (opacity * (s[0] / 255.0));
+      outp[3] = inp[3];
     }
+  }
 
-
-  /* clean up */
-  cairo_surface_destroy(surface);
-  g_object_unref(svg);
-  g_free(image);
+  /* hand the raster back, it may be evicted from now on */
+  dt_pthread_mutex_lock(&gd->lock);
+  raster->users--;
+  _watermark_cache_trim(gd);
+  dt_pthread_mutex_unlock(&gd->lock);
 }
 
 static void watermark_callback(GtkWidget *tb, gpointer user_data)
@@ -1046,6 +1330,29 @@ void init(dt_iop_module_t *module)
   memcpy(module->default_params, &tmp, sizeof(dt_iop_watermark_params_t));
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  dt_iop_watermark_global_data_t *gd
+      = (dt_iop_watermark_global_data_t *)malloc(sizeof(dt_iop_watermark_global_data_t));
+  module->data = gd;
+  dt_pthread_mutex_init(&gd->lock, NULL);
+  gd->templates = NULL;
+  gd->documents = NULL;
+  gd->raster_bytes = 0;
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)module->data;
+  g_list_free_full(gd->templates, (GDestroyNotify)_watermark_template_free);
+  for(GList *l = gd->documents; l; l = g_list_next(l))
+    _watermark_document_free(gd, (dt_iop_watermark_document_t *)l->data);
+  g_list_free(gd->documents);
+  dt_pthread_mutex_destroy(&gd->lock);
+  free(module->data);
+  module->data = NULL;
+}
+
 void cleanup(dt_iop_module_t *module)
 {
   free(module->gui_data);
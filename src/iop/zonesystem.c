@@ -155,6 +155,38 @@ static inline void _iop_zonesystem_calculate_zonemap(struct dt_iop_zonesystem_pa
 }
 
 #define GAUSS(a, b, c, x) (a * pow(2.718281828, (-pow((x - b), 2) / (pow(c, 2)))))
+
+// precompute scale and offset of the zonemap
+static void _iop_zonesystem_precompute(dt_iop_zonesystem_data_t *data, float *zonemap_scale,
+                                       float *zonemap_offset)
+{
+  const int size = data->size;
+  float zonemap[MAX_ZONE_SYSTEM_SIZE] = { -1 };
+  _iop_zonesystem_calculate_zonemap(data, zonemap);
+
+  for(int k = 0; k < size - 1; k++) zonemap_scale[k] = (zonemap[k + 1] - zonemap[k]) * (size - 1);
+  for(int k = 0; k < size - 1; k++) zonemap_offset[k] = 100.0f * ((k + 1) * zonemap[k] - k * zonemap[k + 1]);
+}
+
+dt_iop_transfer_t transfer_function(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
+                                    const float *const in, float *const out, const int num)
+{
+  dt_iop_zonesystem_data_t *data = (dt_iop_zonesystem_data_t *)piece->data;
+  const int size = data->size;
+  float zonemap_offset[MAX_ZONE_SYSTEM_SIZE] = { -1 };
+  float zonemap_scale[MAX_ZONE_SYSTEM_SIZE] = { -1 };
+  _iop_zonesystem_precompute(data, zonemap_scale, zonemap_offset);
+
+  const float rzscale = (size - 1) / 100.0f;
+  for(int k = 0; k < 4 * num; k += 4)
+  {
+    const int rz = CLAMPS(in[k] * rzscale, 0, size - 2); // zone index
+    const float zs = ((rz > 0) ? (zonemap_offset[rz] / in[k]) : 0) + zonemap_scale[rz];
+    for(int c = 0; c < 3; c++) out[k + c] = in[k + c] * zs;
+  }
+  return DT_IOP_TRANSFER_SCALE_CHROMA;
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid,
              const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
@@ -185,9 +217,10 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
 
   /* calculate zonemap */
   const int size = data->size;
-  float zonemap[MAX_ZONE_SYSTEM_SIZE] = { -1 };
-  _iop_zonesystem_calculate_zonemap(data, zonemap);
   const int ch = piece->colors;
+  float zonemap_offset[MAX_ZONE_SYSTEM_SIZE] = { -1 };
+  float zonemap_scale[MAX_ZONE_SYSTEM_SIZE] = { -1 };
+  _iop_zonesystem_precompute(data, zonemap_scale, zonemap_offset);
 
 
   /* process the image */
@@ -196,13 +229,6 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
 
   const float rzscale = (size - 1) / 100.0f;
 
-  float zonemap_offset[MAX_ZONE_SYSTEM_SIZE] = { -1 };
-  float zonemap_scale[MAX_ZONE_SYSTEM_SIZE] = { -1 };
-
-  // precompute scale and offset
-  for(int k = 0; k < size - 1; k++) zonemap_scale[k] = (zonemap[k + 1] - zonemap[k]) * (size - 1);
-  for(int k = 0; k < size - 1; k++) zonemap_offset[k] = 100.0f * ((k + 1) * zonemap[k] - k * zonemap[k + 1]);
-
 #ifdef _OPENMP
 #pragma omp parallel for default(none) shared(in, out, zonemap_scale, zonemap_offset) schedule(static)
 #endif
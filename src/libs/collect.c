@@ -453,7 +453,7 @@ void view_popup_menu_onSearchFilmroll(GtkWidget *menuitem, gpointer userdata)
         old = (gchar *)sqlite3_column_text(stmt, 1);
 
         query = NULL;
-        query = dt_util_dstrcat(query, "update film_rolls set folder=?1 where id=?2");
+        query = dt_util_dstrcat(query, "update film_rolls set folder=?1, crawler_timestamp=NULL where id=?2");
 
         gchar trailing[1024] = { 0 };
         gchar final[1024] = { 0 };
@@ -362,7 +362,7 @@ void _lib_navigation_set_position(dt_lib_module_t *self, double x, double y, int
     gtk_widget_queue_draw(self->widget);
 
     /* redraw pipe */
-    dt_dev_invalidate(darktable.develop);
+    dt_dev_invalidate_zoom(darktable.develop);
     dt_control_queue_redraw_center();
   }
 }
@@ -425,7 +425,7 @@ static void _zoom_preset_change(int val)
   dt_control_set_dev_closeup(closeup);
   dt_control_set_dev_zoom_x(zoom_x);
   dt_control_set_dev_zoom_y(zoom_y);
-  dt_dev_invalidate(dev);
+  dt_dev_invalidate_zoom(dev);
   dt_control_queue_redraw();
 }
 
@@ -21,6 +21,7 @@
 #include "control/control.h"
 #include "control/conf.h"
 #include "develop/develop.h"
+#include "develop/snapshots.h"
 #include "libs/lib.h"
 #include "gui/accelerators.h"
 #include "gui/gtk.h"
@@ -31,13 +32,17 @@ DT_MODULE(1)
 
 #define HANDLE_SIZE 0.02
 
+/* memory the snapshots may take before the old ones get compressed and dropped */
+#define DT_LIB_SNAPSHOTS_BUDGET ((size_t)64 << 20)
+
 /* a snapshot */
 typedef struct dt_lib_snapshot_t
 {
   GtkWidget *button;
   float zoom_x, zoom_y, zoom_scale;
   int32_t zoom, closeup;
-  char filename[512];
+  uint32_t id;        // of the image in the snapshot store
+  char filename[512]; // only written when asked for by lua
 } dt_lib_snapshot_t;
 
 
@@ -59,6 +64,10 @@ typedef struct dt_lib_snapshots_t
   /* snapshot cairo surface */
   cairo_surface_t *snapshot_image;
 
+  /* images of all snapshots */
+  dt_dev_snapshot_store_t store;
+  uint32_t next_id;
+
 
   /* change snapshot overlay controls */
   gboolean dragging, vertical, inverted;
@@ -252,12 +261,14 @@ void gui_reset(dt_lib_module_t *self)
 {
   dt_lib_snapshots_t *d = (dt_lib_snapshots_t *)self->data;
   d->num_snapshots = 0;
+  if(d->snapshot_image) cairo_surface_destroy(d->snapshot_image);
   d->snapshot_image = NULL;
 
   for(uint32_t k = 0; k < d->size; k++)
   {
     gtk_widget_hide(d->snapshot[k].button);
     gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(d->snapshot[k].button), FALSE);
+    dt_dev_snapshot_store_remove(&d->store, d->snapshot[k].id);
   }
 
   dt_control_queue_redraw_center();
@@ -272,6 +283,7 @@ void gui_init(dt_lib_module_t *self)
   /* initialize snapshot storages */
   d->size = 4;
   d->snapshot = (dt_lib_snapshot_t *)g_malloc0_n(d->size, sizeof(dt_lib_snapshot_t));
+  dt_dev_snapshot_store_init(&d->store, DT_LIB_SNAPSHOTS_BUDGET, TRUE);
   d->vp_xpointer = 0.5;
   d->vp_ypointer = 0.5;
   d->vertical = TRUE;
@@ -328,6 +340,8 @@ void gui_cleanup(dt_lib_module_t *self)
   dt_lib_snapshots_t *d = (dt_lib_snapshots_t *)self->data;
 
   g_free(d->snapshot);
+  if(d->snapshot_image) cairo_surface_destroy(d->snapshot_image);
+  dt_dev_snapshot_store_cleanup(&d->store);
 
   g_free(self->data);
   self->data = NULL;
@@ -338,8 +352,9 @@ static void _lib_snapshots_add_button_clicked_callback(GtkWidget *widget, gpoint
   dt_lib_module_t *self = (dt_lib_module_t *)user_data;
   dt_lib_snapshots_t *d = (dt_lib_snapshots_t *)self->data;
 
-  /* backup last snapshot slot */
+  /* backup last snapshot slot, its image is gone for good */
   dt_lib_snapshot_t last = d->snapshot[d->size - 1];
+  dt_dev_snapshot_store_remove(&d->store, last.id);
 
   /* rotate slots down to make room for new one on top */
   for(int k = d->size - 1; k > 0; k--)
@@ -372,6 +387,7 @@ static void _lib_snapshots_add_button_clicked_callback(GtkWidget *widget, gpoint
   gtk_widget_set_halign(gtk_bin_get_child(GTK_BIN(d->snapshot[0].button)), GTK_ALIGN_START);
 
   dt_lib_snapshot_t *s = d->snapshot + 0;
+  s->id = ++d->next_id;
   s->zoom_y = dt_control_get_dev_zoom_y();
   s->zoom_x = dt_control_get_dev_zoom_x();
   s->zoom = dt_control_get_dev_zoom();
@@ -385,7 +401,7 @@ static void _lib_snapshots_add_button_clicked_callback(GtkWidget *widget, gpoint
   for(uint32_t k = 0; k < d->num_snapshots; k++) gtk_widget_show(d->snapshot[k].button);
 
   /* request a new snapshot for top slot */
-  dt_dev_snapshot_request(darktable.develop, (const char *)&d->snapshot[0].filename);
+  dt_dev_snapshot_request(darktable.develop, &d->store, d->snapshot[0].id);
 }
 
 static void _lib_snapshots_toggled_callback(GtkToggleButton *widget, gpointer user_data)
@@ -421,7 +437,7 @@ static void _lib_snapshots_toggled_callback(GtkToggleButton *widget, gpointer us
 
     dt_dev_invalidate(darktable.develop);
 
-    d->snapshot_image = cairo_image_surface_create_from_png(s->filename);
+    d->snapshot_image = dt_dev_snapshot_store_get(&d->store, s->id);
   }
 
   /* redraw center view */
@@ -620,6 +636,7 @@ static int filename_member(lua_State *L)
   {
     return luaL_error(L, "Accessing a non-existant snapshot");
   }
+  dt_dev_snapshot_store_write_png(&d->store, d->snapshot[index].id, d->snapshot[index].filename);
   lua_pushstring(L, d->snapshot[index].filename);
   return 1;
 }
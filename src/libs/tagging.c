@@ -176,6 +176,7 @@ static void attach_selected_tag(dt_lib_module_t *self, dt_lib_tagging_t *d)
 
   dt_tag_attach(tagid, imgsel);
   dt_image_synch_xmp(imgsel);
+  dt_collection_update_images(darktable.collection, imgsel, DT_COLLECTION_CHANGE_TAG);
 
   dt_control_signal_raise(darktable.signals, DT_SIGNAL_TAG_CHANGED);
 }
@@ -197,6 +198,7 @@ static void detach_selected_tag(dt_lib_module_t *self, dt_lib_tagging_t *d)
 
   dt_tag_detach(tagid, imgsel);
   dt_image_synch_xmp(imgsel);
+  dt_collection_update_images(darktable.collection, imgsel, DT_COLLECTION_CHANGE_TAG);
 
   dt_control_signal_raise(darktable.signals, DT_SIGNAL_TAG_CHANGED);
 }
@@ -242,6 +244,7 @@ static void new_button_clicked(GtkButton *button, gpointer user_data)
   /** attach tag to selected images  */
   dt_tag_attach_string_list(tag, -1);
   dt_image_synch_xmp(-1);
+  dt_collection_update_images(darktable.collection, -1, DT_COLLECTION_CHANGE_TAG);
 
   update(self, 1);
   update(self, 0);
@@ -262,6 +265,7 @@ static void entry_activated(GtkButton *button, gpointer user_data)
   /** attach tag to selected images  */
   dt_tag_attach_string_list(tag, -1);
   dt_image_synch_xmp(-1);
+  dt_collection_update_images(darktable.collection, -1, DT_COLLECTION_CHANGE_TAG);
 
   update(self, 1);
   update(self, 0);
@@ -520,6 +524,7 @@ static gboolean _lib_tagging_tag_key_press(GtkWidget *entry, GdkEventKey *event,
       {
         dt_tag_attach_string_list(tag, d->floating_tag_imgid);
         dt_image_synch_xmp(d->floating_tag_imgid);
+        dt_collection_update_images(darktable.collection, d->floating_tag_imgid, DT_COLLECTION_CHANGE_TAG);
       }
       else // all selected images
       {
@@ -535,6 +540,7 @@ static gboolean _lib_tagging_tag_key_press(GtkWidget *entry, GdkEventKey *event,
           } while((iter = g_list_next(iter)) != NULL);
         }
         g_list_free(selected_images);
+        dt_collection_update_images(darktable.collection, -1, DT_COLLECTION_CHANGE_TAG);
       }
       update(self, 1);
       update(self, 0);
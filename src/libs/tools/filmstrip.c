@@ -485,36 +485,7 @@ static gboolean _lib_filmstrip_scroll_callback(GtkWidget *w, GdkEventScroll *e,
 
 static gboolean _lib_filmstrip_imgid_in_collection(const dt_collection_t *collection, const int imgid)
 {
-  sqlite3_stmt *stmt = NULL;
-  uint32_t count = 1;
-  const gchar *query = dt_collection_get_query(collection);
-  gchar *count_query = NULL;
-
-  // gchar *fq = g_strstr_len(query, strlen(query), "from");
-  gchar *fw = g_strstr_len(query, strlen(query), "where") + 6;
-
-  gchar *qq = NULL;
-  qq = dt_util_dstrcat(qq, "id=?3 and %s", fw);
-
-  if((collection->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT))
-    count_query
-        = dt_util_dstrcat(NULL, "select count(images.id) from images %s and id=?3", collection->where_ext);
-  else
-    count_query = dt_util_dstrcat(count_query, "select count(id) from images where %s", qq);
-
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), count_query, -1, &stmt, NULL);
-  if((collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT)
-     && !(collection->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT))
-  {
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
-  }
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, imgid);
-
-  if(sqlite3_step(stmt) == SQLITE_ROW) count = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
-  g_free(count_query);
-  return count;
+  return dt_collection_has_image(collection, imgid);
 }
 
 static gboolean _lib_filmstrip_button_press_callback(GtkWidget *w, GdkEventButton *e, gpointer user_data)
@@ -663,9 +634,6 @@ static gboolean _lib_filmstrip_draw_callback(GtkWidget *widget, cairo_t *cr, gpo
 
   const int col_start = max_cols / 2 - strip->offset;
   const int empty_edge = (width - (max_cols * wd)) / 2;
-  int step_res = SQLITE_ROW;
-
-  sqlite3_stmt *stmt = NULL;
 
   /* mouse over image position in filmstrip */
   pointerx -= empty_edge;
@@ -686,9 +654,9 @@ static gboolean _lib_filmstrip_draw_callback(GtkWidget *widget, cairo_t *cr, gpo
 
   // dt_view_set_scrollbar(self, offset, count, max_cols, 0, 1, 1);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, offset - max_cols / 2);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, max_cols);
+  int32_t ids[max_cols];
+  const int num_ids = dt_collection_get_ids(darktable.collection, offset - max_cols / 2, max_cols, ids);
+  int current = 0;
 
 
   cairo_save(cr);
@@ -701,14 +669,9 @@ static gboolean _lib_filmstrip_draw_callback(GtkWidget *widget, cairo_t *cr, gpo
       continue;
     }
 
-    if(step_res != SQLITE_DONE)
-    {
-      step_res = sqlite3_step(stmt);
-    }
-
-    if(step_res == SQLITE_ROW)
+    if(current < num_ids)
     {
-      int id = sqlite3_column_int(stmt, 0);
+      int id = ids[current++];
       // set mouse over id
       if(seli == col)
       {
@@ -723,17 +686,10 @@ static gboolean _lib_filmstrip_draw_callback(GtkWidget *widget, cairo_t *cr, gpo
       dt_view_image_expose(&(strip->image_over), id, cr, wd, ht, max_cols, img_pointerx, img_pointery, FALSE, FALSE);
       cairo_restore(cr);
     }
-    else if(step_res == SQLITE_DONE)
-    {
-      /* do nothing, just add some empty thumb frames */
-    }
-    else
-      goto failure;
+    /* else do nothing, just add some empty thumb frames */
     cairo_translate(cr, wd, 0.0f);
   }
-failure:
   cairo_restore(cr);
-  sqlite3_finalize(stmt);
 
   if(darktable.gui->center_tooltip == 1) // set in this round
   {
@@ -900,6 +856,8 @@ static gboolean _lib_filmstrip_duplicate_image_key_accel_callback(GtkAccelGroup
   int32_t newimgid = dt_image_duplicate(mouse_over_id);
   if(newimgid != -1) dt_history_copy_and_paste_on_image(mouse_over_id, newimgid, FALSE, NULL);
 
+  // the duplicate joins the collection
+  dt_control_signal_raise(darktable.signals, DT_SIGNAL_FILMROLLS_CHANGED);
   dt_control_queue_redraw_center();
   return TRUE;
 }
@@ -37,6 +37,7 @@ int dt_lua_duplicate_image(lua_State *L)
   int imgid;
   luaA_to(L, dt_lua_image_t, &imgid, -1);
   imgid = dt_image_duplicate(imgid);
+  dt_control_signal_raise(darktable.signals, DT_SIGNAL_FILMROLLS_CHANGED);
   luaA_push(L, dt_lua_image_t, &imgid);
   return 1;
 }
@@ -19,6 +19,7 @@
 #include "lua/image.h"
 #include "lua/types.h"
 #include "common/darktable.h"
+#include "common/collection.h"
 #include "common/tags.h"
 #include "common/debug.h"
 
@@ -158,6 +159,7 @@ int dt_lua_tag_attach(lua_State *L)
     luaA_to(L, dt_lua_image_t, &imgid, 2);
   }
   dt_tag_attach(tagid, imgid);
+  dt_collection_update_images(darktable.collection, imgid, DT_COLLECTION_CHANGE_TAG);
   return 0;
 }
 
@@ -176,6 +178,7 @@ int dt_lua_tag_detach(lua_State *L)
     luaA_to(L, dt_lua_image_t, &imgid, 2);
   }
   dt_tag_detach(tagid, imgid);
+  dt_collection_update_images(darktable.collection, imgid, DT_COLLECTION_CHANGE_TAG);
   return 0;
 }
 
@@ -0,0 +1,183 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define DT_UNIT_TEST
+
+// unit test for the in-memory darkroom snapshot store: push surfaces in, check what comes out.
+#include "develop/snapshots.h"
+#include "develop/snapshots.c"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#define WD 64
+#define HT 48
+
+// a surface filled with a pattern depending on seed. flat patterns compress well, noisy ones don't.
+static cairo_surface_t *make_surface(const uint32_t seed, const int flat)
+{
+  cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, WD, HT);
+  assert(cairo_surface_status(surface) == CAIRO_STATUS_SUCCESS);
+  cairo_surface_flush(surface);
+  uint8_t *data = cairo_image_surface_get_data(surface);
+  const int stride = cairo_image_surface_get_stride(surface);
+  uint32_t state = seed * 2654435761u + 1;
+  for(int j = 0; j < HT; j++)
+    for(int i = 0; i < WD; i++)
+    {
+      uint32_t *px = (uint32_t *)(data + (size_t)j * stride) + i;
+      if(flat)
+        *px = 0xff000000u | (seed & 0xffffff);
+      else
+      {
+        state = state * 1664525u + 1013904223u;
+        *px = 0xff000000u | (state >> 8);
+      }
+    }
+  cairo_surface_mark_dirty(surface);
+  return surface;
+}
+
+static int same_pixels(cairo_surface_t *a, cairo_surface_t *b)
+{
+  cairo_surface_flush(a);
+  cairo_surface_flush(b);
+  if(cairo_image_surface_get_width(a) != cairo_image_surface_get_width(b)
+     || cairo_image_surface_get_height(a) != cairo_image_surface_get_height(b))
+    return 0;
+  const int sa = cairo_image_surface_get_stride(a), sb = cairo_image_surface_get_stride(b);
+  const uint8_t *da = cairo_image_surface_get_data(a), *db = cairo_image_surface_get_data(b);
+  for(int j = 0; j < cairo_image_surface_get_height(a); j++)
+    if(memcmp(da + (size_t)j * sa, db + (size_t)j * sb, 4 * cairo_image_surface_get_width(a))) return 0;
+  return 1;
+}
+
+// fetches snapshot id and compares it to the expected surface
+static int check(dt_dev_snapshot_store_t *store, const uint32_t id, cairo_surface_t *expected)
+{
+  cairo_surface_t *out = dt_dev_snapshot_store_get(store, id);
+  if(!out) return 0;
+  const int res = same_pixels(out, expected);
+  cairo_surface_destroy(out);
+  return res;
+}
+
+int main(int argc, char *arg[])
+{
+  const size_t size = (size_t)4 * WD * HT;
+  dt_dev_snapshot_store_t store;
+
+  {
+    // what goes in comes out, as a private copy
+    dt_dev_snapshot_store_init(&store, 16 * size, FALSE);
+    cairo_surface_t *in = make_surface(1, 0);
+    cairo_surface_t *ref = make_surface(1, 0);
+    dt_dev_snapshot_store_put(&store, 1, in);
+    assert(dt_dev_snapshot_store_get(&store, 2) == NULL);
+    cairo_surface_t *out = dt_dev_snapshot_store_get(&store, 1);
+    assert(out && out != in);
+    assert(same_pixels(out, ref));
+    cairo_surface_destroy(out);
+
+    // drawing into the darkroom surface afterwards doesn't change the snapshot
+    cairo_surface_flush(in);
+    memset(cairo_image_surface_get_data(in), 0, size);
+    cairo_surface_mark_dirty(in);
+    assert(check(&store, 1, ref));
+
+    // storing under the same id replaces it
+    cairo_surface_t *other = make_surface(2, 0);
+    dt_dev_snapshot_store_put(&store, 1, other);
+    assert(check(&store, 1, other));
+    assert(store.used == size);
+
+    dt_dev_snapshot_store_remove(&store, 1);
+    assert(dt_dev_snapshot_store_get(&store, 1) == NULL);
+    assert(store.used == 0);
+
+    cairo_surface_destroy(in);
+    cairo_surface_destroy(ref);
+    cairo_surface_destroy(other);
+    dt_dev_snapshot_store_cleanup(&store);
+    fprintf(stderr, "[passed] put, get, replace and remove\n");
+  }
+
+  {
+    // without compression the least recently used snapshots are dropped to stay within the budget
+    dt_dev_snapshot_store_init(&store, 2 * size, FALSE);
+    cairo_surface_t *s[4];
+    for(int k = 0; k < 4; k++) s[k] = make_surface(k + 10, 0);
+    dt_dev_snapshot_store_put(&store, 0, s[0]);
+    dt_dev_snapshot_store_put(&store, 1, s[1]);
+    // touch 0, so 1 is the oldest now
+    assert(check(&store, 0, s[0]));
+    dt_dev_snapshot_store_put(&store, 2, s[2]);
+    assert(store.used <= store.budget);
+    assert(dt_dev_snapshot_store_get(&store, 1) == NULL);
+    assert(check(&store, 2, s[2]));
+    assert(check(&store, 0, s[0]));
+
+    // the most recent snapshot stays, even if it doesn't fit at all
+    store.budget = size / 2;
+    dt_dev_snapshot_store_put(&store, 3, s[3]);
+    assert(dt_dev_snapshot_store_get(&store, 0) == NULL);
+    assert(dt_dev_snapshot_store_get(&store, 2) == NULL);
+    assert(check(&store, 3, s[3]));
+    assert(store.used == size);
+
+    for(int k = 0; k < 4; k++) cairo_surface_destroy(s[k]);
+    dt_dev_snapshot_store_cleanup(&store);
+    fprintf(stderr, "[passed] lru eviction within the budget\n");
+  }
+
+  {
+    // with compression old snapshots are packed first and come back unchanged
+    dt_dev_snapshot_store_init(&store, size + size / 4, TRUE);
+    cairo_surface_t *s[3];
+    for(int k = 0; k < 3; k++) s[k] = make_surface(k + 20, 1);
+    for(int k = 0; k < 3; k++) dt_dev_snapshot_store_put(&store, k, s[k]);
+    assert(store.used <= store.budget);
+    // all three are still there, only the most recent one is unpacked
+    for(GList *l = store.lru; l; l = g_list_next(l))
+    {
+      const dt_dev_snapshot_t *snap = (const dt_dev_snapshot_t *)l->data;
+      assert((snap->surface != NULL) == (l->next == NULL));
+    }
+    for(int k = 0; k < 3; k++) assert(check(&store, k, s[k]));
+    assert(store.used <= store.budget);
+
+    // noise doesn't compress, so it has to be dropped instead
+    cairo_surface_t *noise = make_surface(30, 0);
+    dt_dev_snapshot_store_put(&store, 3, noise);
+    dt_dev_snapshot_store_put(&store, 4, s[0]);
+    assert(store.used <= store.budget);
+    assert(dt_dev_snapshot_store_get(&store, 3) == NULL);
+    assert(check(&store, 4, s[0]));
+
+    for(int k = 0; k < 3; k++) cairo_surface_destroy(s[k]);
+    cairo_surface_destroy(noise);
+    dt_dev_snapshot_store_cleanup(&store);
+    fprintf(stderr, "[passed] compression of old snapshots\n");
+  }
+
+  exit(0);
+}
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
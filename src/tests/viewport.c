@@ -0,0 +1,133 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define DT_UNIT_TEST
+
+// unit test for the darkroom viewport math: which part of the image the main pipe renders, and when an
+// old rendering may stand in for a new pan or zoom.
+#include "develop/viewport.h"
+#include "develop/viewport.c"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <assert.h>
+
+#define MARGIN 0.125f
+
+static int close_to(const float a, const float b)
+{
+  return fabsf(a - b) < 1e-4f;
+}
+
+int main(int argc, char *arg[])
+{
+  dt_dev_viewport_t have, want;
+  float k, dx, dy;
+
+  {
+    // 2000x1000 image at 1:1 in a 800x600 window, centered
+    dt_dev_viewport_compute(&want, 1.0f, 0.0f, 0.0f, 800, 600, 2000, 1000, 0.0f);
+    assert(want.x == 600 && want.y == 200 && want.width == 800 && want.height == 600);
+    // the margin grows it by 1/8 of the window on each side
+    dt_dev_viewport_compute(&have, 1.0f, 0.0f, 0.0f, 800, 600, 2000, 1000, MARGIN);
+    assert(have.x == 500 && have.y == 125 && have.width == 1000 && have.height == 750);
+    // but not beyond the image
+    dt_dev_viewport_compute(&have, 1.0f, -0.5f, 0.0f, 800, 600, 2000, 1000, MARGIN);
+    assert(have.x == 0 && have.width == 900);
+    dt_dev_viewport_compute(&have, 1.0f, 0.0f, 0.0f, 800, 600, 400, 300, MARGIN);
+    assert(have.x == 0 && have.y == 0 && have.width == 400 && have.height == 300);
+    fprintf(stderr, "[passed] viewport with margin\n");
+  }
+
+  {
+    // a 2048x1024 image, so pans of 64 and 128 pixels are exact zoom offsets
+    dt_dev_viewport_compute(&have, 1.0f, 0.0f, 0.0f, 800, 600, 2048, 1024, MARGIN);
+    assert(have.x == 524 && have.y == 137 && have.width == 1000 && have.height == 750);
+
+    // the same viewport reprojects onto itself
+    assert(!dt_dev_viewport_reproject(&have, &have, &k, &dx, &dy));
+    assert(close_to(k, 1.0f) && close_to(dx, 0.0f) && close_to(dy, 0.0f));
+
+    // panning by less than the margin is served from the old buffer
+    dt_dev_viewport_compute(&want, 1.0f, 64.0f / 2048.0f, -64.0f / 1024.0f, 800, 600, 2048, 1024, 0.0f);
+    assert(want.x == 688 && want.y == 148);
+    assert(!dt_dev_viewport_reproject(&have, &want, &k, &dx, &dy));
+    assert(close_to(k, 1.0f) && close_to(dx, -164.0f) && close_to(dy, -11.0f));
+
+    // panning further right or left isn't
+    dt_dev_viewport_compute(&want, 1.0f, 128.0f / 2048.0f, 0.0f, 800, 600, 2048, 1024, 0.0f);
+    assert(dt_dev_viewport_reproject(&have, &want, &k, &dx, &dy));
+    dt_dev_viewport_compute(&want, 1.0f, -128.0f / 2048.0f, 0.0f, 800, 600, 2048, 1024, 0.0f);
+    assert(dt_dev_viewport_reproject(&have, &want, &k, &dx, &dy));
+    fprintf(stderr, "[passed] pan inside and outside the margin\n");
+  }
+
+  {
+    // the whole image at 1/4, zooming in to 1/2 magnifies it exactly DT_DEV_REPROJECT_MAX_ZOOM times
+    dt_dev_viewport_compute(&have, 0.25f, 0.0f, 0.0f, 800, 600, 2000, 1000, MARGIN);
+    assert(have.x == 0 && have.y == 0 && have.width == 500 && have.height == 250);
+    dt_dev_viewport_compute(&want, 0.25f * DT_DEV_REPROJECT_MAX_ZOOM, 0.0f, 0.0f, 800, 600, 2000, 1000, 0.0f);
+    assert(!dt_dev_viewport_reproject(&have, &want, &k, &dx, &dy));
+    assert(close_to(k, DT_DEV_REPROJECT_MAX_ZOOM) && close_to(dx, -100.0f) && close_to(dy, 0.0f));
+
+    // any further and the old buffer is too blurry, even though it still covers the view
+    dt_dev_viewport_compute(&want, 0.25f * DT_DEV_REPROJECT_MAX_ZOOM * 1.1f, 0.0f, 0.0f, 800, 600, 2000, 1000,
+                            0.0f);
+    assert(dt_dev_viewport_reproject(&have, &want, &k, &dx, &dy));
+    assert(k > DT_DEV_REPROJECT_MAX_ZOOM);
+
+    // zooming out shows parts which were never rendered
+    dt_dev_viewport_compute(&have, 1.0f, 0.0f, 0.0f, 800, 600, 2000, 1000, MARGIN);
+    dt_dev_viewport_compute(&want, 0.5f, 0.0f, 0.0f, 800, 600, 2000, 1000, 0.0f);
+    assert(dt_dev_viewport_reproject(&have, &want, &k, &dx, &dy));
+
+    // nothing rendered yet
+    const dt_dev_viewport_t empty = { 0 };
+    assert(dt_dev_viewport_reproject(&empty, &want, &k, &dx, &dy));
+    fprintf(stderr, "[passed] zoom up to DT_DEV_REPROJECT_MAX_ZOOM\n");
+  }
+
+  {
+    // origins are whole pixels, so a buffer may start up to one pixel late or end up to one pixel early
+    want = (dt_dev_viewport_t){.x = 100, .y = 100, .width = 300, .height = 300, .scale = 1.0f };
+    have = (dt_dev_viewport_t){.x = 101, .y = 101, .width = 299, .height = 299, .scale = 1.0f };
+    assert(!dt_dev_viewport_reproject(&have, &want, &k, &dx, &dy));
+    assert(close_to(dx, 1.0f) && close_to(dy, 1.0f));
+    have = (dt_dev_viewport_t){.x = 100, .y = 100, .width = 299, .height = 299, .scale = 1.0f };
+    assert(!dt_dev_viewport_reproject(&have, &want, &k, &dx, &dy));
+    // but not more
+    have = (dt_dev_viewport_t){.x = 102, .y = 100, .width = 298, .height = 300, .scale = 1.0f };
+    assert(dt_dev_viewport_reproject(&have, &want, &k, &dx, &dy));
+    have = (dt_dev_viewport_t){.x = 100, .y = 100, .width = 300, .height = 298, .scale = 1.0f };
+    assert(dt_dev_viewport_reproject(&have, &want, &k, &dx, &dy));
+
+    // zooming out to 1/2: buffer pixel 201 lands on 100.5, which the new viewport truncated to 100
+    have = (dt_dev_viewport_t){.x = 201, .y = 800, .width = 400, .height = 400, .scale = 1.0f };
+    dt_dev_viewport_compute(&want, 0.5f, (201.0f + 200.0f) / 2000.0f - 0.5f, 0.0f, 200, 200, 2000, 2000, 0.0f);
+    assert(want.x == 100 && want.width == 200);
+    assert(!dt_dev_viewport_reproject(&have, &want, &k, &dx, &dy));
+    assert(close_to(k, 0.5f) && close_to(dx, 0.5f) && close_to(dy, 0.0f));
+    fprintf(stderr, "[passed] origin rounding\n");
+  }
+
+  exit(0);
+}
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -28,6 +28,7 @@
 #include "develop/imageop.h"
 #include "develop/blend.h"
 #include "develop/masks.h"
+#include "develop/snapshots.h"
 #include "common/image_cache.h"
 #include "common/imageio.h"
 #include "common/imageio_module.h"
@@ -70,6 +71,11 @@ static gboolean _brush_size_down_callback(GtkAccelGroup *accel_group, GObject *a
 /* signal handler for filmstrip image switching */
 static void _view_darkroom_filmstrip_activate_callback(gpointer instance, gpointer user_data);
 
+// cairo surface wrapping the main pipe backbuffer, kept across exposes while it stays the same buffer
+static cairo_surface_t *backbuf_surface = NULL;
+static uint8_t *backbuf_surface_data = NULL;
+static int backbuf_surface_width = 0, backbuf_surface_height = 0;
+
 const char *name(dt_view_t *self)
 {
   return _("darkroom");
@@ -169,19 +175,41 @@ void expose(
     dt_view_set_scrollbar(self, zx + .5 - boxw * .5, 1.0, boxw, zy + .5 - boxh * .5, 1.0, boxh);
   }
 
-  if((dev->image_status == DT_DEV_PIXELPIPE_VALID)
-     && dev->pipe->input_timestamp >= dev->preview_pipe->input_timestamp)
+  // the main pipe output can stand in for the current view as long as it is the result of the current
+  // history and covers the view once reprojected to the current zoom and pan. a new one is on its way then.
+  dt_dev_viewport_t view;
+  dt_dev_get_viewport(dev, &view, 0.0f);
+  float k = 1.0f, dx = 0.0f, dy = 0.0f;
+  mutex = &dev->pipe->backbuf_mutex;
+  dt_pthread_mutex_lock(mutex);
+  const dt_dev_viewport_t rendered = { dev->pipe->backbuf_x, dev->pipe->backbuf_y, dev->pipe->backbuf_width,
+                                       dev->pipe->backbuf_height, dev->pipe->backbuf_scale };
+  const int covered = !dt_dev_viewport_reproject(&rendered, &view, &k, &dx, &dy);
+  const int current = dev->image_status == DT_DEV_PIXELPIPE_VALID
+                      || (covered && dev->pipe->backbuf_timestamp == dev->timestamp);
+  const int draw_image
+      = current && dev->pipe->backbuf && dev->pipe->input_timestamp >= dev->preview_pipe->input_timestamp;
+  if(!draw_image) dt_pthread_mutex_unlock(mutex);
+
+  if(draw_image)
   {
     // draw image
     roi_hash_old = roi_hash;
-    mutex = &dev->pipe->backbuf_mutex;
-    dt_pthread_mutex_lock(mutex);
-    wd = dev->pipe->backbuf_width;
-    ht = dev->pipe->backbuf_height;
-    stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, wd);
-    surface = dt_cairo_image_surface_create_for_data(dev->pipe->backbuf, CAIRO_FORMAT_RGB24, wd, ht, stride);
-    wd /= darktable.gui->ppd;
-    ht /= darktable.gui->ppd;
+    if(!backbuf_surface || backbuf_surface_data != dev->pipe->backbuf
+       || backbuf_surface_width != rendered.width || backbuf_surface_height != rendered.height)
+    {
+      if(backbuf_surface) cairo_surface_destroy(backbuf_surface);
+      backbuf_surface_data = dev->pipe->backbuf;
+      backbuf_surface_width = rendered.width;
+      backbuf_surface_height = rendered.height;
+      stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, rendered.width);
+      backbuf_surface = dt_cairo_image_surface_create_for_data(dev->pipe->backbuf, CAIRO_FORMAT_RGB24,
+                                                               rendered.width, rendered.height, stride);
+    }
+    // the pipe writes to the buffer behind cairo's back
+    cairo_surface_mark_dirty(backbuf_surface);
+    wd = view.width / darktable.gui->ppd;
+    ht = view.height / darktable.gui->ppd;
     if(dev->full_preview)
       cairo_set_source_rgb(cr, .1, .1, .1);
     else
@@ -194,13 +222,16 @@ void expose(
       cairo_translate(cr, -.25f * wd, -.25f * ht);
     }
     cairo_rectangle(cr, 0, 0, wd, ht);
-    cairo_set_source_surface(cr, surface, 0, 0);
-    cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_FAST);
+    cairo_save(cr);
+    cairo_translate(cr, dx / darktable.gui->ppd, dy / darktable.gui->ppd);
+    cairo_scale(cr, k, k);
+    cairo_set_source_surface(cr, backbuf_surface, 0, 0);
+    cairo_pattern_set_filter(cairo_get_source(cr), k == 1.0f ? CAIRO_FILTER_FAST : CAIRO_FILTER_BILINEAR);
     cairo_fill_preserve(cr);
+    cairo_restore(cr);
     cairo_set_line_width(cr, 1.0);
     cairo_set_source_rgb(cr, .3, .3, .3);
     cairo_stroke(cr);
-    cairo_surface_destroy(surface);
     dt_pthread_mutex_unlock(mutex);
     image_surface_imgid = dev->image_storage.id;
   }
@@ -251,13 +282,14 @@ void expose(
     /* reset the request */
     darktable.develop->proxy.snapshot.request = FALSE;
 
-    /* validation of snapshot filename */
-    g_assert(darktable.develop->proxy.snapshot.filename != NULL);
+    /* validation of snapshot store */
+    g_assert(darktable.develop->proxy.snapshot.store != NULL);
 
-    /* Store current image surface to snapshot file.
+    /* Store current image surface as snapshot.
        FIXME: add checks so that we dont make snapshots of preview pipe image surface.
     */
-    cairo_surface_write_to_png(image_surface, darktable.develop->proxy.snapshot.filename);
+    dt_dev_snapshot_store_put(darktable.develop->proxy.snapshot.store, darktable.develop->proxy.snapshot.id,
+                              image_surface);
   }
 
   // Displaying sample areas if enabled
@@ -767,7 +799,7 @@ static gboolean zoom_key_accel(GtkAccelGroup *accel_group, GObject *acceleratabl
       dt_control_set_dev_zoom_x(zoom_x);
       dt_control_set_dev_zoom_y(zoom_y);
       dt_control_set_dev_closeup(closeup);
-      dt_dev_invalidate(dev);
+      dt_dev_invalidate_zoom(dev);
       break;
     case 2:
       dt_control_set_dev_zoom(DT_ZOOM_FILL);
@@ -775,14 +807,14 @@ static gboolean zoom_key_accel(GtkAccelGroup *accel_group, GObject *acceleratabl
       dt_control_set_dev_zoom_x(zoom_x);
       dt_control_set_dev_zoom_y(zoom_y);
       dt_control_set_dev_closeup(0);
-      dt_dev_invalidate(dev);
+      dt_dev_invalidate_zoom(dev);
       break;
     case 3:
       dt_control_set_dev_zoom(DT_ZOOM_FIT);
       dt_control_set_dev_zoom_x(0);
       dt_control_set_dev_zoom_y(0);
       dt_control_set_dev_closeup(0);
-      dt_dev_invalidate(dev);
+      dt_dev_invalidate_zoom(dev);
       break;
     default:
       break;
@@ -1298,6 +1330,12 @@ void leave(dt_view_t *self)
     dt_image_synch_xmp(dev->image_storage.id);
   }
 
+  // the pipe buffers go away with the image, don't keep a surface pointing into them
+  if(backbuf_surface) cairo_surface_destroy(backbuf_surface);
+  backbuf_surface = NULL;
+  backbuf_surface_data = NULL;
+  backbuf_surface_width = backbuf_surface_height = 0;
+
   // clear gui.
   dev->gui_leaving = 1;
   dt_pthread_mutex_lock(&dev->history_mutex);
@@ -1432,7 +1470,7 @@ void mouse_moved(dt_view_t *self, double x, double y, double pressure, int which
     dt_control_set_dev_zoom_y(zy);
     ctl->button_x = x - offx;
     ctl->button_y = y - offy;
-    dt_dev_invalidate(dev);
+    dt_dev_invalidate_zoom(dev);
     dt_control_queue_redraw();
   }
 }
@@ -1542,7 +1580,7 @@ int button_pressed(dt_view_t *self, double x, double y, double pressure, int whi
     dt_control_set_dev_closeup(closeup);
     dt_control_set_dev_zoom_x(zoom_x);
     dt_control_set_dev_zoom_y(zoom_y);
-    dt_dev_invalidate(dev);
+    dt_dev_invalidate_zoom(dev);
     return 1;
   }
   return 0;
@@ -1631,7 +1669,7 @@ void scrolled(dt_view_t *self, double x, double y, int up, int state)
   dt_control_set_dev_zoom_x(zoom_x);
   dt_control_set_dev_zoom_y(zoom_y);
 
-  dt_dev_invalidate(dev);
+  dt_dev_invalidate_zoom(dev);
 
   dt_control_queue_redraw();
 }
@@ -1664,7 +1702,7 @@ void border_scrolled(dt_view_t *view, double x, double y, int which, int up)
   dt_dev_check_zoom_bounds(dev, &zoom_x, &zoom_y, zoom, closeup, NULL, NULL);
   dt_control_set_dev_zoom_x(zoom_x);
   dt_control_set_dev_zoom_y(zoom_y);
-  dt_dev_invalidate(dev);
+  dt_dev_invalidate_zoom(dev);
   dt_control_queue_redraw();
 }
 
@@ -52,6 +52,9 @@
 
 DT_MODULE(1)
 
+// zoom level of the file manager, read on every expose
+static dt_conf_handle_t _images_in_row = DT_CONF_HANDLE("plugins/lighttable/images_in_row");
+
 static gboolean star_key_accel_callback(GtkAccelGroup *accel_group, GObject *acceleratable, guint keyval,
                                         GdkModifierType modifier, gpointer data);
 static gboolean go_up_key_accel_callback(GtkAccelGroup *accel_group, GObject *acceleratable, guint keyval,
@@ -63,7 +66,7 @@ static gboolean go_pgup_key_accel_callback(GtkAccelGroup *accel_group, GObject *
 static gboolean go_pgdown_key_accel_callback(GtkAccelGroup *accel_group, GObject *acceleratable, guint keyval,
                                              GdkModifierType modifier, gpointer data);
 
-static void _update_collected_images(dt_view_t *self);
+static void _update_collection(dt_view_t *self);
 
 /**
  * this organises the whole library:
@@ -88,7 +91,7 @@ typedef struct dt_library_t
   int full_preview;
   int full_preview_sticky;
   int32_t full_preview_id;
-  int32_t full_preview_rowid;
+  int32_t full_preview_pos; // position of full_preview_id in the collection
   int display_focus;
   gboolean offset_changed;
   int images_in_row;
@@ -111,8 +114,6 @@ typedef struct dt_library_t
   /* prepared and reusable statements */
   struct
   {
-    /* main query statment, should be update on listener signal of collection */
-    sqlite3_stmt *main_query;
     /* select imgid from selected_images */
     sqlite3_stmt *select_imgid_in_selection;
     /* delete from selected_images where imgid != ?1 */
@@ -176,7 +177,7 @@ void switch_layout_to(dt_library_t *lib, int new_layout)
 
 static void move_view(dt_library_t *lib, direction dir)
 {
-  const int iir = dt_conf_get_int("plugins/lighttable/images_in_row");
+  const int iir = dt_conf_handle_get_int(&_images_in_row);
 
   switch(dir)
   {
@@ -263,86 +264,32 @@ void zoom_around_image(dt_library_t *lib, double pointerx, double pointery, int
 static void _view_lighttable_collection_listener_callback(gpointer instance, gpointer user_data)
 {
   dt_view_t *self = (dt_view_t *)user_data;
-  _update_collected_images(self);
+  _update_collection(self);
 }
 
-static void _update_collected_images(dt_view_t *self)
+static void _update_collection(dt_view_t *self)
 {
   dt_library_t *lib = (dt_library_t *)self->data;
-  sqlite3_stmt *stmt;
-  int32_t min_before = 0, min_after = 0;
-
-  /* check if we can get a query from collection */
-  const gchar *query = dt_collection_get_query(darktable.collection);
-  if(!query) return;
-
-  // we have a new query for the collection of images to display. For speed reason we collect all images into
-  // a temporary (in-memory) table (collected_images).
-  //
-  // 0. get current lower rowid
-  if (lib->full_preview_id != -1)
-  {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT MIN(rowid) FROM memory.collected_images",
-                                -1, &stmt, NULL);
-    if(sqlite3_step(stmt) == SQLITE_ROW)
-    {
-      min_before = sqlite3_column_int(stmt, 0);
-    }
-  }
-
-  // 1. drop previous data
-
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.collected_images", NULL, NULL,
-                        NULL);
 
-  // 2. insert collected images into the temporary table
-
-  char col_query[2048] = { 0 };
-
-  snprintf(col_query, sizeof(col_query), "INSERT INTO memory.collected_images (imgid) %s", query);
-
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), col_query, -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-
-  // 3. get new low-bound, then update the full preview rowid accordingly
-  if (lib->full_preview_id != -1)
+  // the grid draws straight from the ids of the collection. the full preview stays on its image, or shows
+  // the one which took its place if it left the collection.
+  if(lib->full_preview_id != -1)
   {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT MIN(rowid) FROM memory.collected_images",
-                                -1, &stmt, NULL);
-    if(sqlite3_step(stmt) == SQLITE_ROW)
-    {
-      min_after = sqlite3_column_int(stmt, 0);
-    }
-
-    // note that this adjustement is needed as for a memory table the rowid doesn't start to 1 after the DELETE
-    // above,
-    // but rowid is incremented each time we INSERT.
-    lib->full_preview_rowid += (min_after - min_before);
-
-    snprintf(col_query, sizeof(col_query), "SELECT imgid FROM memory.collected_images WHERE rowid=%d", lib->full_preview_rowid);
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), col_query, -1, &stmt, NULL);
-    if(sqlite3_step(stmt) == SQLITE_ROW)
+    if(dt_collection_has_image(darktable.collection, lib->full_preview_id))
+      lib->full_preview_pos = dt_collection_image_offset(lib->full_preview_id);
+    else
     {
-      int nid = sqlite3_column_int(stmt, 0);
-      if (nid != lib->full_preview_id)
+      const int pos = MIN(lib->full_preview_pos, (int)dt_collection_get_count(darktable.collection) - 1);
+      int32_t id = -1;
+      if(pos >= 0 && dt_collection_get_ids(darktable.collection, pos, 1, &id))
       {
-        lib->full_preview_id = sqlite3_column_int(stmt, 0);
+        lib->full_preview_pos = pos;
+        lib->full_preview_id = id;
         dt_control_set_mouse_over_id(lib->full_preview_id);
       }
     }
   }
 
-  /* if we have a statment lets clean it */
-  if(lib->statements.main_query) sqlite3_finalize(lib->statements.main_query);
-
-  /* prepare a new main query statement for collection */
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT imgid FROM memory.collected_images ORDER by rowid LIMIT ?1, ?2", -1,
-                              &lib->statements.main_query, NULL);
-
   dt_control_queue_redraw_center();
 }
 
@@ -405,7 +352,7 @@ void init(dt_view_t *self)
   lib->full_res_thumb_id = -1;
   lib->audio_player_id = -1;
 
-  /* setup collection listener and initialize main_query statement */
+  /* setup collection listener */
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED,
                             G_CALLBACK(_view_lighttable_collection_listener_callback), (gpointer)self);
 
@@ -463,7 +410,7 @@ static int expose_filemanager(dt_view_t *self, cairo_t *cr, int32_t width, int32
   if(darktable.gui->center_tooltip == 1) darktable.gui->center_tooltip = 2;
 
   /* get grid stride */
-  const int iir = dt_conf_get_int("plugins/lighttable/images_in_row");
+  const int iir = dt_conf_handle_get_int(&_images_in_row);
   lib->images_in_row = iir;
 
   /* get image over id */
@@ -533,9 +480,6 @@ static int expose_filemanager(dt_view_t *self, cairo_t *cr, int32_t width, int32
     return 0;
   }
 
-  /* do we have a main query collection statement */
-  if(!lib->statements.main_query) return 0;
-
   /* safety check added to be able to work with zoom slider. The
   * communication between zoom slider and lighttable should be handled
   * differently (i.e. this is a clumsy workaround) */
@@ -555,14 +499,6 @@ static int expose_filemanager(dt_view_t *self, cairo_t *cr, int32_t width, int32
   /* update scroll borders */
   dt_view_set_scrollbar(self, 0, 1, 1, offset, lib->collection_count, max_rows * iir);
 
-  /* let's reset and reuse the main_query statement */
-  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
-  DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
-
-  /* setup offset and row for the main query */
-  DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 1, offset);
-  DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 2, max_rows * iir);
-
   if(mouse_over_id != -1)
   {
     const dt_image_t *mouse_over_image = dt_image_cache_get(darktable.image_cache, mouse_over_id, 'r');
@@ -579,18 +515,8 @@ static int expose_filemanager(dt_view_t *self, cairo_t *cr, int32_t width, int32
   // group.
   int *query_ids = (int *)calloc(max_rows * max_cols, sizeof(int));
   if(!query_ids) goto after_drawing;
-  for(int row = 0; row < max_rows; row++)
-  {
-    for(int col = 0; col < max_cols; col++)
-    {
-      if(sqlite3_step(lib->statements.main_query) == SQLITE_ROW)
-        query_ids[row * iir + col] = sqlite3_column_int(lib->statements.main_query, 0);
-      else
-        goto end_query_cache;
-    }
-  }
+  dt_collection_get_ids(darktable.collection, offset, max_rows * iir, query_ids);
 
-end_query_cache:
   mouse_over_id = -1;
   cairo_save(cr);
   int current_image = 0;
@@ -868,17 +794,8 @@ after_drawing:
     const int prefetchrows = .5 * max_rows + 1;
     int32_t imgids[prefetchrows * iir];
 
-    /* clear and reset main query */
-    DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
-    DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
-
-    /* setup offest and row for prefetch */
-    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 1, offset + max_rows * iir);
-    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 2, prefetchrows * iir);
-
     // prefetch jobs in inverse order: supersede previous jobs: most important last
-    while(sqlite3_step(lib->statements.main_query) == SQLITE_ROW && imgids_num < prefetchrows * iir)
-      imgids[imgids_num++] = sqlite3_column_int(lib->statements.main_query, 0);
+    imgids_num = dt_collection_get_ids(darktable.collection, offset + max_rows * iir, prefetchrows * iir, imgids);
 
     float imgwd = iir == 1 ? 0.97 : 0.8;
     dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, imgwd * wd,
@@ -931,7 +848,7 @@ static int expose_zoomable(dt_view_t *self, cairo_t *cr, int32_t width, int32_t
   lib->collection_count = dt_collection_get_count(darktable.collection);
 
   mouse_over_id = dt_control_get_mouse_over_id();
-  zoom = dt_conf_get_int("plugins/lighttable/images_in_row");
+  zoom = dt_conf_handle_get_int(&_images_in_row);
   zoom_x = lib->zoom_x;
   zoom_y = lib->zoom_y;
   pan = lib->pan;
@@ -957,8 +874,6 @@ static int expose_zoomable(dt_view_t *self, cairo_t *cr, int32_t width, int32_t
     zoom_y = lib->select_offset_y - /* (zoom == 1 ? 2. : 1.)*/ pointery;
   }
 
-  if(!lib->statements.main_query) return 0;
-
   if(track == 0)
     ;
   else if(track > 1)
@@ -1117,17 +1032,13 @@ static int expose_zoomable(dt_view_t *self, cairo_t *cr, int32_t width, int32_t
       continue;
     }
 
-    /* clear and reset main query */
-    DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
-    DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
-
-    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 1, offset);
-    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 2, max_cols);
+    int32_t row_ids[max_cols];
+    const int num_ids = dt_collection_get_ids(darktable.collection, offset, max_cols, row_ids);
     for(int col = 0; col < max_cols; col++)
     {
-      if(sqlite3_step(lib->statements.main_query) == SQLITE_ROW)
+      if(col < num_ids)
       {
-        id = sqlite3_column_int(lib->statements.main_query, 0);
+        id = row_ids[col];
 
         // set mouse over id
         if((zoom == 1 && mouse_over_id < 0) || ((!pan || track) && seli == col && selj == row && pointerx > 0
@@ -1196,48 +1107,39 @@ int expose_full_preview(dt_view_t *self, cairo_t *cr, int32_t width, int32_t hei
       sqlite3_finalize(stmt);
     }
 
-    const dt_image_t *img = dt_image_cache_get(darktable.image_cache, lib->full_preview_id, 'r');
-
-    /* Build outer select criteria */
-    gchar *filter_criteria
-        = g_strdup_printf("INNER JOIN memory.collected_images AS col ON s1.imgid=col.imgid WHERE col.rowid "
-                          "%s %d ORDER BY rowid %s LIMIT 1",
-                          (offset > 0) ? ">" : "<", lib->full_preview_rowid, (offset > 0) ? "ASC" : "DESC");
-    dt_image_cache_read_release(darktable.image_cache, img);
-
-    sqlite3_stmt *stmt;
-    gchar *stmt_string = NULL;
+    int32_t next_id = -1, next_pos = -1;
     if(sel_img_count > 1)
     {
-      stmt_string = g_strdup_printf(
-          "SELECT col.imgid AS id, col.rowid FROM (SELECT imgid FROM selected_images) AS s1 %s",
-          filter_criteria);
-
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), stmt_string, -1, &stmt, NULL);
+      // the selected image closest to the current one in collection order
+      sqlite3_stmt *stmt;
+      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select imgid from selected_images", -1,
+                                  &stmt, NULL);
+      while(sqlite3_step(stmt) == SQLITE_ROW)
+      {
+        const int32_t id = sqlite3_column_int(stmt, 0);
+        if(!dt_collection_has_image(darktable.collection, id)) continue;
+        const int pos = dt_collection_image_offset(id);
+        if((offset > 0) ? (pos > lib->full_preview_pos && (next_pos < 0 || pos < next_pos))
+                        : (pos < lib->full_preview_pos && pos > next_pos))
+        {
+          next_id = id;
+          next_pos = pos;
+        }
+      }
+      sqlite3_finalize(stmt);
     }
     else
     {
-      /* We need to augment the current main query a bit to fetch the
-       * row we need. */
-      const char *main_query = sqlite3_sql(lib->statements.main_query);
-      stmt_string = g_strdup_printf("SELECT col.imgid AS id, col.rowid FROM (%s) AS s1 %s", main_query,
-                                    filter_criteria);
-
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), stmt_string, -1, &stmt, NULL);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
+      next_pos = lib->full_preview_pos + ((offset > 0) ? 1 : -1);
+      if(next_pos < 0 || !dt_collection_get_ids(darktable.collection, next_pos, 1, &next_id)) next_id = -1;
     }
-    g_free(stmt_string);
-    g_free(filter_criteria);
 
-    if(sqlite3_step(stmt) == SQLITE_ROW)
+    if(next_id != -1)
     {
-      lib->full_preview_id = sqlite3_column_int(stmt, 0);
-      lib->full_preview_rowid = sqlite3_column_int(stmt, 1);
+      lib->full_preview_id = next_id;
+      lib->full_preview_pos = next_pos;
       dt_control_set_mouse_over_id(lib->full_preview_id);
     }
-
-    sqlite3_finalize(stmt);
   }
 
   lib->image_over = DT_VIEW_DESERT;
@@ -1422,7 +1324,7 @@ static gboolean go_pgup_key_accel_callback(GtkAccelGroup *accel_group, GObject *
     move_view(lib, PGUP);
   else
   {
-    const int iir = dt_conf_get_int("plugins/lighttable/images_in_row");
+    const int iir = dt_conf_handle_get_int(&_images_in_row);
     const int scroll_by_rows = 4; /* This should be the number of visible rows. */
     const int offset_delta = scroll_by_rows * iir;
     lib->offset = MAX(lib->offset - offset_delta, 0);
@@ -1443,7 +1345,7 @@ static gboolean go_pgdown_key_accel_callback(GtkAccelGroup *accel_group, GObject
   }
   else
   {
-    const int iir = dt_conf_get_int("plugins/lighttable/images_in_row");
+    const int iir = dt_conf_handle_get_int(&_images_in_row);
     const int scroll_by_rows = 4; /* This should be the number of visible rows. */
     const int offset_delta = scroll_by_rows * iir;
     lib->offset = MIN(lib->offset + offset_delta, lib->collection_count);
@@ -1492,7 +1394,7 @@ static gboolean star_key_accel_callback(GtkAccelGroup *accel_group, GObject *acc
     dt_ratings_apply_to_selection(num);
   else
     dt_ratings_apply_to_image(mouse_over_id, num);
-  _update_collected_images(self);
+  _update_collection(self);
   return TRUE;
 }
 
@@ -1579,7 +1481,7 @@ void leave(dt_view_t *self)
   if(lib->full_preview_id != -1 && lib->full_preview_sticky == 0)
   {
     lib->full_preview_id = -1;
-    lib->full_preview_rowid = -1;
+    lib->full_preview_pos = -1;
     dt_control_set_mouse_over_id(-1);
     lib->full_preview = 0;
     lib->display_focus = 0;
@@ -1617,7 +1519,7 @@ void mouse_leave(dt_view_t *self)
   if (lib->using_arrows == 0) 
   {
     lib->last_mouse_over_id = dt_control_get_mouse_over_id(); // see mouse_enter (re: fluxbox)
-    if(!lib->pan && dt_conf_get_int("plugins/lighttable/images_in_row") != 1)
+    if(!lib->pan && dt_conf_handle_get_int(&_images_in_row) != 1)
     {
       dt_control_set_mouse_over_id(-1);
       dt_control_queue_redraw_center();
@@ -1647,7 +1549,7 @@ int scrolled(dt_view_t *self, double x, double y, int up, int state)
   }
   else
   {
-    int zoom = dt_conf_get_int("plugins/lighttable/images_in_row");
+    int zoom = dt_conf_handle_get_int(&_images_in_row);
     if(up)
     {
       zoom--;
@@ -1775,7 +1677,7 @@ int button_pressed(dt_view_t *self, double x, double y, double pressure, int whi
         }
         else
           dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
-        _update_collected_images(self);
+        dt_collection_update_images(darktable.collection, mouse_over_id, DT_COLLECTION_CHANGE_RATING);
         break;
       }
       case DT_VIEW_GROUP:
@@ -1879,7 +1781,7 @@ int key_released(dt_view_t *self, guint key, guint state)
   {
 
     lib->full_preview_id = -1;
-    lib->full_preview_rowid = -1;
+    lib->full_preview_pos = -1;
     dt_control_set_mouse_over_id(-1);
 
     dt_ui_panel_show(darktable.gui->ui, DT_UI_PANEL_LEFT, (lib->full_preview & 1), FALSE);
@@ -1902,7 +1804,7 @@ int key_pressed(dt_view_t *self, guint key, guint state)
 
   if(!darktable.control->key_accelerators_on) return 0;
 
-  int zoom = dt_conf_get_int("plugins/lighttable/images_in_row");
+  int zoom = dt_conf_handle_get_int(&_images_in_row);
 
   const int layout = dt_conf_get_int("plugins/lighttable/layout");
 
@@ -1914,7 +1816,7 @@ int key_pressed(dt_view_t *self, guint key, guint state)
                                         && state == accels->lighttable_preview_sticky_focus.accel_mods)))
   {
     lib->full_preview_id = -1;
-    lib->full_preview_rowid = -1;
+    lib->full_preview_pos = -1;
     dt_control_set_mouse_over_id(-1);
 
     dt_ui_panel_show(darktable.gui->ui, DT_UI_PANEL_LEFT, (lib->full_preview & 1), FALSE);
@@ -1953,19 +1855,8 @@ int key_pressed(dt_view_t *self, guint key, guint state)
       lib->full_preview = 0;
       lib->full_preview_id = mouse_over_id;
 
-      // set corresponding rowid in the collected images
-      {
-        sqlite3_stmt *stmt;
-        DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                    "SELECT rowid FROM memory.collected_images WHERE imgid=?1", -1, &stmt,
-                                    NULL);
-        DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, lib->full_preview_id);
-        if(sqlite3_step(stmt) == SQLITE_ROW)
-        {
-          lib->full_preview_rowid = sqlite3_column_int(stmt, 0);
-        }
-        sqlite3_finalize(stmt);
-      }
+      // remember where it is in the collection, to step to its neighbours
+      lib->full_preview_pos = dt_collection_image_offset(lib->full_preview_id);
 
       // let's hide some gui components
       lib->full_preview |= (dt_ui_panel_visible(darktable.gui->ui, DT_UI_PANEL_LEFT) & 1) << 0;
@@ -106,6 +106,8 @@ static void _get_image_location(dt_view_t *self, int imgid, float *longitude, fl
 
 static gboolean _view_map_prefs_changed(dt_map_t *lib);
 static void _view_map_build_main_query(dt_map_t *lib);
+/* copies the images of the collection into memory.collected_images, to filter the drawn ones */
+static void _view_map_collect_images(void);
 
 const char *name(dt_view_t *self)
 {
@@ -649,6 +651,9 @@ void enter(dt_view_t *self)
   /* set the correct map source */
   _view_map_set_map_source_g_object(self, lib->map_source);
 
+  /* the collection might have changed while we were away */
+  if(dt_conf_get_bool("plugins/map/filter_images_drawn")) _view_map_collect_images();
+
   /* replace center widget */
   GtkWidget *parent = gtk_widget_get_parent(dt_ui_center(darktable.gui->ui));
   gtk_widget_hide(dt_ui_center(darktable.gui->ui));
@@ -807,7 +812,11 @@ static void _view_map_collection_changed(gpointer instance, gpointer user_data)
   if(dt_conf_get_bool("plugins/map/filter_images_drawn"))
   {
     /* only redraw when map mode is currently active, otherwise enter() does the magic */
-    if(darktable.view_manager->proxy.map.view) g_signal_emit_by_name(lib->map, "changed");
+    if(darktable.view_manager->proxy.map.view)
+    {
+      _view_map_collect_images();
+      g_signal_emit_by_name(lib->map, "changed");
+    }
   }
 }
 
@@ -1023,6 +1032,7 @@ static void _view_map_build_main_query(dt_map_t *lib)
                                limit 0, %d) order by (180 - latitude), id",
       lib->filter_images_drawn ? "images i inner join memory.collected_images c on i.id = c.imgid" : "images",
       lib->max_images_drawn);
+  if(lib->filter_images_drawn) _view_map_collect_images();
 
   /* prepare the main query statement */
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), geo_query, -1, &lib->statements.main_query, NULL);
@@ -1030,6 +1040,29 @@ static void _view_map_build_main_query(dt_map_t *lib)
   g_free(geo_query);
 }
 
+static void _view_map_collect_images(void)
+{
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.collected_images", NULL, NULL,
+                        NULL);
+
+  int count = dt_collection_get_count(darktable.collection);
+  int32_t *ids = (int32_t *)malloc(sizeof(int32_t) * MAX(count, 1));
+  if(!ids) return;
+  count = dt_collection_get_ids(darktable.collection, 0, count, ids);
+
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "INSERT INTO memory.collected_images (imgid) VALUES (?1)", -1, &stmt, NULL);
+  for(int k = 0; k < count; k++)
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, ids[k]);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+  free(ids);
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;